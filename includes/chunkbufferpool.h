@@ -0,0 +1,53 @@
+#ifndef CHUNKBUFFERPOOL_H
+#define CHUNKBUFFERPOOL_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+// 文件块缓冲区的容量按此粒度向上取整 (与块大小的对齐粒度相同)，不同大小的块可以复用同一缓冲区
+const qint64 CHUNK_BUFFER_GRANULARITY = 64 * 1024;
+// 缓冲池最多保留的空闲缓冲区总容量，超出时交还的缓冲区直接释放
+const qint64 CHUNK_BUFFER_POOL_MAX_BYTES = 256 * 1024 * 1024;
+
+// 文件块缓冲区池: 发送端读取文件块、接收端接收 FileChunk 帧负载时从池中取缓冲区，
+// 块发出或写入文件后交还。缓冲区以 QByteArray 隐式共享的方式在各层之间传递，交还后池也持有一份引用，
+// 只有其他持有者 (网络发送队列、写入任务等) 全部释放后才会被再次取出，因此交还时不必确认数据已不再使用。
+// 稳态传输中每个块都复用已有的缓冲区，不再分配内存。所有方法线程安全
+class ChunkBufferPool
+{
+public:
+    struct Stats
+    {
+        qint64 allocations = 0; // 池中没有可用缓冲区而新分配的次数
+        qint64 reuses = 0;      // 复用池中缓冲区的次数
+    };
+
+    ChunkBufferPool() = default;
+
+    // 取得 size() == size 的缓冲区，引用计数为 1 (写入不会触发复制)；allocated 报告是否为新分配
+    QByteArray acquire(qsizetype size, bool *allocated = nullptr);
+    // 交还缓冲区 (可以是副本)
+    void release(const QByteArray &buffer);
+
+    // 按传输统计: 取得缓冲区的一方知道它属于哪个传输时记录
+    void recordUse(const QString &transferID, bool allocated);
+    Stats transferStats(const QString &transferID) const;
+    void forgetTransfer(const QString &transferID);
+    Stats totalStats() const;
+
+private:
+    mutable QMutex m_mutex;
+    QList<QByteArray> m_buffers; // 已交还的缓冲区，可能仍被其他持有者引用
+    qint64 m_pooledBytes = 0;
+    Stats m_total;
+    QHash<QString, Stats> m_transfers;
+    Q_DISABLE_COPY(ChunkBufferPool)
+};
+
+// 进程内共享的缓冲池 (网络线程、文件 I/O 线程和传输线程共用)
+ChunkBufferPool &chunkBufferPool();
+
+#endif // CHUNKBUFFERPOOL_H
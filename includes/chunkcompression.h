@@ -0,0 +1,31 @@
+#ifndef CHUNKCOMPRESSION_H
+#define CHUNKCOMPRESSION_H
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+
+// 文件块压缩: 在 FT_OFFER/FT_ACCEPT 中协商，压缩后的块以 FrameFlagCompressed 标记，
+// 不值得压缩的块仍按原样发送。压缩和解压都在 FileIOManager 的工作线程中执行。
+// 编码为 Qt 自带的 zlib (qCompress 格式: 4 字节大端原始长度 + zlib 流)，不引入额外依赖
+const char FT_COMPRESSION_ZLIB[] = "zlib";
+const int FT_COMPRESSION_LEVEL = 1; // 最快的级别，压缩速度需要高于链路速率才有收益
+// 快速检查: 从块中均匀抽取若干段估计字节熵 (位/字节)，超过阈值视为已压缩的数据 (zip、视频、图片等)，不尝试压缩
+const int FT_COMPRESSION_SAMPLE_COUNT = 8;
+const qint64 FT_COMPRESSION_SAMPLE_BYTES = 4096;
+const double FT_COMPRESSION_ENTROPY_THRESHOLD = 7.5;
+// 压缩后至少小这么多 (比例) 才发送压缩数据，否则发送原始数据，接收方省去解压
+const double FT_COMPRESSION_MIN_SAVING = 0.05;
+// 连续这么多块都没有压缩时，该传输不再尝试 (恢复零拷贝发送)
+const int FT_COMPRESSION_GIVE_UP_CHUNKS = 8;
+
+// 按扩展名判断文件本身已经压缩，这类文件不提议压缩
+bool isLikelyCompressedFile(const QString &fileName);
+// 抽样估计的字节熵 (0 ~ 8)
+double estimateChunkEntropy(const char *data, qsizetype size);
+// 压缩一个块；熵过高 (*skipped 置为 true，未花费压缩的 CPU) 或节省不足时返回空
+QByteArray compressChunk(const QByteArray &data, bool *skipped = nullptr);
+// 解压 compressChunk 的输出，原始长度超过 maxSize 或数据损坏时返回空
+QByteArray decompressChunk(const char *data, qsizetype size, qint64 maxSize);
+
+#endif // CHUNKCOMPRESSION_H
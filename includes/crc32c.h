@@ -0,0 +1,15 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <QtGlobal>
+
+// CRC-32C (Castagnoli)，用于文件块和整个文件的完整性校验。
+// x86-64 上运行时检测 SSE4.2，ARMv8 上在编译器启用 CRC 扩展时使用硬件指令，否则按查表计算。
+// 与 zlib 的 crc32() 相同，crc 参数为之前数据的结果 (首次为 0)，可分段连续计算。
+quint32 crc32c(quint32 crc, const char *data, qint64 length);
+// 已知 A、B 两段各自的 CRC 和 B 的长度，得到 A 后接 B 的 CRC (不需要重新读取数据)
+quint32 crc32cCombine(quint32 crcA, quint32 crcB, qint64 lengthB);
+// 当前 CPU 是否使用硬件指令计算
+bool crc32cHardwareAccelerated();
+
+#endif // CRC32C_H
@@ -4,15 +4,42 @@
 #include <QObject>
 #include <QString>
 #include <QByteArray>
+#include <QMap>
+#include <QSharedPointer>
+#include <QHash>
+#include <QQueue>
+#include <memory>
+#include <vector>
 #include <QtConcurrent/QtConcurrent> // Required for QtConcurrent
 #include <QFutureWatcher>          // Required for QFutureWatcher
+#include "iouringqueue.h"
 
 // 用于从 QtConcurrent::run 返回包含多个值的结构体
 struct FileReadResult {
     QString transferID;
     qint64 chunkID;
-    QString dataB64; // 修改：存储Base64编码后的数据
-    qint64 originalSize; // 新增：存储原始数据大小
+    QByteArray data; // 原始文件数据，直接交给网络层发送
+    quint32 checksum; // data 的 CRC-32C，在工作线程中随读取一并计算
+    bool success;
+    QString errorString;
+};
+
+struct FileChecksumResult {
+    QString transferID;
+    qint64 chunkID;
+    quint32 checksum;
+    bool success;
+    QString errorString;
+};
+
+// 块压缩 / 解压的结果 (requestCompressChunk / requestDecompressChunk)
+struct FileCodecResult {
+    QString transferID;
+    qint64 chunkID;
+    QByteArray data;  // 压缩: 压缩后的数据，未压缩时为原始数据；解压: 原始数据
+    quint32 checksum; // 原始数据的 CRC-32C (压缩时原样带回)
+    bool compressed;  // 压缩: 是否发送压缩数据
+    bool skipped;     // 压缩: 抽样检查判断为不可压缩，未尝试压缩
     bool success;
     QString errorString;
 };
@@ -25,37 +52,204 @@ struct FileWriteResult {
     QString errorString;
 };
 
+// 一次写入中的一段数据: buffer 的 [offset, offset + size)，buffer 可以是整个网络帧负载
+struct FileWriteSegment {
+    QByteArray buffer;
+    qsizetype offset = 0;
+    qint64 size = 0;
+};
+// 按文件顺序排列的若干段，合并为一次顺序写入 (pwritev / IORING_OP_WRITEV)
+using FileWriteSegments = QList<FileWriteSegment>;
+
 // Q_DECLARE_METATYPE(FileReadResult) // 如果要在信号槽中直接传递自定义结构体，需要注册
 // Q_DECLARE_METATYPE(FileWriteResult)
 
+// 写入端每次写入后，对落后当前偏移此距离的已写区域提示内核丢弃页缓存 (脏页不受影响)
+const qint64 FILE_DROP_BEHIND_LAG = 64 * 1024 * 1024;
+// io_uring 提交队列深度，覆盖多个传输的完整发送/接收窗口
+const unsigned FILE_IO_URING_QUEUE_DEPTH = 128;
+// 一次 IORING_OP_WRITEV 最多提交的段数 (Linux 的 IOV_MAX，超出时内核返回 EINVAL)；其余部分按短写入继续提交
+const int FILE_IO_URING_MAX_IOVECS = 1024;
+// 设为 "threadpool" 时强制使用线程池后端 (用于对比或排查问题)
+const char FILE_IO_BACKEND_ENV[] = "CHATAPP_FILE_IO_BACKEND";
+// O_DIRECT 写入要求偏移、长度和内存地址按此对齐；不对齐的尾部改用普通写入
+const qint64 FILE_DIRECT_IO_ALIGNMENT = 4096;
+// O_DIRECT 写入时使用的对齐中转缓冲区大小
+const qint64 FILE_DIRECT_IO_BUFFER_SIZE = 4 * 1024 * 1024;
+// 续传前核对已有前缀时每次读入的大小
+const qint64 FILE_CHECKSUM_BLOCK_SIZE = 1024 * 1024;
+
+QT_BEGIN_NAMESPACE
+class QSocketNotifier;
+QT_END_NAMESPACE
+
+// 一次传输期间保持打开的文件句柄。
+// 使用定位读写 (POSIX pread/pwrite，Windows 带 OVERLAPPED 偏移的 ReadFile/WriteFile)，
+// 不共享文件指针，多个工作线程可同时读写不同的块。
+class TransferFile
+{
+public:
+    enum OpenMode
+    {
+        ReadOnly,  // 发送端: 顺序预读，读完的块随即丢弃页缓存
+        ReadWrite  // 接收端: 不存在时创建，不截断
+    };
+
+    TransferFile();
+    ~TransferFile();
+
+    // directIO: 仅 ReadWrite 且 Linux 上有效，对齐的写入绕过页缓存 (O_DIRECT)；文件系统不支持时回退为普通写入
+    bool open(const QString &filePath, OpenMode mode, QString *error, bool directIO = false);
+    void close();
+    bool isOpen() const;
+    bool isDirectIO() const;
+    // 接收端在写入前分配全部空间并把文件长度设为 size: 减少碎片，磁盘空间不足时立即失败
+    bool preallocate(qint64 size, QString *error);
+    QString filePath() const { return m_filePath; }
+    // POSIX 文件描述符 (供 io_uring 使用)，Windows 上返回 -1
+    int nativeDescriptor() const;
+
+    // 读取最多 size 字节，返回实际读取的字节数 (到达文件末尾时可能小于 size)，出错返回 -1
+    qint64 readAt(qint64 offset, char *data, qint64 size, QString *error);
+    // 计算 [offset, offset + size) 的 CRC-32C (续传前核对已传输的前缀)。
+    // 返回实际读取的字节数，出错返回 -1
+    qint64 checksumAt(qint64 offset, qint64 size, quint32 *checksum, QString *error);
+    // 写入全部 size 字节，出错返回 -1
+    qint64 writeAt(qint64 offset, const char *data, qint64 size, QString *error);
+    // 从 offset 起依次写入各段 (一次 pwritev)，出错返回 -1
+    qint64 writeSegmentsAt(qint64 offset, const FileWriteSegments &segments, QString *error);
+
+    // 读写完成后的页缓存提示 (readAt/writeAt 内部调用；异步后端在完成时调用)
+    void readCompleted(qint64 offset, qint64 length);
+    void writeCompleted(qint64 offset, qint64 length);
+
+private:
+    // readAt 的实际读取部分，不处理页缓存
+    qint64 readRaw(qint64 offset, char *data, qint64 size, QString *error);
+    // 提示内核 [offset, offset + length) 之后不会再访问
+    void dropCache(qint64 offset, qint64 length);
+    // 经对齐缓冲区以 O_DIRECT 写入各段的前 length 字节，返回写入的字节数，出错返回 -1
+    qint64 writeDirect(qint64 offset, const FileWriteSegments &segments, qint64 length, QString *error);
+
+    QString m_filePath;
+    OpenMode m_mode;
+#ifdef Q_OS_WIN
+    void *m_handle; // HANDLE
+#else
+    int m_fd;
+    int m_directFd; // 以 O_DIRECT 打开的第二个描述符，未启用时为 -1
+#endif
+    Q_DISABLE_COPY(TransferFile)
+};
+
 class FileIOManager : public QObject
 {
     Q_OBJECT
 public:
+    enum Backend
+    {
+        ThreadPoolBackend, // 每个块一个 QtConcurrent 任务 (所有平台)
+        IoUringBackend     // Linux io_uring: 同一轮事件循环中的请求一次提交，完成事件批量取出
+    };
+
     explicit FileIOManager(QObject *parent = nullptr);
     ~FileIOManager();
 
+    // 当前使用的后端 (首次请求时选择，io_uring 不可用时回退到线程池)
+    Backend backend() const { return m_backend; }
+
+    // 在传输开始时打开文件并缓存句柄，之后该传输的所有块读写都使用同一句柄
+    bool openTransferFile(const QString& transferID, const QString& filePath, TransferFile::OpenMode mode, QString* error = nullptr, bool directIO = false);
+    // 在 cleanupSession 中调用；仍在执行的块任务持有句柄引用，句柄在其完成后关闭
+    void closeTransferFile(const QString& transferID);
+    // 关闭并删除传输的文件 (接收端接受失败时清理刚创建的文件)
+    bool removeTransferFile(const QString& transferID);
+    // 传输的缓存句柄 (未打开时为空)，供网络层零拷贝发送时持有
+    QSharedPointer<TransferFile> transferFile(const QString& transferID) const { return m_openFiles.value(transferID); }
+
     // 请求异步读取文件块
     void requestReadFileChunk(const QString& transferID, qint64 chunkID, const QString& filePath, qint64 offset, int size);
+    // 请求只计算文件中一段数据的 CRC-32C，不把数据交给调用方
+    void requestChecksumFileChunk(const QString& transferID, qint64 chunkID, const QString& filePath, qint64 offset, qint64 size);
+
+    // 请求在工作线程中压缩已读出的块 (data 为原始数据，checksum 为其 CRC-32C，原样带回)
+    void requestCompressChunk(const QString& transferID, qint64 chunkID, const QByteArray& data, quint32 checksum);
+    // 请求在工作线程中解压收到的块: 压缩数据位于 buffer 的 [dataOffset, dataOffset + dataSize)，原始数据不超过 maxSize
+    void requestDecompressChunk(const QString& transferID, qint64 chunkID, const QByteArray& buffer, qsizetype dataOffset, qint64 dataSize, qint64 maxSize);
 
     // 请求异步写入文件块
-    // 修改：data参数类型变为const QString& dataB64，并增加originalChunkSize参数
-    void requestWriteFileChunk(const QString& transferID, qint64 chunkID, const QString& filePath, qint64 offset, const QString& dataB64, qint64 originalChunkSize);
+    // buffer 可以是整个网络帧负载，文件数据位于 [dataOffset, dataOffset + dataSize)，写入时不再拷贝或解码
+    void requestWriteFileChunk(const QString& transferID, qint64 chunkID, const QString& filePath, qint64 offset, const QByteArray& buffer, qsizetype dataOffset, qint64 dataSize);
+    // 请求把若干连续的段合并为一次写入 (接收端 write-behind)；完成时以 chunkID 发出一次 chunkWrittenCompleted
+    void requestWriteFileSegments(const QString& transferID, qint64 chunkID, const QString& filePath, qint64 offset, const FileWriteSegments& segments);
 
 signals:
-    // 文件块读取完成信号
-    // 修改：data参数类型变为const QString& dataB64，并增加originalSize参数
-    void chunkReadCompleted(const QString& transferID, qint64 chunkID, const QString& dataB64, qint64 originalSize, bool success, const QString& error);
+    // 文件块读取完成信号 (data 为原始文件数据，checksum 为其 CRC-32C)
+    void chunkReadCompleted(const QString& transferID, qint64 chunkID, const QByteArray& data, quint32 checksum, bool success, const QString& error);
+    // 文件块校验和计算完成信号 (requestChecksumFileChunk)
+    void chunkChecksumCompleted(const QString& transferID, qint64 chunkID, quint32 checksum, bool success, const QString& error);
+
+    // 块压缩完成信号: compressed 为 false 时 data 为原始数据 (不值得压缩，skipped 表示未经试压)
+    void chunkCompressed(const QString& transferID, qint64 chunkID, const QByteArray& data, quint32 checksum, bool compressed, bool skipped);
+    // 块解压完成信号
+    void chunkDecompressed(const QString& transferID, qint64 chunkID, const QByteArray& data, bool success, const QString& error);
 
     // 文件块写入完成信号
     void chunkWrittenCompleted(const QString& transferID, qint64 chunkID, qint64 bytesWritten, bool success, const QString& error);
 
 private:
     // 辅助函数，实际在工作线程中执行读取
-    static FileReadResult performRead(QString transferID, qint64 chunkID, QString filePath, qint64 offset, int size);
+    static FileReadResult performRead(QSharedPointer<TransferFile> file, QString transferID, qint64 chunkID, qint64 offset, int size);
+    // 辅助函数，在工作线程中只计算校验和
+    static FileChecksumResult performChecksum(QSharedPointer<TransferFile> file, QString transferID, qint64 chunkID, qint64 offset, qint64 size);
+    // 辅助函数，在工作线程中压缩 / 解压块
+    static FileCodecResult performCompress(QString transferID, qint64 chunkID, QByteArray data, quint32 checksum);
+    static FileCodecResult performDecompress(QString transferID, qint64 chunkID, QByteArray buffer, qsizetype dataOffset, qint64 dataSize, qint64 maxSize);
     // 辅助函数，实际在工作线程中执行写入
-    // 修改：data参数类型变为QString dataB64，并增加originalChunkSize参数
-    static FileWriteResult performWrite(QString transferID, qint64 chunkID, QString filePath, qint64 offset, QString dataB64, qint64 originalChunkSize);
+    static FileWriteResult performWrite(QSharedPointer<TransferFile> file, QString transferID, qint64 chunkID, qint64 offset, FileWriteSegments segments);
+
+    // 返回已缓存的句柄；未调用 openTransferFile 时按需打开并缓存
+    QSharedPointer<TransferFile> fileFor(const QString& transferID, const QString& filePath, TransferFile::OpenMode mode, QString* error);
+
+    QMap<QString, QSharedPointer<TransferFile>> m_openFiles; // transferID -> 文件句柄 (仅在 FileIOManager 所在线程访问)
+
+    // 线程池后端
+    void startThreadPoolRead(QSharedPointer<TransferFile> file, const QString& transferID, qint64 chunkID, qint64 offset, int size);
+    void startThreadPoolWrite(QSharedPointer<TransferFile> file, const QString& transferID, qint64 chunkID, qint64 offset, const FileWriteSegments& segments);
+
+    // io_uring 后端
+    struct UringOperation
+    {
+        bool isWrite = false;
+        QSharedPointer<TransferFile> file;
+        QString transferID;
+        qint64 chunkID = 0;
+        qint64 offset = 0;       // 块在文件中的偏移
+        QByteArray buffer;       // 读: 目标缓冲区
+        FileWriteSegments segments; // 写: 调用方的数据 (隐式共享，内核完成前保持存活)
+        std::vector<IoUringQueue::Segment> iovecs; // 写: 本次提交的剩余部分，提交期间不可修改
+        qint64 size = 0;
+        qint64 done = 0;         // 已完成的字节数 (短读写时继续提交剩余部分)
+        bool vectored = false;   // 本次以 IORING_OP_WRITEV 提交 (所有支持 io_uring 的内核都支持，失败不表示内核不支持该操作)
+    };
+    void selectBackend();
+    void enqueueUringOperation(UringOperation operation);
+    void scheduleUringSubmit();
+    void submitUringBatch();
+    void handleUringCompletions();
+    void finishUringOperation(quint64 id, const QString& error);
+    // io_uring 不可用 (如内核不支持该操作) 时把所有未完成的请求转交线程池
+    void abandonUring(const QString& reason);
+
+    Backend m_backend;
+    bool m_backendSelected;
+    std::unique_ptr<IoUringQueue> m_uring;
+    QSocketNotifier* m_uringNotifier;
+    QHash<quint64, UringOperation> m_uringOperations;
+    QQueue<quint64> m_uringBacklog; // 已排队、尚未放入提交队列的请求
+    quint64 m_nextUringId;
+    int m_uringInFlight;
+    bool m_uringSubmitScheduled;
 
     // QMap to hold future watchers if needed for cancellation, though not strictly necessary for this simple model
     // QMap<QFuture<FileReadResult>, QFutureWatcher<FileReadResult>*> m_readWatchers;
@@ -7,17 +7,154 @@
 #include <QTimer>
 #include <QSet> // For receivedOutOfOrderChunks keys
 #include <QElapsedTimer> // Include QElapsedTimer
+#include <QThread>
 #include <QPair> // Required for QPair
 #include "fileiomanager.h" // <-- Include FileIOManager
+#include "transfercongestioncontroller.h"
+#include "transferresumestore.h"
+#include "transferscheduler.h"
+#include "transferratelimiter.h"
 
 class NetworkManager; // Forward declaration
 
 // Sliding Window Configuration
-const int DEFAULT_SEND_WINDOW_SIZE = 32; // Send up to 5 chunks before waiting for ACK for the first one
-const int DEFAULT_RECEIVE_WINDOW_SIZE = 48; // Receiver can buffer up to 10 out-of-order chunks
-const int FT_CHUNK_RETRANSMISSION_TIMEOUT_MS = 10000; // Timeout for retransmitting the base of the send window
+// 发送端在途数据量由 TransferCongestionController 按测得的带宽和 RTT 调整，同时不超过接收方在 ACK 中通告的窗口
+const qint64 FT_RECEIVE_BUFFER_BYTES = 256 * 1024 * 1024; // 接收端每个传输的窗口: 最多这么多未写入数据 (write-behind、写入中、乱序缓冲或已写到最终位置)
+// 所有接收会话共同持有的未写入数据 (内存，含解压中的块) 上限，通告的接收窗口随剩余额度收缩。超出后乱序到达的块不再留在内存中，
+// 而是直接按其偏移写到文件中的最终位置，等前面的数据写完后再并入已写入的前缀 (按序数据仍经 write-behind 合并写入)；
+// 直接写入的数量也已达上限时丢弃该块 (不 SACK)，由发送方重发
+const qint64 FT_RECEIVE_MEMORY_BUDGET_BYTES = 512 * 1024 * 1024;
+const int FT_LEGACY_RECEIVE_WINDOW_CHUNKS = 48; // 对端未通告接收窗口 (旧版) 时沿用旧的固定窗口 (按 DEFAULT_CHUNK_SIZE 计)
+// 块大小按传输选择: 发送方在 FT_OFFER 中提议初始值 (按文件大小和上次与该对端传输时的链路情况)，接收方在 FT_ACCEPT 中给出上限。
+// 发送中途按测得的 BDP 调整，新的块大小从下一个未发出的块开始生效；重传超时会降低上限，此后一段时间无超时再逐步恢复。旧版对端固定使用 DEFAULT_CHUNK_SIZE
+const qint64 FT_MIN_CHUNK_SIZE = 64 * 1024;
+const qint64 FT_MAX_CHUNK_SIZE = 16 * 1024 * 1024;
+const qint64 FT_CHUNK_SIZE_ALIGNMENT = 64 * 1024; // 块大小总是它的整数倍，块偏移因此满足 O_DIRECT 对齐
+const int FT_TARGET_CHUNKS_PER_FILE = 16;         // 初始块大小不超过文件大小的这么多分之一，小文件也能流水线发送
+const int FT_TARGET_CHUNKS_PER_BDP = 8;           // 中途调整的目标: 一个 BDP 内约有这么多块
+const int FT_CHUNK_CEILING_RECOVERY_RTTS = 16;    // 这么多个 SRTT 内没有重传超时，被降低的块大小上限翻倍 (不超过 maxChunkSize)
+const qint64 FT_ACK_BYTES_THRESHOLD = 1024 * 1024; // 累计收到这么多按序数据立即 ACK，不足时由 ACK 延迟定时器发出
+// 分块重传超时 (RTO) 按 RFC 6298 由 ACK 测得的 RTT 计算，超时后指数退避，重传块不参与测量 (Karn 算法)
+const qint64 FT_INITIAL_RTO_MS = 3000; // 尚无 RTT 样本时的 RTO
+const qint64 FT_MIN_RTO_MS = 200;
+const qint64 FT_MAX_RTO_MS = 60000;
+const int FT_EOF_ACK_TIMEOUT_MS = 10000; // 发送 EOF 后等待 EOF_ACK 的时间
+const int FT_SACK_REORDER_THRESHOLD = 3; // 比某块更晚发出的块中已有这么多被 SACK 确认时，视该块丢失并立即重传 (超时前只重传一次)
 const int MAX_CONCURRENT_READS_PER_TRANSFER = 6;  // Example limit
-const int MAX_CONCURRENT_WRITES_PER_TRANSFER = 8; // Example limit
+// 多个传输同时进行时: 发送端由 TransferScheduler 按权重和对端公平分配发送机会，文件 I/O 另有全局上限
+const qint64 FT_SCHEDULER_QUANTUM_BYTES = 1024 * 1024; // 每轮每个对端的发送额度 (按传输权重放大)
+const int FT_MAX_INFLIGHT_READS = 24;  // 所有传输合计的在途文件读取 (含续传前对已有前缀的校验和计算)
+const int FT_MAX_INFLIGHT_WRITES = 8;  // 所有传输合计的在途 write-behind 写入，超出时排队等待
+const int FT_MAX_INFLIGHT_SPILL_WRITES = 8; // 超出内存预算后直接写到最终位置的乱序块，单独计数，不占用 write-behind 的写入额度
+// 接收端写合并 (write-behind): 按序到达的块先累积，达到阈值 (或最后一块、或超时) 后合并为一次顺序写入。
+// 每个传输同一时间只有一次写入在执行，写入期间到达的块继续累积
+const qint64 DEFAULT_WRITE_BEHIND_FLUSH_THRESHOLD = 16 * 1024 * 1024;
+const int FT_WRITE_BEHIND_FLUSH_DELAY_MS = 20; // 未达到阈值的数据最多等待这么久再写入
+const int FT_PROGRESS_UPDATE_INTERVAL_MS = 100;   // 进度信号节流间隔，UI 每个传输每秒最多收到约 10 次更新
+// 完整性校验: 每个块带有 CRC-32C (链路协商了 PeerCapabilityChunkChecksums 时)，接收方校验失败即以 FT_NACK 请求重发；
+// 发送方把各块的 CRC 按文件顺序合并为整个文件的 CRC，放在 FT_EOF 中，接收方核对后才确认完成
+const char FT_FILE_CHECKSUM_PREFIX[] = "crc32c:";
+const int FT_MAX_CHUNK_CORRUPTIONS = 3; // 同一块校验失败超过这么多次 (如发送期间文件被修改) 时终止传输
+// 续传: 接收端定期把已写入的前缀记入续传清单 (TransferResumeStore)；断线时保留清单和发送端记录，
+// 重新连接后接收方以 FT_RESUME 请求从该前缀之后继续
+const int FT_RESUME_MANIFEST_INTERVAL_MS = 1000; // 续传清单最多每隔这么久更新一次 (断线时总会更新)
+// 一对多发送: 同一文件发往多个接收方时每块只读取一次，读出的缓冲区由各接收方共享，全部确认后释放。
+// 共享缓存超过上限时最慢的接收方退出共享 (之后自行读取)，其余接收方不再为它保留数据
+const qint64 FT_FANOUT_CACHE_BYTES = 256 * 1024 * 1024;
+
+// 接收到但尚未写入的块数据
+// buffer 可能是整个网络帧负载 (与网络层共享内存)，文件数据位于 [dataOffset, dataOffset + dataSize)
+struct ReceivedChunk {
+    QByteArray buffer;
+    qsizetype dataOffset = 0;
+    qint64 dataSize = 0;
+    qint64 fileOffset = -1; // 发送方给出的块在文件中的偏移，-1 表示未知 (旧版对端)
+    qint64 checksum = -1;   // 发送方给出的 CRC-32C (已校验)，-1 表示未携带
+};
+
+// 接收端已直接写到最终位置的乱序块 (数据不在内存中)
+struct SpilledChunk {
+    qint64 fileOffset = 0;
+    qint64 dataSize = 0;
+    qint64 checksum = -1;
+    bool written = false; // 写入已完成
+};
+
+// 发送端块边界: 从 firstChunkID 开始的块都是 chunkSize 大小 (最后一块可能更短)，直到下一段开始
+struct ChunkLayoutSegment {
+    qint64 firstChunkID = 0;
+    qint64 firstOffset = 0;
+    qint64 chunkSize = 0;
+};
+
+// 发送端每个传输的 RTT 估计与重传统计
+struct FileTransferMetrics {
+    double srttMs = 0.0;   // 平滑 RTT
+    double rttVarMs = 0.0; // RTT 平均偏差
+    qint64 rtoMs = FT_INITIAL_RTO_MS; // 当前重传超时 (含退避)
+    qint64 rttSamples = 0;
+    qint64 retransmittedChunks = 0;
+    qint64 retransmissionTimeouts = 0;
+    qint64 congestionWindowBytes = 0;
+    qint64 bytesInFlight = 0;
+    double bottleneckBandwidthMBps = 0.0;
+    qint64 minRttMs = -1;
+    qint64 chunkSize = 0;        // 当前块大小
+    qint64 chunkSizeChanges = 0; // 传输中途调整块大小的次数
+    qint64 corruptedChunks = 0;  // 接收方校验失败 (FT_NACK) 而重发的块数
+    // 接收端
+    qint64 receiveBufferedBytes = 0;     // 本传输在内存中持有的未写入数据
+    qint64 receiveBudgetUsedBytes = 0;   // 所有接收传输合计，上限 FT_RECEIVE_MEMORY_BUDGET_BYTES
+    qint64 spilledChunks = 0;            // 因超出预算直接写到最终位置的乱序块数
+    qint64 droppedChunks = 0;            // 超出预算且无法立即写出而丢弃 (不 SACK，由发送方重发) 的乱序块数
+    // 块缓冲区 (ChunkBufferPool): 发送端读取文件块、接收端接收帧负载时新分配 / 复用的次数，稳态下只有复用
+    qint64 bufferAllocations = 0;
+    qint64 bufferReuses = 0;
+    // 块压缩: 块中的文件数据与实际在链路上传输的数据 (压缩后) 的字节数，以及压缩 / 未经试压直接跳过的块数
+    qint64 chunkPayloadBytes = 0;
+    qint64 chunkWireBytes = 0;
+    qint64 compressedChunks = 0;
+    qint64 incompressibleChunks = 0;
+    double compressionRatio = 1.0;        // chunkWireBytes / chunkPayloadBytes
+    double effectiveThroughputGain = 1.0; // chunkPayloadBytes / chunkWireBytes: 同样的链路速率下文件数据的传输速度倍数
+    // 一对多发送: 使用其他接收方读出的共享缓冲区 (本传输未单独读取) 的块数
+    qint64 sharedChunks = 0;
+};
+
+// 发送端记录的已发出块
+struct SentChunkInfo {
+    qint64 sendOrder = 0;           // 发出顺序 (读取并发完成，块号顺序不等于发出顺序)
+    qint64 sentAtMs = 0;            // 最近一次发出时间 (session.sendClock)
+    qint64 deliveredAtSend = 0;     // 发出时累计已确认的字节数，用于计算交付速率
+    qint64 deliveredTimeAtSend = 0;
+    bool appLimited = false;        // 发出时发送方没有用满窗口
+};
+Q_DECLARE_METATYPE(FileTransferMetrics)
+
+// 一对多发送组中读出的块，各接收方发送同一个缓冲区 (QByteArray 隐式共享)
+struct SharedSendChunk {
+    qint64 length = 0;
+    bool reading = true;  // 读取尚未完成，data 为空
+    QByteArray data;
+    quint32 checksum = 0;
+    QList<QPair<QString, qint64>> waiters; // 读取完成后发出该块的 (transferID, chunkID)
+    // 某个接收方压缩过该块后保存结果，协商了压缩的其他接收方直接使用
+    bool compressionTried = false;
+    bool compressionSkipped = false;
+    QByteArray compressed; // 为空表示不值得压缩
+};
+
+// 一对多发送组: 每个接收方仍是独立的传输 (各自的窗口、拥塞控制、确认和重传)，只共享文件读取。
+// 组内传输使用相同的块边界，块号即缓存的索引；块边界改变 (接收方的上限更小、超时降低块大小) 的传输退出共享
+struct FanOutGroup {
+    QString filePath;
+    qint64 chunkSize = 0;
+    QStringList transferIDs;              // 仍在共享读取的传输
+    QMap<qint64, SharedSendChunk> chunks; // chunkID -> 块，所有仍在组内的传输都确认 (或退出) 后释放
+    qint64 cachedBytes = 0;
+    qint64 readChunks = 0;                // 实际从文件读取的块数
+    qint64 sharedDeliveries = 0;          // 未经读取、直接使用已有缓冲区发出的次数
+};
 
 struct FileTransferSession {
     QString transferID;
@@ -28,16 +165,69 @@ struct FileTransferSession {
     bool isSender;
     enum State { Idle, Offered, Accepted, Transferring, WaitingForAck, Completed, Rejected, Error, Paused } state; // Added Paused
     qint64 bytesTransferred; // For sender: bytes ACKed. For receiver: bytes written to disk.
-    qint64 totalChunks;    // Calculated when starting transfer
+    qint64 totalChunks;    // Calculated when starting transfer (接收方在块大小可变时仅为按初始块大小的估计)
+    // 双方都支持可变块大小 (发送方: FT_ACCEPT 带有 MaxChunkSize；接收方: FT_OFFER 带有 ChunkSize)
+    bool adaptiveChunks;
+    qint64 maxChunkSize;   // 发送方: 接收方接受的块大小上限；接收方: 在 FT_ACCEPT 中通告的上限
+    QString fileID;        // 发送方给出的文件标识，为空 (旧版发送方) 时不能续传
+    qint64 resumeOffset;   // 续传时从此偏移开始 (新传输为 0)，此前的数据接收方已有
+    quint32 resumeChecksum; // [0, resumeOffset) 的 CRC-32C
 
     // Sender specific for Sliding Window
     qint64 sendWindowBase;          // Sequence number of the oldest unacknowledged chunk
     qint64 nextChunkToSendInWindow; // Sequence number of the next new chunk to send within the current window pass
     QTimer* retransmissionTimer;    // Timer for retransmitting sendWindowBase if not ACKed
+    QList<ChunkLayoutSegment> chunkLayout; // 实际使用的块边界，块偏移只由它计算
+    qint64 chunkSizeCeiling;        // 中途调整的上限，不超过 maxChunkSize，重传超时时减半，之后无超时逐步恢复
+    qint64 chunkSizeCeilingChangedMs; // 上限最近一次降低或恢复的时间 (sendClock)
+    QSet<qint64> sackedChunks;      // 窗口内已被接收方选择性确认的块 (>= sendWindowBase)
+    qint64 sackedBytes;             // sackedChunks 的总字节数
+    QList<qint64> retransmitQueue;  // 待重传的块，优先于新块发送
+    QSet<qint64> fastRetransmitted; // 已因 SACK 缺口提前重传过的块，超时前不再重复
+    QMap<qint64, SentChunkInfo> sentChunks; // 窗口内已发出的块
+    qint64 sendOrderCounter;
+    QElapsedTimer sendClock;            // 发送时间戳的时钟，传输开始时启动
+    QSet<qint64> retransmittedChunks;   // 发出过不止一次的块，其 ACK 无法对应到某次发送，不用于测量 RTT
+    FileTransferMetrics metrics;
+    TransferCongestionController congestion;
+    qint64 peerWindowEndOffset;         // 接收方通告的窗口右边界 (文件偏移，不含)，只增不减
+    bool appLimited;                    // 上次 processSendQueue 没有用满窗口 (读取跟不上或文件已发完)
+    QMap<qint64, quint32> chunkChecksums; // 窗口内各块首次读取时的 CRC-32C (合并整个文件的 CRC 使用)
+    QMap<qint64, int> chunkCorruptions;   // 窗口内各块被 FT_NACK 的次数
+    // 块压缩已协商 (发送方: 仍在尝试压缩，连续多块不可压缩后关闭；接收方: 接受带 FrameFlagCompressed 的块)
+    bool compressChunks;
+    int uncompressedRun; // 发送方: 连续未压缩的块数
+    QString fanOutGroup; // 发送方: 所属的一对多发送组，为空表示单独读取文件
 
     // Receiver specific for Sliding Window
     qint64 highestContiguousChunkReceived; // Highest chunk ID received and written in order
-    QMap<qint64, QPair<QString, qint64>> receivedOutOfOrderChunks; // Buffer for out-of-order chunks: chunkID -> {dataB64, originalSize}
+    QMap<qint64, ReceivedChunk> receivedOutOfOrderChunks; // Buffer for out-of-order chunks: chunkID -> chunk data
+    // 接收端 write-behind: [highestContiguousChunkReceived + 1, nextChunkToWrite) 已按序收到，正在写入或在 writeBehind 中等待
+    qint64 nextChunkToWrite;
+    FileWriteSegments writeBehind;
+    qint64 writeBehindBytes;
+    bool writeInFlight;
+    qint64 receivedContiguousBytes; // 块 [0, nextChunkToWrite) 的总字节数，即下一个按序块的文件偏移
+    qint64 outOfOrderBytes;         // receivedOutOfOrderChunks 的总字节数
+    qint64 writeInFlightBytes;      // 正在执行的 write-behind 写入的字节数
+    // 超出内存预算时直接写到文件的乱序块，前面的数据全部写入后才并入 bytesTransferred
+    QMap<qint64, SpilledChunk> spilledChunks;
+    qint64 spilledBytes;            // spilledChunks 的总字节数
+    qint64 spillWriteBytes;         // 其中写入尚未完成 (数据仍在内存中) 的字节数
+    qint64 receiveWindowEndOffset;  // 已通告给发送方的窗口右边界 (文件偏移，不含)，超出的块丢弃
+    // 正在工作线程中解压 (buffer 为空，只保留偏移和 CRC) 或已解压、等待按到达顺序处理的块
+    QMap<qint64, ReceivedChunk> decompressingChunks;
+    QList<qint64> decompressQueue; // decompressingChunks 的到达顺序
+    qint64 decompressingBytes;     // decompressingChunks 占用的内存 (解压前为压缩数据，解压后为原始数据)
+
+    // 整个文件的 CRC-32C: 发送方为块 [0, fileChecksumChunks) 的合并结果；接收方为已按序收到的数据，
+    // 有块未携带 CRC 时 fileChecksumChunks 置为 -1 (无法核对)
+    quint32 fileChecksum;
+    qint64 fileChecksumChunks;
+    // 接收方: 整个文件的 CRC 只覆盖已写入的数据 (续传清单记录的就是它)，write-behind 和写入中的数据单独累积
+    quint32 writeBehindChecksum;
+    quint32 writeInFlightChecksum;
+    QElapsedTimer resumeManifestClock; // 上次更新续传清单以来的时间
 
     // 新增成员，用于处理延迟的EOF
     bool eofMessageReceived;                // 标记是否已收到FT_EOF消息
@@ -46,9 +236,11 @@ struct FileTransferSession {
 
     FileTransferSession() : 
         fileSize(0), isSender(false), state(Idle), bytesTransferred(0), 
-        totalChunks(0), sendWindowBase(0), nextChunkToSendInWindow(0), 
-        retransmissionTimer(nullptr), highestContiguousChunkReceived(-1),
-        eofMessageReceived(false), cachedTotalChunksReportedByPeer(0) {} // 初始化新成员
+        totalChunks(0), adaptiveChunks(false), maxChunkSize(0), resumeOffset(0), resumeChecksum(0), sendWindowBase(0), nextChunkToSendInWindow(0), 
+        retransmissionTimer(nullptr), chunkSizeCeiling(0), chunkSizeCeilingChangedMs(0), sackedBytes(0), sendOrderCounter(0), peerWindowEndOffset(0), appLimited(false), compressChunks(false), uncompressedRun(0), highestContiguousChunkReceived(-1),
+        nextChunkToWrite(0), writeBehindBytes(0), writeInFlight(false), receivedContiguousBytes(0), outOfOrderBytes(0), writeInFlightBytes(0),
+        spilledBytes(0), spillWriteBytes(0), receiveWindowEndOffset(0), decompressingBytes(0),
+        fileChecksum(0), fileChecksumChunks(0), writeBehindChecksum(0), writeInFlightChecksum(0), eofMessageReceived(false), cachedTotalChunksReportedByPeer(0) {} // 初始化新成员
 
     // Helper to clean up timer
     void stopAndClearRetransmissionTimer() {
@@ -72,16 +264,26 @@ public:
     ~FileTransferManager();
 
     // Called by UI to initiate sending a file
+    // FileTransferManager 运行在传输线程中，以下接口可从 UI 线程调用，调用会以队列方式转到传输线程执行
     QString requestSendFile(const QString& peerUuid, const QString& filePath);
-
-    // Called by NetworkEventHandler when a file transfer message is received
-    void handleIncomingFileMessage(const QString& peerUuid, const QString& message);
+    // 把同一文件发给多个对端: 每个对端一个传输 (按 peerUuids 的顺序返回 TransferID，信号与单独发送相同)，
+    // 文件只读取一遍，各块的缓冲区由所有接收方共享
+    QStringList requestSendFileToPeers(const QStringList& peerUuids, const QString& filePath);
 
     // Called by UI to accept an incoming file offer
     void acceptFileOffer(const QString& transferID, const QString& savePath); // Modified to include savePath
     // Called by UI to reject an incoming file offer
     void rejectFileOffer(const QString& transferID, const QString& reason);
 
+    // 接收端写入选项: write-behind 合并阈值 (字节)，以及是否以 O_DIRECT 写入 (仅 Linux，对之后接受的传输生效)
+    void setWriteBehindOptions(qint64 flushThreshold, bool directIO);
+    // 发送调度权重 (>= 1，默认 1): 同一对端上的多个传输按权重分配该对端的发送份额
+    void setTransferWeight(const QString& transferID, int weight);
+    // 文件发送限速 (全局和每个对端，可按时段生效)，立即作用于进行中的传输；聊天和控制消息不受限制
+    void setRateLimits(const TransferRateLimits& limits);
+    // 是否提议 / 接受块压缩 (默认开启，对之后开始的传输生效)
+    void setCompressionEnabled(bool enabled);
+
 signals:
     // UI Signals
     void incomingFileOffer(const QString& transferID, const QString& peerUuid, const QString& fileName, qint64 fileSize);
@@ -89,6 +291,8 @@ signals:
     void fileTransferProgress(const QString& transferID, qint64 bytesTransferred, qint64 totalSize);
     void fileTransferFinished(const QString& transferID, const QString& peerUuid, const QString& fileName, bool success, const QString& message);
     void fileTransferError(const QString& transferID, const QString& peerUuid, const QString& errorMsg);
+    // 传输统计 (发送端 RTT/RTO 等，接收端缓冲占用)，与进度信号同样节流
+    void fileTransferMetricsUpdated(const QString& transferID, const FileTransferMetrics& metrics);
     void requestSavePath(const QString& transferID, const QString& fileName, qint64 fileSize, const QString& peerUuid); // New signal
 
 private slots:
@@ -97,9 +301,27 @@ private slots:
     void handleChunkRetransmissionTimeout(const QString& transferID); // Renamed from handleTransferTimeout
 
     // New slots for FileIOManager signals
-    // 修改：data参数类型变为const QString& dataB64，并增加originalSize参数
-    void handleChunkReadForSending(const QString& transferID, qint64 chunkID, const QString& dataB64, qint64 originalSize, bool success, const QString& error);
-    void handleChunkWritten(const QString& transferID, qint64 chunkID, qint64 bytesWritten, bool success, const QString& error);
+    void handleChunkReadForSending(const QString& transferID, qint64 chunkID, const QByteArray& data, quint32 checksum, bool success, const QString& error);
+    // 续传前本端文件中 [0, resumeOffset) 的 CRC-32C
+    void handleResumePrefixChecksum(const QString& transferID, qint64 chunkID, quint32 checksum, bool success, const QString& error);
+    // requestID 为 write-behind 写入的最后一块块号，或乱序块直接写入的请求号 (负数)
+    void handleChunkWritten(const QString& transferID, qint64 requestID, qint64 bytesWritten, bool success, const QString& error);
+    // 工作线程压缩完发送的块 / 解压完收到的块
+    void handleChunkCompressedForSending(const QString& transferID, qint64 chunkID, const QByteArray& data, quint32 checksum, bool compressed, bool skipped);
+    void handleChunkDecompressed(const QString& transferID, qint64 chunkID, const QByteArray& data, bool success, const QString& error);
+
+    // NetworkManager 收到二进制 FileChunk 帧
+    void handleIncomingFileChunk(const QString& peerUuid, const QString& transferID, qint64 chunkID, qint64 fileOffset, qint64 checksum,
+                                 const QByteArray& payload, qsizetype dataOffset, bool compressed);
+    // 对端重新变为可写，继续该对端上所有发送中的传输
+    void handlePeerWritable(const QString& peerUuid);
+    // 零拷贝发送的块未能从文件完整读出
+    void handleChunkSendFailed(const QString& peerUuid, const QString& transferID, qint64 chunkID, const QString& error);
+    // 对端连上时请求续传来自它的未完成接收；断开时暂停与它的所有传输
+    void handlePeerConnected(const QString& peerUuid);
+    void handlePeerDisconnected(const QString& peerUuid);
+    // 限速等待结束，继续发送
+    void resumeRateLimitedSends();
 
 private:
     NetworkManager* m_networkManager;
@@ -107,48 +329,157 @@ private:
     QString m_localUserUuid;
     QMap<QString, FileTransferSession> m_sessions; // Key: TransferID
     QMap<QString, int> m_outstandingReadRequests; // transferID -> count
-    QMap<QString, int> m_outstandingWriteRequests; // transferID -> count
+    QMap<QString, int> m_outstandingWriteRequests; // transferID -> count (含直接写到最终位置的乱序块)
+    QMap<QString, int> m_outstandingSpillWrites;   // transferID -> 其中乱序块直接写入的数量
 
     // 集中ACK相关成员
-    QMap<QString, int> m_pendingAckCount; // transferID -> 当前未发送的ACK计数
+    QMap<QString, qint64> m_pendingAckBytes; // transferID -> 上次 ACK 以来收到的按序数据量
     QMap<QString, QTimer*> m_ackDelayTimers; // transferID -> ACK延迟定时器
 
     // 新增：传输计时器
     QMap<QString, QElapsedTimer*> m_transferTimers; // transferID -> QElapsedTimer*
+    QMap<QString, QElapsedTimer> m_progressThrottle; // transferID -> 上次发出进度信号以来的时间
+    QMap<QString, QTimer*> m_writeBehindTimers; // transferID -> write-behind 超时写入定时器
+    QMap<QString, qint64> m_peerChunkSizeHints; // peerUuid -> 上次向该对端发送结束时的块大小，作为下次的初始值
+    TransferResumeStore m_resumeStore;
+    TransferScheduler m_sendScheduler;
+    bool m_schedulerRunning;
+    QList<QString> m_pendingWriteFlushes; // 因全局写入上限而等待提交 write-behind 的传输，先到先写
+    TransferRateLimiter m_rateLimiter;
+    QTimer* m_rateLimitTimer; // 等待令牌桶补充
+    bool m_globalRateLimited; // 上次调度因全局限速而停止
+    QList<QString> m_rateLimitedTransfers; // 因对端限速移出调度环的传输，等待结束后重新加入
+
+    qint64 m_writeBehindThreshold;
+    bool m_directIOWrites;
+    bool m_compressionEnabled;
+    QMap<QString, FanOutGroup> m_fanOutGroups; // groupID -> 一对多发送组 (组的文件读取以 groupID 提交给 FileIOManager)
+
+    bool isInTransferThread() const { return QThread::currentThread() == thread(); }
+    // fanOutGroup 非空时该传输加入一对多发送组，使用组的块大小
+    void startSendFile(const QString& peerUuid, const QString& filePath, const QString& transferID, const QString& fanOutGroup = QString());
+    void startFanOutSend(const QStringList& peerUuids, const QString& filePath, const QStringList& transferIDs, const QString& groupID);
+    // 节流后的 fileTransferProgress，完成时总是发出
+    void reportProgress(const QString& transferID, qint64 bytesTransferred, qint64 totalSize);
 
     QString generateTransferID() const;
-    void sendFileOffer(const QString& peerUuid, const QString& transferID, const QString& fileName, qint64 fileSize);
-    void sendAcceptMessage(const QString& peerUuid, const QString& transferID, const QString& savePathHint); // Modified
+    void sendFileOffer(const QString& peerUuid, const QString& transferID, const QString& fileName, qint64 fileSize, qint64 chunkSize,
+                       const QString& fileID, qint64 resumeOffset = -1, const QString& compression = QString());
+    void sendAcceptMessage(const QString& peerUuid, const QString& transferID, const QString& savePathHint, qint64 maxChunkSize,
+                           const QString& compression); // Modified
     void sendRejectMessage(const QString& peerUuid, const QString& transferID, const QString& reason);
-    // 修改：chunkData参数类型变为const QString& dataB64，并增加originalChunkSize参数
-    void sendChunkData(const QString& transferID, qint64 chunkID, const QString& dataB64, qint64 originalChunkSize);
+    // 对端支持二进制帧时发送原始字节，否则回退为 Base64 文本 FT_CHUNK
+    // compressed 时 data 为压缩后的数据 (只在协商了压缩的二进制帧链路上发送)
+    void sendChunkData(const QString& transferID, qint64 chunkID, const QByteArray& data, quint32 checksum, bool compressed = false);
     void sendDataAck(const QString& peerUuid, const QString& transferID, qint64 ackedChunkID); // ackedChunkID is the highest contiguous received
     void sendEOF(const QString& transferID);
     void sendEOFAck(const QString& peerUuid, const QString& transferID);
+    void sendChunkNack(const QString& peerUuid, const QString& transferID, qint64 chunkID);
     void sendError(const QString& peerUuid, const QString& transferID, const QString& errorCode, const QString& errorMessage);
 
-    void handleFileOffer(const QString& peerUuid, const QString& transferID, const QString& fileName, qint64 fileSize);
-    void handleFileAccept(const QString& peerUuid, const QString& transferID, const QString& savePathHint); // Modified
+    void handleFileOffer(const QString& peerUuid, const QString& transferID, const QString& fileName, qint64 fileSize, qint64 chunkSize, const QString& fileID,
+                         const QString& compression);
+    void handleFileAccept(const QString& peerUuid, const QString& transferID, const QString& savePathHint, qint64 maxChunkSize,
+                          const QString& compression); // Modified
     void handleFileReject(const QString& peerUuid, const QString& transferID, const QString& reason);
-    // 修改：data参数类型变为const QString& dataB64, chunkSize变为originalChunkSize
-    void handleFileChunk(const QString& peerUuid, const QString& transferID, qint64 chunkID, qint64 originalChunkSize, const QString& dataB64);
-    void handleDataAck(const QString& peerUuid, const QString& transferID, qint64 ackedChunkID); // ackedChunkID is the highest contiguous received by peer
+    void handleFileChunk(const QString& peerUuid, const QString& transferID, qint64 chunkID, const ReceivedChunk& chunk);
+    void handleDataAck(const QString& peerUuid, const QString& transferID, qint64 ackedChunkID, const QByteArray& sackBitmap, qint64 receiveWindowBytes); // ackedChunkID is the highest contiguous received by peer
     void handleEOF(const QString& peerUuid, const QString& transferID, qint64 totalChunks, const QString& finalChecksum);
     void handleEOFAck(const QString& peerUuid, const QString& transferID);
+    void handleChunkNack(const QString& peerUuid, const QString& transferID, qint64 chunkID);
+
+    // 续传
+    // 发送方: 接收方请求从 offset 继续；核对文件和前缀 CRC 后以 FT_OFFER (带 ResumeOffset) 答复
+    void handleResumeRequest(const QString& peerUuid, const QString& transferID, const QString& fileID, qint64 offset, qint64 checksum);
+    void sendResumeOffer(const QString& transferID);
+    // 接收方: 发送方同意续传，不经用户确认直接接受
+    void handleResumeOffer(const QString& peerUuid, const QString& transferID, qint64 fileSize, qint64 chunkSize, const QString& fileID, qint64 resumeOffset,
+                           const QString& compression);
+    // 发送方是否提议压缩: 已启用、链路为二进制帧且文件不是已压缩的格式
+    bool shouldOfferCompression(const QString& peerUuid, const QString& fileName) const;
+    // 断线: 保留续传状态后结束会话
+    void interruptSession(const QString& transferID);
+    void saveResumeManifest(FileTransferSession& session);
     void handleFileError(const QString& peerUuid, const QString& transferID, const QString& errorCode, const QString& message);
     
     // Placeholder for actual data sending/receiving logic
     void startActualFileSend(const QString& transferID);
     void prepareToReceiveFile(const QString& transferID, const QString& savePath);
 
-    // Helper to extract attribute from simple XML-like string (can be moved to a utility class later)
-    QString extractMessageAttribute(const QString& message, const QString& attributeName) const;
+    // 在 NetworkManager 的分发表中注册 FT_ 控制消息处理函数
+    void registerMessageHandlers();
+    void unregisterMessageHandlers();
     void cleanupSession(const QString& transferID, bool success, const QString& message);
     void startRetransmissionTimer(const QString& transferID);
     void stopRetransmissionTimer(const QString& transferID);
+    // 按调度器的顺序为各传输发出块，直到没有可发的块、达到全局在途读取上限或受到限速
+    void runSendScheduler();
+    // 传输下一个可发块 (重传优先) 的字节数，当前不能发送 (窗口已满、对端不可写等) 时返回 -1
+    qint64 nextSendCost(const QString& transferID, FileTransferSession& session);
+    void sendNextChunk(const QString& transferID, FileTransferSession& session);
+    // 限速额度不足时 delayMs 之后再尝试 (已有更早的等待时保留它)
+    void scheduleRateLimitRetry(qint64 delayMs);
+    int totalOutstandingReads() const;
+    int totalOutstandingWrites() const;
+    int totalOutstandingSpillWrites() const;
+    // 有写入完成 (或传输结束) 后提交排队的 write-behind
+    void resumePendingWriteFlushes();
+    // 发送一个块: 零拷贝链路直接交给网络层，否则请求读取；zeroCopyFile 在链路不再支持零拷贝时被清空
+    void issueChunk(const QString& transferID, FileTransferSession& session, qint64 chunkID, QSharedPointer<TransferFile>& zeroCopyFile);
+    // 一对多发送: 使用组内已读出的块，或由组读取 (同一块只读一次)，读取完成后发给所有等待的传输
+    void issueSharedChunk(const QString& transferID, FileTransferSession& session, qint64 chunkID);
+    void handleSharedChunkRead(const QString& groupID, qint64 chunkID, const QByteArray& data, quint32 checksum, bool success, const QString& error);
+    SharedSendChunk* sharedChunk(const FileTransferSession& session, qint64 chunkID);
+    // 释放组内所有传输都已确认的块；超出 FT_FANOUT_CACHE_BYTES 时让最慢的传输退出共享
+    void trimFanOutCache(const QString& groupID);
+    void leaveFanOutGroup(const QString& groupID, const QString& transferID);
+    // 组内没有传输且没有读取在执行时关闭组的文件
+    void maybeRemoveFanOutGroup(const QString& groupID);
+    // 读出 (或从共享缓存取得) 的块: 协商了压缩时先在工作线程中压缩，否则直接发出
+    void dispatchChunkData(const QString& transferID, FileTransferSession& session, qint64 chunkID, const QByteArray& data, quint32 checksum);
+    // 发出块并记录发送，块为窗口底部时开始计时
+    void transmitChunk(const QString& transferID, FileTransferSession& session, qint64 chunkID, const QByteArray& data, quint32 checksum, bool compressed);
+    // 块的压缩结果: 更新统计，退回限速额度，连续多块不可压缩时停止尝试
+    void recordCompressionResult(FileTransferSession& session, qint64 chunkID, qint64 wireBytes, bool compressed, bool skipped);
+    // 记录块的发出顺序和时间戳
+    // wireBytes 为链路上实际发送的块数据字节数 (压缩后)，-1 表示未压缩
+    void recordChunkSent(FileTransferSession& session, qint64 chunkID, qint64 wireBytes = -1);
+    // 累计块数据 / 链路字节数并更新压缩比
+    void recordChunkBytes(FileTransferSession& session, qint64 payloadBytes, qint64 wireBytes);
+    // 用一个 RTT 样本更新 SRTT/RTTVAR 并重新计算 RTO (同时取消退避)
+    void updateRttEstimate(FileTransferSession& session, qint64 rttMs);
+    // 接收方: 当前窗口内已收到 (写入中、write-behind 中、乱序缓冲或已写到最终位置) 的块位图
+    QByteArray buildSackBitmap(const FileTransferSession& session) const;
+    // 接收方从已写入数据末尾起能接受的字节数 (本传输缓冲区与全局内存预算中尚未被未写入数据占用部分的较小者)
+    qint64 receiveWindowBytes(const FileTransferSession& session) const;
+    // 接收方在内存中持有的未写入数据: 单个传输 / 所有传输合计
+    qint64 receiveBufferedBytes(const FileTransferSession& session) const;
+    qint64 totalReceiveBufferedBytes() const;
+    // 接收方: 把乱序块直接写到文件中的最终位置 (内存预算用尽时)
+    void spillChunk(const QString& transferID, FileTransferSession& session, qint64 chunkID, const ReceivedChunk& chunk);
+    // 发送方: 已发出 (或正在读取准备发出) 但未被确认的数据量
+    qint64 bytesInFlight(const FileTransferSession& session) const;
+    // 发送方: 按 chunkLayout 计算的块偏移和大小
+    qint64 chunkOffset(const FileTransferSession& session, qint64 chunkID) const;
+    qint64 chunkBytes(const FileTransferSession& session, qint64 chunkID) const;
+    // 发送方: 从 firstChunkID (尚未发出) 开始改用 chunkSize，并重新计算 totalChunks
+    void setChunkSize(FileTransferSession& session, qint64 firstChunkID, qint64 chunkSize);
+    // 按文件大小和该对端上次传输的块大小选择初始块大小
+    qint64 chooseInitialChunkSize(const QString& peerUuid, qint64 fileSize) const;
+    // 按当前 BDP 估计调整之后发出的块的大小
+    void maybeAdjustChunkSize(const QString& transferID, FileTransferSession& session);
+    // 发送方: 记录块首次读取时的 CRC，并按文件顺序并入整个文件的 CRC
+    void recordChunkChecksum(FileTransferSession& session, qint64 chunkID, quint32 checksum);
+    // 接收方: 用 FT_EOF 中的 FinalChecksum 核对收到的文件；不符时终止传输并返回 false
+    bool verifyFileChecksum(const QString& transferID);
 
-    // Helper for receiver to process buffered chunks
-    void processBufferedChunks(const QString& transferID);
+    // Helper for receiver to process buffered chunks；块偏移与已收到的数据不衔接时终止传输并返回 false。
+    // 已写到最终位置的块在它之前的数据都写入后直接并入 bytesTransferred；flush 为 false 时不提交写入
+    bool processBufferedChunks(const QString& transferID, bool flush = true);
+    // 按序块进入 write-behind 缓冲；块带有的偏移与 receivedContiguousBytes 不符或超出文件大小时返回 false
+    bool appendToWriteBehind(FileTransferSession& session, const ReceivedChunk& chunk);
+    // 满足条件 (达到阈值、包含最后一块或 force) 且没有写入在执行时，把 write-behind 中的数据作为一次写入提交
+    void flushWriteBehind(const QString& transferID, bool force);
 };
 
 #endif // FILETRANSFERMANAGER_H
@@ -0,0 +1,152 @@
+#ifndef FRAMEPROTOCOL_H
+#define FRAMEPROTOCOL_H
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+
+QT_BEGIN_NAMESPACE
+class QIODevice;
+QT_END_NAMESPACE
+
+// 二进制帧协议 (在 SYS_HELLO / SYS_SESSION_ACCEPTED 握手中协商)
+// 帧头固定 10 字节，全部为大端序:
+//   quint16 magic    固定为 FRAME_MAGIC
+//   quint8  version  帧头格式版本 (FRAME_HEADER_VERSION)
+//   quint8  type     FrameType
+//   quint16 flags    FrameFlag 位组合
+//   quint32 length   负载字节数 (不含帧头)
+// 帧头之后紧跟 length 字节的原始负载。
+const quint16 FRAME_MAGIC = 0x4346; // "CF"
+const quint8 FRAME_HEADER_VERSION = 1;
+// 握手中协商的帧协议版本 (功能级别)，与帧头格式版本相互独立:
+//   1 - TextMessage 与 FileChunk 帧
+//   2 - 增加 TypedMessage 帧 (二进制控制消息)
+//   3 - 大负载可拆分为多个分片帧 (FrameFlagFragment)，与控制消息交错发送
+const quint8 FRAME_PROTOCOL_VERSION = 3;
+const quint8 FRAME_PROTOCOL_TYPED_MESSAGES = 2;
+const quint8 FRAME_PROTOCOL_FRAGMENTS = 3;
+// 握手中交换的可选能力位 (SYS_HELLO / SYS_SESSION_ACCEPTED 的 Caps 字段)，链路启用双方能力的交集。
+// 仅在协商出二进制帧时有意义。
+enum PeerCapability : quint8
+{
+    PeerCapabilityNone = 0x00,
+    // 发送方可将 FileChunk 帧的文件数据由内核直接从文件写入套接字 (Linux sendfile)。
+    // 线格式与普通 FileChunk 帧相同；帧头先于数据写出，若文件在发送期间被截短，
+    // 缺少的部分以零填充并随后发送 FT_ERROR 终止该传输。
+    PeerCapabilityZeroCopyFileData = 0x01,
+    // FileChunk 帧子头在 chunkID 之后携带该块在文件中的偏移 (块大小可随传输变化，接收方不能再按块号推算)
+    PeerCapabilityChunkOffsets = 0x02,
+    // FileChunk 帧子头携带块数据的 CRC-32C，接收方校验失败时以 FT_NACK 请求重发该块
+    PeerCapabilityChunkChecksums = 0x04
+};
+#ifdef Q_OS_LINUX
+const quint8 LOCAL_PEER_CAPABILITIES = PeerCapabilityZeroCopyFileData | PeerCapabilityChunkOffsets | PeerCapabilityChunkChecksums;
+#else
+const quint8 LOCAL_PEER_CAPABILITIES = PeerCapabilityChunkOffsets | PeerCapabilityChunkChecksums;
+#endif
+const int FRAME_HEADER_SIZE = 10;
+const quint32 DEFAULT_MAX_FRAME_SIZE = 32 * 1024 * 1024; // 单帧负载上限，防止对端声明超大长度导致内存耗尽 (分片重组后的总长度同样受此限制)
+const quint32 BULK_FRAGMENT_SIZE = 64 * 1024;             // 批量数据分片大小，决定控制消息最多需要等待多少字节
+
+enum class FrameType : quint8
+{
+    TextMessage = 1, // UTF-8 编码的文本消息 (聊天内容、SYS_/FT_ 控制消息)
+    FileChunk = 2,   // 文件数据块，负载格式见 FILE_CHUNK_HEADER_FIXED_SIZE
+    TypedMessage = 3 // 二进制控制消息，负载格式见 messagecodec.h
+};
+
+enum FrameFlag : quint16
+{
+    FrameFlagNone = 0x0000,
+    // 分片帧: 同一逻辑帧的各分片类型相同、按顺序发送，中间只可能穿插未分片的帧
+    FrameFlagFragment = 0x0001,
+    FrameFlagFinalFragment = 0x0002, // 与 FrameFlagFragment 同时设置，表示逻辑帧的最后一个分片
+    // FileChunk 帧的文件数据经过压缩 (见 chunkcompression.h)，分片帧的每个分片都带有此标志。
+    // 只用于在 FT_OFFER/FT_ACCEPT 中协商了压缩的传输，其余帧不设置
+    FrameFlagCompressed = 0x0004
+};
+
+struct Frame
+{
+    FrameType type = FrameType::TextMessage;
+    quint16 flags = FrameFlagNone;
+    QByteArray payload;
+    bool payloadReused = false; // 负载复用了缓冲池 (chunkBufferPool) 中的缓冲区，而不是新分配
+};
+
+// FileChunk 帧负载 (大端序):
+//   quint16 idLength   TransferID 的 UTF-8 字节数
+//   char[idLength]     TransferID
+//   qint64  chunkID
+//   qint64  fileOffset  仅当链路协商了 PeerCapabilityChunkOffsets
+//   quint32 crc32c      仅当链路协商了 PeerCapabilityChunkChecksums
+//   之后直到负载末尾均为原始文件数据
+const int FILE_CHUNK_HEADER_FIXED_SIZE = 2 + 8;
+const int FILE_CHUNK_OFFSET_SIZE = 8;
+const int FILE_CHUNK_CHECKSUM_SIZE = 4;
+
+// 生成帧头，负载由调用方紧随其后写出，避免为拼接帧而复制负载
+QByteArray encodeFrameHeader(FrameType type, quint16 flags, quint32 payloadLength);
+
+// 生成 FileChunk 帧负载的块子头 (不含帧头)，文件数据由调用方直接写出;
+// 帧头在发送时生成，以便整帧或分片发出。可选字段是否存在由链路的 capabilities 决定，
+// 存在时 fileOffset 和 checksum 必须有效 (>= 0)
+QByteArray encodeFileChunkSubHeader(const QString &transferID, qint64 chunkID, quint8 capabilities = PeerCapabilityNone,
+                                    qint64 fileOffset = -1, qint64 checksum = -1);
+// 解析 FileChunk 帧负载的子头，dataOffset 为文件数据在负载中的起始位置；
+// 链路未协商的可选字段置为 -1
+bool decodeFileChunkHeader(const QByteArray &payload, quint8 capabilities, QString &transferID, qint64 &chunkID,
+                           qint64 &fileOffset, qint64 &checksum, qsizetype &dataOffset);
+
+// 增量帧解码器: 每次从设备读取当前可用的数据，帧头完整后才按声明长度分配负载缓冲区
+// (FileChunk 帧负载取自 chunkBufferPool()，写入文件后交还；分片帧的重组缓冲区同样取自缓冲池)。
+// 分片帧在解码器内部重组，调用方只会得到完整的逻辑帧。
+class FrameDecoder
+{
+public:
+    enum Status
+    {
+        NeedMoreData,
+        FrameReady,
+        ProtocolError
+    };
+
+    explicit FrameDecoder(quint32 maxFrameSize = DEFAULT_MAX_FRAME_SIZE);
+
+    void setMaxFrameSize(quint32 maxFrameSize);
+    quint32 maxFrameSize() const;
+
+    // 读取设备中的可用数据，最多组装出一帧
+    Status readFrom(QIODevice *device);
+    // 在 readFrom 返回 FrameReady 后取出该帧，并为下一帧重置状态
+    Frame takeFrame();
+    QString errorString() const;
+    void reset();
+
+private:
+    Status fail(const QString &error);
+
+    quint32 m_maxFrameSize;
+    char m_headerBuffer[FRAME_HEADER_SIZE];
+    int m_headerBytesRead;
+    FrameType m_type;
+    quint16 m_flags;
+    quint32 m_payloadLength;
+    QByteArray m_payload;
+    bool m_payloadReused;
+    quint32 m_payloadBytesRead;
+    bool m_frameReady;
+    QString m_errorString;
+
+    // 正在重组的分片逻辑帧: 各分片的负载直接读入 m_fragmentBuffer，已收到 m_fragmentBytes 字节
+    // (缓冲区的 size() 是预留的大小)。FileChunk 帧的重组缓冲区取自缓冲池，大小按上一个重组的块 (m_fragmentSizeHint)
+    QByteArray m_fragmentBuffer;
+    quint32 m_fragmentBytes;
+    bool m_fragmentReused;
+    quint32 m_fragmentSizeHint;
+    FrameType m_fragmentType;
+    bool m_inFragmentedFrame;
+};
+
+#endif // FRAMEPROTOCOL_H
@@ -0,0 +1,85 @@
+#ifndef IOURINGQUEUE_H
+#define IOURINGQUEUE_H
+
+#include <QtGlobal>
+#include <QString>
+
+// 仅 Linux 且内核头文件提供 io_uring 时编译实际实现，其他平台 init() 始终返回 false
+#if defined(Q_OS_LINUX) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define FILEIO_HAS_IO_URING 1
+#endif
+#endif
+
+// 极简 io_uring 封装 (直接使用系统调用，不依赖 liburing)。
+// 只支持定位读写；调用方先 prepareRead/prepareWrite 若干次，再用一次 submit() 批量提交。
+// 完成事件通过 eventFd() 通知 (可交给 QSocketNotifier)，由 reapCompletions() 批量取出。
+// 非线程安全: 同一队列只能在一个线程中使用。
+class IoUringQueue
+{
+public:
+    // 写入的一段数据，布局与 struct iovec 相同
+    struct Segment
+    {
+        const void *data;
+        size_t length;
+    };
+
+    struct Completion
+    {
+        quint64 userData;
+        int result; // >= 0 为传输的字节数，< 0 为 -errno
+    };
+
+    IoUringQueue();
+    ~IoUringQueue();
+
+    bool init(unsigned entries, QString *error);
+    bool isValid() const { return m_ringFd >= 0; }
+    unsigned capacity() const { return m_sqEntries; }
+    int eventFd() const { return m_eventFd; }
+
+    // 提交队列已满时返回 false
+    bool prepareRead(int fd, void *buffer, unsigned length, quint64 offset, quint64 userData);
+    bool prepareWrite(int fd, const void *buffer, unsigned length, quint64 offset, quint64 userData);
+    // 多段顺序写入 (IORING_OP_WRITEV)；segments 在完成前必须保持有效
+    bool prepareWritev(int fd, const Segment *segments, unsigned count, quint64 offset, quint64 userData);
+    // 提交所有已准备的请求，返回提交数量；出错返回 -errno
+    int submit();
+    // 阻塞等待至少 minComplete 个完成事件 (用于析构前等待内核释放缓冲区)
+    int waitForCompletions(unsigned minComplete);
+    // 取出最多 maxCount 个完成事件，返回数量
+    int reapCompletions(Completion *out, int maxCount);
+    // 清除 eventfd 上的计数
+    void clearEventFd();
+
+private:
+    bool prepare(quint8 opcode, int fd, quint64 address, unsigned length, quint64 offset, quint64 userData);
+    void release();
+
+    int m_ringFd;
+    int m_eventFd;
+    unsigned m_sqEntries;
+    unsigned m_pendingSubmissions;
+
+    void *m_sqRing;
+    size_t m_sqRingSize;
+    void *m_cqRing;
+    size_t m_cqRingSize;
+    void *m_sqes;
+    size_t m_sqesSize;
+
+    // 指向共享环内的字段
+    unsigned *m_sqHead;
+    unsigned *m_sqTail;
+    unsigned *m_sqMask;
+    unsigned *m_sqArray;
+    unsigned *m_cqHead;
+    unsigned *m_cqTail;
+    unsigned *m_cqMask;
+    void *m_cqes;
+
+    Q_DISABLE_COPY(IoUringQueue)
+};
+
+#endif // IOURINGQUEUE_H
@@ -12,6 +12,7 @@
 #include <QTcpSocket>
 #include <QTextEdit>   // 添加 QTextEdit 头文件
 #include <QMap>        // 添加 QMap 头文件
+#include "transferratelimiter.h"
 
 QT_BEGIN_NAMESPACE
 class QListWidget;
@@ -25,6 +26,7 @@ class QFontComboBox;
 class QComboBox;
 class QTextCharFormat; // For formatting
 class QColor;          // For color selection
+class QThread;
 QT_END_NAMESPACE
 
 // 自定义类的前向声明
@@ -79,7 +81,8 @@ private slots: // 将这些声明为 private slots
                                quint16 outgoingPort, bool useSpecificOutgoingPortVal,
                                bool enableUdpDiscovery, quint16 udpDiscoveryPort,
                                bool enableContinuousUdpBroadcast, int udpBroadcastInterval,
-                               const QString &newDefaultDownloadDir, bool newRequireFileAccept);
+                               const QString &newDefaultDownloadDir, bool newRequireFileAccept,
+                               const TransferRateLimits &newRateLimits);
     void handleRetryListenNowRequested(); // 新增槽
     void handleManualUdpBroadcastRequested(); // 新增槽
 
@@ -139,6 +142,8 @@ private:
 
     ContactManager *contactManager;
     NetworkManager *networkManager; // 指针，使用前向声明即可
+    QThread *networkThread;         // NetworkManager 及其套接字所在的网络线程
+    QThread *transferThread;        // FileTransferManager 与 FileIOManager 所在的传输线程
     SettingsDialog *settingsDialog; // 设置对话框实例
 
     // Data members for chat history and current contact
@@ -168,6 +173,7 @@ private:
     // 文件传输相关设置
     QString defaultDownloadDir;
     bool requireFileAccept;
+    TransferRateLimits transferRateLimits;
 
     void setupUI();
     // 新增：联系人持久化和重连方法
@@ -0,0 +1,520 @@
+#ifndef MESSAGECODEC_H
+#define MESSAGECODEC_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringView>
+#include <QHash>
+#include <QPointer>
+#include <QObject>
+#include <QThread>
+#include <QReadWriteLock>
+#include <QtEndian>
+#include <array>
+#include <functional>
+#include <tuple>
+#include <utility>
+
+// SYS_/FT_ 控制消息的数字类型 ID
+// 二进制帧 (FrameType::TypedMessage) 中以 quint16 写出，同时也是分发表的下标。
+// 只能在末尾追加新类型，已有的值不可改变。
+enum class MessageType : quint16
+{
+    Unknown = 0,
+    SysHello,
+    SysSessionAccepted,
+    SysSessionRejected,
+    FtOffer,
+    FtAccept,
+    FtReject,
+    FtChunk,
+    FtDataAck,
+    FtEof,
+    FtEofAck,
+    FtError,
+    FtNack,
+    FtResume,
+    Count
+};
+
+// 消息字段描述: 属性名 (文本协议) + 成员指针 (类型决定二进制编码)
+template <class M, class T>
+struct MessageField
+{
+    const char *name;
+    T M::*member;
+};
+
+template <class M, class T>
+constexpr MessageField<M, T> messageField(const char *name, T M::*member)
+{
+    return MessageField<M, T>{name, member};
+}
+
+// ---------------------------------------------------------------------------
+// 消息定义
+// 每个结构体声明 Type、Tag 以及 fields()；字段顺序即文本属性顺序和二进制字段顺序。
+// 二进制格式只能在 fields() 末尾追加字段，旧版对端会忽略多出的尾部字段。
+// ---------------------------------------------------------------------------
+
+// FrameProto: HELLO 中为发起方支持的最高帧协议版本，SESSION_ACCEPTED 中为协商结果 (0 或缺失表示旧版分帧)
+// Caps: PeerCapability 位组合，HELLO 中为发起方支持的能力，SESSION_ACCEPTED 中为双方的交集 (缺失为 0)
+struct SysHelloMessage
+{
+    static constexpr MessageType Type = MessageType::SysHello;
+    static constexpr const char *Tag = "SYS_HELLO";
+    QString uuid;
+    QString nameHint;
+    quint8 frameProto = 0;
+    quint8 caps = 0;
+    static constexpr auto fields()
+    {
+        return std::make_tuple(messageField("UUID", &SysHelloMessage::uuid),
+                               messageField("NameHint", &SysHelloMessage::nameHint),
+                               messageField("FrameProto", &SysHelloMessage::frameProto),
+                               messageField("Caps", &SysHelloMessage::caps));
+    }
+};
+
+struct SysSessionAcceptedMessage
+{
+    static constexpr MessageType Type = MessageType::SysSessionAccepted;
+    static constexpr const char *Tag = "SYS_SESSION_ACCEPTED";
+    QString uuid;
+    QString name;
+    quint8 frameProto = 0;
+    quint8 caps = 0;
+    static constexpr auto fields()
+    {
+        return std::make_tuple(messageField("UUID", &SysSessionAcceptedMessage::uuid),
+                               messageField("Name", &SysSessionAcceptedMessage::name),
+                               messageField("FrameProto", &SysSessionAcceptedMessage::frameProto),
+                               messageField("Caps", &SysSessionAcceptedMessage::caps));
+    }
+};
+
+struct SysSessionRejectedMessage
+{
+    static constexpr MessageType Type = MessageType::SysSessionRejected;
+    static constexpr const char *Tag = "SYS_SESSION_REJECTED";
+    QString reason;
+    static constexpr auto fields()
+    {
+        return std::make_tuple(messageField("Reason", &SysSessionRejectedMessage::reason));
+    }
+};
+
+struct FtOfferMessage
+{
+    static constexpr MessageType Type = MessageType::FtOffer;
+    static constexpr const char *Tag = "FT_OFFER";
+    QString transferID;
+    QString fileName;
+    qint64 fileSize = 0;
+    QString senderUuid;
+    qint64 chunkSize = 0; // 发送方计划使用的初始块大小；0 (旧版对端) 表示固定 DEFAULT_CHUNK_SIZE
+    QString fileID;       // 文件标识 (大小 + 修改时间)，接收方保存在续传清单中；旧版对端为空，不能续传
+    qint64 resumeOffset = -1; // 对 FT_RESUME 的答复: 从此偏移继续发送 (0 表示从头开始)；-1 为新的传输
+    QString compression;      // 发送方提议的块压缩编码 (FT_COMPRESSION_ZLIB)；为空 (含旧版对端) 表示不压缩
+    static constexpr auto fields()
+    {
+        return std::make_tuple(messageField("TransferID", &FtOfferMessage::transferID),
+                               messageField("FileName", &FtOfferMessage::fileName),
+                               messageField("FileSize", &FtOfferMessage::fileSize),
+                               messageField("SenderUUID", &FtOfferMessage::senderUuid),
+                               messageField("ChunkSize", &FtOfferMessage::chunkSize),
+                               messageField("FileID", &FtOfferMessage::fileID),
+                               messageField("ResumeOffset", &FtOfferMessage::resumeOffset),
+                               messageField("Compression", &FtOfferMessage::compression));
+    }
+};
+
+struct FtAcceptMessage
+{
+    static constexpr MessageType Type = MessageType::FtAccept;
+    static constexpr const char *Tag = "FT_ACCEPT";
+    QString transferID;
+    QString receiverUuid;
+    QString savePathHint; // 可选
+    // 接收方能接受的最大块大小；非 0 表示接收方按字节跟踪进度，发送方可在传输中途改变块大小。
+    // 0 (旧版对端) 时发送方固定使用 DEFAULT_CHUNK_SIZE
+    qint64 maxChunkSize = 0;
+    // 接收方接受的块压缩编码 (必须是 FT_OFFER 中提议的)；为空表示发送方只能发送未压缩的块
+    QString compression;
+    static constexpr auto fields()
+    {
+        return std::make_tuple(messageField("TransferID", &FtAcceptMessage::transferID),
+                               messageField("ReceiverUUID", &FtAcceptMessage::receiverUuid),
+                               messageField("SavePathHint", &FtAcceptMessage::savePathHint),
+                               messageField("MaxChunkSize", &FtAcceptMessage::maxChunkSize),
+                               messageField("Compression", &FtAcceptMessage::compression));
+    }
+};
+
+struct FtRejectMessage
+{
+    static constexpr MessageType Type = MessageType::FtReject;
+    static constexpr const char *Tag = "FT_REJECT";
+    QString transferID;
+    QString reason;
+    QString receiverUuid;
+    static constexpr auto fields()
+    {
+        return std::make_tuple(messageField("TransferID", &FtRejectMessage::transferID),
+                               messageField("Reason", &FtRejectMessage::reason),
+                               messageField("ReceiverUUID", &FtRejectMessage::receiverUuid));
+    }
+};
+
+// 仅用于旧版对端: 数据为 Base64 文本。支持二进制帧的对端使用 FrameType::FileChunk
+struct FtChunkMessage
+{
+    static constexpr MessageType Type = MessageType::FtChunk;
+    static constexpr const char *Tag = "FT_CHUNK";
+    QString transferID;
+    qint64 chunkID = 0;
+    qint64 size = 0; // 原始二进制数据大小
+    QByteArray data; // 原始数据，文本格式中为 Base64
+    qint64 offset = -1; // 块在文件中的偏移；-1 (旧版对端) 表示未携带
+    qint64 checksum = -1; // 原始数据的 CRC-32C；-1 (旧版对端) 表示未携带
+    static constexpr auto fields()
+    {
+        return std::make_tuple(messageField("TransferID", &FtChunkMessage::transferID),
+                               messageField("ChunkID", &FtChunkMessage::chunkID),
+                               messageField("Size", &FtChunkMessage::size),
+                               messageField("Data", &FtChunkMessage::data),
+                               messageField("Offset", &FtChunkMessage::offset),
+                               messageField("Crc32c", &FtChunkMessage::checksum));
+    }
+};
+
+struct FtDataAckMessage
+{
+    static constexpr MessageType Type = MessageType::FtDataAck;
+    static constexpr const char *Tag = "FT_ACK_DATA";
+    QString transferID;
+    qint64 chunkID = 0; // 已连续收到的最高块号
+    QString receiverUuid;
+    // 选择性确认: 第 i 位 (字节 i / 8 的第 i % 8 位，低位在前) 表示块 chunkID + 1 + i 已收到；
+    // 旧版对端不发送该字段，此时为空
+    QByteArray sackBitmap;
+    // 接收方还能接受的字节数，从块 chunkID 的末尾算起 (块大小可变，因此按字节通告)；0 表示未通告 (旧版对端)
+    qint64 receiveWindowBytes = 0;
+    static constexpr auto fields()
+    {
+        return std::make_tuple(messageField("TransferID", &FtDataAckMessage::transferID),
+                               messageField("ChunkID", &FtDataAckMessage::chunkID),
+                               messageField("ReceiverUUID", &FtDataAckMessage::receiverUuid),
+                               messageField("SackBitmap", &FtDataAckMessage::sackBitmap),
+                               messageField("RecvWindowBytes", &FtDataAckMessage::receiveWindowBytes));
+    }
+};
+
+struct FtEofMessage
+{
+    static constexpr MessageType Type = MessageType::FtEof;
+    static constexpr const char *Tag = "FT_EOF";
+    QString transferID;
+    qint64 totalChunks = 0;
+    QString finalChecksum; // "crc32c:" + 整个文件 CRC-32C 的 8 位十六进制；旧版对端发送 "NOT_IMPLEMENTED"
+    static constexpr auto fields()
+    {
+        return std::make_tuple(messageField("TransferID", &FtEofMessage::transferID),
+                               messageField("TotalChunks", &FtEofMessage::totalChunks),
+                               messageField("FinalChecksum", &FtEofMessage::finalChecksum));
+    }
+};
+
+struct FtEofAckMessage
+{
+    static constexpr MessageType Type = MessageType::FtEofAck;
+    static constexpr const char *Tag = "FT_ACK_EOF";
+    QString transferID;
+    QString receiverUuid;
+    static constexpr auto fields()
+    {
+        return std::make_tuple(messageField("TransferID", &FtEofAckMessage::transferID),
+                               messageField("ReceiverUUID", &FtEofAckMessage::receiverUuid));
+    }
+};
+
+struct FtErrorMessage
+{
+    static constexpr MessageType Type = MessageType::FtError;
+    static constexpr const char *Tag = "FT_ERROR";
+    QString transferID;
+    QString code;
+    QString message;
+    QString originatorUuid;
+    static constexpr auto fields()
+    {
+        return std::make_tuple(messageField("TransferID", &FtErrorMessage::transferID),
+                               messageField("Code", &FtErrorMessage::code),
+                               messageField("Message", &FtErrorMessage::message),
+                               messageField("OriginatorUUID", &FtErrorMessage::originatorUuid));
+    }
+};
+
+// 接收方发现块的 CRC-32C 与数据不符时请求重发该块 (数据在途中损坏，不是拥塞)
+struct FtNackMessage
+{
+    static constexpr MessageType Type = MessageType::FtNack;
+    static constexpr const char *Tag = "FT_NACK";
+    QString transferID;
+    qint64 chunkID = 0;
+    QString receiverUuid;
+    static constexpr auto fields()
+    {
+        return std::make_tuple(messageField("TransferID", &FtNackMessage::transferID),
+                               messageField("ChunkID", &FtNackMessage::chunkID),
+                               messageField("ReceiverUUID", &FtNackMessage::receiverUuid));
+    }
+};
+
+// 中断的传输在重新连接后由接收方发起续传: 报告已写入并校验的前缀及其 CRC-32C。
+// 发送方核对文件未改变 (必要时核对前缀的 CRC) 后以带 ResumeOffset 的 FT_OFFER 答复，之后与新传输相同；
+// 无法续传时答复 FT_ERROR
+struct FtResumeMessage
+{
+    static constexpr MessageType Type = MessageType::FtResume;
+    static constexpr const char *Tag = "FT_RESUME";
+    QString transferID;
+    QString receiverUuid;
+    QString fileID;
+    qint64 offset = 0;
+    qint64 checksum = -1; // [0, offset) 的 CRC-32C
+    static constexpr auto fields()
+    {
+        return std::make_tuple(messageField("TransferID", &FtResumeMessage::transferID),
+                               messageField("ReceiverUUID", &FtResumeMessage::receiverUuid),
+                               messageField("FileID", &FtResumeMessage::fileID),
+                               messageField("Offset", &FtResumeMessage::offset),
+                               messageField("Crc32c", &FtResumeMessage::checksum));
+    }
+};
+
+// ---------------------------------------------------------------------------
+// 编解码
+// 文本格式: <TAG Name="value" .../>  (与旧版 *_FORMAT 字符串逐字节相同)
+// 二进制格式: quint16 MessageType，随后按 fields() 顺序写出各字段 (大端序):
+//   QString -> quint32 UTF-8 字节数 + UTF-8 数据; qint64 -> 8 字节; quint8 -> 1 字节
+//   QByteArray -> quint32 字节数 + 原始数据 (文本格式中为 Base64)
+// ---------------------------------------------------------------------------
+
+// 旧版文本协议的单次遍历分词器: <TAG Name="value" .../>
+// tag()/name()/value() 都是指向原消息的切片，分词过程不分配内存，也不拷贝属性值。
+// 属性值中不允许出现双引号，与旧版正则 ([^"]*) 的约定一致。
+class AttributeTokenizer
+{
+public:
+    explicit AttributeTokenizer(QStringView message);
+
+    QStringView tag() const { return m_tag; }
+    // 前进到下一个属性；遇到结尾的 "/>" 或格式错误时返回 false
+    bool next();
+    QStringView name() const { return m_name; }
+    QStringView value() const { return m_value; }
+    bool hasError() const { return m_state == Error; }
+
+    // 只取出标签名，不解析属性
+    static QStringView tagOf(QStringView message);
+
+private:
+    enum State
+    {
+        InAttributes,
+        Finished,
+        Error
+    };
+
+    QStringView m_message;
+    QStringView m_tag;
+    QStringView m_name;
+    QStringView m_value;
+    qsizetype m_pos;
+    State m_state;
+};
+
+namespace MessageCodec
+{
+    inline void appendTextValue(QString &out, const QString &value) { out += value; }
+    inline void appendTextValue(QString &out, qint64 value) { out += QString::number(value); }
+    inline void appendTextValue(QString &out, quint8 value) { out += QString::number(value); }
+    void appendTextValue(QString &out, const QByteArray &value);
+
+    bool parseTextValue(QStringView text, QString &value);
+    bool parseTextValue(QStringView text, qint64 &value);
+    bool parseTextValue(QStringView text, quint8 &value);
+    // Base64 直接从 UTF-16 切片解码到目标缓冲区，不生成中间字符串
+    bool parseTextValue(QStringView text, QByteArray &value);
+
+    void appendBinaryValue(QByteArray &out, const QString &value);
+    void appendBinaryValue(QByteArray &out, qint64 value);
+    void appendBinaryValue(QByteArray &out, quint8 value);
+    void appendBinaryValue(QByteArray &out, const QByteArray &value);
+
+    bool readBinaryValue(const char *&in, const char *end, QString &value);
+    bool readBinaryValue(const char *&in, const char *end, qint64 &value);
+    bool readBinaryValue(const char *&in, const char *end, quint8 &value);
+    bool readBinaryValue(const char *&in, const char *end, QByteArray &value);
+
+    // 从二进制负载中读取消息类型；负载不足 2 字节时返回 Unknown
+    MessageType binaryType(const QByteArray &payload);
+
+    template <class M>
+    QString encodeText(const M &message)
+    {
+        QString out;
+        out.reserve(96);
+        out += QLatin1Char('<');
+        out += QLatin1String(M::Tag);
+        std::apply([&](const auto &...field) {
+            ((out += QLatin1Char(' '),
+              out += QLatin1String(field.name),
+              out += QLatin1String("=\""),
+              appendTextValue(out, message.*(field.member)),
+              out += QLatin1Char('"')), ...);
+        }, M::fields());
+        out += QLatin1String("/>");
+        return out;
+    }
+
+    // 消费分词器剩余的属性并写入对应字段，整条消息只遍历一次。
+    // 缺失的属性保留默认值 (与旧版 extractAttribute 返回空串的行为一致)，未知属性被忽略，数值格式错误则失败
+    template <class M>
+    bool assignAttributes(AttributeTokenizer &tokenizer, M &message)
+    {
+        bool ok = true;
+        while (tokenizer.next())
+        {
+            std::apply([&](const auto &...field) {
+                (void)((tokenizer.name() == QLatin1String(field.name)
+                            ? (ok = parseTextValue(tokenizer.value(), message.*(field.member)) && ok, true)
+                            : false) || ...);
+            }, M::fields());
+        }
+        return ok && !tokenizer.hasError();
+    }
+
+    template <class M>
+    bool decodeText(QStringView text, M &message)
+    {
+        AttributeTokenizer tokenizer(text);
+        if (tokenizer.tag() != QLatin1String(M::Tag))
+            return false;
+        return assignAttributes(tokenizer, message);
+    }
+
+    template <class M>
+    QByteArray encodeBinary(const M &message)
+    {
+        QByteArray out;
+        out.reserve(64);
+        char type[sizeof(quint16)];
+        qToBigEndian<quint16>(static_cast<quint16>(M::Type), type);
+        out.append(type, sizeof(type));
+        std::apply([&](const auto &...field) {
+            (appendBinaryValue(out, message.*(field.member)), ...);
+        }, M::fields());
+        return out;
+    }
+
+    // 负载在某个字段前结束时其余字段保留默认值 (对端版本较旧)；多出的尾部字节被忽略 (对端版本较新)
+    template <class M>
+    bool decodeBinary(const QByteArray &payload, M &message)
+    {
+        if (binaryType(payload) != M::Type)
+            return false;
+        const char *in = payload.constData() + sizeof(quint16);
+        const char *end = payload.constData() + payload.size();
+        bool ok = true;
+        std::apply([&](const auto &...field) {
+            auto read = [&](const auto &f) {
+                if (ok && in < end)
+                    ok = readBinaryValue(in, end, message.*(f.member));
+            };
+            (read(field), ...);
+        }, M::fields());
+        return ok;
+    }
+}
+
+// 控制消息分发表，以 MessageType 为下标。
+// 各子系统在构造时注册自己负责的消息类型，NetworkManager 收到控制消息后直接查表调用。
+class MessageDispatcher
+{
+public:
+    MessageDispatcher() = default;
+
+    // 注册消息处理函数，context 被销毁后不再调用 (与 QObject::connect 的 context 参数语义相同)。
+    // 消息在调用 dispatch 的线程 (网络线程) 中解码；context 属于其他线程时，处理函数以队列方式在 context 的线程中执行。
+    // 处理函数中不可再注册或注销处理函数。
+    template <class M, class Handler>
+    void registerHandler(QObject *context, Handler handler)
+    {
+        QPointer<QObject> guard(context);
+        auto deliver = [guard, handler](const QString &peerUuid, M &message) {
+            // guard 在 fromText/fromBinary 检查之后仍可能被其他线程销毁
+            QObject *target = guard.data();
+            if (!target)
+                return;
+            if (target->thread() == QThread::currentThread())
+            {
+                handler(peerUuid, message);
+                return;
+            }
+            QMetaObject::invokeMethod(target, [guard, handler, peerUuid, message = std::move(message)]() {
+                if (guard)
+                    handler(peerUuid, message);
+            }, Qt::QueuedConnection);
+        };
+
+        QWriteLocker locker(&m_lock);
+        Entry &entry = m_entries[static_cast<int>(M::Type)];
+        entry.tag = QLatin1String(M::Tag);
+        entry.fromText = [guard, deliver](const QString &peerUuid, AttributeTokenizer &tokenizer) {
+            if (!guard)
+                return true;
+            M message;
+            if (!MessageCodec::assignAttributes(tokenizer, message))
+                return false;
+            deliver(peerUuid, message);
+            return true;
+        };
+        entry.fromBinary = [guard, deliver](const QString &peerUuid, const QByteArray &payload) {
+            if (!guard)
+                return true;
+            M message;
+            if (!MessageCodec::decodeBinary(payload, message))
+                return false;
+            deliver(peerUuid, message);
+            return true;
+        };
+        registerTag(entry.tag, M::Type);
+    }
+
+    void unregisterHandler(MessageType type);
+
+    // 文本消息: 若其标签已注册则分发并返回 true；否则返回 false (例如普通聊天内容)
+    bool dispatchText(const QString &peerUuid, const QString &message) const;
+    // 二进制消息 (FrameType::TypedMessage 负载)：类型未注册时返回 false
+    bool dispatchBinary(const QString &peerUuid, const QByteArray &payload) const;
+
+private:
+    struct Entry
+    {
+        QLatin1String tag{nullptr};
+        std::function<bool(const QString &, AttributeTokenizer &)> fromText;
+        std::function<bool(const QString &, const QByteArray &)> fromBinary;
+    };
+
+    void registerTag(QLatin1String tag, MessageType type);
+
+    std::array<Entry, static_cast<int>(MessageType::Count)> m_entries;
+    // 以标签的哈希值为键，查找时对 QStringView 直接求哈希，无需构造 QString
+    QHash<size_t, MessageType> m_tagHashToType;
+    // 注册可能发生在 UI 线程，分发发生在网络线程
+    mutable QReadWriteLock m_lock;
+};
+
+#endif // MESSAGECODEC_H
@@ -5,6 +5,7 @@
 #include <QAbstractSocket> // For SocketError
 #include <QStringList>     // Include for QStringList
 #include <QMap>            // Include for QMap
+#include "networkmanager.h" // ReceivedMessage
 
 QT_BEGIN_NAMESPACE
 class NetworkManager;
@@ -41,6 +42,8 @@ public slots:
     void handlePeerConnected(const QString &peerUuid, const QString &peerName, const QString& peerAddress, quint16 peerPort);
     void handlePeerDisconnected(const QString &peerUuid);
     void handleNewMessageReceived(const QString &peerUuid, const QString &message);
+    // NetworkManager 每轮事件循环投递一批消息
+    void handleMessagesReceived(const QList<ReceivedMessage> &messages);
     void handlePeerNetworkError(const QString &peerUuid, QAbstractSocket::SocketError socketError, const QString& errorString);
 
 private:
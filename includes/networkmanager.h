@@ -10,11 +10,15 @@
 #include <QNetworkInterface> // Required for getting local IP addresses
 #include <QTimer> // QTimer for retryListenTimer
 #include <QUdpSocket> // 用于UDP发现
-
-// Define system message constants and formats
-const QString SYS_MSG_HELLO_FORMAT = QStringLiteral("<SYS_HELLO UUID=\"%1\" NameHint=\"%2\"/>");
-const QString SYS_MSG_SESSION_ACCEPTED_FORMAT = QStringLiteral("<SYS_SESSION_ACCEPTED UUID=\"%1\" Name=\"%2\"/>");
-const QString SYS_MSG_SESSION_REJECTED_FORMAT = QStringLiteral("<SYS_SESSION_REJECTED Reason=\"%1\"/>"); // New
+#include <QQueue>
+#include <QSet>
+#include <QMutex>
+#include <QThread>
+#include <QSharedPointer>
+#include <QPointer>
+#include <QSocketNotifier>
+#include "frameprotocol.h" // 二进制帧协议
+#include "messagecodec.h"  // SYS_/FT_ 控制消息定义与分发表
 
 // UDP发现相关常量
 const int DEFAULT_UDP_BROADCAST_INTERVAL_SECONDS = 5; // 默认5秒广播一次
@@ -24,18 +28,103 @@ const QString UDP_RESPONSE_TO_NEED_PREFIX = "CHAT_RESP_NEED_V1"; // For REQNEED
 const QString UDP_REPLY_TO_PORT_FIELD_KEY = "ReplyToUDPPort"; // New: Key for reply port in NEED message
 const int UDP_TEMP_RESPONSE_LISTENER_TIMEOUT_MS = 15000; // New: Timeout for temporary listener (15s)
 
-// File Transfer Message Formats
-const QString FT_MSG_OFFER_FORMAT = QStringLiteral("<FT_OFFER TransferID=\"%1\" FileName=\"%2\" FileSize=\"%3\" SenderUUID=\"%4\"/>");
-const QString FT_MSG_ACCEPT_FORMAT = QStringLiteral("<FT_ACCEPT TransferID=\"%1\" ReceiverUUID=\"%2\" SavePathHint=\"%3\"/>"); // Added SavePathHint (optional)
-const QString FT_MSG_REJECT_FORMAT = QStringLiteral("<FT_REJECT TransferID=\"%1\" Reason=\"%2\" ReceiverUUID=\"%3\"/>");
-const QString FT_MSG_CHUNK_FORMAT = QStringLiteral("<FT_CHUNK TransferID=\"%1\" ChunkID=\"%2\" Size=\"%3\" Data=\"%4\"/>"); // Data will be Base64 encoded
-const QString FT_MSG_DATA_ACK_FORMAT = QStringLiteral("<FT_ACK_DATA TransferID=\"%1\" ChunkID=\"%2\" ReceiverUUID=\"%3\"/>"); // ChunkID is highest contiguous received
-const QString FT_MSG_EOF_FORMAT = QStringLiteral("<FT_EOF TransferID=\"%1\" TotalChunks=\"%2\" FinalChecksum=\"%3\"/>"); // Optional: FinalChecksum
-const QString FT_MSG_EOF_ACK_FORMAT = QStringLiteral("<FT_ACK_EOF TransferID=\"%1\" ReceiverUUID=\"%2\"/>");
-const QString FT_MSG_ERROR_FORMAT = QStringLiteral("<FT_ERROR TransferID=\"%1\" Code=\"%2\" Message=\"%3\" OriginatorUUID=\"%4\"/>");
+const qint64 DEFAULT_CHUNK_SIZE = 4096 * 1024; // 4 MiB；旧版对端固定使用此块大小，新版按传输协商 (见 FileTransferManager)
+
+// 每个对端的发送背压 (按 NetworkManager 发送队列 + QTcpSocket 写缓冲区中的待发送字节计算)
+const qint64 PEER_SEND_HIGH_WATERMARK = 24 * 1024 * 1024; // 超过后对端变为不可写，文件传输暂停读取新块
+const qint64 PEER_SEND_LOW_WATERMARK = 8 * 1024 * 1024;   // 回落到此值以下时发出 peerWritable
+const qint64 PEER_SOCKET_BUFFER_TARGET = 256 * 1024;      // QTcpSocket 写缓冲区中最多保留的字节数，其余留在发送队列中以便控制消息插队
+
+// 已建立连接的套接字选项。控制与批量通道复用同一 TCP 连接，因此选项按链路设置:
+// 写出已在事件循环内合并，关闭 Nagle 避免控制消息额外等待
+const int PEER_SOCKET_RECEIVE_BUFFER_SIZE = 8 * 1024 * 1024;
+const int PEER_SOCKET_SEND_BUFFER_SIZE = 4 * 1024 * 1024;
+
+class TransferFile; // 零拷贝发送时由发送队列持有的文件句柄 (见 fileiomanager.h)
+
+// 发送通道: 控制通道 (聊天、SYS_/FT_ 控制消息) 总是先于批量通道 (文件数据) 发出
+enum class OutboundChannel
+{
+    Control,
+    Bulk
+};
+
+// 发送队列中的一条逻辑消息
+struct OutboundMessage
+{
+    bool framed = true;                   // false 表示旧版链路的 QDataStream 数据块，原样写出
+    FrameType type = FrameType::TextMessage;
+    QByteArray head;                      // 负载前段 (如文件块子头)
+    QByteArray body;                      // 负载后段 (如文件数据，隐式共享，不拷贝)
+    // 零拷贝文件数据: file 非空时负载末段为文件的 [fileOffset, fileOffset + fileLength)，写出时才从文件发送
+    QSharedPointer<TransferFile> file;
+    qint64 fileOffset = 0;
+    qint64 fileLength = 0;
+    qsizetype written = 0;                // 已作为分片写出的负载字节数
+    quint16 flags = FrameFlagNone;        // 附加在帧头 (分片时为每个分片) 上的 FrameFlag，如 FrameFlagCompressed
+    // 零拷贝分片写到一半 (内核发送缓冲区已满) 时的进度，套接字可写后从这里继续，其间不能插入其他帧
+    QByteArray pendingPrefix;             // 尚未写出的帧头与子头字节
+    qsizetype fragmentEnd = 0;            // 当前分片在负载中的结束位置
+
+    qsizetype payloadSize() const { return head.size() + body.size() + fileLength; }
+    bool fragmentPending() const { return !pendingPrefix.isEmpty() || written < fragmentEnd; }
+    qint64 wireSize() const { return payloadSize() + (framed ? FRAME_HEADER_SIZE : 0); }
+};
+
+// 写合并统计: 每次套接字写出 (bytesWritten) 携带了多少条消息/分片
+struct PeerWriteStats
+{
+    quint64 socketWrites = 0;
+    quint64 messages = 0;
+    quint32 maxMessagesPerWrite = 0;
+    quint32 messagesSinceLastWrite = 0; // 已交给套接字、尚未确认写出的消息数
+    quint64 zeroCopyBytes = 0;          // 经 sendfile 直接从文件写入套接字的字节数
+
+    double averageMessagesPerWrite() const { return socketWrites ? double(messages) / double(socketWrites) : 0.0; }
+};
+
+// 已建立连接的链路状态
+struct PeerLink
+{
+    quint8 frameProtocolVersion = 0; // 0 表示旧版 QDataStream<<QString 分帧
+    quint8 capabilities = 0;         // 握手协商出的 PeerCapability 位
+    FrameDecoder decoder;
+
+    // 发送队列: 已编码、尚未交给套接字的消息
+    QQueue<OutboundMessage> controlQueue;
+    QQueue<OutboundMessage> bulkQueue;
+    qint64 queuedBytes = 0;
+    bool writable = true;
+    PeerWriteStats writeStats;
+    // 零拷贝写出遇到 EAGAIN 时等待套接字可写 (属于套接字，按需创建)
+    QPointer<QSocketNotifier> fileWriteNotifier;
+
+    ~PeerLink() { delete fileWriteNotifier.data(); }
+};
 
-const qint64 DEFAULT_CHUNK_SIZE = 4096 * 1024; // 2048KB chunks
+// 供其他线程读取的对端状态快照 (在网络线程中更新，由 snapshotMutex 保护)
+struct PeerSnapshot
+{
+    QString name;
+    QString address;
+    quint16 port = 0;
+    quint8 frameProtocolVersion = 0;
+    quint8 capabilities = 0;
+    bool writable = true;
+    qint64 pendingBytes = 0;
+    PeerWriteStats writeStats;
+};
 
+// 按批次交给 UI 线程的文本消息
+struct ReceivedMessage
+{
+    QString peerUuid;
+    QString message;
+};
+
+// NetworkManager 及其所有套接字运行在专用网络线程中 (见 MainWindow)。
+// 公共修改接口可从任意线程调用，调用会以队列方式转到网络线程执行；
+// 查询接口从线程安全的快照中读取，不访问套接字。
 class NetworkManager : public QObject
 {
     Q_OBJECT
@@ -63,7 +152,46 @@ public:
     void disconnectFromPeer(const QString &peerUuid);
 
     // 发送消息给特定对等方
-    void sendMessage(const QString &targetPeerUuid, const QString &message);
+    void sendMessage(const QString &targetPeerUuid, const QString &message, OutboundChannel channel = OutboundChannel::Control);
+    // 以二进制 FileChunk 帧发送文件块 (原始字节，无 Base64)；对端不支持二进制帧时返回 false。
+    // fileOffset 为块在文件中的偏移、checksum 为块数据的 CRC-32C，仅在链路协商了对应能力 (PeerCapabilityChunkOffsets /
+    // PeerCapabilityChunkChecksums) 时随帧发出。compressed 表示 data 是压缩后的数据 (帧带有 FrameFlagCompressed)，
+    // checksum 仍为原始数据的 CRC
+    bool sendFileChunk(const QString &targetPeerUuid, const QString &transferID, qint64 chunkID, qint64 fileOffset, qint64 checksum, const QByteArray &data,
+                       bool compressed = false);
+    // 零拷贝发送文件块: 数据在写出时由内核直接从 file 的 [offset, offset + length) 发往套接字，
+    // 不经过用户态缓冲区，因此不带 CRC-32C (链路协商了 PeerCapabilityChunkChecksums 时调用方应读取后用 sendFileChunk 发送)。
+    // 链路未协商 PeerCapabilityZeroCopyFileData 时返回 false，调用方应改用 sendFileChunk
+    bool sendFileChunkFromFile(const QString &targetPeerUuid, const QString &transferID, qint64 chunkID,
+                               const QSharedPointer<TransferFile> &file, qint64 offset, qint64 length);
+    // 与对端的链路是否启用了零拷贝文件数据
+    bool isPeerZeroCopyEnabled(const QString &peerUuid) const;
+    // 与对端的链路是否在文件块中携带 CRC-32C (此时文件块不走零拷贝)
+    bool isPeerChunkChecksumEnabled(const QString &peerUuid) const;
+    // 与对端的连接是否已协商为二进制帧
+    bool isPeerUsingBinaryFrames(const QString &peerUuid) const;
+    // 对端待发送字节数 (发送队列 + 套接字写缓冲区) 是否低于高水位
+    bool isPeerWritable(const QString &peerUuid) const;
+    qint64 getPeerPendingBytes(const QString &peerUuid) const;
+    // 对端链路的写合并统计 (未连接时返回空统计)
+    PeerWriteStats getPeerWriteStats(const QString &peerUuid) const;
+    // 与对端协商的帧协议版本 (0 表示旧版分帧或未连接)
+    quint8 getPeerFrameProtocolVersion(const QString &peerUuid) const;
+
+    // 发送 SYS_/FT_ 控制消息: 对端支持时以二进制 TypedMessage 帧发送，否则以文本格式发送
+    template <class M>
+    void sendControlMessage(const QString &targetPeerUuid, const M &message)
+    {
+        // 文本回退路径的 FT_CHUNK 携带文件数据，走批量通道
+        constexpr OutboundChannel channel = M::Type == MessageType::FtChunk ? OutboundChannel::Bulk : OutboundChannel::Control;
+        if (getPeerFrameProtocolVersion(targetPeerUuid) >= FRAME_PROTOCOL_TYPED_MESSAGES)
+            sendTypedMessageFrame(targetPeerUuid, MessageCodec::encodeBinary(message), channel);
+        else
+            sendMessage(targetPeerUuid, MessageCodec::encodeText(message), channel);
+    }
+
+    // 控制消息分发表，各子系统在此注册自己负责的消息类型
+    MessageDispatcher *getMessageDispatcher();
 
     // 获取特定对等方的socket状态
     QAbstractSocket::SocketState getPeerSocketState(const QString& peerUuid) const;
@@ -82,6 +210,10 @@ public:
     void startUdpDiscovery();
     void stopUdpDiscovery();
 
+    // 设置单条消息/单帧允许的最大字节数 (同时作用于旧版分帧和二进制帧)
+    void setMaxFrameSize(quint32 bytes);
+    quint32 getMaxFrameSize() const;
+
 signals:
     // 对等方连接成功信号 (包含UUID, 名称, 地址, 端口)
     void peerConnected(const QString &peerUuid, const QString &peerName, const QString& peerAddress, quint16 peerPort);
@@ -89,8 +221,20 @@ signals:
     // 对等方断开连接信号
     void peerDisconnected(const QString &peerUuid);
     
-    // 收到来自特定对等方的新消息信号
-    void newMessageReceived(const QString &peerUuid, const QString &message);
+    // 收到来自对等方的新消息 (同一轮事件循环中收到的消息合并为一批发出)
+    void messagesReceived(const QList<ReceivedMessage> &messages);
+
+    // 对端待发送字节数从高水位以上回落到低水位以下
+    void peerWritable(const QString &peerUuid);
+
+    // 零拷贝发送的文件块未能完整从文件读出 (文件在传输期间被截短或读取出错)，已以零填充
+    void fileChunkSendFailed(const QString &peerUuid, const QString &transferID, qint64 chunkID, const QString &errorString);
+
+    // 收到二进制文件块 (payload 为整个帧负载，文件数据从 dataOffset 开始，避免拷贝)；
+    // fileOffset 为块在文件中的偏移、checksum 为发送方计算的 CRC-32C，链路未协商对应能力时为 -1；
+    // compressed 表示数据是压缩后的 (checksum 针对解压后的数据)
+    void fileChunkReceived(const QString &peerUuid, const QString &transferID, qint64 chunkID, qint64 fileOffset, qint64 checksum,
+                           const QByteArray &payload, qsizetype dataOffset, bool compressed);
     
     // 特定对等方的网络错误信号
     void peerNetworkError(const QString &peerUuid, QAbstractSocket::SocketError socketError, const QString& errorString);
@@ -122,6 +266,12 @@ private slots:
     void handleClientSocketReadyRead();
     // 处理已建立连接的客户端socket错误
     void handleClientSocketError(QAbstractSocket::SocketError socketError);
+    // 套接字写出数据后继续从发送队列补充，并检查是否回落到低水位
+    void handleClientSocketBytesWritten(qint64 bytes);
+    // 每轮事件循环执行一次，把本轮排队的消息一起交给套接字
+    void flushPendingWrites();
+    // 每轮事件循环执行一次，把本轮收到的文本消息一次性交给 UI
+    void flushReceivedMessages();
 
     // 处理等待HELLO消息的传入socket可读数据
     void handlePendingIncomingSocketReadyRead();
@@ -159,11 +309,17 @@ private:
     QMap<QString, QTcpSocket*> connectedSockets; // Key: Peer UUID
     QMap<QTcpSocket*, QString> socketToUuidMap;  // Helper: Socket -> Peer UUID
     QMap<QString, QString> peerUuidToNameMap; // Helper: Peer UUID -> Peer Name (as known locally)
+    QMap<QTcpSocket*, PeerLink*> socketLinks;  // Socket -> 链路状态 (帧协议版本、解码器)
+    MessageDispatcher messageDispatcher;       // 已注册的控制消息不再经过 messagesReceived
+    QSet<QTcpSocket*> socketsPendingFlush;     // 本轮事件循环中有新消息排队的套接字
 
     // 管理正在建立的连接
     QList<QTcpSocket*> pendingIncomingSockets; // Sockets from onNewConnection, waiting for HELLO
     // Key: Socket, Value: Pair of (TentativePeerName, TargetPeerUUIDHint)
     QMap<QTcpSocket*, QPair<QString, QString>> outgoingSocketsAwaitingSessionAccepted; 
+    // HELLO 中对端声明的帧协议版本，在接受会话时用于协商
+    QMap<QTcpSocket*, quint8> pendingIncomingFrameVersions;
+    QMap<QTcpSocket*, quint8> pendingIncomingCapabilities; // HELLO 中对端声明的能力位
 
     quint16 defaultPort;        // 默认端口 (保留，但首选端口更重要)
     QString lastError;          // 最后发生的通用服务器错误字符串
@@ -184,12 +340,62 @@ private:
     QTimer *retryListenTimer;
     QTimer *udpBroadcastTimer;
     int retryListenIntervalMs;
+    quint32 maxFrameSize;
+    bool flushScheduled;
+    QList<ReceivedMessage> pendingReceivedMessages;
+    bool deliveryScheduled;
+
+    // 跨线程查询使用的快照
+    mutable QMutex snapshotMutex;
+    QHash<QString, PeerSnapshot> peerSnapshots; // Key: Peer UUID
+
+    enum LegacyReadStatus
+    {
+        LegacyNeedMoreData,
+        LegacyMessageReady,
+        LegacyMessageTooLarge
+    };
+
+    enum FileFrameWriteStatus
+    {
+        FileFrameWritten,     // 分片已完整交给内核或 QTcpSocket
+        FileFrameWouldBlock,  // 内核发送缓冲区已满，进度保存在消息中，套接字可写后继续
+        FileFrameWriteFailed
+    };
 
     void setupServer();
+    bool isInNetworkThread() const { return QThread::currentThread() == thread(); }
+    void setLastError(const QString& error);
+    // 将链路的发送状态 (可写、待发送字节、写合并统计) 写入快照
+    void publishLinkState(QTcpSocket* socket, const PeerLink* link);
     void cleanupSocket(QTcpSocket* socket, bool removeFromConnectedSockets = true);
-    void sendSystemMessage(QTcpSocket* socket, const QString& sysMessage);
+    void sendSystemMessage(QTcpSocket* socket, const QString& sysMessage, OutboundChannel channel = OutboundChannel::Control);
+    void sendTypedMessageFrame(const QString& targetPeerUuid, const QByteArray& payload, OutboundChannel channel = OutboundChannel::Control);
+    // 将已编码的消息放入对端对应通道的发送队列并尝试写出
+    void enqueueOutbound(QTcpSocket* socket, PeerLink* link, OutboundChannel channel, OutboundMessage message);
+    // 按通道优先级向套接字交付数据: 先清空控制通道，再写出一个批量分片
+    void pumpOutboundQueue(QTcpSocket* socket, PeerLink* link);
+    // 写出消息负载中 [offset, offset + length) 的部分 (跨越 head 与 body)
+    bool writeOutboundPayload(QTcpSocket* socket, const OutboundMessage& message, qsizetype offset, qsizetype length);
+    // 写出零拷贝消息的当前帧/分片 (message.pendingPrefix 与 [written, fragmentEnd))：帧头与子头直接写入内核，文件数据用 sendfile 发送；
+    // 内核发送缓冲区已满时保留进度并返回 FileFrameWouldBlock，不改走拷贝路径。调用前 QTcpSocket 写缓冲区必须为空
+    FileFrameWriteStatus writeFileBackedFrame(QTcpSocket* socket, PeerLink* link, OutboundMessage& message);
+    // 零拷贝写出被阻塞后，在套接字可写时继续发送队列
+    void waitForFileWritable(QTcpSocket* socket, PeerLink* link);
+    qint64 pendingOutboundBytes(QTcpSocket* socket, const PeerLink* link) const;
+    // 待发送字节数回落到低水位以下时恢复可写并发出 peerWritable，同时更新快照
+    void updatePeerWritable(QTcpSocket* socket, PeerLink* link);
+    // 已建立连接上收到的文本消息: 控制消息交给分发表，其余作为聊天消息发出
+    void deliverTextMessage(const QString& peerUuid, const QString& message);
+    // 读取一条旧版 QDataStream<<QString 消息，先检查声明的长度再分配
+    LegacyReadStatus readLegacyMessage(QTcpSocket* socket, QString& message) const;
+    // 处理已建立连接上的数据 (旧版分帧或二进制帧)
+    void processEstablishedSocketData(QTcpSocket* socket);
+    void processFramedSocketData(QTcpSocket* socket, const QString& peerUuid, PeerLink* link);
+    // 因协议错误关闭已建立的连接
+    void dropEstablishedConnection(QTcpSocket* socket, const QString& reason);
     // 将socket添加到connectedSockets和相关映射中
-    void addEstablishedConnection(QTcpSocket* socket, const QString& peerUuid, const QString& peerName, const QString& peerAddress, quint16 peerPort);
+    void addEstablishedConnection(QTcpSocket* socket, const QString& peerUuid, const QString& peerName, const QString& peerAddress, quint16 peerPort, quint8 frameProtocolVersion, quint8 capabilities);
     // 从pendingIncomingSockets中移除socket并断开其临时信号槽
     void removePendingIncomingSocket(QTcpSocket* socket);
     // 从outgoingSocketsAwaitingSessionAccepted中移除socket并断开其临时信号槽
@@ -3,6 +3,7 @@
 
 #include <QDialog>
 #include <QString> 
+#include "transferratelimiter.h"
 
 QT_BEGIN_NAMESPACE
 class QLineEdit;
@@ -11,6 +12,7 @@ class QLabel;
 class QSpinBox;
 class QCheckBox;
 class QTabWidget;
+class QTimeEdit;
 class QFileDialog; // 新增
 QT_END_NAMESPACE
 
@@ -32,6 +34,7 @@ public:
                             // 新增参数
                             const QString &currentDefaultDownloadDir = QString(),
                             bool currentRequireFileAccept = true,
+                            const TransferRateLimits &currentRateLimits = TransferRateLimits(),
                             QWidget *parent = nullptr);
     ~SettingsDialog();
 
@@ -48,6 +51,7 @@ public:
     // 新增getter
     QString getDefaultDownloadDir() const;
     bool isRequireFileAccept() const;
+    TransferRateLimits getRateLimits() const;
 
     void updateFields(const QString &userName, const QString &uuid,
                       quint16 listenPort, bool enableListening,
@@ -56,7 +60,8 @@ public:
                       bool enableContinuousUdpBroadcast, int udpBroadcastInterval,
                       // 新增参数
                       const QString &defaultDownloadDir,
-                      bool requireFileAccept);
+                      bool requireFileAccept,
+                      const TransferRateLimits &rateLimits);
 
 signals:
     void settingsApplied(const QString &userName,
@@ -67,7 +72,8 @@ signals:
                          bool enableContinuousUdpBroadcast, int udpBroadcastInterval,
                          // 新增参数
                          const QString &defaultDownloadDir,
-                         bool requireFileAccept);
+                         bool requireFileAccept,
+                         const TransferRateLimits &rateLimits);
     void retryListenNowRequested();
     void manualUdpBroadcastRequested();
 
@@ -80,6 +86,7 @@ private slots:
     void onManualBroadcastClicked();
     void onUdpContinuousBroadcastChanged(bool checked);
     void onSelectDownloadDirClicked(); // 新增槽
+    void onRateLimitScheduleChanged(bool checked);
 
 private:
     void setupUI();
@@ -107,6 +114,12 @@ private:
     QLineEdit *downloadDirEdit;
     QPushButton *selectDownloadDirButton;
     QCheckBox *requireFileAcceptCheckBox;
+    // 文件发送限速 (KB/s，0 表示不限速)
+    QSpinBox *globalRateLimitSpinBox;
+    QSpinBox *perPeerRateLimitSpinBox;
+    QCheckBox *rateLimitScheduleCheckBox;
+    QTimeEdit *rateLimitStartEdit;
+    QTimeEdit *rateLimitEndEdit;
 
     QPushButton *saveButton;
     QPushButton *cancelButton;
@@ -125,6 +138,9 @@ private:
     // 新增初始值
     QString initialDefaultDownloadDir;
     bool initialRequireFileAccept;
+    TransferRateLimits initialRateLimits;
+
+    void setRateLimitFields(const TransferRateLimits &rateLimits);
 };
 
 #endif // SETTINGSDIALOG_H
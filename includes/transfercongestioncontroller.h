@@ -0,0 +1,81 @@
+#ifndef TRANSFERCONGESTIONCONTROLLER_H
+#define TRANSFERCONGESTIONCONTROLLER_H
+
+#include <QtGlobal>
+#include <QMap>
+
+// 文件块发送窗口控制 (参照 BBR 的思路，按字节计算):
+//   - 瓶颈带宽 btlBw: 最近若干轮交付速率样本的最大值
+//   - minRtt: 最近一段时间内 RTT 样本的最小值
+//   - 在途数据上限 cwnd ≈ gain * btlBw * minRtt
+// 没有逐包 pacing (底层是 TCP)，因此只用 cwnd 增益来探测带宽: Startup 阶段每轮加倍直到带宽不再增长，
+// Drain 阶段让在途数据回落到 BDP，之后在 ProbeBW 阶段按 1.25 / 0.75 / 1 ... 的增益循环。
+// 非线程安全，由 FileTransferManager 在传输线程中使用。
+class TransferCongestionController
+{
+public:
+    enum Phase { Startup, Drain, ProbeBandwidth };
+
+    explicit TransferCongestionController(qint64 chunkSize = 0);
+
+    void reset(qint64 chunkSize);
+    // 块大小在传输中途改变: 只影响窗口下限，带宽与 RTT 估计保留
+    void setChunkSize(qint64 chunkSize);
+
+    // 一次 ACK 的处理结果
+    struct AckSample
+    {
+        qint64 ackedBytes = 0;          // 本次新确认 (累计或选择性) 的字节数
+        bool hasRateSample = false;     // 以下两项来自本次确认的块中最晚发出的一个
+        qint64 deliveredAtSend = 0;     // 该块发出时的 deliveredBytes()
+        qint64 deliveredTimeAtSend = 0; // 该块发出时的 deliveredTimeMs()
+        bool appLimited = false;        // 该块发出时发送方没有用满窗口
+        qint64 rttMs = -1;              // RTT 样本，< 0 表示没有
+        qint64 inflightBytes = 0;       // 处理本次 ACK 后仍在途的字节数
+    };
+
+    void onAck(qint64 nowMs, const AckSample &sample);
+    // 重传超时: 在途上限降到最小值，带宽估计保留，之后按确认量重新增长
+    void onRetransmissionTimeout();
+
+    qint64 congestionWindowBytes() const { return m_cwndBytes; }
+    qint64 deliveredBytes() const { return m_delivered; }
+    qint64 deliveredTimeMs() const { return m_deliveredTimeMs; }
+    double bottleneckBandwidth() const { return m_btlBw; } // 字节/毫秒
+    qint64 minRttMs() const { return m_minRttMs; }
+    // 当前估计的带宽时延积 (字节)；还没有估计时按初始窗口计算
+    qint64 estimatedBdpBytes() const { return bdpBytes(1.0); }
+    Phase phase() const { return m_phase; }
+
+private:
+    qint64 bdpBytes(double gain) const;
+    void updateBandwidth(double rate, bool appLimited);
+    void updateMinRtt(qint64 nowMs, qint64 rttMs);
+    void checkFullPipe();
+    void advanceCycle(qint64 inflightBytes);
+    void setCongestionWindow(qint64 ackedBytes);
+
+    qint64 m_chunkSize;
+    Phase m_phase;
+
+    // 交付计数与轮次: 当发出时累计交付量 >= m_nextRoundDelivered 的块被确认时，一轮结束
+    qint64 m_delivered;
+    qint64 m_deliveredTimeMs;
+    qint64 m_roundCount;
+    qint64 m_nextRoundDelivered;
+    bool m_roundStart;
+
+    QMap<qint64, double> m_bandwidthSamples; // 轮次 -> 该轮最大交付速率
+    double m_btlBw;
+    qint64 m_minRttMs;
+    qint64 m_minRttStampMs;
+
+    double m_fullBw;
+    int m_fullBwRounds;
+    bool m_filledPipe;
+
+    int m_cycleIndex;
+    qint64 m_cwndBytes;
+};
+
+#endif // TRANSFERCONGESTIONCONTROLLER_H
@@ -0,0 +1,71 @@
+#ifndef TRANSFERRATELIMITER_H
+#define TRANSFERRATELIMITER_H
+
+#include <QtGlobal>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QString>
+#include <QTime>
+
+// 令牌桶最多积累这么长时间的额度: 空闲之后允许的突发量
+const qint64 FT_RATE_LIMIT_BURST_MS = 250;
+// 单次等待的上限: 欠额很大 (大块、低速率) 时也至少这么久检查一次，限速时段结束后及时恢复全速
+const qint64 FT_RATE_LIMIT_MAX_WAIT_MS = 1000;
+
+// 文件传输限速设置 (由设置对话框编辑，保存在用户设置中)
+struct TransferRateLimits
+{
+    qint64 globalBytesPerSecond = 0;  // 所有文件发送合计，0 表示不限速
+    qint64 perPeerBytesPerSecond = 0; // 发往每个对端，0 表示不限速
+    // 启用时限速只在 [scheduleStart, scheduleEnd) 时段内生效 (结束时间早于开始时间表示跨过午夜)，其余时间不限速
+    bool scheduleEnabled = false;
+    QTime scheduleStart = QTime(9, 0);
+    QTime scheduleEnd = QTime(18, 0);
+
+    bool operator==(const TransferRateLimits &other) const
+    {
+        return globalBytesPerSecond == other.globalBytesPerSecond && perPeerBytesPerSecond == other.perPeerBytesPerSecond &&
+               scheduleEnabled == other.scheduleEnabled && scheduleStart == other.scheduleStart && scheduleEnd == other.scheduleEnd;
+    }
+    bool operator!=(const TransferRateLimits &other) const { return !(*this == other); }
+};
+
+// 文件数据的发送限速: 一个全局令牌桶加每个对端一个令牌桶，发出一块需要两个桶都有额度。
+// 块可以比桶容量大: 桶中额度为正即可发出，扣除后的欠额按速率补足之前不再发送，长期速率仍等于设定值。
+// 只用于文件块 (含重传和零拷贝发送)，聊天消息和控制消息不经过这里。非线程安全，由 FileTransferManager 在传输线程中使用
+class TransferRateLimiter
+{
+public:
+    TransferRateLimiter();
+
+    // 立即生效；已有的欠额保留，积累的额度不超过新的桶容量
+    void setLimits(const TransferRateLimits &limits);
+    const TransferRateLimits &limits() const { return m_limits; }
+    // 当前是否有限速生效 (已设置速率且处在时段内)
+    bool isActive() const;
+
+    // 向 peerUuid 发出下一块之前需要等待的毫秒数，0 表示可以立即发出；
+    // globalLimited 报告等待是否由全局桶造成 (此时所有对端都要等待)
+    qint64 delayMs(const QString &peerUuid, bool *globalLimited = nullptr);
+    // 已向 peerUuid 发出 bytes 字节
+    void consume(const QString &peerUuid, qint64 bytes);
+    // 退回预先扣除但没有发出的字节 (例如块压缩后变小)
+    void refund(const QString &peerUuid, qint64 bytes);
+    void forgetPeer(const QString &peerUuid);
+
+private:
+    struct Bucket
+    {
+        double tokens = 0;
+        qint64 refilledAtMs = -1;
+    };
+    void refill(Bucket &bucket, qint64 bytesPerSecond, qint64 nowMs) const;
+    static qint64 waitMs(const Bucket &bucket, qint64 bytesPerSecond);
+
+    TransferRateLimits m_limits;
+    QElapsedTimer m_clock;
+    Bucket m_global;
+    QHash<QString, Bucket> m_peers;
+};
+
+#endif // TRANSFERRATELIMITER_H
@@ -0,0 +1,54 @@
+#ifndef TRANSFERRESUMESTORE_H
+#define TRANSFERRESUMESTORE_H
+
+#include <QString>
+#include <QList>
+
+// 接收端的续传清单: 传输中断 (断线或程序退出) 后，重新连上发送方时据此请求只发送缺少的部分。
+// 接收端只按文件顺序写入，已写入并校验的数据总是文件开头连续的一段 [0, verifiedBytes)，
+// 因此块位图退化为这段前缀的长度和 CRC-32C
+struct ReceiveResumeManifest {
+    QString transferID;
+    QString peerUuid;
+    QString fileName;
+    QString fileID;        // 发送方在 FT_OFFER 中给出的文件标识 (大小 + 修改时间)
+    QString savePath;
+    qint64 fileSize = 0;
+    qint64 verifiedBytes = 0;
+    quint32 checksum = 0;  // [0, verifiedBytes) 的 CRC-32C
+};
+
+// 发送端的续传记录: 接收方发来 FT_RESUME 时据此重新打开文件 (程序重启后会话已不在内存中)
+struct SendResumeRecord {
+    QString transferID;
+    QString peerUuid;
+    QString filePath;
+    QString fileID;
+    qint64 fileSize = 0;
+};
+
+// 以 transferID 为文件名保存在 AppLocalDataLocation/Transfers/<本地用户 UUID>/ 下 (QDataStream 格式)。
+// 写入经 QSaveFile 原子替换，程序在写入中途退出不会留下损坏的清单
+class TransferResumeStore
+{
+public:
+    explicit TransferResumeStore(const QString &localUserUuid);
+
+    bool saveReceive(const ReceiveResumeManifest &manifest);
+    bool loadReceive(const QString &transferID, ReceiveResumeManifest *manifest) const;
+    // 来自该对端、尚未完成的接收
+    QList<ReceiveResumeManifest> receivesFromPeer(const QString &peerUuid) const;
+    void removeReceive(const QString &transferID);
+
+    bool saveSend(const SendResumeRecord &record);
+    bool loadSend(const QString &transferID, SendResumeRecord *record) const;
+    void removeSend(const QString &transferID);
+
+private:
+    // transferID 来自对端，只接受 UUID 格式，避免被用作路径
+    QString pathFor(const QString &transferID, const char *suffix) const;
+
+    QString m_directory;
+};
+
+#endif // TRANSFERRESUMESTORE_H
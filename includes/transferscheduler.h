@@ -0,0 +1,52 @@
+#ifndef TRANSFERSCHEDULER_H
+#define TRANSFERSCHEDULER_H
+
+#include <QtGlobal>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+// 发送端各传输之间的公平调度 (Deficit Round Robin，按字节计算):
+// 有数据可发的传输排成一个环，轮到某个传输时其额度增加一个 quantum，额度足够发出下一块就发出并扣除，
+// 不够时额度保留并轮到下一个传输。这样各传输得到的字节数与权重成正比，与块大小和回调先后无关。
+// quantum 按同一对端上活动传输的数量均分，每个对端 (整体) 得到相同的份额，不因并发传输多而占用更多带宽。
+// 只决定发送顺序，全局在途读取上限等由调用方检查。非线程安全，由 FileTransferManager 在传输线程中使用。
+class TransferScheduler
+{
+public:
+    explicit TransferScheduler(qint64 quantumBytes);
+
+    // 权重 (>= 1) 在传输下次加入时生效，未设置时为 1
+    void setWeight(const QString &transferID, int weight);
+    // 传输有数据可发: 不在环中时加入环尾
+    void activate(const QString &transferID, const QString &peerUuid);
+    // 没有可发的数据 (窗口已满、对端不可写等): 移出环并清零额度，之后需重新 activate
+    void deactivate(const QString &transferID);
+    // 传输结束，同时丢弃权重
+    void remove(const QString &transferID);
+
+    bool isEmpty() const { return m_active.isEmpty(); }
+    // 当前轮到的传输 (环非空时)
+    QString current() const { return m_active.first(); }
+    // 当前传输的下一块为 cost 字节: 额度足够时扣除并返回 true (当前传输可继续发送)；
+    // 否则补充额度后轮到下一个传输，返回 false
+    bool consume(qint64 cost);
+
+private:
+    struct Flow
+    {
+        QString peerUuid;
+        qint64 deficit = 0;
+        bool creditedThisTurn = false;
+    };
+    qint64 quantumFor(const Flow &flow, const QString &transferID) const;
+    void rotate();
+
+    qint64 m_quantum;
+    QList<QString> m_active;         // 环，首元素为当前传输
+    QHash<QString, Flow> m_flows;    // 环中的传输
+    QHash<QString, int> m_peerFlows; // 对端 -> 环中属于它的传输数
+    QHash<QString, int> m_weights;
+};
+
+#endif // TRANSFERSCHEDULER_H
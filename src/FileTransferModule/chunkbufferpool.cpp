@@ -0,0 +1,89 @@
+#include "chunkbufferpool.h"
+#include <QMutexLocker>
+
+QByteArray ChunkBufferPool::acquire(qsizetype size, bool *allocated)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        // 容量足够的空闲缓冲区中取最小的一个，大缓冲区留给大块
+        int best = -1;
+        for (int i = 0; i < m_buffers.size(); ++i)
+        {
+            const QByteArray &buffer = m_buffers.at(i);
+            if (!buffer.isDetached() || buffer.capacity() < size) // 仍有其他持有者
+                continue;
+            if (best < 0 || buffer.capacity() < m_buffers.at(best).capacity())
+                best = i;
+        }
+        if (best >= 0)
+        {
+            QByteArray buffer = m_buffers.takeAt(best);
+            m_pooledBytes -= buffer.capacity();
+            m_total.reuses++;
+            locker.unlock();
+            buffer.resize(size); // 容量足够，不会重新分配
+            if (allocated)
+                *allocated = false;
+            return buffer;
+        }
+        m_total.allocations++;
+    }
+
+    QByteArray buffer;
+    buffer.reserve((size + CHUNK_BUFFER_GRANULARITY - 1) / CHUNK_BUFFER_GRANULARITY * CHUNK_BUFFER_GRANULARITY);
+    buffer.resize(size);
+    if (allocated)
+        *allocated = true;
+    return buffer;
+}
+
+void ChunkBufferPool::release(const QByteArray &buffer)
+{
+    if (buffer.capacity() <= 0)
+        return;
+    QMutexLocker locker(&m_mutex);
+    // 同一缓冲区可能被交还多次 (如一次合并写入中来自同一帧负载的若干段)
+    for (const QByteArray &pooled : m_buffers)
+    {
+        if (pooled.constData() == buffer.constData())
+            return;
+    }
+    if (m_pooledBytes + buffer.capacity() > CHUNK_BUFFER_POOL_MAX_BYTES)
+        return;
+    m_buffers.append(buffer);
+    m_pooledBytes += buffer.capacity();
+}
+
+void ChunkBufferPool::recordUse(const QString &transferID, bool allocated)
+{
+    QMutexLocker locker(&m_mutex);
+    Stats &stats = m_transfers[transferID];
+    if (allocated)
+        stats.allocations++;
+    else
+        stats.reuses++;
+}
+
+ChunkBufferPool::Stats ChunkBufferPool::transferStats(const QString &transferID) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_transfers.value(transferID);
+}
+
+void ChunkBufferPool::forgetTransfer(const QString &transferID)
+{
+    QMutexLocker locker(&m_mutex);
+    m_transfers.remove(transferID);
+}
+
+ChunkBufferPool::Stats ChunkBufferPool::totalStats() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_total;
+}
+
+ChunkBufferPool &chunkBufferPool()
+{
+    static ChunkBufferPool instance;
+    return instance;
+}
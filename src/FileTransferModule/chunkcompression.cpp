@@ -0,0 +1,80 @@
+#include "chunkcompression.h"
+#include <QFileInfo>
+#include <QSet>
+#include <QtEndian>
+#include <cmath>
+
+namespace {
+    // 常见的已压缩格式 (归档、音视频、图片、安装包等)
+    const QSet<QString> &compressedSuffixes()
+    {
+        static const QSet<QString> suffixes = {
+            "7z", "apk", "avi", "br", "bz2", "cab", "deb", "docx", "flac", "gif", "gz", "heic", "jar", "jpeg", "jpg",
+            "lz", "lz4", "lzma", "m4a", "m4v", "mkv", "mov", "mp3", "mp4", "msi", "ogg", "opus", "png", "pptx", "rar",
+            "rpm", "tgz", "txz", "webm", "webp", "whl", "xlsx", "xz", "zip", "zst"};
+        return suffixes;
+    }
+}
+
+bool isLikelyCompressedFile(const QString &fileName)
+{
+    return compressedSuffixes().contains(QFileInfo(fileName).suffix().toLower());
+}
+
+double estimateChunkEntropy(const char *data, qsizetype size)
+{
+    if (size <= 0)
+        return 0.0;
+    qint64 counts[256] = {};
+    qint64 total = 0;
+    const qint64 sampleBytes = qMin<qint64>(FT_COMPRESSION_SAMPLE_BYTES, size);
+    const qint64 stride = size > sampleBytes ? (size - sampleBytes) / qMax(FT_COMPRESSION_SAMPLE_COUNT - 1, 1) : 0;
+    for (int sample = 0; sample < FT_COMPRESSION_SAMPLE_COUNT; ++sample)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(data) + sample * stride;
+        for (qint64 i = 0; i < sampleBytes; ++i)
+            counts[p[i]]++;
+        total += sampleBytes;
+        if (stride == 0)
+            break; // 块不大于一个样本: 整块已统计
+    }
+    double entropy = 0.0;
+    for (qint64 count : counts)
+    {
+        if (count == 0)
+            continue;
+        const double p = double(count) / double(total);
+        entropy -= p * std::log2(p);
+    }
+    return entropy;
+}
+
+QByteArray compressChunk(const QByteArray &data, bool *skipped)
+{
+    if (skipped)
+        *skipped = false;
+    if (estimateChunkEntropy(data.constData(), data.size()) > FT_COMPRESSION_ENTROPY_THRESHOLD)
+    {
+        if (skipped)
+            *skipped = true;
+        return QByteArray();
+    }
+    QByteArray compressed = qCompress(data, FT_COMPRESSION_LEVEL);
+    if (compressed.isEmpty() || compressed.size() > data.size() * (1.0 - FT_COMPRESSION_MIN_SAVING))
+        return QByteArray();
+    return compressed;
+}
+
+QByteArray decompressChunk(const char *data, qsizetype size, qint64 maxSize)
+{
+    // 在分配内存之前检查声明的原始长度
+    if (size < qsizetype(sizeof(quint32)))
+        return QByteArray();
+    const quint32 rawSize = qFromBigEndian<quint32>(data);
+    if (rawSize == 0 || rawSize > quint64(maxSize))
+        return QByteArray();
+    QByteArray raw = qUncompress(reinterpret_cast<const uchar *>(data), size);
+    if (raw.size() != qsizetype(rawSize))
+        return QByteArray();
+    return raw;
+}
@@ -0,0 +1,165 @@
+#include "crc32c.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC32C_HAS_X86 1
+#include <nmmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_HAS_ARM 1
+#include <arm_acle.h>
+#endif
+
+namespace
+{
+    const quint32 CRC32C_POLY = 0x82F63B78; // 反射形式的 Castagnoli 多项式
+
+    struct Crc32cTables
+    {
+        quint32 bytes[256];
+        quint32 powers[64]; // x^(2^k) mod P，用于合并 (对该多项式 x^(2^32) != x，不能按 k mod 32 循环使用)
+    };
+
+    // 乘法 a * b mod P (反射表示)
+    quint32 multModP(quint32 a, quint32 b)
+    {
+        quint32 m = 1u << 31;
+        quint32 p = 0;
+        for (;;)
+        {
+            if (a & m)
+            {
+                p ^= b;
+                if ((a & (m - 1)) == 0)
+                    break;
+            }
+            m >>= 1;
+            b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+        }
+        return p;
+    }
+
+    Crc32cTables makeTables()
+    {
+        Crc32cTables tables;
+        for (quint32 i = 0; i < 256; ++i)
+        {
+            quint32 crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            tables.bytes[i] = crc;
+        }
+        tables.powers[0] = 1u << 30; // x^1
+        for (int k = 1; k < 64; ++k)
+            tables.powers[k] = multModP(tables.powers[k - 1], tables.powers[k - 1]);
+        return tables;
+    }
+
+    const Crc32cTables &tables()
+    {
+        static const Crc32cTables instance = makeTables();
+        return instance;
+    }
+
+    quint32 crc32cSoftware(quint32 crc, const uchar *data, qint64 length)
+    {
+        const quint32 *table = tables().bytes;
+        while (length-- > 0)
+            crc = table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        return crc;
+    }
+
+#if defined(CRC32C_HAS_X86)
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((target("sse4.2")))
+#endif
+    quint32 crc32cHardware(quint32 crc, const uchar *data, qint64 length)
+    {
+        quint64 value = crc;
+        while (length >= 8)
+        {
+            quint64 word;
+            std::memcpy(&word, data, sizeof(word));
+            value = _mm_crc32_u64(value, word);
+            data += 8;
+            length -= 8;
+        }
+        quint32 crc32 = static_cast<quint32>(value);
+        while (length-- > 0)
+            crc32 = _mm_crc32_u8(crc32, *data++);
+        return crc32;
+    }
+
+    bool detectHardware()
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0; // ECX.SSE4_2
+#else
+        return __builtin_cpu_supports("sse4.2");
+#endif
+    }
+#elif defined(CRC32C_HAS_ARM)
+    quint32 crc32cHardware(quint32 crc, const uchar *data, qint64 length)
+    {
+        while (length >= 8)
+        {
+            quint64 word;
+            std::memcpy(&word, data, sizeof(word));
+            crc = __crc32cd(crc, word);
+            data += 8;
+            length -= 8;
+        }
+        while (length-- > 0)
+            crc = __crc32cb(crc, *data++);
+        return crc;
+    }
+
+    bool detectHardware()
+    {
+        return true;
+    }
+#endif
+
+    bool useHardware()
+    {
+#if defined(CRC32C_HAS_X86) || defined(CRC32C_HAS_ARM)
+        static const bool supported = detectHardware();
+        return supported;
+#else
+        return false;
+#endif
+    }
+}
+
+quint32 crc32c(quint32 crc, const char *data, qint64 length)
+{
+    const uchar *bytes = reinterpret_cast<const uchar *>(data);
+    crc = ~crc;
+#if defined(CRC32C_HAS_X86) || defined(CRC32C_HAS_ARM)
+    if (useHardware())
+        return ~crc32cHardware(crc, bytes, length);
+#endif
+    return ~crc32cSoftware(crc, bytes, length);
+}
+
+quint32 crc32cCombine(quint32 crcA, quint32 crcB, qint64 lengthB)
+{
+    // crc(A || B) = crcA * x^(8 * lengthB) mod P  xor  crcB
+    quint32 power = 1u << 31; // x^0
+    quint64 n = static_cast<quint64>(qMax<qint64>(lengthB, 0));
+    for (int k = 3; n && k < 64; n >>= 1, ++k)
+    {
+        if (n & 1)
+            power = multModP(tables().powers[k], power);
+    }
+    return multModP(power, crcA) ^ crcB;
+}
+
+bool crc32cHardwareAccelerated()
+{
+    return useHardware();
+}
@@ -1,7 +1,24 @@
 #include "fileiomanager.h"
 #include <QFile>
+#include <QDir>
 #include <QDebug>
 #include <QThread> // For QThread::currentThreadId()
+#include <QSocketNotifier>
+#include "iouringqueue.h"
+#include "crc32c.h"
+#include "chunkbufferpool.h"
+#include "chunkcompression.h"
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#endif
 
 // 如果要在信号槽中直接传递自定义结构体，需要注册
 // Q_DECLARE_METATYPE(FileReadResult)
@@ -9,8 +26,451 @@
 // int id = qRegisterMetaType<FileReadResult>();
 // id = qRegisterMetaType<FileWriteResult>();
 
+TransferFile::TransferFile()
+    : m_mode(ReadOnly),
+#ifdef Q_OS_WIN
+      m_handle(INVALID_HANDLE_VALUE)
+#else
+      m_fd(-1),
+      m_directFd(-1)
+#endif
+{
+}
+
+TransferFile::~TransferFile()
+{
+    close();
+}
+
+bool TransferFile::isOpen() const
+{
+#ifdef Q_OS_WIN
+    return m_handle != INVALID_HANDLE_VALUE;
+#else
+    return m_fd >= 0;
+#endif
+}
+
+bool TransferFile::isDirectIO() const
+{
+#ifdef Q_OS_WIN
+    return false;
+#else
+    return m_directFd >= 0;
+#endif
+}
+
+bool TransferFile::open(const QString &filePath, OpenMode mode, QString *error, bool directIO)
+{
+    close();
+    m_filePath = filePath;
+    m_mode = mode;
+#ifdef Q_OS_WIN
+    const QString nativePath = QDir::toNativeSeparators(filePath);
+    DWORD access = GENERIC_READ | (mode == ReadWrite ? GENERIC_WRITE : 0);
+    DWORD disposition = mode == ReadWrite ? OPEN_ALWAYS : OPEN_EXISTING;
+    DWORD flags = FILE_ATTRIBUTE_NORMAL | (mode == ReadOnly ? FILE_FLAG_SEQUENTIAL_SCAN : 0);
+    m_handle = CreateFileW(reinterpret_cast<LPCWSTR>(nativePath.utf16()), access, FILE_SHARE_READ, nullptr, disposition, flags, nullptr);
+    if (m_handle == INVALID_HANDLE_VALUE)
+    {
+        if (error)
+            *error = QString("Failed to open file %1: %2").arg(filePath, qt_error_string(int(GetLastError())));
+        return false;
+    }
+#else
+    int flags = (mode == ReadWrite ? (O_RDWR | O_CREAT) : O_RDONLY) | O_CLOEXEC;
+    do
+    {
+        m_fd = ::open(QFile::encodeName(filePath).constData(), flags, 0666);
+    } while (m_fd < 0 && errno == EINTR);
+    if (m_fd < 0)
+    {
+        if (error)
+            *error = QString("Failed to open file %1: %2").arg(filePath, qt_error_string(errno));
+        return false;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (mode == ReadOnly)
+        ::posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL); // 加大预读窗口
+#endif
+#ifdef O_DIRECT
+    if (directIO && mode == ReadWrite)
+    {
+        // 对齐的写入走此描述符；不对齐的尾部和读取仍用 m_fd
+        do
+        {
+            m_directFd = ::open(QFile::encodeName(filePath).constData(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+        } while (m_directFd < 0 && errno == EINTR);
+        if (m_directFd < 0)
+            qWarning() << "TransferFile: O_DIRECT not available for" << filePath << ":" << qt_error_string(errno) << "- using buffered writes.";
+    }
+#endif
+#endif
+#ifndef O_DIRECT
+    Q_UNUSED(directIO);
+#endif
+    return true;
+}
+
+void TransferFile::close()
+{
+#ifdef Q_OS_WIN
+    if (m_handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_handle);
+        m_handle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (m_directFd >= 0)
+    {
+        ::close(m_directFd);
+        m_directFd = -1;
+    }
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+#endif
+}
+
+bool TransferFile::preallocate(qint64 size, QString *error)
+{
+#ifdef Q_OS_WIN
+    FILE_ALLOCATION_INFO allocation = {};
+    allocation.AllocationSize.QuadPart = size;
+    FILE_END_OF_FILE_INFO endOfFile = {};
+    endOfFile.EndOfFile.QuadPart = size;
+    if (!SetFileInformationByHandle(m_handle, FileAllocationInfo, &allocation, sizeof(allocation)) ||
+        !SetFileInformationByHandle(m_handle, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile)))
+    {
+        if (error)
+            *error = QString("Failed to allocate %1 bytes for file %2: %3").arg(size).arg(m_filePath, qt_error_string(int(GetLastError())));
+        return false;
+    }
+#else
+#ifdef Q_OS_LINUX
+    if (size > 0)
+    {
+        int ret;
+        do
+        {
+            ret = ::fallocate(m_fd, 0, 0, off_t(size));
+        } while (ret < 0 && errno == EINTR);
+        // 文件系统不支持时只设置长度 (不能提前发现空间不足)，其他错误 (如 ENOSPC) 直接失败
+        if (ret < 0 && errno != EOPNOTSUPP && errno != ENOSYS)
+        {
+            if (error)
+                *error = QString("Failed to allocate %1 bytes for file %2: %3").arg(size).arg(m_filePath, qt_error_string(errno));
+            return false;
+        }
+    }
+#endif
+    // 覆盖已存在的较大文件时截掉多余的尾部
+    if (::ftruncate(m_fd, off_t(size)) < 0)
+    {
+        if (error)
+            *error = QString("Failed to resize file %1 to %2 bytes: %3").arg(m_filePath).arg(size).arg(qt_error_string(errno));
+        return false;
+    }
+#endif
+    return true;
+}
+
+void TransferFile::dropCache(qint64 offset, qint64 length)
+{
+#ifdef POSIX_FADV_DONTNEED
+    if (m_fd >= 0 && length > 0)
+        ::posix_fadvise(m_fd, offset, length, POSIX_FADV_DONTNEED);
+#else
+    Q_UNUSED(offset);
+    Q_UNUSED(length);
+#endif
+}
+
+qint64 TransferFile::readAt(qint64 offset, char *data, qint64 size, QString *error)
+{
+    qint64 total = readRaw(offset, data, size, error);
+    if (total >= 0)
+        readCompleted(offset, total);
+    return total;
+}
+
+qint64 TransferFile::checksumAt(qint64 offset, qint64 size, quint32 *checksum, QString *error)
+{
+    QByteArray buffer = chunkBufferPool().acquire(qsizetype(qMin(size, FILE_CHECKSUM_BLOCK_SIZE)));
+    quint32 crc = 0;
+    qint64 total = 0;
+    while (total < size)
+    {
+        qint64 n = readRaw(offset + total, buffer.data(), qMin<qint64>(buffer.size(), size - total), error);
+        if (n < 0)
+        {
+            total = -1;
+            break;
+        }
+        if (n == 0)
+            break; // 文件末尾
+        crc = crc32c(crc, buffer.constData(), n);
+        total += n;
+    }
+    chunkBufferPool().release(buffer);
+    if (checksum && total >= 0)
+        *checksum = crc;
+    return total;
+}
+
+qint64 TransferFile::readRaw(qint64 offset, char *data, qint64 size, QString *error)
+{
+    qint64 total = 0;
+#ifdef Q_OS_WIN
+    while (total < size)
+    {
+        OVERLAPPED overlapped = {};
+        const qint64 position = offset + total;
+        overlapped.Offset = DWORD(position & 0xFFFFFFFF);
+        overlapped.OffsetHigh = DWORD(position >> 32);
+        DWORD toRead = DWORD(qMin<qint64>(size - total, 0x40000000));
+        DWORD bytesRead = 0;
+        if (!ReadFile(m_handle, data + total, toRead, &bytesRead, &overlapped))
+        {
+            DWORD lastError = GetLastError();
+            if (lastError == ERROR_HANDLE_EOF)
+                break;
+            if (error)
+                *error = QString("Failed to read from file %1: %2").arg(m_filePath, qt_error_string(int(lastError)));
+            return -1;
+        }
+        if (bytesRead == 0)
+            break;
+        total += bytesRead;
+    }
+#else
+    while (total < size)
+    {
+        ssize_t n = ::pread(m_fd, data + total, size_t(size - total), off_t(offset + total));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (error)
+                *error = QString("Failed to read from file %1: %2").arg(m_filePath, qt_error_string(errno));
+            return -1;
+        }
+        if (n == 0)
+            break; // 文件末尾
+        total += n;
+    }
+#endif
+    return total;
+}
+
+qint64 TransferFile::writeAt(qint64 offset, const char *data, qint64 size, QString *error)
+{
+    qint64 total = 0;
+#ifdef Q_OS_WIN
+    while (total < size)
+    {
+        OVERLAPPED overlapped = {};
+        const qint64 position = offset + total;
+        overlapped.Offset = DWORD(position & 0xFFFFFFFF);
+        overlapped.OffsetHigh = DWORD(position >> 32);
+        DWORD toWrite = DWORD(qMin<qint64>(size - total, 0x40000000));
+        DWORD bytesWritten = 0;
+        if (!WriteFile(m_handle, data + total, toWrite, &bytesWritten, &overlapped))
+        {
+            if (error)
+                *error = QString("Failed to write to file %1: %2").arg(m_filePath, qt_error_string(int(GetLastError())));
+            return -1;
+        }
+        total += bytesWritten;
+    }
+#else
+    while (total < size)
+    {
+        ssize_t n = ::pwrite(m_fd, data + total, size_t(size - total), off_t(offset + total));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (error)
+                *error = QString("Failed to write to file %1: %2").arg(m_filePath, qt_error_string(errno));
+            return -1;
+        }
+        total += n;
+    }
+#endif
+    writeCompleted(offset, total);
+    return total;
+}
 
-FileIOManager::FileIOManager(QObject *parent) : QObject(parent)
+qint64 TransferFile::writeSegmentsAt(qint64 offset, const FileWriteSegments &segments, QString *error)
+{
+    qint64 total = 0;
+    for (const FileWriteSegment &segment : segments)
+        total += segment.size;
+
+#ifdef Q_OS_WIN
+    qint64 written = 0;
+    for (const FileWriteSegment &segment : segments)
+    {
+        if (writeAt(offset + written, segment.buffer.constData() + segment.offset, segment.size, error) != segment.size)
+            return -1;
+        written += segment.size;
+    }
+    return written;
+#else
+    qint64 written = 0;
+    if (m_directFd >= 0 && offset % FILE_DIRECT_IO_ALIGNMENT == 0)
+    {
+        const qint64 alignedSize = total - total % FILE_DIRECT_IO_ALIGNMENT;
+        if (alignedSize > 0)
+        {
+            written = writeDirect(offset, segments, alignedSize, error);
+            if (written < 0)
+                return -1;
+        }
+    }
+
+    // 其余部分 (未启用 O_DIRECT 时为全部数据) 用 pwritev 一次写出多个段
+    const qint64 bufferedStart = written;
+    int index = 0;
+    qint64 skip = written; // segments[index] 中已写出的字节数
+    auto advance = [&]() {
+        while (index < segments.size() && skip >= segments.at(index).size)
+        {
+            skip -= segments.at(index).size;
+            ++index;
+        }
+    };
+    advance();
+    while (written < total)
+    {
+        iovec iov[64];
+        int count = 0;
+        for (int i = index; i < segments.size() && count < 64; ++i)
+        {
+            const FileWriteSegment &segment = segments.at(i);
+            const qint64 start = i == index ? skip : 0;
+            if (segment.size - start <= 0)
+                continue;
+            iov[count].iov_base = const_cast<char *>(segment.buffer.constData() + segment.offset + start);
+            iov[count].iov_len = size_t(segment.size - start);
+            ++count;
+        }
+        ssize_t n = ::pwritev(m_fd, iov, count, off_t(offset + written));
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (error)
+                *error = QString("Failed to write to file %1: %2").arg(m_filePath, qt_error_string(n < 0 ? errno : EIO));
+            return -1;
+        }
+        written += n;
+        skip += n;
+        advance();
+    }
+    writeCompleted(offset + bufferedStart, total - bufferedStart);
+    return written;
+#endif
+}
+
+qint64 TransferFile::writeDirect(qint64 offset, const FileWriteSegments &segments, qint64 length, QString *error)
+{
+#ifdef Q_OS_WIN
+    Q_UNUSED(offset);
+    Q_UNUSED(segments);
+    Q_UNUSED(length);
+    Q_UNUSED(error);
+    return 0;
+#else
+    // O_DIRECT 要求内存地址对齐，网络帧负载不满足，先拷贝到对齐的中转缓冲区
+    void *memory = nullptr;
+    const qint64 bufferSize = qMin(length, FILE_DIRECT_IO_BUFFER_SIZE);
+    if (::posix_memalign(&memory, size_t(FILE_DIRECT_IO_ALIGNMENT), size_t(bufferSize)) != 0)
+    {
+        if (error)
+            *error = QString("Failed to allocate aligned buffer for file %1").arg(m_filePath);
+        return -1;
+    }
+    std::unique_ptr<char, decltype(&::free)> buffer(static_cast<char *>(memory), &::free);
+
+    int index = 0;
+    qint64 segmentPos = 0;
+    qint64 written = 0;
+    while (written < length)
+    {
+        const qint64 blockSize = qMin(bufferSize, length - written);
+        qint64 filled = 0;
+        while (filled < blockSize)
+        {
+            const FileWriteSegment &segment = segments.at(index);
+            const qint64 n = qMin(segment.size - segmentPos, blockSize - filled);
+            std::memcpy(buffer.get() + filled, segment.buffer.constData() + segment.offset + segmentPos, size_t(n));
+            filled += n;
+            segmentPos += n;
+            if (segmentPos == segment.size)
+            {
+                ++index;
+                segmentPos = 0;
+            }
+        }
+
+        qint64 blockWritten = 0;
+        while (blockWritten < blockSize)
+        {
+            ssize_t n = ::pwrite(m_directFd, buffer.get() + blockWritten, size_t(blockSize - blockWritten), off_t(offset + written + blockWritten));
+            if (n <= 0)
+            {
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (error)
+                    *error = QString("Failed to write to file %1: %2").arg(m_filePath, qt_error_string(n < 0 ? errno : EIO));
+                return -1;
+            }
+            blockWritten += n;
+        }
+        written += blockSize;
+    }
+    return written;
+#endif
+}
+
+int TransferFile::nativeDescriptor() const
+{
+#ifdef Q_OS_WIN
+    return -1;
+#else
+    return m_fd;
+#endif
+}
+
+void TransferFile::readCompleted(qint64 offset, qint64 length)
+{
+    // 已读入内存的块不会再读取，发送大文件时不挤占其他程序的页缓存
+    dropCache(offset, length);
+}
+
+void TransferFile::writeCompleted(qint64 offset, qint64 length)
+{
+#ifdef Q_OS_LINUX
+    // 立即开始异步回写，稍后即可丢弃落后区域的页缓存
+    if (m_fd >= 0 && length > 0)
+        ::sync_file_range(m_fd, offset, length, SYNC_FILE_RANGE_WRITE);
+#endif
+    if (offset >= FILE_DROP_BEHIND_LAG)
+        dropCache(offset - FILE_DROP_BEHIND_LAG, length);
+}
+
+FileIOManager::FileIOManager(QObject *parent)
+    : QObject(parent),
+      m_backend(ThreadPoolBackend),
+      m_backendSelected(false),
+      m_uringNotifier(nullptr),
+      m_nextUringId(1),
+      m_uringInFlight(0),
+      m_uringSubmitScheduled(false)
 {
     // qRegisterMetaType<FileReadResult>(); // 确保类型已注册
     // qRegisterMetaType<FileWriteResult>();
@@ -18,101 +478,192 @@ FileIOManager::FileIOManager(QObject *parent) : QObject(parent)
 
 FileIOManager::~FileIOManager()
 {
-    // Cleanup any pending watchers if they were used and stored
+    // 内核仍可能写入已提交请求的缓冲区，必须等它们全部完成后才能释放
+    if (m_uring && m_uringInFlight > 0) {
+        QList<IoUringQueue::Completion> completions(FILE_IO_URING_QUEUE_DEPTH);
+        while (m_uringInFlight > 0) {
+            if (m_uring->waitForCompletions(1) < 0)
+                break;
+            m_uringInFlight -= m_uring->reapCompletions(completions.data(), int(completions.size()));
+        }
+    }
+    // 仍在执行的块任务持有句柄引用，句柄在其完成后关闭
+    m_openFiles.clear();
 }
 
-FileReadResult FileIOManager::performRead(QString transferID, qint64 chunkID, QString filePath, qint64 offset, int size)
+bool FileIOManager::openTransferFile(const QString& transferID, const QString& filePath, TransferFile::OpenMode mode, QString* error, bool directIO)
+{
+    QSharedPointer<TransferFile> file = QSharedPointer<TransferFile>::create();
+    if (!file->open(filePath, mode, error, directIO))
+        return false;
+    m_openFiles.insert(transferID, file);
+    return true;
+}
+
+void FileIOManager::closeTransferFile(const QString& transferID)
+{
+    m_openFiles.remove(transferID);
+}
+
+bool FileIOManager::removeTransferFile(const QString& transferID)
+{
+    QSharedPointer<TransferFile> file = m_openFiles.take(transferID);
+    if (!file)
+        return false;
+    const QString filePath = file->filePath();
+    file.reset(); // 先关闭句柄 (Windows 上无法删除打开的文件)
+    return QFile::remove(filePath);
+}
+
+QSharedPointer<TransferFile> FileIOManager::fileFor(const QString& transferID, const QString& filePath, TransferFile::OpenMode mode, QString* error)
+{
+    QSharedPointer<TransferFile> file = m_openFiles.value(transferID);
+    if (file && file->filePath() == filePath)
+        return file;
+    if (!openTransferFile(transferID, filePath, mode, error))
+        return QSharedPointer<TransferFile>();
+    return m_openFiles.value(transferID);
+}
+
+FileReadResult FileIOManager::performRead(QSharedPointer<TransferFile> file, QString transferID, qint64 chunkID, qint64 offset, int size)
 {
     // qDebug() << "FileIOManager::performRead on thread:" << QThread::currentThreadId();
-    QFile file(filePath);
     FileReadResult result;
     result.transferID = transferID;
     result.chunkID = chunkID;
+    result.checksum = 0;
     result.success = false;
-    result.originalSize = 0;
 
-    if (!file.open(QIODevice::ReadOnly)) {
-        result.errorString = QString("Failed to open file %1: %2").arg(filePath).arg(file.errorString());
-        return result;
+    // 缓冲区取自缓冲池，块发出后由 FileTransferManager 交还
+    bool allocated = false;
+    QByteArray rawData = chunkBufferPool().acquire(size, &allocated);
+    chunkBufferPool().recordUse(transferID, allocated);
+    qint64 bytesRead = file->readAt(offset, rawData.data(), size, &result.errorString);
+    if (bytesRead >= 0) {
+        rawData.truncate(bytesRead);
+        result.checksum = crc32c(0, rawData.constData(), rawData.size());
+        result.data = rawData;
+        result.success = true;
+    } else {
+        chunkBufferPool().release(rawData);
     }
+    return result;
+}
 
-    if (!file.seek(offset)) {
-        result.errorString = QString("Failed to seek to offset %1 in file %2: %3").arg(offset).arg(filePath).arg(file.errorString());
-        file.close();
-        return result;
-    }
+FileChecksumResult FileIOManager::performChecksum(QSharedPointer<TransferFile> file, QString transferID, qint64 chunkID, qint64 offset, qint64 size)
+{
+    FileChecksumResult result;
+    result.transferID = transferID;
+    result.chunkID = chunkID;
+    result.checksum = 0;
+    result.success = file->checksumAt(offset, size, &result.checksum, &result.errorString) >= 0;
+    return result;
+}
 
-    QByteArray rawData = file.read(size);
-    if (rawData.isNull() && file.error() != QFileDevice::NoError) { // read() returns null on error
-        result.errorString = QString("Failed to read from file %1: %2").arg(filePath).arg(file.errorString());
+FileCodecResult FileIOManager::performCompress(QString transferID, qint64 chunkID, QByteArray data, quint32 checksum)
+{
+    FileCodecResult result;
+    result.transferID = transferID;
+    result.chunkID = chunkID;
+    result.checksum = checksum;
+    result.skipped = false;
+    result.success = true;
+    QByteArray compressed = compressChunk(data, &result.skipped);
+    result.compressed = !compressed.isEmpty();
+    result.data = result.compressed ? compressed : data;
+    return result;
+}
+
+FileCodecResult FileIOManager::performDecompress(QString transferID, qint64 chunkID, QByteArray buffer, qsizetype dataOffset, qint64 dataSize, qint64 maxSize)
+{
+    FileCodecResult result;
+    result.transferID = transferID;
+    result.chunkID = chunkID;
+    result.checksum = 0;
+    result.compressed = false;
+    result.skipped = false;
+    result.success = false;
+    if (dataOffset < 0 || dataSize <= 0 || dataOffset + dataSize > buffer.size()) {
+        result.errorString = QString("Invalid compressed data range for chunk %1.").arg(chunkID);
     } else {
-        result.originalSize = rawData.size();
-        result.dataB64 = QString::fromUtf8(rawData.toBase64());
-        result.success = true;
+        result.data = decompressChunk(buffer.constData() + dataOffset, dataSize, maxSize);
+        result.success = !result.data.isEmpty();
+        if (!result.success)
+            result.errorString = QString("Chunk %1 could not be decompressed.").arg(chunkID);
     }
-
-    file.close();
+    // 压缩数据已不再需要，帧负载交还缓冲池
+    chunkBufferPool().release(buffer);
     return result;
 }
 
-FileWriteResult FileIOManager::performWrite(QString transferID, qint64 chunkID, QString filePath, qint64 offset, QString dataB64, qint64 originalChunkSize)
+FileWriteResult FileIOManager::performWrite(QSharedPointer<TransferFile> file, QString transferID, qint64 chunkID, qint64 offset, FileWriteSegments segments)
 {
     // qDebug() << "FileIOManager::performWrite on thread:" << QThread::currentThreadId();
-    QFile file(filePath);
     FileWriteResult result;
     result.transferID = transferID;
     result.chunkID = chunkID;
     result.success = false;
     result.bytesWritten = 0;
 
-    QByteArray decodedData = QByteArray::fromBase64(dataB64.toUtf8());
-
-    if (decodedData.size() != originalChunkSize) {
-        result.errorString = QString("Decoded data size mismatch for chunk %1. Expected %2, got %3.")
-                                 .arg(chunkID).arg(originalChunkSize).arg(decodedData.size());
-        return result;
+    qint64 dataSize = 0;
+    for (const FileWriteSegment& segment : segments) {
+        if (segment.offset < 0 || segment.size < 0 || segment.offset + segment.size > segment.buffer.size()) {
+            result.errorString = QString("Invalid data range for chunk %1: offset %2, size %3, buffer %4 bytes.")
+                                     .arg(chunkID).arg(segment.offset).arg(segment.size).arg(segment.buffer.size());
+            return result;
+        }
+        dataSize += segment.size;
     }
 
-    if (!file.open(QIODevice::ReadWrite)) { // Use ReadWrite to allow seek
-        result.errorString = QString("Failed to open file %1 for writing: %2").arg(filePath).arg(file.errorString());
-        return result;
+    qint64 bytesWrittenToFile = file->writeSegmentsAt(offset, segments, &result.errorString);
+    if (bytesWrittenToFile == dataSize) {
+        result.bytesWritten = bytesWrittenToFile;
+        result.success = true;
     }
-
-    if (!file.seek(offset)) {
-        result.errorString = QString("Failed to seek to offset %1 for writing in file %2: %3").arg(offset).arg(filePath).arg(file.errorString());
-        file.close();
-        return result;
+    // 数据已在文件中，接收缓冲区交还缓冲池 (帧负载取自缓冲池)
+    for (const FileWriteSegment& segment : segments) {
+        chunkBufferPool().release(segment.buffer);
     }
+    return result;
+}
 
-    qint64 bytesWrittenToFile = file.write(decodedData);
-    if (bytesWrittenToFile != decodedData.size()) {
-        result.errorString = QString("Failed to write complete data to file %1 (wrote %2 of %3 bytes): %4")
-                                 .arg(filePath).arg(bytesWrittenToFile).arg(decodedData.size()).arg(file.errorString());
-        // result.success remains false
-    } else {
-        result.bytesWritten = bytesWrittenToFile;
-        result.success = true;
+void FileIOManager::selectBackend()
+{
+    m_backendSelected = true;
+    if (qEnvironmentVariable(FILE_IO_BACKEND_ENV).compare(QLatin1String("threadpool"), Qt::CaseInsensitive) == 0) {
+        qInfo() << "FileIOManager: Using thread pool backend (forced by" << FILE_IO_BACKEND_ENV << ")";
+        return;
     }
 
-    file.close();
-    return result;
+    // 在 FileIOManager 所在的线程中创建，QSocketNotifier 必须属于该线程
+    auto uring = std::make_unique<IoUringQueue>();
+    QString error;
+    if (!uring->init(FILE_IO_URING_QUEUE_DEPTH, &error)) {
+        qInfo() << "FileIOManager: io_uring unavailable, using thread pool backend:" << error;
+        return;
+    }
+    m_uring = std::move(uring);
+    m_uringNotifier = new QSocketNotifier(m_uring->eventFd(), QSocketNotifier::Read, this);
+    connect(m_uringNotifier, &QSocketNotifier::activated, this, &FileIOManager::handleUringCompletions);
+    m_backend = IoUringBackend;
+    qInfo() << "FileIOManager: Using io_uring backend, queue depth" << m_uring->capacity();
 }
 
-void FileIOManager::requestReadFileChunk(const QString& transferID, qint64 chunkID, const QString& filePath, qint64 offset, int size)
+void FileIOManager::startThreadPoolRead(QSharedPointer<TransferFile> file, const QString& transferID, qint64 chunkID, qint64 offset, int size)
 {
     // Use a QFutureWatcher to manage the asynchronous task and get results on the main thread
     QFutureWatcher<FileReadResult> *watcher = new QFutureWatcher<FileReadResult>(this);
     connect(watcher, &QFutureWatcher<FileReadResult>::finished, this, [this, watcher]() {
         FileReadResult result = watcher->result();
-        emit chunkReadCompleted(result.transferID, result.chunkID, result.dataB64, result.originalSize, result.success, result.errorString);
+        emit chunkReadCompleted(result.transferID, result.chunkID, result.data, result.checksum, result.success, result.errorString);
         watcher->deleteLater(); // Clean up the watcher
     });
 
-    QFuture<FileReadResult> future = QtConcurrent::run(&FileIOManager::performRead, transferID, chunkID, filePath, offset, size);
+    QFuture<FileReadResult> future = QtConcurrent::run(&FileIOManager::performRead, file, transferID, chunkID, offset, size);
     watcher->setFuture(future);
 }
 
-void FileIOManager::requestWriteFileChunk(const QString& transferID, qint64 chunkID, const QString& filePath, qint64 offset, const QString& dataB64, qint64 originalChunkSize)
+void FileIOManager::startThreadPoolWrite(QSharedPointer<TransferFile> file, const QString& transferID, qint64 chunkID, qint64 offset, const FileWriteSegments& segments)
 {
     QFutureWatcher<FileWriteResult> *watcher = new QFutureWatcher<FileWriteResult>(this);
     connect(watcher, &QFutureWatcher<FileWriteResult>::finished, this, [this, watcher]() {
@@ -121,6 +672,309 @@ void FileIOManager::requestWriteFileChunk(const QString& transferID, qint64 chun
         watcher->deleteLater();
     });
 
-    QFuture<FileWriteResult> future = QtConcurrent::run(&FileIOManager::performWrite, transferID, chunkID, filePath, offset, dataB64, originalChunkSize);
+    QFuture<FileWriteResult> future = QtConcurrent::run(&FileIOManager::performWrite, file, transferID, chunkID, offset, segments);
+    watcher->setFuture(future);
+}
+
+void FileIOManager::enqueueUringOperation(UringOperation operation)
+{
+    quint64 id = m_nextUringId++;
+    m_uringOperations.insert(id, std::move(operation));
+    m_uringBacklog.enqueue(id);
+    scheduleUringSubmit();
+}
+
+void FileIOManager::scheduleUringSubmit()
+{
+    // 发送窗口内的多个读请求在同一轮事件循环中发出，合并为一次 io_uring_enter
+    if (m_uringSubmitScheduled)
+        return;
+    m_uringSubmitScheduled = true;
+    QMetaObject::invokeMethod(this, &FileIOManager::submitUringBatch, Qt::QueuedConnection);
+}
+
+void FileIOManager::submitUringBatch()
+{
+    m_uringSubmitScheduled = false;
+    if (!m_uring)
+        return;
+
+    int prepared = 0;
+    while (!m_uringBacklog.isEmpty() && m_uringInFlight + prepared < int(m_uring->capacity())) {
+        quint64 id = m_uringBacklog.head();
+        auto it = m_uringOperations.find(id);
+        if (it == m_uringOperations.end()) {
+            m_uringBacklog.dequeue();
+            continue;
+        }
+        UringOperation &op = it.value();
+        const int fd = op.file->nativeDescriptor();
+        const unsigned length = unsigned(op.size - op.done);
+        const quint64 position = quint64(op.offset + op.done);
+        bool ok;
+        if (op.isWrite) {
+            // 跳过已写出的部分，剩余的各段 (最多 FILE_IO_URING_MAX_IOVECS 个) 作为一个 IORING_OP_WRITEV 提交，
+            // 之后的段在完成时按短写入继续提交
+            op.iovecs.clear();
+            qint64 skip = op.done;
+            for (const FileWriteSegment &segment : std::as_const(op.segments)) {
+                if (skip >= segment.size) {
+                    skip -= segment.size;
+                    continue;
+                }
+                op.iovecs.push_back({segment.buffer.constData() + segment.offset + skip, size_t(segment.size - skip)});
+                skip = 0;
+                if (int(op.iovecs.size()) >= FILE_IO_URING_MAX_IOVECS)
+                    break;
+            }
+            op.vectored = op.iovecs.size() > 1;
+            ok = !op.vectored
+                     ? m_uring->prepareWrite(fd, op.iovecs.front().data, unsigned(op.iovecs.front().length), position, id)
+                     : m_uring->prepareWritev(fd, op.iovecs.data(), unsigned(op.iovecs.size()), position, id);
+        } else {
+            ok = m_uring->prepareRead(fd, op.buffer.data() + op.done, length, position, id);
+        }
+        if (!ok)
+            break; // 提交队列已满，等待完成后继续
+        m_uringBacklog.dequeue();
+        ++prepared;
+    }
+    if (prepared == 0)
+        return;
+
+    int submitted = m_uring->submit();
+    if (submitted < 0) {
+        abandonUring(QString("io_uring_enter failed: %1").arg(qt_error_string(-submitted)));
+        return;
+    }
+    m_uringInFlight += submitted;
+}
+
+void FileIOManager::handleUringCompletions()
+{
+    if (!m_uring)
+        return;
+    m_uring->clearEventFd();
+
+    IoUringQueue::Completion completions[64];
+    int count;
+    QString unsupported;
+    while (unsupported.isEmpty() && (count = m_uring->reapCompletions(completions, 64)) > 0) {
+        m_uringInFlight -= count;
+        for (int i = 0; i < count; ++i) {
+            const quint64 id = completions[i].userData;
+            const int result = completions[i].result;
+            auto it = m_uringOperations.find(id);
+            if (it == m_uringOperations.end())
+                continue;
+            UringOperation &op = it.value();
+
+            if (result < 0) {
+                if ((result == -EINVAL || result == -EOPNOTSUPP) && op.done == 0 && !op.vectored) {
+                    // 内核不支持 IORING_OP_READ/WRITE (Linux < 5.6)；WRITEV 的参数错误只让该次写入失败。
+                    // 本批其余的完成事件照常处理，之后再回退: 该请求与其余未完成的请求由 abandonUring 各交给线程池重新执行一次
+                    unsupported = QString("io_uring operation not supported: %1").arg(qt_error_string(-result));
+                    continue;
+                }
+                finishUringOperation(id, QString("Failed to %1 file %2: %3")
+                                             .arg(op.isWrite ? "write" : "read", op.file->filePath(), qt_error_string(-result)));
+                continue;
+            }
+
+            op.done += result;
+            if (!op.isWrite && result == 0) {
+                finishUringOperation(id, QString()); // 文件末尾
+            } else if (op.done < op.size) {
+                m_uringBacklog.enqueue(id); // 短读写: 继续提交剩余部分
+            } else {
+                finishUringOperation(id, QString());
+            }
+        }
+    }
+
+    if (!unsupported.isEmpty()) {
+        abandonUring(unsupported);
+        return;
+    }
+    if (!m_uringBacklog.isEmpty())
+        submitUringBatch();
+}
+
+void FileIOManager::finishUringOperation(quint64 id, const QString& error)
+{
+    UringOperation op = m_uringOperations.take(id);
+    const bool success = error.isEmpty();
+    if (op.isWrite) {
+        if (success)
+            op.file->writeCompleted(op.offset, op.done);
+        for (const FileWriteSegment &segment : op.segments)
+            chunkBufferPool().release(segment.buffer);
+        emit chunkWrittenCompleted(op.transferID, op.chunkID, success ? op.done : 0, success, error);
+    } else {
+        quint32 checksum = 0;
+        if (success) {
+            op.buffer.truncate(op.done);
+            op.file->readCompleted(op.offset, op.done);
+            // io_uring 没有工作线程，在此计算 (硬件 CRC-32C 远快于磁盘和网络)
+            checksum = crc32c(0, op.buffer.constData(), op.buffer.size());
+        } else {
+            chunkBufferPool().release(op.buffer);
+        }
+        emit chunkReadCompleted(op.transferID, op.chunkID, success ? op.buffer : QByteArray(), checksum, success, error);
+    }
+}
+
+void FileIOManager::abandonUring(const QString& reason)
+{
+    qWarning() << "FileIOManager: Falling back to thread pool backend:" << reason;
+    if (m_uringNotifier) {
+        m_uringNotifier->setEnabled(false);
+        m_uringNotifier->deleteLater();
+        m_uringNotifier = nullptr;
+    }
+    // 已提交的请求可能仍在内核中使用缓冲区，等待它们结束后再释放队列
+    if (m_uringInFlight > 0) {
+        IoUringQueue::Completion completions[64];
+        while (m_uringInFlight > 0 && m_uring->waitForCompletions(1) >= 0)
+            m_uringInFlight -= m_uring->reapCompletions(completions, 64);
+    }
+    m_uring.reset();
+    m_uringInFlight = 0;
+    m_uringBacklog.clear();
+    m_backend = ThreadPoolBackend;
+
+    // 所有未完成的请求 (包括已部分完成的) 从头交给线程池重新执行
+    const QHash<quint64, UringOperation> operations = m_uringOperations;
+    m_uringOperations.clear();
+    for (const UringOperation &op : operations) {
+        if (op.isWrite)
+            startThreadPoolWrite(op.file, op.transferID, op.chunkID, op.offset, op.segments);
+        else
+            startThreadPoolRead(op.file, op.transferID, op.chunkID, op.offset, int(op.size));
+    }
+}
+
+void FileIOManager::requestReadFileChunk(const QString& transferID, qint64 chunkID, const QString& filePath, qint64 offset, int size)
+{
+    QString error;
+    QSharedPointer<TransferFile> file = fileFor(transferID, filePath, TransferFile::ReadOnly, &error);
+    if (!file) {
+        // 以队列方式报告，避免在调用方的发送循环中重入
+        QMetaObject::invokeMethod(this, [this, transferID, chunkID, error]() {
+            emit chunkReadCompleted(transferID, chunkID, QByteArray(), 0, false, error);
+        }, Qt::QueuedConnection);
+        return;
+    }
+
+    if (!m_backendSelected)
+        selectBackend();
+    if (m_backend == IoUringBackend && file->nativeDescriptor() >= 0) {
+        UringOperation op;
+        op.file = file;
+        op.transferID = transferID;
+        op.chunkID = chunkID;
+        op.offset = offset;
+        bool allocated = false;
+        op.buffer = chunkBufferPool().acquire(size, &allocated);
+        chunkBufferPool().recordUse(transferID, allocated);
+        op.size = size;
+        enqueueUringOperation(std::move(op));
+        return;
+    }
+    startThreadPoolRead(file, transferID, chunkID, offset, size);
+}
+
+void FileIOManager::requestChecksumFileChunk(const QString& transferID, qint64 chunkID, const QString& filePath, qint64 offset, qint64 size)
+{
+    QString error;
+    QSharedPointer<TransferFile> file = fileFor(transferID, filePath, TransferFile::ReadOnly, &error);
+    if (!file) {
+        QMetaObject::invokeMethod(this, [this, transferID, chunkID, error]() {
+            emit chunkChecksumCompleted(transferID, chunkID, 0, false, error);
+        }, Qt::QueuedConnection);
+        return;
+    }
+
+    QFutureWatcher<FileChecksumResult> *watcher = new QFutureWatcher<FileChecksumResult>(this);
+    connect(watcher, &QFutureWatcher<FileChecksumResult>::finished, this, [this, watcher]() {
+        FileChecksumResult result = watcher->result();
+        emit chunkChecksumCompleted(result.transferID, result.chunkID, result.checksum, result.success, result.errorString);
+        watcher->deleteLater();
+    });
+
+    QFuture<FileChecksumResult> future = QtConcurrent::run(&FileIOManager::performChecksum, file, transferID, chunkID, offset, size);
     watcher->setFuture(future);
 }
+
+void FileIOManager::requestCompressChunk(const QString& transferID, qint64 chunkID, const QByteArray& data, quint32 checksum)
+{
+    QFutureWatcher<FileCodecResult> *watcher = new QFutureWatcher<FileCodecResult>(this);
+    connect(watcher, &QFutureWatcher<FileCodecResult>::finished, this, [this, watcher]() {
+        FileCodecResult result = watcher->result();
+        emit chunkCompressed(result.transferID, result.chunkID, result.data, result.checksum, result.compressed, result.skipped);
+        watcher->deleteLater();
+    });
+
+    QFuture<FileCodecResult> future = QtConcurrent::run(&FileIOManager::performCompress, transferID, chunkID, data, checksum);
+    watcher->setFuture(future);
+}
+
+void FileIOManager::requestDecompressChunk(const QString& transferID, qint64 chunkID, const QByteArray& buffer, qsizetype dataOffset, qint64 dataSize, qint64 maxSize)
+{
+    QFutureWatcher<FileCodecResult> *watcher = new QFutureWatcher<FileCodecResult>(this);
+    connect(watcher, &QFutureWatcher<FileCodecResult>::finished, this, [this, watcher]() {
+        FileCodecResult result = watcher->result();
+        emit chunkDecompressed(result.transferID, result.chunkID, result.data, result.success, result.errorString);
+        watcher->deleteLater();
+    });
+
+    QFuture<FileCodecResult> future = QtConcurrent::run(&FileIOManager::performDecompress, transferID, chunkID, buffer, dataOffset, dataSize, maxSize);
+    watcher->setFuture(future);
+}
+
+void FileIOManager::requestWriteFileChunk(const QString& transferID, qint64 chunkID, const QString& filePath, qint64 offset, const QByteArray& buffer, qsizetype dataOffset, qint64 dataSize)
+{
+    FileWriteSegment segment;
+    segment.buffer = buffer;
+    segment.offset = dataOffset;
+    segment.size = dataSize;
+    requestWriteFileSegments(transferID, chunkID, filePath, offset, FileWriteSegments{segment});
+}
+
+void FileIOManager::requestWriteFileSegments(const QString& transferID, qint64 chunkID, const QString& filePath, qint64 offset, const FileWriteSegments& segments)
+{
+    QString error;
+    QSharedPointer<TransferFile> file = fileFor(transferID, filePath, TransferFile::ReadWrite, &error);
+    if (!file) {
+        QMetaObject::invokeMethod(this, [this, transferID, chunkID, error]() {
+            emit chunkWrittenCompleted(transferID, chunkID, 0, false, error);
+        }, Qt::QueuedConnection);
+        return;
+    }
+
+    qint64 dataSize = 0;
+    bool validRanges = true;
+    for (const FileWriteSegment& segment : segments) {
+        validRanges = validRanges && segment.offset >= 0 && segment.size >= 0 && segment.offset + segment.size <= segment.buffer.size();
+        dataSize += segment.size;
+    }
+
+    if (!m_backendSelected)
+        selectBackend();
+    // O_DIRECT 写入需要对齐的中转缓冲区，由线程池执行
+    if (m_backend == IoUringBackend && file->nativeDescriptor() >= 0 && !file->isDirectIO()
+        && validRanges && dataSize > 0) {
+        UringOperation op;
+        op.isWrite = true;
+        op.file = file;
+        op.transferID = transferID;
+        op.chunkID = chunkID;
+        op.offset = offset;
+        op.segments = segments;
+        op.size = dataSize;
+        enqueueUringOperation(std::move(op));
+        return;
+    }
+    // 线程池后端 (也负责报告非法的数据范围)
+    startThreadPoolWrite(file, transferID, chunkID, offset, segments);
+}
@@ -1,30 +1,46 @@
 #include "filetransfermanager.h"
 #include "networkmanager.h"
 #include "fileiomanager.h" // Make sure this is included
+#include "crc32c.h"
+#include "chunkbufferpool.h"
+#include "chunkcompression.h"
 #include <QUuid>
 #include <QFileInfo>
 #include <QDebug>
-#include <QRegularExpression>
 #include <QStandardPaths>
 #include <QBuffer>
 #include <QElapsedTimer>
-
-// Helper function to extract attribute (can be moved to a shared utility if NetworkManager's one is not accessible/suitable)
-QString FileTransferManager::extractMessageAttribute(const QString& message, const QString& attributeName) const {
-    QRegularExpression regex(QStringLiteral("%1=\\\"([^\\\"]*)\\\"").arg(attributeName));
-    QRegularExpressionMatch match = regex.match(message);
-    if (match.hasMatch() && match.capturedTexts().size() > 1) {
-        return match.captured(1);
-    }
-    return QString();
-}
+#include <algorithm>
+#include <limits>
 
 // 集中ACK参数
-const int ACK_BATCH_SIZE = 4;      // 每收到4个新chunk就ACK一次
 const int ACK_DELAY_MS = 10;      // 或每100ms至少ACK一次
 
+namespace {
+    // 向下取整到 FT_CHUNK_SIZE_ALIGNMENT 的整数倍，并限制在 [FT_MIN_CHUNK_SIZE, maxSize]
+    qint64 alignChunkSize(qint64 bytes, qint64 maxSize) {
+        return qBound(FT_MIN_CHUNK_SIZE, bytes / FT_CHUNK_SIZE_ALIGNMENT * FT_CHUNK_SIZE_ALIGNMENT, qMax(maxSize, FT_MIN_CHUNK_SIZE));
+    }
+
+    // 续传时用于判断文件是否改变: 大小 + 修改时间
+    QString fileIdentity(const QFileInfo& info) {
+        return QString("%1-%2").arg(info.size()).arg(info.lastModified().toMSecsSinceEpoch());
+    }
+
+    // 发送方续传前核对前缀 CRC 的校验请求 (不是真正的块)
+    const qint64 RESUME_PREFIX_CHUNK_ID = -1;
+
+    // 直接写到最终位置的乱序块以负的请求号提交，与 write-behind 写入 (以其最后一块的块号提交) 区分
+    qint64 spillWriteRequestID(qint64 chunkID) { return -2 - chunkID; }
+    bool isSpillWriteRequest(qint64 requestID) { return requestID <= -2; }
+    qint64 spilledChunkID(qint64 requestID) { return -2 - requestID; }
+}
+
 FileTransferManager::FileTransferManager(NetworkManager* networkManager, FileIOManager* fileIOManager, const QString& localUserUuid, QObject *parent)
-    : QObject(parent), m_networkManager(networkManager), m_fileIOManager(fileIOManager), m_localUserUuid(localUserUuid)
+    : QObject(parent), m_networkManager(networkManager), m_fileIOManager(fileIOManager), m_localUserUuid(localUserUuid),
+      m_resumeStore(localUserUuid), m_sendScheduler(FT_SCHEDULER_QUANTUM_BYTES), m_schedulerRunning(false),
+      m_rateLimitTimer(new QTimer(this)), m_globalRateLimited(false), m_writeBehindThreshold(DEFAULT_WRITE_BEHIND_FLUSH_THRESHOLD), m_directIOWrites(false),
+      m_compressionEnabled(true)
 {
     if (!m_networkManager) {
         qCritical() << "FileTransferManager initialized with a null NetworkManager!";
@@ -36,15 +52,35 @@ FileTransferManager::FileTransferManager(NetworkManager* networkManager, FileIOM
     // Connect signals from FileIOManager
     // 更新以匹配新的信号签名
     connect(m_fileIOManager, &FileIOManager::chunkReadCompleted, this, &FileTransferManager::handleChunkReadForSending);
+    connect(m_fileIOManager, &FileIOManager::chunkChecksumCompleted, this, &FileTransferManager::handleResumePrefixChecksum);
     connect(m_fileIOManager, &FileIOManager::chunkWrittenCompleted, this, &FileTransferManager::handleChunkWritten);
+    connect(m_fileIOManager, &FileIOManager::chunkCompressed, this, &FileTransferManager::handleChunkCompressedForSending);
+    connect(m_fileIOManager, &FileIOManager::chunkDecompressed, this, &FileTransferManager::handleChunkDecompressed);
+    // 二进制文件块不经过文本消息路径
+    connect(m_networkManager, &NetworkManager::fileChunkReceived, this, &FileTransferManager::handleIncomingFileChunk);
+    // 对端发送队列回落到低水位后恢复读取
+    connect(m_networkManager, &NetworkManager::peerWritable, this, &FileTransferManager::handlePeerWritable);
+    connect(m_networkManager, &NetworkManager::fileChunkSendFailed, this, &FileTransferManager::handleChunkSendFailed);
+    // 断线时暂停传输，重新连接后续传
+    connect(m_networkManager, &NetworkManager::peerConnected, this, &FileTransferManager::handlePeerConnected);
+    connect(m_networkManager, &NetworkManager::peerDisconnected, this, &FileTransferManager::handlePeerDisconnected);
+    // FT_ 控制消息由 NetworkManager 的分发表直接交给本对象
+    registerMessageHandlers();
+
+    m_rateLimitTimer->setSingleShot(true);
+    connect(m_rateLimitTimer, &QTimer::timeout, this, &FileTransferManager::resumeRateLimitedSends);
 }
 
 FileTransferManager::~FileTransferManager()
 {
+    // 先注销分发表中的处理函数，网络线程此后不再向本对象投递消息
+    unregisterMessageHandlers();
+
     // Clean up any active sessions
     m_sessions.clear();
     m_outstandingReadRequests.clear();
     m_outstandingWriteRequests.clear();
+    m_outstandingSpillWrites.clear();
 
     // 清理ACK定时器
     for (auto timer : m_ackDelayTimers) {
@@ -52,13 +88,17 @@ FileTransferManager::~FileTransferManager()
         timer->deleteLater();
     }
     m_ackDelayTimers.clear();
-    m_pendingAckCount.clear();
+    m_pendingAckBytes.clear();
 
     // 清理传输计时器
     for (auto timer : m_transferTimers) {
         delete timer;
     }
     m_transferTimers.clear();
+
+    qDeleteAll(m_writeBehindTimers);
+    m_writeBehindTimers.clear();
+    m_fanOutGroups.clear();
 }
 
 QString FileTransferManager::generateTransferID() const
@@ -80,7 +120,83 @@ QString FileTransferManager::requestSendFile(const QString& peerUuid, const QStr
         return QString();
     }
 
+    // TransferID 在调用线程中生成并立即返回，会话在传输线程中创建
     QString transferID = generateTransferID();
+    if (!isInTransferThread()) {
+        QMetaObject::invokeMethod(this, [=]() { startSendFile(peerUuid, filePath, transferID); }, Qt::QueuedConnection);
+    } else {
+        startSendFile(peerUuid, filePath, transferID);
+    }
+    return transferID;
+}
+
+QStringList FileTransferManager::requestSendFileToPeers(const QStringList& peerUuids, const QString& filePath)
+{
+    QStringList peers = peerUuids;
+    peers.removeDuplicates();
+    peers.removeAll(QString());
+    if (peers.size() <= 1) {
+        // 只有一个接收方时没有可共享的读取
+        QString transferID = peers.isEmpty() ? QString() : requestSendFile(peers.first(), filePath);
+        return transferID.isEmpty() ? QStringList() : QStringList{transferID};
+    }
+    if (!m_networkManager) {
+        qWarning() << "FileTransferManager::requestSendFileToPeers: NetworkManager is not available.";
+        return QStringList();
+    }
+
+    QFileInfo fileInfo(filePath);
+    if (!fileInfo.exists() || !fileInfo.isFile()) {
+        qWarning() << "FileTransferManager::requestSendFileToPeers: File does not exist or is not a file:" << filePath;
+        for (const QString& peerUuid : peers) {
+            emit fileTransferError("", peerUuid, tr("File not found or is invalid: %1").arg(filePath));
+        }
+        return QStringList();
+    }
+
+    QStringList transferIDs;
+    for (int i = 0; i < peers.size(); ++i) {
+        transferIDs.append(generateTransferID());
+    }
+    QString groupID = generateTransferID();
+    if (!isInTransferThread()) {
+        QMetaObject::invokeMethod(this, [=]() { startFanOutSend(peers, filePath, transferIDs, groupID); }, Qt::QueuedConnection);
+    } else {
+        startFanOutSend(peers, filePath, transferIDs, groupID);
+    }
+    return transferIDs;
+}
+
+void FileTransferManager::startFanOutSend(const QStringList& peerUuids, const QString& filePath, const QStringList& transferIDs, const QString& groupID)
+{
+    QString openError;
+    if (!m_fileIOManager->openTransferFile(groupID, filePath, TransferFile::ReadOnly, &openError)) {
+        // 各传输打开文件时会各自报告错误
+        qWarning() << "FileTransferManager: Cannot open" << filePath << "for shared reads:" << openError << ". Sending to each peer separately.";
+        for (int i = 0; i < peerUuids.size(); ++i) {
+            startSendFile(peerUuids.at(i), filePath, transferIDs.at(i));
+        }
+        return;
+    }
+
+    FanOutGroup group;
+    group.filePath = filePath;
+    // 各接收方必须使用相同的块边界: 不按单个对端的链路选择，大文件使用旧版对端的固定块大小，旧版接收方也能共享
+    group.chunkSize = alignChunkSize(qMin(DEFAULT_CHUNK_SIZE, QFileInfo(filePath).size() / FT_TARGET_CHUNKS_PER_FILE), FT_MAX_CHUNK_SIZE);
+    group.transferIDs = transferIDs;
+    m_fanOutGroups.insert(groupID, group);
+    m_outstandingReadRequests[groupID] = 0;
+    qInfo() << "FileTransferManager: Sending" << filePath << "to" << peerUuids.size() << "peers with shared reads. Group:" << groupID
+            << "ChunkSize:" << group.chunkSize;
+
+    for (int i = 0; i < peerUuids.size(); ++i) {
+        startSendFile(peerUuids.at(i), filePath, transferIDs.at(i), groupID);
+    }
+}
+
+void FileTransferManager::startSendFile(const QString& peerUuid, const QString& filePath, const QString& transferID, const QString& fanOutGroup)
+{
+    QFileInfo fileInfo(filePath);
     FileTransferSession session;
     session.transferID = transferID;
     session.peerUuid = peerUuid;
@@ -89,111 +205,157 @@ QString FileTransferManager::requestSendFile(const QString& peerUuid, const QStr
     session.isSender = true;
     session.state = FileTransferSession::Offered;
     session.localFilePath = filePath;
-    session.totalChunks = (session.fileSize + DEFAULT_CHUNK_SIZE - 1) / DEFAULT_CHUNK_SIZE;
+    session.fileID = fileIdentity(fileInfo);
+    // 初始块大小只是提议，收到 FT_ACCEPT 后按接收方的上限 (或旧版对端的固定大小) 确定
+    qint64 chunkSize = chooseInitialChunkSize(peerUuid, session.fileSize);
+    if (m_fanOutGroups.contains(fanOutGroup)) {
+        session.fanOutGroup = fanOutGroup;
+        chunkSize = m_fanOutGroups.value(fanOutGroup).chunkSize;
+    }
+    setChunkSize(session, 0, chunkSize);
+    // 提议压缩，收到 FT_ACCEPT 后按接收方的答复确定
+    session.compressChunks = shouldOfferCompression(peerUuid, session.fileName);
 
     m_sessions.insert(transferID, session);
 
-    sendFileOffer(peerUuid, transferID, session.fileName, session.fileSize);
+    sendFileOffer(peerUuid, transferID, session.fileName, session.fileSize, chunkSize, session.fileID, -1,
+                  session.compressChunks ? QString(FT_COMPRESSION_ZLIB) : QString());
     qInfo() << "FileTransferManager: Requested to send file" << session.fileName << "to" << peerUuid << "TransferID:" << transferID;
-    return transferID;
 }
 
-void FileTransferManager::sendFileOffer(const QString& peerUuid, const QString& transferID, const QString& fileName, qint64 fileSize)
+void FileTransferManager::sendFileOffer(const QString& peerUuid, const QString& transferID, const QString& fileName, qint64 fileSize, qint64 chunkSize,
+                                        const QString& fileID, qint64 resumeOffset, const QString& compression)
 {
-    QString offerMessage = FT_MSG_OFFER_FORMAT.arg(transferID).arg(fileName).arg(fileSize).arg(m_localUserUuid);
-    m_networkManager->sendMessage(peerUuid, offerMessage);
-    qDebug() << "FileTransferManager: Sent file offer to" << peerUuid << "TransferID:" << transferID << "FileName:" << fileName << "Size:" << fileSize;
+    FtOfferMessage offer;
+    offer.transferID = transferID;
+    offer.fileName = fileName;
+    offer.fileSize = fileSize;
+    offer.senderUuid = m_localUserUuid;
+    offer.chunkSize = chunkSize;
+    offer.fileID = fileID;
+    offer.resumeOffset = resumeOffset;
+    offer.compression = compression;
+    m_networkManager->sendControlMessage(peerUuid, offer);
+    qDebug() << "FileTransferManager: Sent file offer to" << peerUuid << "TransferID:" << transferID << "FileName:" << fileName << "Size:" << fileSize
+             << "ChunkSize:" << chunkSize << "ResumeOffset:" << resumeOffset << "Compression:" << compression;
 }
 
-void FileTransferManager::handleIncomingFileMessage(const QString& peerUuid, const QString& message)
+void FileTransferManager::registerMessageHandlers()
 {
-    
-    qDebug() << "FileTransferManager::handleIncomingFileMessage from" << peerUuid << "Type:" << (message.left(20));
+    MessageDispatcher *dispatcher = m_networkManager->getMessageDispatcher();
 
-    if (message.startsWith("<FT_OFFER")) {
-        QString transferID = extractMessageAttribute(message, "TransferID");
-        QString fileName = extractMessageAttribute(message, "FileName");
-        qint64 fileSize = extractMessageAttribute(message, "FileSize").toLongLong();
-        QString senderUuid = extractMessageAttribute(message, "SenderUUID");
+    dispatcher->registerHandler<FtOfferMessage>(this, [this](const QString& peerUuid, const FtOfferMessage& msg) {
+        if (msg.transferID.isEmpty() || msg.fileName.isEmpty() || msg.senderUuid.isEmpty() || msg.senderUuid != peerUuid) {
+            qWarning() << "FileTransferManager: Invalid FT_OFFER received from" << peerUuid << "TransferID:" << msg.transferID;
+            return;
+        }
+        if (msg.resumeOffset >= 0) {
+            handleResumeOffer(peerUuid, msg.transferID, msg.fileSize, msg.chunkSize, msg.fileID, msg.resumeOffset, msg.compression);
+        } else {
+            handleFileOffer(peerUuid, msg.transferID, msg.fileName, msg.fileSize, msg.chunkSize, msg.fileID, msg.compression);
+        }
+    });
 
-        if (transferID.isEmpty() || fileName.isEmpty() || senderUuid.isEmpty() || senderUuid != peerUuid) {
-            qWarning() << "FileTransferManager: Invalid FT_OFFER received:" << message;
+    dispatcher->registerHandler<FtAcceptMessage>(this, [this](const QString& peerUuid, const FtAcceptMessage& msg) {
+        if (msg.transferID.isEmpty() || msg.receiverUuid.isEmpty() || msg.receiverUuid != peerUuid) {
+            qWarning() << "FileTransferManager: Invalid FT_ACCEPT received from" << peerUuid << "TransferID:" << msg.transferID;
             return;
         }
-        handleFileOffer(peerUuid, transferID, fileName, fileSize);
+        handleFileAccept(peerUuid, msg.transferID, msg.savePathHint, msg.maxChunkSize, msg.compression);
+    });
 
-    } else if (message.startsWith("<FT_ACCEPT")) {
-        QString transferID = extractMessageAttribute(message, "TransferID");
-        QString receiverUuid = extractMessageAttribute(message, "ReceiverUUID");
-        QString savePathHint = extractMessageAttribute(message, "SavePathHint");
-        if (transferID.isEmpty() || receiverUuid.isEmpty() || receiverUuid != peerUuid) {
-            qWarning() << "FileTransferManager: Invalid FT_ACCEPT received:" << message;
+    dispatcher->registerHandler<FtRejectMessage>(this, [this](const QString& peerUuid, const FtRejectMessage& msg) {
+        if (msg.transferID.isEmpty() || msg.receiverUuid.isEmpty() || msg.receiverUuid != peerUuid) {
+            qWarning() << "FileTransferManager: Invalid FT_REJECT received from" << peerUuid << "TransferID:" << msg.transferID;
+            return;
+        }
+        handleFileReject(peerUuid, msg.transferID, msg.reason);
+    });
+
+    dispatcher->registerHandler<FtChunkMessage>(this, [this](const QString& peerUuid, const FtChunkMessage& msg) {
+        if (msg.transferID.isEmpty() || msg.data.isEmpty()) {
+            qWarning() << "FileTransferManager: Invalid FT_CHUNK received (empty ID or data) from" << peerUuid;
+            sendError(peerUuid, msg.transferID, "CHUNK_INVALID", "Received invalid chunk data (empty ID or data).");
+            return;
+        }
+        // 旧版对端以 Base64 文本发送数据块；分词器已直接从消息切片解码，之后与二进制路径共用后续流程
+        ReceivedChunk chunk;
+        chunk.buffer = msg.data;
+        chunk.dataSize = chunk.buffer.size();
+        chunk.fileOffset = msg.offset;
+        chunk.checksum = msg.checksum;
+        if (chunk.dataSize != msg.size) {
+            qWarning() << "FileTransferManager: FT_CHUNK size mismatch for" << msg.transferID << "chunk" << msg.chunkID
+                       << "Expected:" << msg.size << "Decoded:" << chunk.dataSize;
+            sendError(peerUuid, msg.transferID, "CHUNK_INVALID", "Decoded chunk size does not match declared size.");
             return;
         }
-        handleFileAccept(peerUuid, transferID, savePathHint);
+        handleFileChunk(peerUuid, msg.transferID, msg.chunkID, chunk);
+    });
 
-    } else if (message.startsWith("<FT_REJECT")) {
-        QString transferID = extractMessageAttribute(message, "TransferID");
-        QString reason = extractMessageAttribute(message, "Reason");
-        QString receiverUuid = extractMessageAttribute(message, "ReceiverUUID");
-        if (transferID.isEmpty() || receiverUuid.isEmpty() || receiverUuid != peerUuid) {
-            qWarning() << "FileTransferManager: Invalid FT_REJECT received:" << message;
+    dispatcher->registerHandler<FtDataAckMessage>(this, [this](const QString& peerUuid, const FtDataAckMessage& msg) {
+        if (msg.transferID.isEmpty() || msg.receiverUuid.isEmpty() || msg.receiverUuid != peerUuid) {
+            qWarning() << "FileTransferManager: Invalid FT_ACK_DATA received from" << peerUuid << "TransferID:" << msg.transferID;
             return;
         }
-        handleFileReject(peerUuid, transferID, reason);
-    } else if (message.startsWith("<FT_CHUNK")) {
-        QString transferID = extractMessageAttribute(message, "TransferID");
-        qint64 chunkID = extractMessageAttribute(message, "ChunkID").toLongLong();
-        qint64 originalChunkSize = extractMessageAttribute(message, "Size").toLongLong(); // This is the original binary size
-        QString dataB64 = extractMessageAttribute(message, "Data");
-        // QByteArray data = QByteArray::fromBase64(dataB64.toUtf8()); // 解码移至FileIOManager
-
-        if (transferID.isEmpty() || dataB64.isEmpty()) { // 移除了 data.size() != chunkSize 的检查
-            qWarning() << "FileTransferManager: Invalid FT_CHUNK received (empty ID or dataB64):" << message;
-            sendError(peerUuid, transferID, "CHUNK_INVALID", "Received invalid chunk data (empty ID or data).");
+        handleDataAck(peerUuid, msg.transferID, msg.chunkID, msg.sackBitmap, msg.receiveWindowBytes);
+    });
+
+    dispatcher->registerHandler<FtEofMessage>(this, [this](const QString& peerUuid, const FtEofMessage& msg) {
+        if (msg.transferID.isEmpty()) {
+            qWarning() << "FileTransferManager: Invalid FT_EOF received from" << peerUuid;
             return;
         }
-        handleFileChunk(peerUuid, transferID, chunkID, originalChunkSize, dataB64); // 传递QString dataB64 和 originalChunkSize
-    } else if (message.startsWith("<FT_ACK_DATA")) {
-        QString transferID = extractMessageAttribute(message, "TransferID");
-        qint64 ackedChunkID = extractMessageAttribute(message, "ChunkID").toLongLong();
-        QString ackingPeerUuid = extractMessageAttribute(message, "ReceiverUUID");
-        if (transferID.isEmpty() || ackingPeerUuid.isEmpty() || ackingPeerUuid != peerUuid) {
-            qWarning() << "FileTransferManager: Invalid FT_ACK_DATA received:" << message;
+        handleEOF(peerUuid, msg.transferID, msg.totalChunks, msg.finalChecksum);
+    });
+
+    dispatcher->registerHandler<FtEofAckMessage>(this, [this](const QString& peerUuid, const FtEofAckMessage& msg) {
+        if (msg.transferID.isEmpty() || msg.receiverUuid.isEmpty() || msg.receiverUuid != peerUuid) {
+            qWarning() << "FileTransferManager: Invalid FT_ACK_EOF received from" << peerUuid << "TransferID:" << msg.transferID;
             return;
         }
-        handleDataAck(peerUuid, transferID, ackedChunkID);
-    } else if (message.startsWith("<FT_EOF")) {
-        QString transferID = extractMessageAttribute(message, "TransferID");
-        qint64 totalChunks = extractMessageAttribute(message, "TotalChunks").toLongLong();
-        QString finalChecksum = extractMessageAttribute(message, "FinalChecksum");
-        if (transferID.isEmpty()) {
-            qWarning() << "FileTransferManager: Invalid FT_EOF received:" << message;
+        handleEOFAck(peerUuid, msg.transferID);
+    });
+
+    dispatcher->registerHandler<FtErrorMessage>(this, [this](const QString& peerUuid, const FtErrorMessage& msg) {
+        if (msg.transferID.isEmpty() || msg.originatorUuid.isEmpty() || msg.originatorUuid != peerUuid) {
+            qWarning() << "FileTransferManager: Invalid FT_ERROR received from" << peerUuid << "TransferID:" << msg.transferID;
             return;
         }
-        handleEOF(peerUuid, transferID, totalChunks, finalChecksum);
-    } else if (message.startsWith("<FT_ACK_EOF")) {
-        QString transferID = extractMessageAttribute(message, "TransferID");
-        QString ackingPeerUuid = extractMessageAttribute(message, "ReceiverUUID");
-        if (transferID.isEmpty() || ackingPeerUuid.isEmpty() || ackingPeerUuid != peerUuid) {
-            qWarning() << "FileTransferManager: Invalid FT_ACK_EOF received:" << message;
+        handleFileError(peerUuid, msg.transferID, msg.code, msg.message);
+    });
+
+    dispatcher->registerHandler<FtNackMessage>(this, [this](const QString& peerUuid, const FtNackMessage& msg) {
+        if (msg.transferID.isEmpty() || msg.receiverUuid.isEmpty() || msg.receiverUuid != peerUuid) {
+            qWarning() << "FileTransferManager: Invalid FT_NACK received from" << peerUuid << "TransferID:" << msg.transferID;
             return;
         }
-        handleEOFAck(peerUuid, transferID);
-    } else if (message.startsWith("<FT_ERROR")) {
-        QString transferID = extractMessageAttribute(message, "TransferID");
-        QString errorCode = extractMessageAttribute(message, "Code");
-        QString errorMsg = extractMessageAttribute(message, "Message");
-        QString originatorUuid = extractMessageAttribute(message, "OriginatorUUID");
-        if (transferID.isEmpty() || originatorUuid.isEmpty() || originatorUuid != peerUuid) {
-            qWarning() << "FileTransferManager: Invalid FT_ERROR received:" << message;
+        handleChunkNack(peerUuid, msg.transferID, msg.chunkID);
+    });
+
+    dispatcher->registerHandler<FtResumeMessage>(this, [this](const QString& peerUuid, const FtResumeMessage& msg) {
+        if (msg.transferID.isEmpty() || msg.receiverUuid.isEmpty() || msg.receiverUuid != peerUuid) {
+            qWarning() << "FileTransferManager: Invalid FT_RESUME received from" << peerUuid << "TransferID:" << msg.transferID;
             return;
         }
-        handleFileError(peerUuid, transferID, errorCode, errorMsg);
+        handleResumeRequest(peerUuid, msg.transferID, msg.fileID, msg.offset, msg.checksum);
+    });
+}
+
+void FileTransferManager::unregisterMessageHandlers()
+{
+    if (!m_networkManager)
+        return;
+    MessageDispatcher *dispatcher = m_networkManager->getMessageDispatcher();
+    for (MessageType type : {FtOfferMessage::Type, FtAcceptMessage::Type, FtRejectMessage::Type, FtChunkMessage::Type,
+                             FtDataAckMessage::Type, FtEofMessage::Type, FtEofAckMessage::Type, FtErrorMessage::Type,
+                             FtNackMessage::Type, FtResumeMessage::Type}) {
+        dispatcher->unregisterHandler(type);
     }
 }
 
-void FileTransferManager::handleFileOffer(const QString& peerUuid, const QString& transferID, const QString& fileName, qint64 fileSize)
+void FileTransferManager::handleFileOffer(const QString& peerUuid, const QString& transferID, const QString& fileName, qint64 fileSize, qint64 chunkSize, const QString& fileID,
+                                          const QString& compression)
 {
     if (m_sessions.contains(transferID)) {
         qWarning() << "FileTransferManager: Duplicate file offer for TransferID" << transferID << ". Ignoring.";
@@ -205,9 +367,15 @@ void FileTransferManager::handleFileOffer(const QString& peerUuid, const QString
     session.peerUuid = peerUuid;
     session.fileName = fileName;
     session.fileSize = fileSize;
+    session.fileID = fileID;
     session.isSender = false;
     session.state = FileTransferSession::Offered;
-    session.totalChunks = (fileSize + DEFAULT_CHUNK_SIZE - 1) / DEFAULT_CHUNK_SIZE;
+    // 提议了块大小的发送方会在传输中途调整块大小，完成与否按字节判断，totalChunks 只是估计
+    session.adaptiveChunks = chunkSize > 0;
+    session.maxChunkSize = session.adaptiveChunks ? FT_MAX_CHUNK_SIZE : DEFAULT_CHUNK_SIZE;
+    qint64 initialChunkSize = session.adaptiveChunks ? qMin(chunkSize, FT_MAX_CHUNK_SIZE) : DEFAULT_CHUNK_SIZE;
+    session.totalChunks = (fileSize + initialChunkSize - 1) / initialChunkSize;
+    session.compressChunks = m_compressionEnabled && compression == QLatin1String(FT_COMPRESSION_ZLIB);
     m_sessions.insert(transferID, session);
 
     qInfo() << "FileTransferManager: Received file offer for" << fileName << "from" << peerUuid << "TransferID:" << transferID;
@@ -216,6 +384,10 @@ void FileTransferManager::handleFileOffer(const QString& peerUuid, const QString
 
 void FileTransferManager::acceptFileOffer(const QString& transferID, const QString& savePath)
 {
+    if (!isInTransferThread()) {
+        QMetaObject::invokeMethod(this, [=]() { acceptFileOffer(transferID, savePath); }, Qt::QueuedConnection);
+        return;
+    }
     if (!m_sessions.contains(transferID)) {
         qWarning() << "FileTransferManager::acceptFileOffer: Unknown TransferID" << transferID;
         return;
@@ -225,16 +397,92 @@ void FileTransferManager::acceptFileOffer(const QString& transferID, const QStri
         qWarning() << "FileTransferManager::acceptFileOffer: Invalid state for TransferID" << transferID;
         return;
     }
+    QString openError;
+    const bool fileExisted = QFileInfo::exists(savePath);
+    if (!m_fileIOManager->openTransferFile(transferID, savePath, TransferFile::ReadWrite, &openError, m_directIOWrites)) {
+        qWarning() << "FileTransferManager::acceptFileOffer: Cannot open" << savePath << ":" << openError;
+        rejectFileOffer(transferID, tr("Cannot open file for writing: %1").arg(openError));
+        return;
+    }
+    // 预先分配完整文件大小: 磁盘空间不足时在接受阶段就失败，而不是传到一半；同时减少碎片
+    if (!m_fileIOManager->transferFile(transferID)->preallocate(session.fileSize, &openError)) {
+        qWarning() << "FileTransferManager::acceptFileOffer: Cannot preallocate" << savePath << ":" << openError;
+        // 不留下刚创建的空文件；原有的文件 (接收方选择覆盖) 只关闭，不删除
+        if (fileExisted) {
+            m_fileIOManager->closeTransferFile(transferID);
+        } else {
+            m_fileIOManager->removeTransferFile(transferID);
+        }
+        rejectFileOffer(transferID, tr("Not enough disk space: %1").arg(openError));
+        return;
+    }
     session.localFilePath = savePath;
     session.state = FileTransferSession::Accepted;
-    sendAcceptMessage(session.peerUuid, transferID, savePath);
+    sendAcceptMessage(session.peerUuid, transferID, savePath, session.adaptiveChunks ? session.maxChunkSize : 0,
+                      session.compressChunks ? QString(FT_COMPRESSION_ZLIB) : QString());
     qInfo() << "FileTransferManager: Accepted file offer for TransferID" << transferID << "from" << session.peerUuid << "Saving to:" << savePath;
 
     prepareToReceiveFile(transferID, savePath);
+    saveResumeManifest(m_sessions[transferID]);
+}
+
+void FileTransferManager::setTransferWeight(const QString& transferID, int weight)
+{
+    if (!isInTransferThread()) {
+        QMetaObject::invokeMethod(this, [=]() { setTransferWeight(transferID, weight); }, Qt::QueuedConnection);
+        return;
+    }
+    m_sendScheduler.setWeight(transferID, weight);
+    qInfo() << "FileTransferManager: Transfer" << transferID << "scheduling weight" << qMax(weight, 1);
+}
+
+void FileTransferManager::setRateLimits(const TransferRateLimits& limits)
+{
+    if (!isInTransferThread()) {
+        QMetaObject::invokeMethod(this, [=]() { setRateLimits(limits); }, Qt::QueuedConnection);
+        return;
+    }
+    m_rateLimiter.setLimits(limits);
+    qInfo() << "FileTransferManager: Rate limits global" << limits.globalBytesPerSecond << "B/s, per peer" << limits.perPeerBytesPerSecond
+            << "B/s, schedule" << limits.scheduleEnabled << limits.scheduleStart.toString("HH:mm") << "-" << limits.scheduleEnd.toString("HH:mm");
+    // 限速放宽或取消时不必等到原定的时间
+    m_rateLimitTimer->stop();
+    resumeRateLimitedSends();
+}
+
+void FileTransferManager::setCompressionEnabled(bool enabled)
+{
+    if (!isInTransferThread()) {
+        QMetaObject::invokeMethod(this, [=]() { setCompressionEnabled(enabled); }, Qt::QueuedConnection);
+        return;
+    }
+    m_compressionEnabled = enabled;
+    qInfo() << "FileTransferManager: Chunk compression" << (enabled ? "enabled" : "disabled");
+}
+
+bool FileTransferManager::shouldOfferCompression(const QString& peerUuid, const QString& fileName) const
+{
+    // 压缩的块以帧标志区分，旧版 (Base64 文本) 链路无法表示
+    return m_compressionEnabled && m_networkManager->isPeerUsingBinaryFrames(peerUuid) && !isLikelyCompressedFile(fileName);
+}
+
+void FileTransferManager::setWriteBehindOptions(qint64 flushThreshold, bool directIO)
+{
+    if (!isInTransferThread()) {
+        QMetaObject::invokeMethod(this, [=]() { setWriteBehindOptions(flushThreshold, directIO); }, Qt::QueuedConnection);
+        return;
+    }
+    m_writeBehindThreshold = qMax<qint64>(flushThreshold, 0);
+    m_directIOWrites = directIO;
+    qInfo() << "FileTransferManager: Write-behind threshold" << m_writeBehindThreshold << "bytes, direct I/O" << m_directIOWrites;
 }
 
 void FileTransferManager::rejectFileOffer(const QString& transferID, const QString& reason)
 {
+    if (!isInTransferThread()) {
+        QMetaObject::invokeMethod(this, [=]() { rejectFileOffer(transferID, reason); }, Qt::QueuedConnection);
+        return;
+    }
     if (!m_sessions.contains(transferID)) {
         qWarning() << "FileTransferManager::rejectFileOffer: Unknown TransferID" << transferID;
         return;
@@ -251,21 +499,31 @@ void FileTransferManager::rejectFileOffer(const QString& transferID, const QStri
     cleanupSession(transferID, false, tr("Rejected by user: %1").arg(reason));
 }
 
-void FileTransferManager::sendAcceptMessage(const QString& peerUuid, const QString& transferID, const QString& savePathHint)
+void FileTransferManager::sendAcceptMessage(const QString& peerUuid, const QString& transferID, const QString& savePathHint, qint64 maxChunkSize,
+                                            const QString& compression)
 {
-    QString acceptMessage = FT_MSG_ACCEPT_FORMAT.arg(transferID).arg(m_localUserUuid).arg(savePathHint);
-    m_networkManager->sendMessage(peerUuid, acceptMessage);
-    qDebug() << "FileTransferManager: Sent file accept to" << peerUuid << "TransferID:" << transferID;
+    FtAcceptMessage accept;
+    accept.transferID = transferID;
+    accept.receiverUuid = m_localUserUuid;
+    accept.savePathHint = savePathHint;
+    accept.maxChunkSize = maxChunkSize;
+    accept.compression = compression;
+    m_networkManager->sendControlMessage(peerUuid, accept);
+    qDebug() << "FileTransferManager: Sent file accept to" << peerUuid << "TransferID:" << transferID << "Compression:" << compression;
 }
 
 void FileTransferManager::sendRejectMessage(const QString& peerUuid, const QString& transferID, const QString& reason)
 {
-    QString rejectMessage = FT_MSG_REJECT_FORMAT.arg(transferID).arg(reason).arg(m_localUserUuid);
-    m_networkManager->sendMessage(peerUuid, rejectMessage);
+    FtRejectMessage reject;
+    reject.transferID = transferID;
+    reject.reason = reason;
+    reject.receiverUuid = m_localUserUuid;
+    m_networkManager->sendControlMessage(peerUuid, reject);
     qDebug() << "FileTransferManager: Sent file reject to" << peerUuid << "TransferID:" << transferID << "Reason:" << reason;
 }
 
-void FileTransferManager::handleFileAccept(const QString& peerUuid, const QString& transferID, const QString& savePathHint)
+void FileTransferManager::handleFileAccept(const QString& peerUuid, const QString& transferID, const QString& savePathHint, qint64 maxChunkSize,
+                                           const QString& compression)
 {
     Q_UNUSED(savePathHint);
     if (!m_sessions.contains(transferID)) {
@@ -283,7 +541,36 @@ void FileTransferManager::handleFileAccept(const QString& peerUuid, const QStrin
     }
 
     session.state = FileTransferSession::Accepted;
-    qInfo() << "FileTransferManager: File offer accepted by" << peerUuid << "for TransferID" << transferID;
+    // 旧版接收方按 DEFAULT_CHUNK_SIZE 推算块数和偏移，只能使用固定块大小
+    session.adaptiveChunks = maxChunkSize > 0;
+    if (session.adaptiveChunks) {
+        session.maxChunkSize = alignChunkSize(qMin(maxChunkSize, FT_MAX_CHUNK_SIZE), FT_MAX_CHUNK_SIZE);
+        if (session.chunkLayout.last().chunkSize > session.maxChunkSize) {
+            setChunkSize(session, 0, session.maxChunkSize);
+        }
+    } else {
+        session.maxChunkSize = DEFAULT_CHUNK_SIZE;
+        setChunkSize(session, 0, DEFAULT_CHUNK_SIZE);
+    }
+    session.chunkSizeCeiling = session.maxChunkSize;
+    if (!session.fanOutGroup.isEmpty() && session.chunkLayout.last().chunkSize != m_fanOutGroups.value(session.fanOutGroup).chunkSize) {
+        // 接收方的上限小于组的块大小，块边界与组内其他传输不同
+        leaveFanOutGroup(session.fanOutGroup, transferID);
+        session.fanOutGroup.clear();
+    }
+    // 只有接收方接受了提议的编码才压缩
+    session.compressChunks = session.compressChunks && compression == QLatin1String(FT_COMPRESSION_ZLIB);
+    // 断线或重启后接收方发来 FT_RESUME 时据此重新打开文件
+    SendResumeRecord record;
+    record.transferID = transferID;
+    record.peerUuid = peerUuid;
+    record.filePath = session.localFilePath;
+    record.fileID = session.fileID;
+    record.fileSize = session.fileSize;
+    m_resumeStore.saveSend(record);
+    qInfo() << "FileTransferManager: File offer accepted by" << peerUuid << "for TransferID" << transferID
+            << "ChunkSize:" << session.chunkLayout.last().chunkSize << "Adaptive:" << session.adaptiveChunks
+            << "Compression:" << session.compressChunks;
 
     startActualFileSend(transferID);
 }
@@ -320,10 +607,37 @@ void FileTransferManager::startActualFileSend(const QString& transferID) {
         return;
     }
 
+    // 整个传输期间保持文件打开，各块使用定位读取
+    QString openError;
+    if (!m_fileIOManager->openTransferFile(transferID, session.localFilePath, TransferFile::ReadOnly, &openError)) {
+        qWarning() << "FileTransferManager: Cannot open" << session.localFilePath << ":" << openError;
+        sendError(session.peerUuid, transferID, "FILE_OPEN_ERROR", openError);
+        cleanupSession(transferID, false, tr("File open error: %1").arg(openError));
+        return;
+    }
+
     session.state = FileTransferSession::Transferring;
     session.sendWindowBase = 0;
     session.nextChunkToSendInWindow = 0;
-    session.bytesTransferred = 0;
+    session.sackedChunks.clear();
+    session.sackedBytes = 0;
+    session.retransmitQueue.clear();
+    session.fastRetransmitted.clear();
+    session.sentChunks.clear();
+    session.sendOrderCounter = 0;
+    session.retransmittedChunks.clear();
+    session.chunkChecksums.clear();
+    session.chunkCorruptions.clear();
+    session.fileChecksum = session.resumeChecksum;
+    session.fileChecksumChunks = 0;
+    session.metrics = FileTransferMetrics();
+    session.metrics.chunkSize = session.chunkLayout.last().chunkSize;
+    session.congestion.reset(session.metrics.chunkSize);
+    // 第一个 ACK 之前沿用旧版接收方的固定窗口，新版接收方的窗口不小于它
+    session.peerWindowEndOffset = session.resumeOffset + FT_LEGACY_RECEIVE_WINDOW_CHUNKS * DEFAULT_CHUNK_SIZE;
+    session.appLimited = false;
+    session.sendClock.start();
+    session.bytesTransferred = session.resumeOffset;
     m_outstandingReadRequests[transferID] = 0;
 
     // 启动传输计时器
@@ -334,8 +648,13 @@ void FileTransferManager::startActualFileSend(const QString& transferID) {
         qInfo() << "[FTM] Transfer" << transferID << "timer started.";
     }
 
-    qInfo() << "FileTransferManager: Starting to send file" << session.fileName << "for TransferID" << transferID;
+    qInfo() << "FileTransferManager: Starting to send file" << session.fileName << "for TransferID" << transferID << "from offset" << session.resumeOffset;
     emit fileTransferStarted(transferID, session.peerUuid, session.fileName, true);
+    // 空文件 (或续传时接收方已有全部数据) 没有块可发，直接发送 EOF
+    if (session.totalChunks == 0) {
+        sendEOF(transferID);
+        return;
+    }
     processSendQueue(transferID);
 }
 
@@ -346,10 +665,27 @@ void FileTransferManager::prepareToReceiveFile(const QString& transferID, const
     session.state = FileTransferSession::Transferring;
     session.highestContiguousChunkReceived = -1;
     session.receivedOutOfOrderChunks.clear();
-    session.bytesTransferred = 0;
+    session.nextChunkToWrite = 0;
+    session.writeBehind.clear();
+    session.writeBehindBytes = 0;
+    session.writeInFlight = false;
+    // 续传时 [0, resumeOffset) 已在磁盘上
+    session.receivedContiguousBytes = session.resumeOffset;
+    session.outOfOrderBytes = 0;
+    session.writeInFlightBytes = 0;
+    session.spilledChunks.clear();
+    session.spilledBytes = 0;
+    session.spillWriteBytes = 0;
+    session.fileChecksum = session.resumeChecksum;
+    session.fileChecksumChunks = 0;
+    session.writeBehindChecksum = 0;
+    session.writeInFlightChecksum = 0;
+    session.bytesTransferred = session.resumeOffset;
     m_outstandingWriteRequests[transferID] = 0;
+    m_outstandingSpillWrites[transferID] = 0;
 
-    m_pendingAckCount[transferID] = 0; // 初始化ACK计数器
+    m_pendingAckBytes[transferID] = 0; // 初始化ACK计数器
+    session.receiveWindowEndOffset = session.bytesTransferred + receiveWindowBytes(session);
 
     // 启动传输计时器
     if (!m_transferTimers.contains(transferID)) {
@@ -371,80 +707,712 @@ void FileTransferManager::processSendQueue(const QString& transferID) {
         return;
     }
 
-    while (session.nextChunkToSendInWindow < session.sendWindowBase + DEFAULT_SEND_WINDOW_SIZE &&
-           session.nextChunkToSendInWindow < session.totalChunks &&
-           m_outstandingReadRequests.value(transferID, 0) < MAX_CONCURRENT_READS_PER_TRANSFER) {
-        
-        qint64 currentChunkID = session.nextChunkToSendInWindow;
-        qint64 offset = currentChunkID * DEFAULT_CHUNK_SIZE;
-        
-        qDebug() << "FileTransferManager: Requesting read for chunk" << currentChunkID << "for" << transferID;
-        m_fileIOManager->requestReadFileChunk(transferID, currentChunkID, session.localFilePath, offset, DEFAULT_CHUNK_SIZE);
-        
-        m_outstandingReadRequests[transferID]++;
-        session.nextChunkToSendInWindow++;
-    }
+    // 各传输轮流发出块 (可能先轮到其他传输)
+    m_sendScheduler.activate(transferID, session.peerUuid);
+    runSendScheduler();
+
+    // 窗口没有用满且不是被接收窗口挡住时 (包括受到限速)，之后的交付速率样本偏低
+    session.appLimited = (bytesInFlight(session) < session.congestion.congestionWindowBytes() &&
+                          chunkOffset(session, session.nextChunkToSendInWindow + 1) <= session.peerWindowEndOffset) ||
+                         m_globalRateLimited || m_rateLimitedTransfers.contains(transferID);
 
     qInfo() << "[FTM] processSendQueue: transferID=" << transferID
             << "sendWindowBase=" << session.sendWindowBase
             << "nextChunkToSendInWindow=" << session.nextChunkToSendInWindow
+            << "inflight=" << bytesInFlight(session)
+            << "cwnd=" << session.congestion.congestionWindowBytes()
+            << "peerWindowEndOffset=" << session.peerWindowEndOffset
+            << "chunkSize=" << session.chunkLayout.last().chunkSize
+            << "retransmitQueue=" << session.retransmitQueue.size()
             << "outstandingReads=" << m_outstandingReadRequests.value(transferID, 0);
 }
 
-void FileTransferManager::handleChunkReadForSending(const QString& transferID, qint64 chunkID, const QString& dataB64, qint64 originalSize, bool success, const QString& error) {
+void FileTransferManager::runSendScheduler() {
+    if (m_schedulerRunning) return;
+    m_schedulerRunning = true;
+    m_globalRateLimited = false;
+    while (!m_sendScheduler.isEmpty() && totalOutstandingReads() < FT_MAX_INFLIGHT_READS) {
+        const QString transferID = m_sendScheduler.current();
+        auto it = m_sessions.find(transferID);
+        qint64 cost = it != m_sessions.end() ? nextSendCost(transferID, it.value()) : -1;
+        if (cost < 0) {
+            // 再次 processSendQueue (ACK、读取完成、对端可写等) 时重新加入
+            m_sendScheduler.deactivate(transferID);
+            continue;
+        }
+        // 限速只作用于文件数据: 额度不足时该对端 (或全局受限时所有传输) 等到令牌桶补足
+        bool globalLimited = false;
+        qint64 delay = m_rateLimiter.delayMs(it->peerUuid, &globalLimited);
+        if (delay > 0) {
+            scheduleRateLimitRetry(delay);
+            if (globalLimited) {
+                m_globalRateLimited = true;
+                break; // 调度环保持原状，等待后从当前传输继续
+            }
+            m_sendScheduler.deactivate(transferID);
+            if (!m_rateLimitedTransfers.contains(transferID)) m_rateLimitedTransfers.append(transferID);
+            continue;
+        }
+        if (m_sendScheduler.consume(cost)) {
+            m_rateLimiter.consume(it->peerUuid, cost);
+            sendNextChunk(transferID, it.value());
+        }
+    }
+    m_schedulerRunning = false;
+}
+
+void FileTransferManager::scheduleRateLimitRetry(qint64 delayMs) {
+    if (m_rateLimitTimer->isActive() && m_rateLimitTimer->remainingTime() <= delayMs) return;
+    m_rateLimitTimer->start(int(qMin<qint64>(delayMs, FT_RATE_LIMIT_MAX_WAIT_MS)));
+}
+
+void FileTransferManager::resumeRateLimitedSends() {
+    const QList<QString> transferIDs = m_rateLimitedTransfers;
+    m_rateLimitedTransfers.clear();
+    for (const QString& transferID : transferIDs) {
+        auto it = m_sessions.constFind(transferID);
+        if (it != m_sessions.constEnd() && it->isSender && it->state == FileTransferSession::Transferring) {
+            m_sendScheduler.activate(transferID, it->peerUuid);
+        }
+    }
+    runSendScheduler();
+}
+
+qint64 FileTransferManager::nextSendCost(const QString& transferID, FileTransferSession& session) {
+    if (!session.isSender || session.state != FileTransferSession::Transferring) return -1;
+    // 对端发送队列超过高水位时不再发起新的读取，等待 peerWritable
+    if (!m_networkManager->isPeerWritable(session.peerUuid)) {
+        qDebug() << "FileTransferManager: Peer" << session.peerUuid << "not writable, deferring reads for" << transferID;
+        return -1;
+    }
+    if (m_outstandingReadRequests.value(transferID, 0) >= MAX_CONCURRENT_READS_PER_TRANSFER) return -1;
+
+    // 先重传丢失的块 (排队期间已被确认的直接丢弃)，再发送窗口内的新块
+    while (!session.retransmitQueue.isEmpty()) {
+        qint64 chunkID = session.retransmitQueue.first();
+        if (chunkID >= session.sendWindowBase && !session.sackedChunks.contains(chunkID)) {
+            return chunkBytes(session, chunkID);
+        }
+        session.retransmitQueue.removeFirst();
+    }
+    // 新块受拥塞窗口 (在途字节数) 和接收方通告窗口双重限制；块必须完整落在通告窗口内
+    if (session.nextChunkToSendInWindow < session.totalChunks &&
+        chunkOffset(session, session.nextChunkToSendInWindow + 1) <= session.peerWindowEndOffset &&
+        bytesInFlight(session) < session.congestion.congestionWindowBytes()) {
+        return chunkBytes(session, session.nextChunkToSendInWindow);
+    }
+    return -1;
+}
+
+void FileTransferManager::sendNextChunk(const QString& transferID, FileTransferSession& session) {
+    // 链路启用零拷贝时不再读取文件，直接把文件范围交给网络层，由内核从页缓存发往套接字。
+    // 尝试压缩的传输需要读出数据，放弃压缩后恢复零拷贝；一对多发送使用共享的读取缓冲区。
+    // 块的 CRC-32C 只能从读出的数据计算，链路要求块带有 CRC 时零拷贝需要再读一次文件，不如直接读取后发送
+    QSharedPointer<TransferFile> zeroCopyFile;
+    if (m_networkManager->isPeerZeroCopyEnabled(session.peerUuid) && !m_networkManager->isPeerChunkChecksumEnabled(session.peerUuid) &&
+        !session.compressChunks && session.fanOutGroup.isEmpty())
+        zeroCopyFile = m_fileIOManager->transferFile(transferID);
+
+    if (!session.retransmitQueue.isEmpty()) {
+        qint64 chunkID = session.retransmitQueue.takeFirst();
+        qDebug() << "FileTransferManager: Retransmitting chunk" << chunkID << "for" << transferID;
+        issueChunk(transferID, session, chunkID, zeroCopyFile);
+        return;
+    }
+    issueChunk(transferID, session, session.nextChunkToSendInWindow, zeroCopyFile);
+    session.nextChunkToSendInWindow++;
+}
+
+int FileTransferManager::totalOutstandingReads() const {
+    int total = 0;
+    for (int count : m_outstandingReadRequests) total += count;
+    return total;
+}
+
+int FileTransferManager::totalOutstandingWrites() const {
+    // 乱序块的直接写入另有上限，不占用 write-behind 的额度
+    int total = -totalOutstandingSpillWrites();
+    for (int count : m_outstandingWriteRequests) total += count;
+    return total;
+}
+
+int FileTransferManager::totalOutstandingSpillWrites() const {
+    int total = 0;
+    for (int count : m_outstandingSpillWrites) total += count;
+    return total;
+}
+
+void FileTransferManager::resumePendingWriteFlushes() {
+    while (!m_pendingWriteFlushes.isEmpty() && totalOutstandingWrites() < FT_MAX_INFLIGHT_WRITES) {
+        flushWriteBehind(m_pendingWriteFlushes.takeFirst(), true);
+    }
+}
+
+void FileTransferManager::issueChunk(const QString& transferID, FileTransferSession& session, qint64 chunkID, QSharedPointer<TransferFile>& zeroCopyFile) {
+    if (m_fanOutGroups.contains(session.fanOutGroup)) {
+        issueSharedChunk(transferID, session, chunkID);
+        return;
+    }
+    qint64 offset = chunkOffset(session, chunkID);
+    qint64 length = chunkBytes(session, chunkID);
+
+    if (zeroCopyFile) {
+        if (m_networkManager->sendFileChunkFromFile(session.peerUuid, transferID, chunkID, zeroCopyFile, offset, length)) {
+            recordChunkSent(session, chunkID);
+            if (chunkID == session.sendWindowBase) {
+                startRetransmissionTimer(transferID);
+            }
+            return;
+        }
+        zeroCopyFile.reset(); // 链路不再支持零拷贝，其余块改为读取后发送
+    }
+
+    qDebug() << "FileTransferManager: Requesting read for chunk" << chunkID << "for" << transferID;
+    m_fileIOManager->requestReadFileChunk(transferID, chunkID, session.localFilePath, offset, length);
+    m_outstandingReadRequests[transferID]++;
+}
+
+void FileTransferManager::issueSharedChunk(const QString& transferID, FileTransferSession& session, qint64 chunkID) {
+    const QString groupID = session.fanOutGroup;
+    FanOutGroup& group = m_fanOutGroups[groupID];
+    auto it = group.chunks.find(chunkID);
+    if (it != group.chunks.end()) {
+        // 其他传输已读出 (或正在读取) 该块
+        group.sharedDeliveries++;
+        session.metrics.sharedChunks++;
+        if (!it->reading) {
+            const QByteArray data = it->data;
+            dispatchChunkData(transferID, session, chunkID, data, it->checksum);
+            return;
+        }
+    } else {
+        SharedSendChunk chunk;
+        chunk.length = chunkBytes(session, chunkID);
+        it = group.chunks.insert(chunkID, chunk);
+        group.cachedBytes += chunk.length;
+        group.readChunks++;
+        qDebug() << "FileTransferManager: Requesting shared read for chunk" << chunkID << "of group" << groupID;
+        m_fileIOManager->requestReadFileChunk(groupID, chunkID, group.filePath, chunkOffset(session, chunkID), chunk.length);
+        m_outstandingReadRequests[groupID]++;
+    }
+    it->waiters.append(qMakePair(transferID, chunkID));
+    // 可能使本传输退出共享，它等待的块读完后仍照常发出
+    trimFanOutCache(groupID);
+}
+
+void FileTransferManager::handleSharedChunkRead(const QString& groupID, qint64 chunkID, const QByteArray& data, quint32 checksum, bool success, const QString& error) {
+    m_outstandingReadRequests[groupID]--;
+    FanOutGroup& group = m_fanOutGroups[groupID];
+    QList<QPair<QString, qint64>> waiters;
+    auto it = group.chunks.find(chunkID);
+    if (it != group.chunks.end()) {
+        waiters = it->waiters;
+        it->waiters.clear();
+    }
+    QString readError = error;
+    if (success && it != group.chunks.end() && data.size() != it->length) {
+        // 文件在传输期间被修改，块边界已不成立
+        readError = tr("File changed during transfer.");
+    }
+    const bool valid = readError.isEmpty() && success;
+    if (it != group.chunks.end()) {
+        if (valid) {
+            it->data = data;
+            it->checksum = checksum;
+            it->reading = false;
+        } else {
+            group.cachedBytes -= it->length;
+            group.chunks.erase(it);
+        }
+    }
+
+    // 出错的传输会被清理，之后不再使用 group
+    QStringList notified;
+    for (const auto& waiter : waiters) {
+        auto session = m_sessions.find(waiter.first);
+        if (session == m_sessions.end() || !session->isSender) continue;
+        if (!valid) {
+            qWarning() << "FileTransferManager: Failed to read shared chunk" << chunkID << "for" << waiter.first << ":" << readError;
+            sendError(session->peerUuid, waiter.first, "FILE_READ_ERROR_ASYNC", readError);
+            cleanupSession(waiter.first, false, tr("File read error: %1").arg(readError));
+            continue;
+        }
+        if (session->state != FileTransferSession::Transferring && session->state != FileTransferSession::WaitingForAck) continue;
+        if (waiter.second < session->sendWindowBase || session->sackedChunks.contains(waiter.second)) continue;
+        dispatchChunkData(waiter.first, *session, waiter.second, data, checksum);
+        if (!notified.contains(waiter.first)) notified.append(waiter.first);
+    }
+    for (const QString& transferID : notified) {
+        processSendQueue(transferID);
+    }
+    trimFanOutCache(groupID);
+    maybeRemoveFanOutGroup(groupID);
+    runSendScheduler(); // 读取名额交给其他传输
+}
+
+SharedSendChunk* FileTransferManager::sharedChunk(const FileTransferSession& session, qint64 chunkID) {
+    auto group = m_fanOutGroups.find(session.fanOutGroup);
+    if (session.fanOutGroup.isEmpty() || group == m_fanOutGroups.end()) return nullptr;
+    auto it = group->chunks.find(chunkID);
+    return it != group->chunks.end() && !it->reading ? &it.value() : nullptr;
+}
+
+void FileTransferManager::trimFanOutCache(const QString& groupID) {
+    auto group = m_fanOutGroups.find(groupID);
+    if (group == m_fanOutGroups.end()) return;
+    while (true) {
+        // 各传输仍可能发送的最小块号: 未开始发送的传输需要从头开始的全部数据
+        qint64 neededFrom = std::numeric_limits<qint64>::max();
+        QString slowest;
+        for (const QString& transferID : group->transferIDs) {
+            auto session = m_sessions.constFind(transferID);
+            if (session == m_sessions.constEnd()) continue;
+            qint64 pinned = (session->state == FileTransferSession::Transferring || session->state == FileTransferSession::WaitingForAck)
+                                ? session->sendWindowBase : 0;
+            if (pinned < neededFrom) {
+                neededFrom = pinned;
+                slowest = transferID;
+            }
+        }
+        for (auto it = group->chunks.begin(); it != group->chunks.end() && it.key() < neededFrom;) {
+            if (it->reading) {
+                ++it; // 读取完成后再释放
+                continue;
+            }
+            group->cachedBytes -= it->length + it->compressed.size();
+            it = group->chunks.erase(it);
+        }
+        if (group->cachedBytes <= FT_FANOUT_CACHE_BYTES || group->transferIDs.size() <= 1) break;
+
+        qInfo() << "FileTransferManager: Shared read buffers of group" << groupID << "exceed" << FT_FANOUT_CACHE_BYTES
+                << "bytes. Slowest transfer" << slowest << "at chunk" << neededFrom << "continues with its own reads.";
+        group->transferIDs.removeAll(slowest);
+        auto session = m_sessions.find(slowest);
+        if (session != m_sessions.end()) session->fanOutGroup.clear();
+    }
+}
+
+void FileTransferManager::leaveFanOutGroup(const QString& groupID, const QString& transferID) {
+    auto group = m_fanOutGroups.find(groupID);
+    if (group == m_fanOutGroups.end()) return;
+    group->transferIDs.removeAll(transferID);
+    trimFanOutCache(groupID);
+    maybeRemoveFanOutGroup(groupID);
+}
+
+void FileTransferManager::maybeRemoveFanOutGroup(const QString& groupID) {
+    auto group = m_fanOutGroups.find(groupID);
+    if (group == m_fanOutGroups.end() || !group->transferIDs.isEmpty() || m_outstandingReadRequests.value(groupID, 0) > 0) return;
+    qInfo() << "[FTM] Fan-out group" << groupID << "read" << group->readChunks << "chunks, reused shared buffers" << group->sharedDeliveries << "times";
+    m_fanOutGroups.erase(group);
+    m_outstandingReadRequests.remove(groupID);
+    m_fileIOManager->closeTransferFile(groupID);
+    chunkBufferPool().forgetTransfer(groupID);
+}
+
+void FileTransferManager::dispatchChunkData(const QString& transferID, FileTransferSession& session, qint64 chunkID, const QByteArray& data, quint32 checksum) {
+    recordChunkChecksum(session, chunkID, checksum);
+    if (!session.compressChunks) {
+        transmitChunk(transferID, session, chunkID, data, checksum, false);
+        return;
+    }
+    // 一对多发送时其他接收方可能已压缩过同一块
+    if (const SharedSendChunk* shared = sharedChunk(session, chunkID); shared && shared->compressionTried) {
+        const bool compressed = !shared->compressed.isEmpty();
+        const QByteArray encoded = compressed ? shared->compressed : data;
+        recordCompressionResult(session, chunkID, encoded.size(), compressed, shared->compressionSkipped);
+        transmitChunk(transferID, session, chunkID, encoded, checksum, compressed);
+        return;
+    }
+    // 在工作线程中压缩后再发出，期间继续占用该块的读取名额
+    m_fileIOManager->requestCompressChunk(transferID, chunkID, data, checksum);
+    m_outstandingReadRequests[transferID]++;
+}
+
+void FileTransferManager::transmitChunk(const QString& transferID, FileTransferSession& session, qint64 chunkID, const QByteArray& data, quint32 checksum, bool compressed) {
+    sendChunkData(transferID, chunkID, data, checksum, compressed);
+    recordChunkSent(session, chunkID, data.size());
+
+    if (chunkID == session.sendWindowBase) {
+        startRetransmissionTimer(transferID);
+    }
+}
+
+void FileTransferManager::recordCompressionResult(FileTransferSession& session, qint64 chunkID, qint64 wireBytes, bool compressed, bool skipped) {
+    if (compressed) {
+        session.metrics.compressedChunks++;
+        session.uncompressedRun = 0;
+        // 限速按链路上的字节计算，压缩节省的部分退回
+        m_rateLimiter.refund(session.peerUuid, chunkBytes(session, chunkID) - wireBytes);
+        return;
+    }
+    if (skipped) session.metrics.incompressibleChunks++;
+    if (session.compressChunks && ++session.uncompressedRun >= FT_COMPRESSION_GIVE_UP_CHUNKS) {
+        session.compressChunks = false;
+        qInfo() << "FileTransferManager: Data of" << session.transferID << "does not compress. Sending the remaining chunks uncompressed.";
+    }
+}
+
+void FileTransferManager::recordChunkSent(FileTransferSession& session, qint64 chunkID, qint64 wireBytes) {
+    const qint64 payloadBytes = chunkBytes(session, chunkID);
+    recordChunkBytes(session, payloadBytes, wireBytes >= 0 ? wireBytes : payloadBytes);
+    if (session.sentChunks.contains(chunkID)) {
+        session.retransmittedChunks.insert(chunkID);
+        session.metrics.retransmittedChunks++;
+    }
+    SentChunkInfo info;
+    info.sendOrder = session.sendOrderCounter++;
+    info.sentAtMs = session.sendClock.elapsed();
+    info.deliveredAtSend = session.congestion.deliveredBytes();
+    info.deliveredTimeAtSend = session.congestion.deliveredTimeMs();
+    info.appLimited = session.appLimited;
+    session.sentChunks.insert(chunkID, info);
+}
+
+void FileTransferManager::recordChunkBytes(FileTransferSession& session, qint64 payloadBytes, qint64 wireBytes) {
+    FileTransferMetrics& metrics = session.metrics;
+    metrics.chunkPayloadBytes += payloadBytes;
+    metrics.chunkWireBytes += wireBytes;
+    if (metrics.chunkPayloadBytes > 0 && metrics.chunkWireBytes > 0) {
+        metrics.compressionRatio = double(metrics.chunkWireBytes) / double(metrics.chunkPayloadBytes);
+        metrics.effectiveThroughputGain = double(metrics.chunkPayloadBytes) / double(metrics.chunkWireBytes);
+    }
+}
+
+void FileTransferManager::recordChunkChecksum(FileTransferSession& session, qint64 chunkID, quint32 checksum) {
+    if (session.chunkChecksums.contains(chunkID)) {
+        return; // 重传时再次读取的数据只用于该次发送
+    }
+    session.chunkChecksums.insert(chunkID, checksum);
+    // 读取按完成顺序返回，只有从文件开头连续的部分能并入整个文件的 CRC
+    while (session.fileChecksumChunks >= 0) {
+        auto it = session.chunkChecksums.constFind(session.fileChecksumChunks);
+        if (it == session.chunkChecksums.constEnd()) break;
+        session.fileChecksum = crc32cCombine(session.fileChecksum, *it, chunkBytes(session, session.fileChecksumChunks));
+        session.fileChecksumChunks++;
+    }
+}
+
+qint64 FileTransferManager::chunkOffset(const FileTransferSession& session, qint64 chunkID) const {
+    // 段数很少 (只在块大小改变时增加)，从最后一段向前找
+    for (int i = session.chunkLayout.size() - 1; i >= 0; --i) {
+        const ChunkLayoutSegment& segment = session.chunkLayout.at(i);
+        if (chunkID >= segment.firstChunkID) {
+            return qMin(session.fileSize, segment.firstOffset + (chunkID - segment.firstChunkID) * segment.chunkSize);
+        }
+    }
+    return session.resumeOffset; // 布局为空: 块 0 从续传偏移开始
+}
+
+qint64 FileTransferManager::chunkBytes(const FileTransferSession& session, qint64 chunkID) const {
+    return chunkOffset(session, chunkID + 1) - chunkOffset(session, chunkID);
+}
+
+void FileTransferManager::setChunkSize(FileTransferSession& session, qint64 firstChunkID, qint64 chunkSize) {
+    ChunkLayoutSegment segment;
+    segment.firstChunkID = firstChunkID;
+    segment.firstOffset = chunkOffset(session, firstChunkID);
+    segment.chunkSize = chunkSize;
+    while (!session.chunkLayout.isEmpty() && session.chunkLayout.last().firstChunkID >= firstChunkID) {
+        session.chunkLayout.removeLast();
+    }
+    session.chunkLayout.append(segment);
+    session.totalChunks = firstChunkID + (session.fileSize - segment.firstOffset + chunkSize - 1) / chunkSize;
+}
+
+qint64 FileTransferManager::chooseInitialChunkSize(const QString& peerUuid, qint64 fileSize) const {
+    // 上次传输结束时的块大小反映了该链路的 BDP；没有记录时从旧的固定大小开始
+    qint64 chunkSize = m_peerChunkSizeHints.value(peerUuid, DEFAULT_CHUNK_SIZE);
+    return alignChunkSize(qMin(chunkSize, fileSize / FT_TARGET_CHUNKS_PER_FILE), FT_MAX_CHUNK_SIZE);
+}
+
+void FileTransferManager::maybeAdjustChunkSize(const QString& transferID, FileTransferSession& session) {
+    // 带宽和 minRtt 估计稳定 (进入 ProbeBW) 之后才调整
+    // 一对多发送的各传输共用块边界，不按单个链路调整
+    if (!session.adaptiveChunks || !session.fanOutGroup.isEmpty() || session.congestion.phase() != TransferCongestionController::ProbeBandwidth ||
+        session.nextChunkToSendInWindow >= session.totalChunks) {
+        return;
+    }
+    // 超时降低的上限不是永久的: 链路恢复 (连续若干 RTT 无超时) 后逐步放宽，每次翻倍
+    if (session.chunkSizeCeiling < session.maxChunkSize) {
+        qint64 nowMs = session.sendClock.elapsed();
+        qint64 recoveryMs = qMax<qint64>(static_cast<qint64>(session.metrics.srttMs), FT_MIN_RTO_MS) * FT_CHUNK_CEILING_RECOVERY_RTTS;
+        if (nowMs - session.chunkSizeCeilingChangedMs >= recoveryMs) {
+            session.chunkSizeCeiling = alignChunkSize(session.chunkSizeCeiling * 2, session.maxChunkSize);
+            session.chunkSizeCeilingChangedMs = nowMs;
+            qInfo() << "FileTransferManager: Chunk size ceiling for" << transferID << "recovered to" << session.chunkSizeCeiling << "bytes";
+        }
+    }
+    qint64 current = session.chunkLayout.last().chunkSize;
+    qint64 target = alignChunkSize(session.congestion.estimatedBdpBytes() / FT_TARGET_CHUNKS_PER_BDP, session.chunkSizeCeiling);
+    // 相差不到一倍时保持不变，避免来回调整
+    if (target < current * 2 && target * 2 > current) {
+        return;
+    }
+    setChunkSize(session, session.nextChunkToSendInWindow, target);
+    session.congestion.setChunkSize(target);
+    session.metrics.chunkSize = target;
+    session.metrics.chunkSizeChanges++;
+    qInfo() << "FileTransferManager: Chunk size for" << transferID << "changed from" << current << "to" << target
+            << "bytes starting at chunk" << session.nextChunkToSendInWindow << "BDP:" << session.congestion.estimatedBdpBytes();
+}
+
+qint64 FileTransferManager::bytesInFlight(const FileTransferSession& session) const {
+    qint64 bytes = chunkOffset(session, session.nextChunkToSendInWindow) - chunkOffset(session, session.sendWindowBase) - session.sackedBytes;
+    return qMax<qint64>(bytes, 0);
+}
+
+void FileTransferManager::updateRttEstimate(FileTransferSession& session, qint64 rttMs) {
+    FileTransferMetrics& m = session.metrics;
+    double r = static_cast<double>(rttMs);
+    if (m.rttSamples == 0) {
+        m.srttMs = r;
+        m.rttVarMs = r / 2.0;
+    } else {
+        m.rttVarMs = 0.75 * m.rttVarMs + 0.25 * qAbs(m.srttMs - r);
+        m.srttMs = 0.875 * m.srttMs + 0.125 * r;
+    }
+    m.rttSamples++;
+    // RTO = SRTT + max(G, 4 * RTTVAR)，时钟粒度 G 为 1ms
+    m.rtoMs = qBound(FT_MIN_RTO_MS, static_cast<qint64>(m.srttMs + qMax(1.0, 4.0 * m.rttVarMs)), FT_MAX_RTO_MS);
+}
+
+void FileTransferManager::reportProgress(const QString& transferID, qint64 bytesTransferred, qint64 totalSize) {
+    QElapsedTimer& throttle = m_progressThrottle[transferID];
+    if (bytesTransferred < totalSize && throttle.isValid() && throttle.elapsed() < FT_PROGRESS_UPDATE_INTERVAL_MS) {
+        return;
+    }
+    throttle.start();
+    emit fileTransferProgress(transferID, bytesTransferred, totalSize);
+    auto it = m_sessions.find(transferID);
+    if (it == m_sessions.end()) return;
+    ChunkBufferPool::Stats buffers = chunkBufferPool().transferStats(transferID);
+    it->metrics.bufferAllocations = buffers.allocations;
+    it->metrics.bufferReuses = buffers.reuses;
+    if (!it->isSender) {
+        it->metrics.receiveBufferedBytes = receiveBufferedBytes(*it);
+        it->metrics.receiveBudgetUsedBytes = totalReceiveBufferedBytes();
+    }
+    emit fileTransferMetricsUpdated(transferID, it->metrics);
+}
+
+void FileTransferManager::handlePeerWritable(const QString& peerUuid) {
+    const QStringList transferIDs = m_sessions.keys();
+    for (const QString& transferID : transferIDs) {
+        auto it = m_sessions.constFind(transferID);
+        if (it == m_sessions.constEnd()) continue;
+        if (it->isSender && it->peerUuid == peerUuid && it->state == FileTransferSession::Transferring) {
+            processSendQueue(transferID);
+        }
+    }
+}
+
+void FileTransferManager::handleChunkSendFailed(const QString& peerUuid, const QString& transferID, qint64 chunkID, const QString& error) {
+    auto it = m_sessions.constFind(transferID);
+    if (it == m_sessions.constEnd() || !it->isSender || it->peerUuid != peerUuid) return;
+
+    // 已发出的块以零填充，不能让接收方把它当作有效数据
+    qWarning() << "FileTransferManager: Failed to send chunk" << chunkID << "for" << transferID << "from file:" << error;
+    sendError(peerUuid, transferID, "FILE_READ_ERROR_ASYNC", error);
+    cleanupSession(transferID, false, tr("File read error: %1").arg(error));
+}
+
+void FileTransferManager::handleChunkReadForSending(const QString& transferID, qint64 chunkID, const QByteArray& data, quint32 checksum, bool success, const QString& error) {
+    // 读取缓冲区交还缓冲池: 网络发送队列中的引用释放 (块已写出) 后才会被再次取出
+    chunkBufferPool().release(data);
+    if (m_fanOutGroups.contains(transferID)) {
+        handleSharedChunkRead(transferID, chunkID, data, checksum, success, error);
+        return;
+    }
+    if (!m_sessions.contains(transferID)) {
+        if (m_outstandingReadRequests.contains(transferID)) m_outstandingReadRequests[transferID]--;
+        return;
+    }
+    m_outstandingReadRequests[transferID]--;
+    FileTransferSession& session = m_sessions[transferID];
+
+    if (!success) {
+        qWarning() << "FileTransferManager: Failed to read chunk" << chunkID << "for" << transferID << ":" << error;
+        sendError(session.peerUuid, transferID, "FILE_READ_ERROR_ASYNC", error);
+        cleanupSession(transferID, false, tr("File read error: %1").arg(error));
+        return;
+    }
+
+    if (session.state != FileTransferSession::Transferring && session.state != FileTransferSession::WaitingForAck) {
+         qWarning() << "FileTransferManager::handleChunkReadForSending: Session" << transferID << "not in transferable state. Chunk" << chunkID;
+         runSendScheduler(); // 读取名额交给其他传输
+         return;
+    }
+    
+    if (chunkID < session.sendWindowBase || session.sackedChunks.contains(chunkID)) {
+        qDebug() << "FileTransferManager: Ignoring stale read for chunk" << chunkID << "(sendWindowBase is" << session.sendWindowBase << ")";
+        processSendQueue(transferID);
+        return;
+    }
+
+    if (data.size() != chunkBytes(session, chunkID)) {
+        // 文件在传输期间被修改，块边界已不成立
+        qWarning() << "FileTransferManager: Short read for chunk" << chunkID << "of" << transferID << "Expected:" << chunkBytes(session, chunkID) << "Read:" << data.size();
+        sendError(session.peerUuid, transferID, "FILE_READ_ERROR_ASYNC", "File changed during transfer.");
+        cleanupSession(transferID, false, tr("File read error: %1").arg(tr("File changed during transfer.")));
+        return;
+    }
+
+    dispatchChunkData(transferID, session, chunkID, data, checksum);
+    processSendQueue(transferID);
+}
+
+void FileTransferManager::handleChunkCompressedForSending(const QString& transferID, qint64 chunkID, const QByteArray& data, quint32 checksum,
+                                                          bool compressed, bool skipped) {
+    if (!m_sessions.contains(transferID)) {
+        if (m_outstandingReadRequests.contains(transferID)) m_outstandingReadRequests[transferID]--;
+        return;
+    }
+    m_outstandingReadRequests[transferID]--;
+    FileTransferSession& session = m_sessions[transferID];
+    if (session.state != FileTransferSession::Transferring && session.state != FileTransferSession::WaitingForAck) {
+        runSendScheduler();
+        return;
+    }
+    if (chunkID < session.sendWindowBase || session.sackedChunks.contains(chunkID)) {
+        processSendQueue(transferID);
+        return;
+    }
+
+    // 一对多发送: 其他协商了压缩的接收方直接使用这次的结果
+    if (SharedSendChunk* shared = sharedChunk(session, chunkID); shared && !shared->compressionTried) {
+        shared->compressionTried = true;
+        shared->compressionSkipped = skipped;
+        shared->compressed = compressed ? data : QByteArray();
+        m_fanOutGroups[session.fanOutGroup].cachedBytes += shared->compressed.size();
+    }
+    recordCompressionResult(session, chunkID, data.size(), compressed, skipped);
+    transmitChunk(transferID, session, chunkID, data, checksum, compressed);
+    processSendQueue(transferID);
+}
+
+void FileTransferManager::handleResumePrefixChecksum(const QString& transferID, qint64 chunkID, quint32 checksum, bool success, const QString& error) {
     if (!m_sessions.contains(transferID)) {
         if (m_outstandingReadRequests.contains(transferID)) m_outstandingReadRequests[transferID]--;
         return;
     }
     m_outstandingReadRequests[transferID]--;
     FileTransferSession& session = m_sessions[transferID];
+    if (chunkID != RESUME_PREFIX_CHUNK_ID || !session.isSender || session.state != FileTransferSession::Offered) return;
 
-    if (!success) {
-        qWarning() << "FileTransferManager: Failed to read chunk" << chunkID << "for" << transferID << ":" << error;
-        sendError(session.peerUuid, transferID, "FILE_READ_ERROR_ASYNC", error);
-        cleanupSession(transferID, false, tr("File read error: %1").arg(error));
-        return;
+    // 接收方已有的数据与本端文件不符 (或无法读取) 时从头发送
+    if (!success || checksum != session.resumeChecksum) {
+        qWarning() << "FileTransferManager: Resume prefix of" << transferID << "does not match the local file" << error << ". Restarting from the beginning.";
+        session.resumeOffset = 0;
+        session.resumeChecksum = 0;
     }
+    sendResumeOffer(transferID);
+    runSendScheduler();
+}
 
-    if (session.state != FileTransferSession::Transferring && session.state != FileTransferSession::WaitingForAck) {
-         qWarning() << "FileTransferManager::handleChunkReadForSending: Session" << transferID << "not in transferable state. Chunk" << chunkID;
-         return;
+void FileTransferManager::sendChunkData(const QString& transferID, qint64 chunkID, const QByteArray& data, quint32 checksum, bool compressed) {
+    if (!m_sessions.contains(transferID)) return;
+    FileTransferSession& session = m_sessions[transferID];
+
+    qint64 offset = chunkOffset(session, chunkID);
+    if (m_networkManager->sendFileChunk(session.peerUuid, transferID, chunkID, offset, checksum, data, compressed)) {
+        qDebug() << "FileTransferManager: Sent binary chunk" << chunkID << "for" << transferID << "Size:" << data.size() << "Compressed:" << compressed;
+        return;
     }
-    
-    if (chunkID < session.sendWindowBase) {
-        qDebug() << "FileTransferManager: Ignoring stale read for chunk" << chunkID << "(sendWindowBase is" << session.sendWindowBase << ")";
-        processSendQueue(transferID);
+    if (compressed) {
+        // 压缩只在二进制帧链路上协商，链路断开会中断传输，不应走到这里
+        qWarning() << "FileTransferManager: Cannot send compressed chunk" << chunkID << "of" << transferID << "without binary frames.";
         return;
     }
 
-    sendChunkData(transferID, chunkID, dataB64, originalSize); // 传递 dataB64 和 originalSize
+    // 对端仅支持旧版分帧，回退为 Base64 文本
+    FtChunkMessage chunk;
+    chunk.transferID = transferID;
+    chunk.chunkID = chunkID;
+    chunk.size = data.size();
+    chunk.data = data;
+    chunk.offset = offset;
+    chunk.checksum = checksum;
+    m_networkManager->sendControlMessage(session.peerUuid, chunk);
+    qDebug() << "FileTransferManager: Sent Base64 chunk" << chunkID << "for" << transferID << "OriginalSize:" << data.size();
+}
 
-    if (chunkID == session.sendWindowBase) {
-        startRetransmissionTimer(transferID);
+void FileTransferManager::handleIncomingFileChunk(const QString& peerUuid, const QString& transferID, qint64 chunkID, qint64 fileOffset, qint64 checksum,
+                                                  const QByteArray& payload, qsizetype dataOffset, bool compressed) {
+    ReceivedChunk chunk;
+    chunk.buffer = payload;
+    chunk.dataOffset = dataOffset;
+    chunk.dataSize = payload.size() - dataOffset;
+    chunk.fileOffset = fileOffset;
+    chunk.checksum = checksum;
+
+    auto it = m_sessions.find(transferID);
+    if (it != m_sessions.end() && !it->isSender && it->peerUuid == peerUuid) {
+        if (compressed && !it->compressChunks) {
+            qWarning() << "FileTransferManager::handleIncomingFileChunk: Compressed chunk" << chunkID << "for" << transferID << "but compression was not negotiated.";
+            sendError(peerUuid, transferID, "CHUNK_INVALID", "Compressed chunk received but compression was not negotiated.");
+            cleanupSession(transferID, false, tr("Invalid chunk received from peer."));
+            return;
+        }
+        if (!compressed) {
+            recordChunkBytes(*it, chunk.dataSize, chunk.dataSize);
+        }
+        if (compressed || !it->decompressQueue.isEmpty()) {
+            // 压缩的块在工作线程中解压，完成后与未压缩的块走同样的流程 (CRC 针对解压后的数据)。
+            // 解压并行执行，各块 (包括其间到达的未压缩块) 按到达顺序交给 handleFileChunk
+            if (it->decompressingChunks.contains(chunkID)) return; // 重复的块，前一份仍在排队
+            if (compressed) {
+                recordChunkBytes(*it, 0, chunk.dataSize);
+                chunk.buffer = QByteArray();
+                m_fileIOManager->requestDecompressChunk(transferID, chunkID, payload, dataOffset, payload.size() - dataOffset, it->maxChunkSize);
+            }
+            it->decompressingChunks.insert(chunkID, chunk);
+            it->decompressQueue.append(chunkID);
+            it->decompressingBytes += chunk.dataSize;
+            return;
+        }
     }
-
-    processSendQueue(transferID);
+    handleFileChunk(peerUuid, transferID, chunkID, chunk);
 }
 
-void FileTransferManager::sendChunkData(const QString& transferID, qint64 chunkID, const QString& dataB64, qint64 originalChunkSize) {
-    if (!m_sessions.contains(transferID)) return;
-    FileTransferSession& session = m_sessions[transferID];
+void FileTransferManager::handleChunkDecompressed(const QString& transferID, qint64 chunkID, const QByteArray& data, bool success, const QString& error) {
+    auto it = m_sessions.find(transferID);
+    if (it == m_sessions.end() || !it->decompressingChunks.contains(chunkID)) return;
+    if (!success) {
+        // 与 CRC 不符同样处理: 数据在途中损坏，请求重发
+        qWarning() << "FileTransferManager: Failed to decompress chunk" << chunkID << "of" << transferID << ":" << error << ". Requesting resend.";
+        it->decompressingBytes -= it->decompressingChunks.take(chunkID).dataSize;
+        it->decompressQueue.removeAll(chunkID);
+        sendChunkNack(it->peerUuid, transferID, chunkID);
+    } else {
+        recordChunkBytes(*it, data.size(), 0); // 链路字节在收到时已计入
+        it->metrics.compressedChunks++;
+        ReceivedChunk& chunk = it->decompressingChunks[chunkID];
+        it->decompressingBytes += data.size() - chunk.dataSize;
+        chunk.buffer = data;
+        chunk.dataOffset = 0;
+        chunk.dataSize = data.size();
+    }
 
-    // dataB64 已经是 QString 格式的Base64编码数据
-    // originalChunkSize 是原始二进制数据的大小
-    QString chunkMessage = FT_MSG_CHUNK_FORMAT.arg(transferID)
-                                           .arg(chunkID)
-                                           .arg(originalChunkSize) // 使用原始大小
-                                           .arg(dataB64);          // 使用Base64编码的QString
-    m_networkManager->sendMessage(session.peerUuid, chunkMessage);
-    qDebug() << "FileTransferManager: Sent chunk" << chunkID << "for" << transferID << "OriginalSize:" << originalChunkSize;
+    // 先完成解压的后续块不能先被 SACK，否则发送方会按乱序阈值把仍在解压的块判为丢失并重发
+    const QString peerUuid = it->peerUuid;
+    for (;;) {
+        auto session = m_sessions.find(transferID);
+        if (session == m_sessions.end() || session->decompressQueue.isEmpty()) break;
+        const qint64 next = session->decompressQueue.first();
+        if (session->decompressingChunks.value(next).buffer.isNull()) break; // 仍在解压
+        session->decompressQueue.removeFirst();
+        ReceivedChunk chunk = session->decompressingChunks.take(next);
+        session->decompressingBytes -= chunk.dataSize;
+        handleFileChunk(peerUuid, transferID, next, chunk);
+    }
 }
 
-void FileTransferManager::handleFileChunk(const QString& peerUuid, const QString& transferID, qint64 chunkID, qint64 originalChunkSize, const QString& dataB64) {
+void FileTransferManager::handleFileChunk(const QString& peerUuid, const QString& transferID, qint64 chunkID, const ReceivedChunk& chunk) {
     // 在此处立即记录接收到块的信息
     qInfo() << "[FTM] Received chunk on network thread: " << " <IMPORTANT> "
             << "ChunkID=" << chunkID 
-            << "OriginalSize=" << originalChunkSize 
+            << "OriginalSize=" << chunk.dataSize 
             << "FromPeer=" << peerUuid;
 
     if (!m_sessions.contains(transferID) || !m_fileIOManager) {
@@ -461,43 +1429,75 @@ void FileTransferManager::handleFileChunk(const QString& peerUuid, const QString
     }
     if (session.state == FileTransferSession::Accepted) session.state = FileTransferSession::Transferring;
 
-    qInfo() << "[FTM] handleFileChunk: transferID=" << transferID << "chunkID=" << chunkID << "originalSize=" << originalChunkSize
-            << "in-order=" << (chunkID == session.highestContiguousChunkReceived + 1)
+    qInfo() << "[FTM] handleFileChunk: transferID=" << transferID << "chunkID=" << chunkID << "originalSize=" << chunk.dataSize
+            << "in-order=" << (chunkID == session.nextChunkToWrite)
             << "outstandingWrites=" << m_outstandingWriteRequests.value(transferID, 0)
-            << "bufferedChunks=" << session.receivedOutOfOrderChunks.size();
+            << "writeBehindBytes=" << session.writeBehindBytes
+            << "bufferedChunks=" << session.receivedOutOfOrderChunks.size()
+            << "spilledChunks=" << session.spilledChunks.size();
+
+    if (chunk.dataSize <= 0 || chunk.dataSize > session.maxChunkSize) {
+        qWarning() << "FileTransferManager::handleFileChunk: Chunk" << chunkID << "of" << transferID << "has invalid size" << chunk.dataSize
+                   << "(max" << session.maxChunkSize << ")";
+        sendError(peerUuid, transferID, "CHUNK_INVALID", "Chunk size exceeds the negotiated maximum.");
+        cleanupSession(transferID, false, tr("Invalid chunk received from peer."));
+        return;
+    }
 
-    if (chunkID < session.highestContiguousChunkReceived + 1 || 
-        chunkID >= session.highestContiguousChunkReceived + 1 + DEFAULT_RECEIVE_WINDOW_SIZE) {
+    // 旧版发送方不携带偏移，但其块大小固定，偏移可由块号推算
+    ReceivedChunk placed = chunk;
+    if (placed.fileOffset < 0 && !session.adaptiveChunks) {
+        placed.fileOffset = chunkID * DEFAULT_CHUNK_SIZE;
+    }
+    // 窗口按字节计算: 偏移已知时块必须完整落在通告窗口内；未知时按它排在所有已缓冲数据之后估算。
+    // 块号同时受限，否则 SACK 位图可能被极小的块撑大
+    qint64 chunkEnd = placed.fileOffset >= 0 ? placed.fileOffset + placed.dataSize
+                                             : session.receivedContiguousBytes + session.outOfOrderBytes + session.spilledBytes + placed.dataSize;
+    qint64 maxChunkID = session.nextChunkToWrite + (session.receiveWindowEndOffset - session.receivedContiguousBytes) / FT_MIN_CHUNK_SIZE;
+    // 已进入 write-behind 或正在写入的块 (< nextChunkToWrite) 视为重复
+    if (chunkID < session.nextChunkToWrite || chunkID > maxChunkID || chunkEnd > session.receiveWindowEndOffset) {
         qWarning() << "FileTransferManager::handleFileChunk: Chunk" << chunkID << "out of window for" << transferID
-                   << ". Expected range: [" << (session.highestContiguousChunkReceived + 1)
-                   << "-" << (session.highestContiguousChunkReceived + DEFAULT_RECEIVE_WINDOW_SIZE) << "]";
+                   << ". Expected from chunk" << session.nextChunkToWrite
+                   << ", chunk end" << chunkEnd << "window end" << session.receiveWindowEndOffset;
         sendDataAck(peerUuid, transferID, session.highestContiguousChunkReceived); 
         return;
     }
 
-    if (chunkID == session.highestContiguousChunkReceived + 1) {
-        if (m_outstandingWriteRequests.value(transferID, 0) >= MAX_CONCURRENT_WRITES_PER_TRANSFER) {
-            qDebug() << "FileTransferManager: Max concurrent writes reached for" << transferID << ". Buffering chunk" << chunkID;
-            if (!session.receivedOutOfOrderChunks.contains(chunkID)) {
-                 session.receivedOutOfOrderChunks.insert(chunkID, qMakePair(dataB64, originalChunkSize)); // 存储 QPair
-            }
-            sendDataAck(peerUuid, transferID, session.highestContiguousChunkReceived);
-        } else {
-            qint64 expectedOffset = session.bytesTransferred;
-            qDebug() << "FileTransferManager: Requesting write for chunk" << chunkID << "at offset" << expectedOffset;
-            m_fileIOManager->requestWriteFileChunk(transferID, chunkID, session.localFilePath, expectedOffset, dataB64, originalChunkSize); // 传递 dataB64 和 originalChunkSize
-            m_outstandingWriteRequests[transferID]++;
+    // 数据在途中损坏: 丢弃该块并请求重发 (不经过重传超时，发送方也不把它当作拥塞)
+    if (chunk.checksum >= 0 &&
+        crc32c(0, chunk.buffer.constData() + chunk.dataOffset, chunk.dataSize) != static_cast<quint32>(chunk.checksum)) {
+        qWarning() << "FileTransferManager::handleFileChunk: Checksum mismatch for chunk" << chunkID << "of" << transferID << ". Requesting resend.";
+        sendChunkNack(peerUuid, transferID, chunkID);
+        return;
+    }
+
+    if (chunkID == session.nextChunkToWrite && session.spilledChunks.contains(chunkID)) {
+        // 已直接写到最终位置 (写入中或等待并入) 的块又到达一份 (如 SACK 到达发送方之前的超时重传): 按重复块处理，
+        // 否则它会越过 spilledChunks 中的记录进入 write-behind
+        qDebug() << "FileTransferManager: Received duplicate of spilled chunk" << chunkID << "for" << transferID;
+        sendDataAck(peerUuid, transferID, session.highestContiguousChunkReceived);
+        return;
+    }
+    if (chunkID == session.nextChunkToWrite) {
+        if (!appendToWriteBehind(session, placed)) {
+            qWarning() << "FileTransferManager::handleFileChunk: Chunk" << chunkID << "of" << transferID << "at offset" << placed.fileOffset
+                       << "does not continue received data ending at" << session.receivedContiguousBytes;
+            sendError(peerUuid, transferID, "CHUNK_OFFSET_MISMATCH", "Chunk offset does not match received data.");
+            cleanupSession(transferID, false, tr("Invalid chunk received from peer."));
+            return;
         }
+        // 之前乱序到达的后续块现在也连续了，一并并入 write-behind，然后按阈值决定是否写入
+        if (!processBufferedChunks(transferID)) return;
 
         // 集中ACK计数
-        m_pendingAckCount[transferID] += 1;
+        m_pendingAckBytes[transferID] += chunk.dataSize;
         // 启动/重启ACK延迟定时器
         if (!m_ackDelayTimers.contains(transferID)) {
             QTimer* timer = new QTimer(this);
             timer->setSingleShot(true);
             connect(timer, &QTimer::timeout, this, [this, peerUuid, transferID]() {
                 sendDataAck(peerUuid, transferID, m_sessions[transferID].highestContiguousChunkReceived);
-                m_pendingAckCount[transferID] = 0;
+                m_pendingAckBytes[transferID] = 0;
                 if (m_ackDelayTimers.contains(transferID)) {
                     m_ackDelayTimers[transferID]->stop();
                 }
@@ -508,29 +1508,76 @@ void FileTransferManager::handleFileChunk(const QString& peerUuid, const QString
             m_ackDelayTimers[transferID]->start(ACK_DELAY_MS);
         }
         // 如果累计到批量阈值，立即ACK
-        if (m_pendingAckCount[transferID] >= ACK_BATCH_SIZE) {
+        if (m_pendingAckBytes[transferID] >= FT_ACK_BYTES_THRESHOLD) {
             sendDataAck(peerUuid, transferID, session.highestContiguousChunkReceived);
-            m_pendingAckCount[transferID] = 0;
+            m_pendingAckBytes[transferID] = 0;
             m_ackDelayTimers[transferID]->stop();
         }
     } else {
-        if (!session.receivedOutOfOrderChunks.contains(chunkID)) {
-            session.receivedOutOfOrderChunks.insert(chunkID, qMakePair(dataB64, originalChunkSize)); // 存储 QPair
-            qDebug() << "FileTransferManager: Buffered out-of-order chunk" << chunkID << "for" << transferID;
-        } else {
+        if (session.receivedOutOfOrderChunks.contains(chunkID) || session.spilledChunks.contains(chunkID)) {
             qDebug() << "FileTransferManager: Received duplicate out-of-order chunk" << chunkID << "for" << transferID;
+        } else if (totalReceiveBufferedBytes() + placed.dataSize > FT_RECEIVE_MEMORY_BUDGET_BYTES &&
+                   (placed.fileOffset < 0 || totalOutstandingSpillWrites() >= FT_MAX_INFLIGHT_SPILL_WRITES)) {
+            // 内存预算已用尽且无法立即写出: 不缓冲也不 SACK，发送方按 SACK 缺口或超时重发
+            session.metrics.droppedChunks++;
+            qDebug() << "FileTransferManager: Receive buffers over budget. Dropping out-of-order chunk" << chunkID << "of" << transferID;
+        } else if (totalReceiveBufferedBytes() + placed.dataSize > FT_RECEIVE_MEMORY_BUDGET_BYTES) {
+            // 内存预算已用尽: 偏移已知的块直接写到最终位置 (定位写入，不影响前面尚未到达的数据)
+            if (placed.fileOffset < session.receivedContiguousBytes || placed.fileOffset + placed.dataSize > session.fileSize) {
+                qWarning() << "FileTransferManager::handleFileChunk: Out-of-order chunk" << chunkID << "of" << transferID << "has invalid offset" << placed.fileOffset;
+                sendError(peerUuid, transferID, "CHUNK_OFFSET_MISMATCH", "Chunk offset does not match received data.");
+                cleanupSession(transferID, false, tr("Invalid chunk received from peer."));
+                return;
+            }
+            spillChunk(transferID, session, chunkID, placed);
+        } else {
+            session.receivedOutOfOrderChunks.insert(chunkID, placed);
+            session.outOfOrderBytes += placed.dataSize;
+            qDebug() << "FileTransferManager: Buffered out-of-order chunk" << chunkID << "for" << transferID;
         }
         sendDataAck(peerUuid, transferID, session.highestContiguousChunkReceived);
     }
 }
 
-void FileTransferManager::handleChunkWritten(const QString& transferID, qint64 chunkID, qint64 bytesWritten, bool success, const QString& error) {
+void FileTransferManager::spillChunk(const QString& transferID, FileTransferSession& session, qint64 chunkID, const ReceivedChunk& chunk) {
+    SpilledChunk spilled;
+    spilled.fileOffset = chunk.fileOffset;
+    spilled.dataSize = chunk.dataSize;
+    spilled.checksum = chunk.checksum;
+    session.spilledChunks.insert(chunkID, spilled);
+    session.spilledBytes += chunk.dataSize;
+    session.spillWriteBytes += chunk.dataSize;
+    session.metrics.spilledChunks++;
+    m_outstandingWriteRequests[transferID]++;
+    m_outstandingSpillWrites[transferID]++;
+    m_fileIOManager->requestWriteFileChunk(transferID, spillWriteRequestID(chunkID), session.localFilePath, chunk.fileOffset, chunk.buffer, chunk.dataOffset, chunk.dataSize);
+    qDebug() << "FileTransferManager: Receive buffers over budget. Writing out-of-order chunk" << chunkID << "of" << transferID
+             << "directly at offset" << chunk.fileOffset;
+}
+
+void FileTransferManager::handleChunkWritten(const QString& transferID, qint64 requestID, qint64 bytesWritten, bool success, const QString& error) {
+    const bool spillWrite = isSpillWriteRequest(requestID);
     if (!m_sessions.contains(transferID)) {
         if (m_outstandingWriteRequests.contains(transferID)) m_outstandingWriteRequests[transferID]--; // 确保即使会话消失也递减
+        if (spillWrite && m_outstandingSpillWrites.contains(transferID)) m_outstandingSpillWrites[transferID]--;
+        resumePendingWriteFlushes();
         return;
     }
     m_outstandingWriteRequests[transferID]--;
+    if (spillWrite) m_outstandingSpillWrites[transferID]--;
+    resumePendingWriteFlushes();
     FileTransferSession& session = m_sessions[transferID];
+    // 直接写到最终位置的乱序块与 write-behind 的顺序写入并行执行
+    const qint64 chunkID = spillWrite ? spilledChunkID(requestID) : requestID;
+    auto spilled = session.spilledChunks.find(chunkID);
+    if (spillWrite && (spilled == session.spilledChunks.end() || spilled->written)) {
+        qWarning() << "FileTransferManager::handleChunkWritten: Unexpected spill write completion for chunk" << chunkID << "of" << transferID;
+        return;
+    }
+    if (!spillWrite) {
+        session.writeInFlight = false;
+        session.writeInFlightBytes = 0;
+    }
 
     qInfo() << "[FTM] handleChunkWritten: transferID=" << transferID << "chunkID=" << chunkID << "bytesWritten=" << bytesWritten
             << "success=" << success << "outstandingWrites=" << m_outstandingWriteRequests.value(transferID, 0);
@@ -541,125 +1588,268 @@ void FileTransferManager::handleChunkWritten(const QString& transferID, qint64 c
         cleanupSession(transferID, false, tr("File write error: %1").arg(error));
         return;
     }
-    
-    if (chunkID == session.highestContiguousChunkReceived + 1) {
+
+    if (spillWrite) {
+        spilled->written = true;
+        session.spillWriteBytes -= spilled->dataSize;
+        // 前面的数据还在写入或等待合并时，由那次写入完成后并入
+        if (chunkID != session.nextChunkToWrite || session.writeInFlight) return;
+        if (!session.writeBehind.isEmpty()) {
+            flushWriteBehind(transferID, true);
+            return;
+        }
+    } else {
+        // 一次写入覆盖 write-behind 合并的若干连续块，chunkID 是其中最后一块
         session.bytesTransferred += bytesWritten;
+        session.fileChecksum = crc32cCombine(session.fileChecksum, session.writeInFlightChecksum, bytesWritten);
         session.highestContiguousChunkReceived = chunkID;
-        emit fileTransferProgress(transferID, session.bytesTransferred, session.fileSize);
-        qDebug() << "FileTransferManager: Successfully wrote chunk" << chunkID << "for" << transferID << ". Total written:" << session.bytesTransferred;
-
-        processBufferedChunks(transferID); // 这可能会触发更多写入或更新 highestContiguousChunkReceived
-
-        // 检查是否所有预期的块都已连续写入
-        bool allChunksWrittenAndContiguous = (session.highestContiguousChunkReceived == session.totalChunks - 1);
-        
-        // 检查此传输的所有未完成写入操作是否已完成
-        bool allWritesComplete = (m_outstandingWriteRequests.value(transferID, 0) == 0);
-
-        if (allChunksWrittenAndContiguous && allWritesComplete && session.eofMessageReceived) {
-            // 关键条件：所有数据都在磁盘上，所有写入操作都已完成，并且先前已收到EOF。
-            qInfo() << "FileTransferManager::handleChunkWritten: All chunks written, all writes complete, and EOF was pending for" << transferID << ". Processing deferred EOF.";
-            
-            if (session.cachedTotalChunksReportedByPeer != session.totalChunks) {
-                 qWarning() << "FileTransferManager::handleChunkWritten (deferred EOF): Total chunks mismatch for" << transferID
-                           << ". Peer reported:" << session.cachedTotalChunksReportedByPeer << ", we calculated:" << session.totalChunks;
-            }
+    }
+    // 紧随其后的块可能已写到最终位置，一并计入
+    if (!processBufferedChunks(transferID, false)) return;
+    if (session.bytesTransferred < session.fileSize && session.resumeManifestClock.elapsed() >= FT_RESUME_MANIFEST_INTERVAL_MS) {
+        saveResumeManifest(session);
+    }
+    reportProgress(transferID, session.bytesTransferred, session.fileSize);
+    qDebug() << "FileTransferManager: Successfully wrote up to chunk" << session.highestContiguousChunkReceived << "for" << transferID << ". Total written:" << session.bytesTransferred;
 
-            qInfo() << "FileTransferManager: Processing deferred EOF for" << transferID << ". File" << session.fileName << "received. Sending EOF_ACK.";
-            sendEOFAck(session.peerUuid, transferID);
-            cleanupSession(transferID, true, tr("File received successfully (processed deferred EOF)."));
-        } else if (allChunksWrittenAndContiguous && allWritesComplete && !session.eofMessageReceived) {
-            // 所有块都已写入，所有写入都已完成，但尚未收到EOF消息。
-            // 这是接收方完成其数据传输部分的时刻，正在等待发送方的EOF。
-            // 无论m_pendingAckCount如何，都发送一个最终的DATA_ACK以确保发送方知道所有数据都已收到。
-            qInfo() << "FileTransferManager: All chunks written and all writes complete for receiver " << transferID 
-                    << ". Ensuring final DATA_ACK for chunk " << session.highestContiguousChunkReceived << " before waiting for EOF.";
-            sendDataAck(session.peerUuid, transferID, session.highestContiguousChunkReceived);
-            
-            // 清理ACK计数和定时器，因为数据传输部分已完成。
-            if (m_pendingAckCount.contains(transferID)) {
-                m_pendingAckCount[transferID] = 0; // 重置计数器，因为我们刚刚发送了最终的DATA_ACK
-            }
-            if (m_ackDelayTimers.contains(transferID)) {
-                m_ackDelayTimers[transferID]->stop();
-                m_ackDelayTimers[transferID]->deleteLater();
-                m_ackDelayTimers.remove(transferID);
-            }
+    // 检查是否所有数据都已连续写入 (块大小可能在传输中改变，按字节判断)
+    bool allChunksWrittenAndContiguous = (session.bytesTransferred >= session.fileSize);
+
+    if (allChunksWrittenAndContiguous && session.eofMessageReceived) {
+        // 关键条件：所有数据都在磁盘上，所有写入操作都已完成，并且先前已收到EOF。
+        qInfo() << "FileTransferManager::handleChunkWritten: All chunks written, all writes complete, and EOF was pending for" << transferID << ". Processing deferred EOF.";
+
+        if (session.cachedTotalChunksReportedByPeer != session.highestContiguousChunkReceived + 1) {
+             qWarning() << "FileTransferManager::handleChunkWritten (deferred EOF): Total chunks mismatch for" << transferID
+                       << ". Peer reported:" << session.cachedTotalChunksReportedByPeer << ", we received:" << session.highestContiguousChunkReceived + 1;
         }
-        // 如果并非所有块都已写入或写入仍在进行中，则此处不对EOF执行特殊操作。
-        // 数据块的常规ACK逻辑（批处理/延迟）在handleFileChunk中处理。
+        if (!verifyFileChecksum(transferID)) return;
 
-    } else {
-        // 这种情况（成功写入后 chunkID != session.highestContiguousChunkReceived + 1）
-        // 意味着一个乱序的块写入已完成。这是正常的。
-        qDebug() << "FileTransferManager: Wrote out-of-order chunk" << chunkID << "successfully for" << transferID
-                   << ". Highest contiguous is still" << session.highestContiguousChunkReceived;
-        
-        // 如果这是最后一个未完成的写入，并且满足其他条件，则检查延迟的EOF。
-        bool allWritesComplete = (m_outstandingWriteRequests.value(transferID, 0) == 0);
-        bool allChunksWrittenAndContiguous = (session.highestContiguousChunkReceived == session.totalChunks - 1);
-
-        if (allChunksWrittenAndContiguous && allWritesComplete && session.eofMessageReceived) {
-             qInfo() << "FileTransferManager::handleChunkWritten (after out-of-order write): All chunks written, all writes complete, and EOF was pending for" << transferID << ". Processing deferred EOF.";
-            if (session.cachedTotalChunksReportedByPeer != session.totalChunks) {
-                 qWarning() << "FileTransferManager::handleChunkWritten (deferred EOF after OOO write): Total chunks mismatch for" << transferID
-                           << ". Peer reported:" << session.cachedTotalChunksReportedByPeer << ", we calculated:" << session.totalChunks;
-            }
-            sendEOFAck(session.peerUuid, transferID);
-            cleanupSession(transferID, true, tr("File received successfully (processed deferred EOF)."));
-        } else if (allChunksWrittenAndContiguous && allWritesComplete && !session.eofMessageReceived) {
-            // 与上面类似，即使在乱序写入完成后达到此状态，也确保发送最终的DATA_ACK。
-            qInfo() << "FileTransferManager: All chunks written and all writes complete for receiver " << transferID 
-                    << " (after out-of-order write). Ensuring final DATA_ACK for chunk " << session.highestContiguousChunkReceived << " before waiting for EOF.";
-            sendDataAck(session.peerUuid, transferID, session.highestContiguousChunkReceived);
-            
-            if (m_pendingAckCount.contains(transferID)) {
-                m_pendingAckCount[transferID] = 0;
+        qInfo() << "FileTransferManager: Processing deferred EOF for" << transferID << ". File" << session.fileName << "received. Sending EOF_ACK.";
+        sendEOFAck(session.peerUuid, transferID);
+        cleanupSession(transferID, true, tr("File received successfully (processed deferred EOF)."));
+        return;
+    }
+
+    // 写入完成后立即确认: 写入期间到达的块还在 write-behind 中，发送方需要这个 ACK 才能继续推进窗口
+    sendDataAck(session.peerUuid, transferID, session.highestContiguousChunkReceived);
+    if (m_pendingAckBytes.contains(transferID)) {
+        m_pendingAckBytes[transferID] = 0;
+    }
+
+    if (allChunksWrittenAndContiguous) {
+        // 所有块都已写入，但尚未收到EOF消息；上面已发送最终的DATA_ACK。
+        // 清理ACK计数和定时器，因为数据传输部分已完成。
+        qInfo() << "FileTransferManager: All chunks written for receiver" << transferID
+                << ". Sent final DATA_ACK for chunk" << session.highestContiguousChunkReceived << "before waiting for EOF.";
+        if (m_ackDelayTimers.contains(transferID)) {
+            m_ackDelayTimers[transferID]->stop();
+            m_ackDelayTimers[transferID]->deleteLater();
+            m_ackDelayTimers.remove(transferID);
+        }
+        return;
+    }
+    if (m_ackDelayTimers.contains(transferID)) {
+        m_ackDelayTimers[transferID]->stop();
+    }
+
+    // 写入期间累积的数据 (下一块已在文件中时不再等待合并)
+    flushWriteBehind(transferID, session.eofMessageReceived || session.spilledChunks.contains(session.nextChunkToWrite));
+}
+
+bool FileTransferManager::processBufferedChunks(const QString& transferID, bool flush) {
+    if (!m_sessions.contains(transferID) || !m_fileIOManager) return false;
+    FileTransferSession& session = m_sessions[transferID];
+
+    // 把已经连续的缓冲块全部并入 write-behind
+    for (;;) {
+        if (session.receivedOutOfOrderChunks.contains(session.nextChunkToWrite)) {
+            ReceivedChunk chunk = session.receivedOutOfOrderChunks.take(session.nextChunkToWrite);
+            session.outOfOrderBytes -= chunk.dataSize;
+            if (!appendToWriteBehind(session, chunk)) {
+                qWarning() << "FileTransferManager::processBufferedChunks: Buffered chunk" << session.nextChunkToWrite << "of" << transferID
+                           << "at offset" << chunk.fileOffset << "does not continue received data ending at" << session.receivedContiguousBytes;
+                sendError(session.peerUuid, transferID, "CHUNK_OFFSET_MISMATCH", "Chunk offset does not match received data.");
+                cleanupSession(transferID, false, tr("Invalid chunk received from peer."));
+                return false;
             }
-            if (m_ackDelayTimers.contains(transferID)) {
-                m_ackDelayTimers[transferID]->stop();
-                m_ackDelayTimers[transferID]->deleteLater();
-                m_ackDelayTimers.remove(transferID);
+            continue;
+        }
+        // 已写到最终位置的块只能在它之前的数据全部写入后并入
+        auto spilled = session.spilledChunks.constFind(session.nextChunkToWrite);
+        if (spilled == session.spilledChunks.constEnd() || !spilled->written || session.writeInFlight || !session.writeBehind.isEmpty()) {
+            break;
+        }
+        if (spilled->fileOffset != session.receivedContiguousBytes) {
+            qWarning() << "FileTransferManager::processBufferedChunks: Spilled chunk" << session.nextChunkToWrite << "of" << transferID
+                       << "at offset" << spilled->fileOffset << "does not continue received data ending at" << session.receivedContiguousBytes;
+            sendError(session.peerUuid, transferID, "CHUNK_OFFSET_MISMATCH", "Chunk offset does not match received data.");
+            cleanupSession(transferID, false, tr("Invalid chunk received from peer."));
+            return false;
+        }
+        SpilledChunk chunk = session.spilledChunks.take(session.nextChunkToWrite);
+        session.spilledBytes -= chunk.dataSize;
+        if (session.fileChecksumChunks >= 0) {
+            if (chunk.checksum >= 0) {
+                session.fileChecksum = crc32cCombine(session.fileChecksum, static_cast<quint32>(chunk.checksum), chunk.dataSize);
+                session.fileChecksumChunks++;
+            } else {
+                session.fileChecksumChunks = -1;
             }
-        }else{
-            sendDataAck(session.peerUuid, transferID, session.highestContiguousChunkReceived);
         }
+        session.receivedContiguousBytes += chunk.dataSize;
+        session.bytesTransferred += chunk.dataSize;
+        session.highestContiguousChunkReceived = session.nextChunkToWrite;
+        session.nextChunkToWrite++;
     }
+
+    qInfo() << "[FTM] processBufferedChunks: transferID=" << transferID
+            << "nextChunkToWrite=" << session.nextChunkToWrite
+            << "buffered=" << session.receivedOutOfOrderChunks.size()
+            << "spilled=" << session.spilledChunks.size()
+            << "writeBehindBytes=" << session.writeBehindBytes;
+
+    if (flush) {
+        flushWriteBehind(transferID, session.spilledChunks.contains(session.nextChunkToWrite));
+    }
+    return true;
+}
+
+bool FileTransferManager::appendToWriteBehind(FileTransferSession& session, const ReceivedChunk& chunk) {
+    if ((chunk.fileOffset >= 0 && chunk.fileOffset != session.receivedContiguousBytes) ||
+        session.receivedContiguousBytes + chunk.dataSize > session.fileSize) {
+        return false;
+    }
+    FileWriteSegment segment;
+    segment.buffer = chunk.buffer;
+    segment.offset = chunk.dataOffset;
+    segment.size = chunk.dataSize;
+    session.writeBehind.append(segment);
+    session.writeBehindBytes += chunk.dataSize;
+    // 块的 CRC 已在收到时校验，按文件顺序合并即得整个文件的 CRC，不必再次扫描数据 (写入完成后并入 fileChecksum)
+    if (session.fileChecksumChunks >= 0) {
+        if (chunk.checksum >= 0) {
+            session.writeBehindChecksum = crc32cCombine(session.writeBehindChecksum, static_cast<quint32>(chunk.checksum), chunk.dataSize);
+            session.fileChecksumChunks++;
+        } else {
+            session.fileChecksumChunks = -1;
+        }
+    }
+    session.receivedContiguousBytes += chunk.dataSize;
+    session.nextChunkToWrite++;
+    return true;
 }
 
-void FileTransferManager::processBufferedChunks(const QString& transferID) {
+void FileTransferManager::flushWriteBehind(const QString& transferID, bool force) {
     if (!m_sessions.contains(transferID) || !m_fileIOManager) return;
     FileTransferSession& session = m_sessions[transferID];
+    // 每个传输同时只有一次写入；写入完成后 handleChunkWritten 会再次调用
+    if (session.writeInFlight || session.writeBehind.isEmpty()) return;
+
+    bool includesLastChunk = (session.receivedContiguousBytes >= session.fileSize);
+    if (!force && !includesLastChunk && session.writeBehindBytes < m_writeBehindThreshold) {
+        // 数据不足一次合并写入: 等待更多块，最多 FT_WRITE_BEHIND_FLUSH_DELAY_MS
+        QTimer* timer = m_writeBehindTimers.value(transferID, nullptr);
+        if (!timer) {
+            timer = new QTimer(this);
+            timer->setSingleShot(true);
+            connect(timer, &QTimer::timeout, this, [this, transferID]() {
+                flushWriteBehind(transferID, true);
+            });
+            m_writeBehindTimers.insert(transferID, timer);
+        }
+        if (!timer->isActive()) {
+            timer->start(FT_WRITE_BEHIND_FLUSH_DELAY_MS);
+        }
+        return;
+    }
 
-    qint64 nextExpectedChunk = session.highestContiguousChunkReceived + 1;
-    if (session.receivedOutOfOrderChunks.contains(nextExpectedChunk) &&
-        m_outstandingWriteRequests.value(transferID, 0) < MAX_CONCURRENT_WRITES_PER_TRANSFER) {
-
-        QPair<QString, qint64> chunkInfo = session.receivedOutOfOrderChunks.take(nextExpectedChunk); 
-        QString dataB64 = chunkInfo.first;
-        qint64 originalSize = chunkInfo.second;
-        qint64 expectedOffset = session.bytesTransferred; 
-
-        qDebug() << "FileTransferManager: Requesting write for buffered chunk" << nextExpectedChunk << "for" << transferID << "at offset" << expectedOffset;
-        m_fileIOManager->requestWriteFileChunk(transferID, nextExpectedChunk, session.localFilePath, expectedOffset, dataB64, originalSize); // 传递 dataB64 和 originalSize
-        m_outstandingWriteRequests[transferID]++;
+    if (m_writeBehindTimers.contains(transferID)) {
+        m_writeBehindTimers[transferID]->stop();
+    }
+    // 全局在途写入已达上限: 排队，其他写入完成后再提交
+    if (totalOutstandingWrites() >= FT_MAX_INFLIGHT_WRITES) {
+        if (!m_pendingWriteFlushes.contains(transferID)) m_pendingWriteFlushes.append(transferID);
+        return;
     }
 
-    qInfo() << "[FTM] processBufferedChunks: transferID=" << transferID
-            << "nextExpectedChunk=" << nextExpectedChunk
-            << "buffered=" << session.receivedOutOfOrderChunks.size()
-            << "outstandingWrites=" << m_outstandingWriteRequests.value(transferID, 0);
+    FileWriteSegments segments = session.writeBehind;
+    session.writeBehind.clear();
+    qint64 lastChunkID = session.nextChunkToWrite - 1;
+    qDebug() << "FileTransferManager: Flushing write-behind for" << transferID << ":" << segments.size() << "chunks,"
+             << session.writeBehindBytes << "bytes at offset" << session.bytesTransferred;
+    session.writeInFlightBytes = session.writeBehindBytes;
+    session.writeBehindBytes = 0;
+    session.writeInFlightChecksum = session.writeBehindChecksum;
+    session.writeBehindChecksum = 0;
+    session.writeInFlight = true;
+    m_outstandingWriteRequests[transferID]++;
+    m_fileIOManager->requestWriteFileSegments(transferID, lastChunkID, session.localFilePath, session.bytesTransferred, segments);
 }
 
 void FileTransferManager::sendDataAck(const QString& peerUuid, const QString& transferID, qint64 ackedChunkID) {
-    QString ackMsg = FT_MSG_DATA_ACK_FORMAT.arg(transferID).arg(ackedChunkID).arg(m_localUserUuid);
-    m_networkManager->sendMessage(peerUuid, ackMsg);
+    FtDataAckMessage ack;
+    ack.transferID = transferID;
+    ack.chunkID = ackedChunkID;
+    ack.receiverUuid = m_localUserUuid;
+    auto it = m_sessions.find(transferID);
+    if (it != m_sessions.end() && ackedChunkID == it->highestContiguousChunkReceived) {
+        // 通告接收窗口 (从已写入数据的末尾算起)；右边界只增不减，已通告范围内到达的块总能被接受
+        it->receiveWindowEndOffset = qMax(it->receiveWindowEndOffset, it->bytesTransferred + receiveWindowBytes(*it));
+        ack.receiveWindowBytes = it->receiveWindowEndOffset - it->bytesTransferred;
+        ack.sackBitmap = buildSackBitmap(*it);
+    }
+    m_networkManager->sendControlMessage(peerUuid, ack);
     qDebug() << "FileTransferManager: Sent ACK for highest contiguous chunk" << ackedChunkID << "for" << transferID;
 
     qInfo() << "[FTM] sendDataAck: transferID=" << transferID << "ackedChunkID=" << ackedChunkID;
 }
 
-void FileTransferManager::handleDataAck(const QString& peerUuid, const QString& transferID, qint64 ackedChunkID) {
+QByteArray FileTransferManager::buildSackBitmap(const FileTransferSession& session) const {
+    // 写入中或在 write-behind 中的块 [highest + 1, nextChunkToWrite) 以及乱序缓冲和已写到最终位置的块都算已收到
+    qint64 first = session.highestContiguousChunkReceived + 1;
+    qint64 end = session.nextChunkToWrite;
+    if (!session.receivedOutOfOrderChunks.isEmpty()) {
+        end = qMax(end, session.receivedOutOfOrderChunks.lastKey() + 1);
+    }
+    if (!session.spilledChunks.isEmpty()) {
+        end = qMax(end, session.spilledChunks.lastKey() + 1);
+    }
+    QByteArray bitmap;
+    for (qint64 chunkID = first; chunkID < end; ++chunkID) {
+        if (chunkID >= session.nextChunkToWrite && !session.receivedOutOfOrderChunks.contains(chunkID) && !session.spilledChunks.contains(chunkID)) {
+            continue;
+        }
+        qint64 bit = chunkID - first;
+        while (bitmap.size() <= bit / 8) {
+            bitmap.append('\0');
+        }
+        bitmap[bit / 8] = static_cast<char>(static_cast<uchar>(bitmap[bit / 8]) | (1u << (bit % 8)));
+    }
+    return bitmap;
+}
+
+qint64 FileTransferManager::receiveWindowBytes(const FileTransferSession& session) const {
+    // 窗口从已写入数据的末尾开始，大小为本传输缓冲区和全局内存预算中剩余的较小者。
+    // 至少保留一块: 0 对发送方表示旧版对端，且窗口关闭后没有块到达就不会再有 ACK 重新打开它
+    qint64 window = qMin(FT_RECEIVE_BUFFER_BYTES - receiveBufferedBytes(session),
+                         FT_RECEIVE_MEMORY_BUDGET_BYTES - totalReceiveBufferedBytes());
+    return qMax(window, session.maxChunkSize);
+}
+
+qint64 FileTransferManager::receiveBufferedBytes(const FileTransferSession& session) const {
+    return session.writeBehindBytes + session.writeInFlightBytes + session.outOfOrderBytes + session.spillWriteBytes + session.decompressingBytes;
+}
+
+qint64 FileTransferManager::totalReceiveBufferedBytes() const {
+    qint64 total = 0;
+    for (const FileTransferSession& session : m_sessions) {
+        if (!session.isSender) total += receiveBufferedBytes(session);
+    }
+    return total;
+}
+
+void FileTransferManager::handleDataAck(const QString& peerUuid, const QString& transferID, qint64 ackedChunkID, const QByteArray& sackBitmap, qint64 receiveWindowBytes) {
     if (!m_sessions.contains(transferID)) return;
     FileTransferSession& session = m_sessions[transferID];
 
@@ -670,6 +1860,30 @@ void FileTransferManager::handleDataAck(const QString& peerUuid, const QString&
     
     qDebug() << "FileTransferManager: Received ACK for chunk up to" << ackedChunkID << "for" << transferID << ". Current sendWindowBase:" << session.sendWindowBase;
 
+    if (ackedChunkID < session.sendWindowBase - 1) {
+        qDebug() << "FileTransferManager: Received old/duplicate ACK for" << ackedChunkID << "(current base" << session.sendWindowBase << ")";
+        return;
+    }
+
+    // 本次新确认的块: 统计确认量，并以其中最晚发出的一个作为 RTT 与交付速率样本
+    TransferCongestionController::AckSample ackSample;
+    qint64 newestSendOrder = -1;
+    qint64 nowMs = session.sendClock.elapsed();
+    auto onChunkAcknowledged = [&](qint64 chunkID) {
+        ackSample.ackedBytes += chunkBytes(session, chunkID);
+        auto it = session.sentChunks.constFind(chunkID);
+        if (it == session.sentChunks.constEnd() || it->sendOrder <= newestSendOrder) {
+            return;
+        }
+        newestSendOrder = it->sendOrder;
+        ackSample.hasRateSample = true;
+        ackSample.deliveredAtSend = it->deliveredAtSend;
+        ackSample.deliveredTimeAtSend = it->deliveredTimeAtSend;
+        ackSample.appLimited = it->appLimited;
+        // 只发出过一次的块才能确定 ACK 对应哪次发送 (Karn 算法)
+        ackSample.rttMs = session.retransmittedChunks.contains(chunkID) ? -1 : nowMs - it->sentAtMs;
+    };
+
     if (ackedChunkID >= session.sendWindowBase) {
         stopRetransmissionTimer(transferID);
 
@@ -679,24 +1893,93 @@ void FileTransferManager::handleDataAck(const QString& peerUuid, const QString&
         qInfo() << "[FTM] handleDataAck: transferID=" << transferID << "ackedChunkID=" << ackedChunkID
                 << "oldSendWindowBase=" << oldSendWindowBase << "newSendWindowBase=" << session.sendWindowBase;
 
-        if (session.sendWindowBase > oldSendWindowBase) {
-            session.bytesTransferred = qMin(session.fileSize, session.sendWindowBase * DEFAULT_CHUNK_SIZE);
-            if (session.sendWindowBase >= session.totalChunks) {
-                session.bytesTransferred = session.fileSize;
+        // 窗口前移后丢弃已越过窗口底部的记录；之前已被 SACK 的块已经计入过确认量
+        for (qint64 chunkID = oldSendWindowBase; chunkID < session.sendWindowBase; ++chunkID) {
+            if (session.sackedChunks.remove(chunkID)) {
+                session.sackedBytes -= chunkBytes(session, chunkID);
+            } else {
+                onChunkAcknowledged(chunkID);
             }
-            emit fileTransferProgress(transferID, session.bytesTransferred, session.fileSize);
+            session.fastRetransmitted.remove(chunkID);
+            session.sentChunks.remove(chunkID);
+            session.retransmittedChunks.remove(chunkID);
+            session.chunkChecksums.remove(chunkID);
+            session.chunkCorruptions.remove(chunkID);
+        }
+        // 已确认的块不会再读取；其 CRC 若未并入 (零拷贝链路未协商块校验)，整个文件的 CRC 就无法得出
+        if (session.fileChecksumChunks >= 0 && session.fileChecksumChunks < session.sendWindowBase) {
+            session.fileChecksumChunks = -1;
+        }
+
+        session.bytesTransferred = chunkOffset(session, session.sendWindowBase);
+        reportProgress(transferID, session.bytesTransferred, session.fileSize);
+        if (!session.fanOutGroup.isEmpty()) {
+            trimFanOutCache(session.fanOutGroup); // 所有接收方都确认的共享缓冲区可以释放
+        }
+    }
+
+    // 接收窗口右边界只增不减；旧版接收方不通告窗口，按其固定窗口计算
+    qint64 window = receiveWindowBytes > 0 ? receiveWindowBytes : FT_LEGACY_RECEIVE_WINDOW_CHUNKS * DEFAULT_CHUNK_SIZE;
+    session.peerWindowEndOffset = qMax(session.peerWindowEndOffset, chunkOffset(session, ackedChunkID + 1) + window);
+
+    // 记录选择性确认；重复 ACK (ackedChunkID == sendWindowBase - 1) 也可能带来新的 SACK 信息
+    for (qint64 bit = 0; bit < static_cast<qint64>(sackBitmap.size()) * 8; ++bit) {
+        if (!(static_cast<uchar>(sackBitmap.at(bit / 8)) & (1u << (bit % 8)))) continue;
+        qint64 chunkID = ackedChunkID + 1 + bit;
+        if (chunkID >= session.sendWindowBase && chunkID < session.nextChunkToSendInWindow && !session.sackedChunks.contains(chunkID)) {
+            onChunkAcknowledged(chunkID);
+            session.sackedChunks.insert(chunkID);
+            session.sackedBytes += chunkBytes(session, chunkID);
         }
-        
-        if (session.sendWindowBase >= session.totalChunks) {
+    }
+
+    if (ackSample.rttMs >= 0) {
+        updateRttEstimate(session, ackSample.rttMs);
+    }
+    ackSample.inflightBytes = bytesInFlight(session);
+    session.congestion.onAck(nowMs, ackSample);
+    session.metrics.congestionWindowBytes = session.congestion.congestionWindowBytes();
+    session.metrics.bytesInFlight = ackSample.inflightBytes;
+    session.metrics.bottleneckBandwidthMBps = session.congestion.bottleneckBandwidth() * 1000.0 / (1024.0 * 1024.0);
+    session.metrics.minRttMs = session.congestion.minRttMs();
+    maybeAdjustChunkSize(transferID, session);
+
+    if (session.sendWindowBase >= session.totalChunks) {
+        if (session.state == FileTransferSession::Transferring) {
             qInfo() << "FileTransferManager: All chunks ACKed for" << transferID;
             sendEOF(transferID);
-        } else {
-            session.state = FileTransferSession::Transferring;
-            processSendQueue(transferID);
         }
-    } else {
-        qDebug() << "FileTransferManager: Received old/duplicate ACK for" << ackedChunkID << "(current base" << session.sendWindowBase << ")";
+        return;
+    }
+    // 新的窗口底部可能早已发出，重新为它计时，否则它丢失时不会被重传
+    if (!session.retransmissionTimer && session.sendWindowBase < session.nextChunkToSendInWindow) {
+        startRetransmissionTimer(transferID);
+    }
+
+    // 比某个未确认块更晚发出的块已有足够多到达，认为该块已丢失，不等超时立即重传。
+    // 已 SACK 块的发出顺序排序一次，每个未确认块二分查找，窗口很大时每个 ACK 也只需 O(n log n)
+    QList<qint64> sackedSendOrders;
+    sackedSendOrders.reserve(session.sackedChunks.size());
+    for (qint64 sacked : std::as_const(session.sackedChunks)) {
+        auto sackedInfo = session.sentChunks.constFind(sacked);
+        if (sackedInfo != session.sentChunks.constEnd()) sackedSendOrders.append(sackedInfo->sendOrder);
     }
+    std::sort(sackedSendOrders.begin(), sackedSendOrders.end());
+    const QSet<qint64> queued(session.retransmitQueue.cbegin(), session.retransmitQueue.cend());
+    for (auto it = session.sentChunks.constBegin(); sackedSendOrders.size() >= FT_SACK_REORDER_THRESHOLD && it != session.sentChunks.constEnd(); ++it) {
+        qint64 chunkID = it.key();
+        if (session.sackedChunks.contains(chunkID) || session.fastRetransmitted.contains(chunkID) || queued.contains(chunkID)) {
+            continue;
+        }
+        const qint64 sackedLater = sackedSendOrders.cend() - std::upper_bound(sackedSendOrders.cbegin(), sackedSendOrders.cend(), it->sendOrder);
+        if (sackedLater >= FT_SACK_REORDER_THRESHOLD) {
+            session.fastRetransmitted.insert(chunkID);
+            session.retransmitQueue.append(chunkID);
+        }
+    }
+    std::sort(session.retransmitQueue.begin(), session.retransmitQueue.end());
+
+    processSendQueue(transferID);
 }
 
 void FileTransferManager::sendEOF(const QString& transferID) {
@@ -705,19 +1988,25 @@ void FileTransferManager::sendEOF(const QString& transferID) {
     
     stopRetransmissionTimer(transferID);
 
-    QString finalChecksum = "NOT_IMPLEMENTED";
-    QString eofMsg = FT_MSG_EOF_FORMAT.arg(transferID).arg(session.totalChunks).arg(finalChecksum); 
-    m_networkManager->sendMessage(session.peerUuid, eofMsg);
+    // 所有块的 CRC 都已按顺序合并时才给出整个文件的 CRC，否则留空 (接收方不做核对)
+    QString finalChecksum;
+    if (session.fileChecksumChunks == session.totalChunks) {
+        finalChecksum = QLatin1String(FT_FILE_CHECKSUM_PREFIX) + QString("%1").arg(session.fileChecksum, 8, 16, QLatin1Char('0'));
+    }
+    FtEofMessage eof;
+    eof.transferID = transferID;
+    eof.totalChunks = session.totalChunks;
+    eof.finalChecksum = finalChecksum;
+    m_networkManager->sendControlMessage(session.peerUuid, eof);
     session.state = FileTransferSession::WaitingForAck;
     
     session.sendWindowBase = session.totalChunks;
     startRetransmissionTimer(transferID);
 
-    qInfo() << "FileTransferManager: Sent EOF for" << transferID << "Total Chunks:" << session.totalChunks;
+    qInfo() << "FileTransferManager: Sent EOF for" << transferID << "Total Chunks:" << session.totalChunks << "Checksum:" << finalChecksum;
 }
 
 void FileTransferManager::handleEOF(const QString& peerUuid, const QString& transferID, qint64 totalChunksReported, const QString& finalChecksum) {
-    Q_UNUSED(finalChecksum); // 假设校验和尚未完全实现（基于 "NOT_IMPLEMENTED"）
     if (!m_sessions.contains(transferID)) return;
     FileTransferSession& session = m_sessions[transferID];
 
@@ -729,25 +2018,26 @@ void FileTransferManager::handleEOF(const QString& peerUuid, const QString& tran
     // 存储已收到EOF及其详细信息，无论当前状态如何
     session.eofMessageReceived = true;
     session.cachedTotalChunksReportedByPeer = totalChunksReported;
-    // session.cachedFinalChecksumFromPeer = finalChecksum; // 如果使用校验和
+    session.cachedFinalChecksumFromPeer = finalChecksum;
 
     qInfo() << "FileTransferManager::handleEOF: Received EOF for" << transferID 
             << ". Writes outstanding:" << m_outstandingWriteRequests.value(transferID, 0)
             << ". Last received chunk:" << session.highestContiguousChunkReceived 
-            << ". Total expected:" << (session.totalChunks -1);
+            << ". Bytes written:" << session.bytesTransferred << "of" << session.fileSize;
 
-    // 条件1：是否所有块都已连续接收？
-    if (session.highestContiguousChunkReceived != session.totalChunks - 1) {
+    // 条件1：是否所有数据都已连续接收并写入？
+    if (session.bytesTransferred < session.fileSize) {
         qWarning() << "FileTransferManager::handleEOF: EOF for" << transferID 
                    << "received, but not all chunks are contiguously present. Last received:" << session.highestContiguousChunkReceived
                    << ". Attempting to process buffered chunks.";
-        processBufferedChunks(transferID); // 尝试填补空白
+        if (!processBufferedChunks(transferID)) return; // 尝试填补空白
+        flushWriteBehind(transferID, true); // 不再等待合并，剩余数据立即写入
 
         // 处理缓冲块后重新检查
-        if (session.highestContiguousChunkReceived != session.totalChunks - 1) {
+        if (session.bytesTransferred < session.fileSize) {
             // 仍然缺少块。
             // 如果*已接收*块没有挂起的写入，则这是一个错误。
-            if (m_outstandingWriteRequests.value(transferID, 0) == 0) {
+            if (m_outstandingWriteRequests.value(transferID, 0) == 0 && !m_pendingWriteFlushes.contains(transferID)) {
                 qWarning() << "FileTransferManager::handleEOF: After processing buffered, still missing chunks for" << transferID
                            << "and no writes pending. Error.";
                 sendError(peerUuid, transferID, "EOF_WITH_MISSING_CHUNKS", "Received EOF but chunks are missing and no writes pending for them.");
@@ -763,7 +2053,7 @@ void FileTransferManager::handleEOF(const QString& peerUuid, const QString& tran
         qInfo() << "FileTransferManager::handleEOF: All chunks became contiguous after processing buffered for" << transferID;
     }
 
-    // 此时，所有块都已连续接收 (session.highestContiguousChunkReceived == session.totalChunks - 1)
+    // 此时，所有数据都已连续接收 (session.bytesTransferred == session.fileSize)
 
     // 条件2：这些块是否有任何未完成的写入？
     if (m_outstandingWriteRequests.value(transferID, 0) > 0) {
@@ -779,11 +2069,12 @@ void FileTransferManager::handleEOF(const QString& peerUuid, const QString& tran
     // 3. 这些块的所有写入操作都已完成。
     // 是时候发送EOF_ACK了。
     
-    if (totalChunksReported != session.totalChunks) { // 使用消息中的原始totalChunksReported
+    if (totalChunksReported != session.highestContiguousChunkReceived + 1) { // 使用消息中的原始totalChunksReported
         qWarning() << "FileTransferManager::handleEOF: Total chunks mismatch for" << transferID 
-                   << ". Peer reported:" << totalChunksReported << ", we calculated:" << session.totalChunks;
+                   << ". Peer reported:" << totalChunksReported << ", we received:" << session.highestContiguousChunkReceived + 1;
         // 决定这是否是致命错误或只是警告。目前是警告。
     }
+    if (!verifyFileChecksum(transferID)) return;
 
     qInfo() << "FileTransferManager: Processing EOF for" << transferID << ". File" << session.fileName << "received. Sending EOF_ACK.";
     sendEOFAck(peerUuid, transferID);
@@ -809,14 +2100,264 @@ void FileTransferManager::sendEOFAck(const QString& peerUuid, const QString& tra
         qWarning() << "FileTransferManager::sendEOFAck: NetworkManager is null.";
         return;
     }
-    QString eofAckMsg = FT_MSG_EOF_ACK_FORMAT.arg(transferID).arg(m_localUserUuid);
-    m_networkManager->sendMessage(peerUuid, eofAckMsg);
+    FtEofAckMessage eofAck;
+    eofAck.transferID = transferID;
+    eofAck.receiverUuid = m_localUserUuid;
+    m_networkManager->sendControlMessage(peerUuid, eofAck);
     qDebug() << "FileTransferManager: Sent EOF_ACK for" << transferID << "to" << peerUuid;
 }
 
+void FileTransferManager::sendChunkNack(const QString& peerUuid, const QString& transferID, qint64 chunkID)
+{
+    FtNackMessage nack;
+    nack.transferID = transferID;
+    nack.chunkID = chunkID;
+    nack.receiverUuid = m_localUserUuid;
+    m_networkManager->sendControlMessage(peerUuid, nack);
+    qDebug() << "FileTransferManager: Sent NACK for chunk" << chunkID << "of" << transferID << "to" << peerUuid;
+}
+
+void FileTransferManager::handleChunkNack(const QString& peerUuid, const QString& transferID, qint64 chunkID) {
+    if (!m_sessions.contains(transferID)) return;
+    FileTransferSession& session = m_sessions[transferID];
+
+    if (!session.isSender || session.peerUuid != peerUuid || session.state != FileTransferSession::Transferring) {
+        qWarning() << "FileTransferManager::handleChunkNack: Received NACK in invalid state for" << transferID;
+        return;
+    }
+    if (chunkID < session.sendWindowBase || chunkID >= session.nextChunkToSendInWindow || session.sackedChunks.contains(chunkID)) {
+        qDebug() << "FileTransferManager: Ignoring NACK for chunk" << chunkID << "outside the send window of" << transferID;
+        return;
+    }
+
+    session.metrics.corruptedChunks++;
+    if (++session.chunkCorruptions[chunkID] > FT_MAX_CHUNK_CORRUPTIONS) {
+        qWarning() << "FileTransferManager: Chunk" << chunkID << "of" << transferID << "failed verification" << session.chunkCorruptions.value(chunkID) << "times. Aborting.";
+        sendError(peerUuid, transferID, "CHUNK_CORRUPTED", "Chunk failed checksum verification repeatedly.");
+        cleanupSession(transferID, false, tr("Chunk %1 was repeatedly corrupted in transit.").arg(chunkID));
+        return;
+    }
+    // 损坏不是拥塞: 不退避 RTO，也不缩小拥塞窗口，只重发该块
+    qWarning() << "FileTransferManager: Peer reported corrupted chunk" << chunkID << "for" << transferID << ". Resending.";
+    if (!session.retransmitQueue.contains(chunkID)) {
+        session.retransmitQueue.append(chunkID);
+        std::sort(session.retransmitQueue.begin(), session.retransmitQueue.end());
+    }
+    processSendQueue(transferID);
+}
+
+void FileTransferManager::handlePeerConnected(const QString& peerUuid) {
+    const QList<ReceiveResumeManifest> manifests = m_resumeStore.receivesFromPeer(peerUuid);
+    for (const ReceiveResumeManifest& manifest : manifests) {
+        if (m_sessions.contains(manifest.transferID)) continue;
+        if (!QFileInfo::exists(manifest.savePath)) {
+            qInfo() << "FileTransferManager: Partial file for" << manifest.transferID << "is gone. Dropping resume manifest.";
+            m_resumeStore.removeReceive(manifest.transferID);
+            continue;
+        }
+
+        // 在发送方答复 FT_OFFER 之前保持 Paused
+        FileTransferSession session;
+        session.transferID = manifest.transferID;
+        session.peerUuid = peerUuid;
+        session.fileName = manifest.fileName;
+        session.fileSize = manifest.fileSize;
+        session.fileID = manifest.fileID;
+        session.localFilePath = manifest.savePath;
+        session.isSender = false;
+        session.state = FileTransferSession::Paused;
+        session.resumeOffset = manifest.verifiedBytes;
+        session.resumeChecksum = manifest.checksum;
+        m_sessions.insert(manifest.transferID, session);
+
+        FtResumeMessage resume;
+        resume.transferID = manifest.transferID;
+        resume.receiverUuid = m_localUserUuid;
+        resume.fileID = manifest.fileID;
+        resume.offset = manifest.verifiedBytes;
+        resume.checksum = manifest.checksum;
+        m_networkManager->sendControlMessage(peerUuid, resume);
+        qInfo() << "FileTransferManager: Requesting resume of" << manifest.fileName << "from" << peerUuid
+                << "TransferID:" << manifest.transferID << "Offset:" << manifest.verifiedBytes << "of" << manifest.fileSize;
+    }
+}
+
+void FileTransferManager::handlePeerDisconnected(const QString& peerUuid) {
+    m_rateLimiter.forgetPeer(peerUuid);
+    const QStringList transferIDs = m_sessions.keys();
+    for (const QString& transferID : transferIDs) {
+        auto it = m_sessions.constFind(transferID);
+        if (it == m_sessions.constEnd() || it->peerUuid != peerUuid) continue;
+        switch (it->state) {
+        case FileTransferSession::Paused:
+            // 尚未得到答复的续传请求，下次连上时重新发出
+            m_sessions.remove(transferID);
+            break;
+        case FileTransferSession::Accepted:
+        case FileTransferSession::Transferring:
+        case FileTransferSession::WaitingForAck:
+            if (!it->fileID.isEmpty()) {
+                interruptSession(transferID);
+            } else {
+                cleanupSession(transferID, false, tr("Connection to peer lost."));
+            }
+            break;
+        default:
+            break; // 等待用户确认的 FT_OFFER 保持不变
+        }
+    }
+}
+
+void FileTransferManager::interruptSession(const QString& transferID) {
+    FileTransferSession& session = m_sessions[transferID];
+    session.state = FileTransferSession::Paused;
+    saveResumeManifest(session);
+    qInfo() << "FileTransferManager: Transfer" << transferID << "interrupted at" << session.bytesTransferred << "of" << session.fileSize << "bytes.";
+    cleanupSession(transferID, false, tr("Connection lost. The transfer will resume when the peer reconnects."));
+}
+
+void FileTransferManager::saveResumeManifest(FileTransferSession& session) {
+    // 旧版发送方不提供文件标识；有块未携带 CRC 时无法让发送方核对前缀
+    if (session.isSender || session.fileID.isEmpty() || session.fileChecksumChunks < 0 || session.localFilePath.isEmpty()) {
+        return;
+    }
+    ReceiveResumeManifest manifest;
+    manifest.transferID = session.transferID;
+    manifest.peerUuid = session.peerUuid;
+    manifest.fileName = session.fileName;
+    manifest.fileID = session.fileID;
+    manifest.savePath = session.localFilePath;
+    manifest.fileSize = session.fileSize;
+    manifest.verifiedBytes = session.bytesTransferred;
+    manifest.checksum = session.fileChecksum;
+    m_resumeStore.saveReceive(manifest);
+    session.resumeManifestClock.start();
+}
+
+void FileTransferManager::handleResumeRequest(const QString& peerUuid, const QString& transferID, const QString& fileID, qint64 offset, qint64 checksum) {
+    auto existing = m_sessions.constFind(transferID);
+    if (existing != m_sessions.constEnd()) {
+        if (!existing->isSender || existing->peerUuid != peerUuid || existing->state == FileTransferSession::Offered) {
+            qWarning() << "FileTransferManager::handleResumeRequest: Ignoring FT_RESUME for" << transferID << "in state" << existing->state;
+            return;
+        }
+        // 接收方已重新连上 (或重启)，本端还没发现断线: 旧会话不会再收到 ACK
+        interruptSession(transferID);
+    }
+
+    SendResumeRecord record;
+    if (!m_resumeStore.loadSend(transferID, &record) || record.peerUuid != peerUuid) {
+        qWarning() << "FileTransferManager: Cannot resume unknown transfer" << transferID << "for" << peerUuid;
+        sendError(peerUuid, transferID, "RESUME_UNAVAILABLE", "Transfer is unknown to the sender.");
+        return;
+    }
+    QFileInfo fileInfo(record.filePath);
+    if (!fileInfo.isFile() || fileInfo.size() != record.fileSize || fileIdentity(fileInfo) != record.fileID || fileID != record.fileID) {
+        qWarning() << "FileTransferManager: File" << record.filePath << "changed since transfer" << transferID << "started. Cannot resume.";
+        m_resumeStore.removeSend(transferID);
+        sendError(peerUuid, transferID, "RESUME_FILE_CHANGED", "The file has changed since the transfer started.");
+        return;
+    }
+
+    FileTransferSession session;
+    session.transferID = transferID;
+    session.peerUuid = peerUuid;
+    session.fileName = fileInfo.fileName();
+    session.fileSize = record.fileSize;
+    session.fileID = record.fileID;
+    session.localFilePath = record.filePath;
+    session.isSender = true;
+    session.state = FileTransferSession::Offered;
+    session.resumeOffset = qBound<qint64>(0, offset, session.fileSize);
+    session.resumeChecksum = checksum >= 0 ? static_cast<quint32>(checksum) : 0;
+    m_sessions.insert(transferID, session);
+    qInfo() << "FileTransferManager: Peer" << peerUuid << "requested resume of" << session.fileName << "TransferID:" << transferID
+            << "Offset:" << session.resumeOffset;
+
+    // 先核对接收方已有的数据与本端文件一致 (读取本地磁盘远快于重新传输)
+    if (session.resumeOffset > 0 && checksum >= 0) {
+        m_fileIOManager->requestChecksumFileChunk(transferID, RESUME_PREFIX_CHUNK_ID, record.filePath, 0, session.resumeOffset);
+        m_outstandingReadRequests[transferID]++;
+        return;
+    }
+    m_sessions[transferID].resumeOffset = 0;
+    m_sessions[transferID].resumeChecksum = 0;
+    sendResumeOffer(transferID);
+}
+
+void FileTransferManager::sendResumeOffer(const QString& transferID) {
+    FileTransferSession& session = m_sessions[transferID];
+    qint64 chunkSize = chooseInitialChunkSize(session.peerUuid, session.fileSize - session.resumeOffset);
+    session.chunkLayout.clear();
+    setChunkSize(session, 0, chunkSize);
+    session.compressChunks = shouldOfferCompression(session.peerUuid, session.fileName);
+    sendFileOffer(session.peerUuid, transferID, session.fileName, session.fileSize, chunkSize, session.fileID, session.resumeOffset,
+                  session.compressChunks ? QString(FT_COMPRESSION_ZLIB) : QString());
+}
+
+void FileTransferManager::handleResumeOffer(const QString& peerUuid, const QString& transferID, qint64 fileSize, qint64 chunkSize, const QString& fileID, qint64 resumeOffset,
+                                            const QString& compression) {
+    auto it = m_sessions.find(transferID);
+    if (it == m_sessions.end() || it->isSender || it->peerUuid != peerUuid || it->state != FileTransferSession::Paused) {
+        qWarning() << "FileTransferManager::handleResumeOffer: Unexpected resume offer for" << transferID << "from" << peerUuid;
+        return;
+    }
+    FileTransferSession& session = it.value();
+    if (fileID != session.fileID || fileSize != session.fileSize || (resumeOffset != 0 && resumeOffset != session.resumeOffset)) {
+        qWarning() << "FileTransferManager::handleResumeOffer: Resume offer for" << transferID << "does not match the partial file.";
+        session.state = FileTransferSession::Rejected;
+        sendRejectMessage(peerUuid, transferID, "Resume offer does not match the partial file.");
+        cleanupSession(transferID, false, tr("Cannot resume: the sender's file does not match the partial file."));
+        return;
+    }
+    if (resumeOffset == 0) {
+        qInfo() << "FileTransferManager: Sender restarts" << transferID << "from the beginning.";
+        session.resumeOffset = 0;
+        session.resumeChecksum = 0;
+    }
+    session.adaptiveChunks = chunkSize > 0;
+    session.maxChunkSize = session.adaptiveChunks ? FT_MAX_CHUNK_SIZE : DEFAULT_CHUNK_SIZE;
+    qint64 initialChunkSize = session.adaptiveChunks ? qMin(chunkSize, FT_MAX_CHUNK_SIZE) : DEFAULT_CHUNK_SIZE;
+    session.totalChunks = (fileSize - session.resumeOffset + initialChunkSize - 1) / initialChunkSize;
+    session.compressChunks = m_compressionEnabled && compression == QLatin1String(FT_COMPRESSION_ZLIB);
+    session.state = FileTransferSession::Offered;
+    qInfo() << "FileTransferManager: Resuming" << session.fileName << "from" << peerUuid << "at offset" << session.resumeOffset;
+    // 用户已在首次接收时确认过，直接接受
+    acceptFileOffer(transferID, session.localFilePath);
+}
+
+bool FileTransferManager::verifyFileChecksum(const QString& transferID) {
+    FileTransferSession& session = m_sessions[transferID];
+    const QString& reported = session.cachedFinalChecksumFromPeer;
+    // 旧版发送方 ("NOT_IMPLEMENTED") 或未能得出整个文件 CRC 的发送方不提供校验值
+    if (!reported.startsWith(QLatin1String(FT_FILE_CHECKSUM_PREFIX))) {
+        qInfo() << "FileTransferManager: No file checksum from peer for" << transferID << ". Skipping verification.";
+        return true;
+    }
+    if (session.fileChecksumChunks < 0) {
+        qWarning() << "FileTransferManager: Some chunks of" << transferID << "carried no checksum. Cannot verify the file.";
+        return true;
+    }
+    bool ok = false;
+    quint32 expected = reported.mid(int(sizeof(FT_FILE_CHECKSUM_PREFIX) - 1)).toUInt(&ok, 16);
+    if (ok && expected == session.fileChecksum) {
+        qInfo() << "FileTransferManager: File checksum verified for" << transferID << ":" << reported;
+        return true;
+    }
+    qWarning() << "FileTransferManager: File checksum mismatch for" << transferID << ". Peer reported:" << reported
+               << ", received data:" << QString::number(session.fileChecksum, 16);
+    sendError(session.peerUuid, transferID, "CHECKSUM_MISMATCH", "Received file does not match the sender's checksum.");
+    cleanupSession(transferID, false, tr("File checksum mismatch: the received file is corrupted."));
+    return false;
+}
+
 void FileTransferManager::sendError(const QString& peerUuid, const QString& transferID, const QString& errorCode, const QString& errorMessage) {
-    QString errorMsg = FT_MSG_ERROR_FORMAT.arg(transferID).arg(errorCode).arg(errorMessage).arg(m_localUserUuid);
-    m_networkManager->sendMessage(peerUuid, errorMsg);
+    FtErrorMessage error;
+    error.transferID = transferID;
+    error.code = errorCode;
+    error.message = errorMessage;
+    error.originatorUuid = m_localUserUuid;
+    m_networkManager->sendControlMessage(peerUuid, error);
 }
 
 void FileTransferManager::handleFileError(const QString& peerUuid, const QString& transferID, const QString& errorCode, const QString& message) {
@@ -824,6 +2365,7 @@ void FileTransferManager::handleFileError(const QString& peerUuid, const QString
     if (!m_sessions.contains(transferID)) return;
     
     qWarning() << "FileTransferManager: Received error for transfer" << transferID << "Code:" << errorCode << "Message:" << message;
+    m_sessions[transferID].state = FileTransferSession::Error; // 对端报告的错误不可续传
     cleanupSession(transferID, false, tr("Transfer failed due to peer error: %1 (%2)").arg(message).arg(errorCode));
 }
 
@@ -832,16 +2374,40 @@ void FileTransferManager::cleanupSession(const QString& transferID, bool success
     
     FileTransferSession session = m_sessions.take(transferID); 
     session.stopAndClearRetransmissionTimer();
+    // 断线暂停的传输保留续传状态，其余情况 (完成、拒绝、出错) 都不会再续传
+    if (session.state != FileTransferSession::Paused) {
+        if (session.isSender) {
+            m_resumeStore.removeSend(transferID);
+        } else {
+            m_resumeStore.removeReceive(transferID);
+        }
+    }
 
     m_outstandingReadRequests.remove(transferID);
     m_outstandingWriteRequests.remove(transferID);
+    m_outstandingSpillWrites.remove(transferID);
+    m_sendScheduler.remove(transferID);
+    m_pendingWriteFlushes.removeAll(transferID);
+    m_rateLimitedTransfers.removeAll(transferID);
+    if (m_fileIOManager) {
+        m_fileIOManager->closeTransferFile(transferID);
+    }
+    if (!session.fanOutGroup.isEmpty()) {
+        leaveFanOutGroup(session.fanOutGroup, transferID);
+    }
 
     if (m_ackDelayTimers.contains(transferID)) {
         m_ackDelayTimers[transferID]->stop();
         m_ackDelayTimers[transferID]->deleteLater();
         m_ackDelayTimers.remove(transferID);
     }
-    m_pendingAckCount.remove(transferID);
+    m_pendingAckBytes.remove(transferID);
+    m_progressThrottle.remove(transferID);
+    if (m_writeBehindTimers.contains(transferID)) {
+        m_writeBehindTimers[transferID]->stop();
+        m_writeBehindTimers[transferID]->deleteLater();
+        m_writeBehindTimers.remove(transferID);
+    }
 
     // 统计传输耗时和速度
     double speedMBps = 0.0;
@@ -857,6 +2423,31 @@ void FileTransferManager::cleanupSession(const QString& transferID, bool success
         qInfo() << "[FTM] Transfer" << transferID << "finished in" << elapsedMs << "ms,"
                 << "average speed:" << QString::number(speedMBps, 'f', 2) << "MB/s";
     }
+    ChunkBufferPool::Stats buffers = chunkBufferPool().transferStats(transferID);
+    chunkBufferPool().forgetTransfer(transferID);
+    session.metrics.bufferAllocations = buffers.allocations;
+    session.metrics.bufferReuses = buffers.reuses;
+    qInfo() << "[FTM] Transfer" << transferID << "chunk buffers allocated:" << buffers.allocations << "reused:" << buffers.reuses;
+    if (session.metrics.chunkPayloadBytes > 0) {
+        qInfo() << "[FTM] Transfer" << transferID << "chunk bytes:" << session.metrics.chunkPayloadBytes << "on wire:" << session.metrics.chunkWireBytes
+                << "compression ratio:" << QString::number(session.metrics.compressionRatio, 'f', 3)
+                << "effective throughput gain:" << QString::number(session.metrics.effectiveThroughputGain, 'f', 2)
+                << "compressed chunks:" << session.metrics.compressedChunks << "incompressible chunks:" << session.metrics.incompressibleChunks;
+    }
+    if (session.isSender) {
+        qInfo() << "[FTM] Transfer" << transferID << "SRTT:" << session.metrics.srttMs << "ms RTTVAR:" << session.metrics.rttVarMs
+                << "ms RTO:" << session.metrics.rtoMs << "ms RTT samples:" << session.metrics.rttSamples
+                << "retransmitted chunks:" << session.metrics.retransmittedChunks
+                << "timeouts:" << session.metrics.retransmissionTimeouts
+                << "chunk size:" << session.metrics.chunkSize << "changes:" << session.metrics.chunkSizeChanges
+                << "corrupted chunks:" << session.metrics.corruptedChunks
+                << "shared chunks:" << session.metrics.sharedChunks;
+        emit fileTransferMetricsUpdated(transferID, session.metrics);
+        // 只有按链路测量调整过的块大小才有参考价值
+        if (success && session.adaptiveChunks && session.metrics.chunkSizeChanges > 0) {
+            m_peerChunkSizeHints[session.peerUuid] = session.metrics.chunkSize;
+        }
+    }
 
     // 在信号中带上速度信息
     QString msgWithSpeed = message;
@@ -870,6 +2461,10 @@ void FileTransferManager::cleanupSession(const QString& transferID, bool success
         emit fileTransferFinished(transferID, session.peerUuid, session.fileName, false, message);
     }
     qInfo() << "FileTransferManager: Cleaned up session" << transferID << (success ? "Successfully" : "Unsuccessfully");
+
+    // 该传输占用的读写名额交给其他传输
+    runSendScheduler();
+    resumePendingWriteFlushes();
 }
 
 void FileTransferManager::startRetransmissionTimer(const QString& transferID) {
@@ -885,10 +2480,11 @@ void FileTransferManager::startRetransmissionTimer(const QString& transferID) {
         handleChunkRetransmissionTimeout(transferID);
     });
     
-    int timeoutDuration = FT_CHUNK_RETRANSMISSION_TIMEOUT_MS;
+    qint64 timeoutDuration = session.metrics.rtoMs;
     if (session.state == FileTransferSession::WaitingForAck && session.sendWindowBase >= session.totalChunks) {
+        timeoutDuration = FT_EOF_ACK_TIMEOUT_MS;
     }
-    session.retransmissionTimer->start(timeoutDuration); 
+    session.retransmissionTimer->start(static_cast<int>(timeoutDuration)); 
     qDebug() << "FileTransferManager: Started retransmission timer for" << transferID << "Base:" << session.sendWindowBase << "Duration:" << timeoutDuration;
 }
 
@@ -912,13 +2508,41 @@ void FileTransferManager::handleChunkRetransmissionTimeout(const QString& transf
         return;
     }
 
-    qWarning() << "FileTransferManager: Retransmission Timeout for transfer" << transferID << "ChunkID (Base):" << session.sendWindowBase;
-    
-    m_outstandingReadRequests[transferID] = 0; 
-    session.nextChunkToSendInWindow = session.sendWindowBase;
+    // 指数退避，直到下一个有效 RTT 样本
+    session.metrics.retransmissionTimeouts++;
+    session.metrics.rtoMs = qMin(session.metrics.rtoMs * 2, FT_MAX_RTO_MS);
+    session.congestion.onRetransmissionTimeout();
+    // 丢包链路上大块的重传代价高: 降低块大小上限，之后未发出的块立即改用更小的块。上限的恢复从最近一次超时重新计时
+    session.chunkSizeCeilingChangedMs = session.sendClock.elapsed();
+    if (session.adaptiveChunks && session.chunkSizeCeiling > FT_MIN_CHUNK_SIZE) {
+        session.chunkSizeCeiling = alignChunkSize(session.chunkSizeCeiling / 2, FT_MAX_CHUNK_SIZE);
+        qint64 current = session.chunkLayout.last().chunkSize;
+        if (current > session.chunkSizeCeiling && session.nextChunkToSendInWindow < session.totalChunks) {
+            setChunkSize(session, session.nextChunkToSendInWindow, session.chunkSizeCeiling);
+            session.congestion.setChunkSize(session.chunkSizeCeiling);
+            session.metrics.chunkSize = session.chunkSizeCeiling;
+            session.metrics.chunkSizeChanges++;
+            if (!session.fanOutGroup.isEmpty()) {
+                // 块边界与组内其他传输不再一致
+                leaveFanOutGroup(session.fanOutGroup, transferID);
+                session.fanOutGroup.clear();
+            }
+        }
+    }
+    qWarning() << "FileTransferManager: Retransmission Timeout for transfer" << transferID << "ChunkID (Base):" << session.sendWindowBase
+               << "SRTT:" << session.metrics.srttMs << "ms, RTO backed off to" << session.metrics.rtoMs << "ms";
+
+    // 只重传已发出但未被确认 (累计或选择性) 的块，接收方已缓存的块不再重发；仍在读取中的块读完后自然会发出
+    session.retransmitQueue.clear();
+    session.fastRetransmitted.clear();
+    for (auto it = session.sentChunks.constBegin(); it != session.sentChunks.constEnd(); ++it) {
+        if (!session.sackedChunks.contains(it.key())) {
+            session.retransmitQueue.append(it.key());
+        }
+    }
     session.state = FileTransferSession::Transferring;
     
-    qInfo() << "FileTransferManager: Retransmitting by re-requesting read for chunk" << session.sendWindowBase << "for transfer" << transferID;
+    qInfo() << "FileTransferManager: Retransmitting" << session.retransmitQueue.size() << "unacknowledged chunks from" << session.sendWindowBase << "for transfer" << transferID;
     processSendQueue(transferID);
 }
 
@@ -0,0 +1,317 @@
+#include "iouringqueue.h"
+
+#ifdef FILEIO_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cerrno>
+#include <cstring>
+#endif
+
+IoUringQueue::IoUringQueue()
+    : m_ringFd(-1),
+      m_eventFd(-1),
+      m_sqEntries(0),
+      m_pendingSubmissions(0),
+      m_sqRing(nullptr),
+      m_sqRingSize(0),
+      m_cqRing(nullptr),
+      m_cqRingSize(0),
+      m_sqes(nullptr),
+      m_sqesSize(0),
+      m_sqHead(nullptr),
+      m_sqTail(nullptr),
+      m_sqMask(nullptr),
+      m_sqArray(nullptr),
+      m_cqHead(nullptr),
+      m_cqTail(nullptr),
+      m_cqMask(nullptr),
+      m_cqes(nullptr)
+{
+}
+
+IoUringQueue::~IoUringQueue()
+{
+    release();
+}
+
+#ifdef FILEIO_HAS_IO_URING
+
+namespace
+{
+    template <class T>
+    T *ringField(void *ring, quint32 offset)
+    {
+        return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+    }
+}
+
+bool IoUringQueue::init(unsigned entries, QString *error)
+{
+    release();
+
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0)
+    {
+        if (error)
+            *error = QString("io_uring_setup failed: %1").arg(qt_error_string(errno));
+        return false;
+    }
+    m_ringFd = fd;
+    m_sqEntries = params.sq_entries;
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap)
+        m_sqRingSize = m_cqRingSize = qMax(m_sqRingSize, m_cqRingSize);
+
+    m_sqRing = ::mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED)
+    {
+        m_sqRing = nullptr;
+        if (error)
+            *error = QString("Failed to map io_uring submission ring: %1").arg(qt_error_string(errno));
+        release();
+        return false;
+    }
+    if (singleMmap)
+    {
+        m_cqRing = m_sqRing;
+    }
+    else
+    {
+        m_cqRing = ::mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED)
+        {
+            m_cqRing = nullptr;
+            if (error)
+                *error = QString("Failed to map io_uring completion ring: %1").arg(qt_error_string(errno));
+            release();
+            return false;
+        }
+    }
+
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = ::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+    {
+        m_sqes = nullptr;
+        if (error)
+            *error = QString("Failed to map io_uring submission entries: %1").arg(qt_error_string(errno));
+        release();
+        return false;
+    }
+
+    m_sqHead = ringField<unsigned>(m_sqRing, params.sq_off.head);
+    m_sqTail = ringField<unsigned>(m_sqRing, params.sq_off.tail);
+    m_sqMask = ringField<unsigned>(m_sqRing, params.sq_off.ring_mask);
+    m_sqArray = ringField<unsigned>(m_sqRing, params.sq_off.array);
+    m_cqHead = ringField<unsigned>(m_cqRing, params.cq_off.head);
+    m_cqTail = ringField<unsigned>(m_cqRing, params.cq_off.tail);
+    m_cqMask = ringField<unsigned>(m_cqRing, params.cq_off.ring_mask);
+    m_cqes = ringField<io_uring_cqe>(m_cqRing, params.cq_off.cqes);
+
+    m_eventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_eventFd < 0)
+    {
+        if (error)
+            *error = QString("Failed to create eventfd: %1").arg(qt_error_string(errno));
+        release();
+        return false;
+    }
+    if (::syscall(__NR_io_uring_register, m_ringFd, IORING_REGISTER_EVENTFD, &m_eventFd, 1) < 0)
+    {
+        if (error)
+            *error = QString("Failed to register io_uring eventfd: %1").arg(qt_error_string(errno));
+        release();
+        return false;
+    }
+    return true;
+}
+
+void IoUringQueue::release()
+{
+    if (m_sqes)
+        ::munmap(m_sqes, m_sqesSize);
+    if (m_cqRing && m_cqRing != m_sqRing)
+        ::munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing)
+        ::munmap(m_sqRing, m_sqRingSize);
+    if (m_eventFd >= 0)
+        ::close(m_eventFd);
+    if (m_ringFd >= 0)
+        ::close(m_ringFd);
+
+    m_ringFd = -1;
+    m_eventFd = -1;
+    m_sqEntries = 0;
+    m_pendingSubmissions = 0;
+    m_sqRing = m_cqRing = m_sqes = m_cqes = nullptr;
+    m_sqHead = m_sqTail = m_sqMask = m_sqArray = nullptr;
+    m_cqHead = m_cqTail = m_cqMask = nullptr;
+}
+
+bool IoUringQueue::prepare(quint8 opcode, int fd, quint64 address, unsigned length, quint64 offset, quint64 userData)
+{
+    if (!isValid())
+        return false;
+    // 只有本线程写 sqTail；内核推进 sqHead
+    const unsigned tail = *m_sqTail;
+    const unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (tail - head >= m_sqEntries)
+        return false;
+
+    const unsigned index = tail & *m_sqMask;
+    io_uring_sqe *sqe = static_cast<io_uring_sqe *>(m_sqes) + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = address;
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->user_data = userData;
+    m_sqArray[index] = index;
+
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+    m_pendingSubmissions++;
+    return true;
+}
+
+bool IoUringQueue::prepareRead(int fd, void *buffer, unsigned length, quint64 offset, quint64 userData)
+{
+    return prepare(IORING_OP_READ, fd, reinterpret_cast<quintptr>(buffer), length, offset, userData);
+}
+
+bool IoUringQueue::prepareWrite(int fd, const void *buffer, unsigned length, quint64 offset, quint64 userData)
+{
+    return prepare(IORING_OP_WRITE, fd, reinterpret_cast<quintptr>(buffer), length, offset, userData);
+}
+
+static_assert(sizeof(IoUringQueue::Segment) == sizeof(iovec) &&
+                  offsetof(IoUringQueue::Segment, data) == offsetof(iovec, iov_base) &&
+                  offsetof(IoUringQueue::Segment, length) == offsetof(iovec, iov_len),
+              "IoUringQueue::Segment must match struct iovec");
+
+bool IoUringQueue::prepareWritev(int fd, const Segment *segments, unsigned count, quint64 offset, quint64 userData)
+{
+    return prepare(IORING_OP_WRITEV, fd, reinterpret_cast<quintptr>(segments), count, offset, userData);
+}
+
+int IoUringQueue::submit()
+{
+    int submitted = 0;
+    while (m_pendingSubmissions > 0)
+    {
+        int ret = static_cast<int>(::syscall(__NR_io_uring_enter, m_ringFd, m_pendingSubmissions, 0, 0, nullptr, 0));
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return submitted > 0 ? submitted : -errno;
+        }
+        if (ret == 0)
+            break;
+        m_pendingSubmissions -= static_cast<unsigned>(ret);
+        submitted += ret;
+    }
+    return submitted;
+}
+
+int IoUringQueue::waitForCompletions(unsigned minComplete)
+{
+    for (;;)
+    {
+        int ret = static_cast<int>(::syscall(__NR_io_uring_enter, m_ringFd, 0, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0));
+        if (ret >= 0)
+            return ret;
+        if (errno != EINTR)
+            return -errno;
+    }
+}
+
+int IoUringQueue::reapCompletions(Completion *out, int maxCount)
+{
+    if (!isValid())
+        return 0;
+    unsigned head = *m_cqHead;
+    const unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    int count = 0;
+    while (head != tail && count < maxCount)
+    {
+        const io_uring_cqe *cqe = static_cast<const io_uring_cqe *>(m_cqes) + (head & *m_cqMask);
+        out[count].userData = cqe->user_data;
+        out[count].result = cqe->res;
+        ++count;
+        ++head;
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+void IoUringQueue::clearEventFd()
+{
+    eventfd_t value;
+    ::eventfd_read(m_eventFd, &value);
+}
+
+#else // !FILEIO_HAS_IO_URING
+
+bool IoUringQueue::init(unsigned entries, QString *error)
+{
+    Q_UNUSED(entries);
+    if (error)
+        *error = QStringLiteral("io_uring is not available on this platform");
+    return false;
+}
+
+void IoUringQueue::release()
+{
+}
+
+bool IoUringQueue::prepare(quint8, int, quint64, unsigned, quint64, quint64)
+{
+    return false;
+}
+
+bool IoUringQueue::prepareRead(int, void *, unsigned, quint64, quint64)
+{
+    return false;
+}
+
+bool IoUringQueue::prepareWrite(int, const void *, unsigned, quint64, quint64)
+{
+    return false;
+}
+
+bool IoUringQueue::prepareWritev(int, const Segment *, unsigned, quint64, quint64)
+{
+    return false;
+}
+
+int IoUringQueue::submit()
+{
+    return 0;
+}
+
+int IoUringQueue::waitForCompletions(unsigned)
+{
+    return 0;
+}
+
+int IoUringQueue::reapCompletions(Completion *, int)
+{
+    return 0;
+}
+
+void IoUringQueue::clearEventFd()
+{
+}
+
+#endif // FILEIO_HAS_IO_URING
@@ -0,0 +1,162 @@
+#include "transfercongestioncontroller.h"
+
+namespace
+{
+    const double STARTUP_GAIN = 2.885;          // 2 / ln2: 每轮在途数据翻倍
+    const double PROBE_CWND_GAIN = 2.0;         // ProbeBW 阶段 cwnd = 2 * BDP * 循环增益
+    const double PROBE_CYCLE_GAINS[] = {1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+    const int PROBE_CYCLE_LENGTH = sizeof(PROBE_CYCLE_GAINS) / sizeof(PROBE_CYCLE_GAINS[0]);
+    const qint64 BANDWIDTH_WINDOW_ROUNDS = 10;  // 带宽最大值滤波的轮数
+    const qint64 MIN_RTT_WINDOW_MS = 10000;     // minRtt 过期时间
+    const double FULL_BANDWIDTH_GROWTH = 1.25;   // 一轮内带宽增长不足 25% 视为没有增长
+    const int FULL_BANDWIDTH_ROUNDS = 3;        // 连续这么多轮没有增长即认为管道已满
+    const qint64 INITIAL_WINDOW_CHUNKS = 4;
+    const qint64 MIN_WINDOW_CHUNKS = 2;
+    const qint64 MAX_WINDOW_BYTES = 1024LL * 1024 * 1024;
+}
+
+TransferCongestionController::TransferCongestionController(qint64 chunkSize)
+{
+    reset(chunkSize);
+}
+
+void TransferCongestionController::reset(qint64 chunkSize)
+{
+    m_chunkSize = qMax<qint64>(chunkSize, 1);
+    m_phase = Startup;
+    m_delivered = 0;
+    m_deliveredTimeMs = 0;
+    m_roundCount = 0;
+    m_nextRoundDelivered = 0;
+    m_roundStart = false;
+    m_bandwidthSamples.clear();
+    m_btlBw = 0.0;
+    m_minRttMs = -1;
+    m_minRttStampMs = 0;
+    m_fullBw = 0.0;
+    m_fullBwRounds = 0;
+    m_filledPipe = false;
+    m_cycleIndex = 0;
+    m_cwndBytes = INITIAL_WINDOW_CHUNKS * m_chunkSize;
+}
+
+void TransferCongestionController::setChunkSize(qint64 chunkSize)
+{
+    m_chunkSize = qMax<qint64>(chunkSize, 1);
+    m_cwndBytes = qBound(MIN_WINDOW_CHUNKS * m_chunkSize, m_cwndBytes, MAX_WINDOW_BYTES);
+}
+
+void TransferCongestionController::onAck(qint64 nowMs, const AckSample &sample)
+{
+    m_delivered += sample.ackedBytes;
+    if (sample.ackedBytes > 0)
+        m_deliveredTimeMs = nowMs;
+
+    m_roundStart = false;
+    if (sample.hasRateSample && sample.deliveredAtSend >= m_nextRoundDelivered)
+    {
+        m_nextRoundDelivered = m_delivered;
+        m_roundCount++;
+        m_roundStart = true;
+    }
+
+    if (sample.hasRateSample)
+    {
+        qint64 intervalMs = nowMs - sample.deliveredTimeAtSend;
+        if (intervalMs > 0)
+            updateBandwidth(static_cast<double>(m_delivered - sample.deliveredAtSend) / intervalMs, sample.appLimited);
+    }
+    updateMinRtt(nowMs, sample.rttMs);
+    if (!sample.appLimited)
+        checkFullPipe();
+
+    if (m_phase == Startup && m_filledPipe)
+        m_phase = Drain;
+    if (m_phase == Drain && sample.inflightBytes <= bdpBytes(1.0))
+    {
+        m_phase = ProbeBandwidth;
+        m_cycleIndex = 2; // 从增益 1 开始，下一轮再探测
+    }
+    else if (m_phase == ProbeBandwidth)
+    {
+        advanceCycle(sample.inflightBytes);
+    }
+
+    setCongestionWindow(sample.ackedBytes);
+}
+
+void TransferCongestionController::onRetransmissionTimeout()
+{
+    m_cwndBytes = MIN_WINDOW_CHUNKS * m_chunkSize;
+}
+
+qint64 TransferCongestionController::bdpBytes(double gain) const
+{
+    if (m_btlBw <= 0.0 || m_minRttMs < 0)
+        return INITIAL_WINDOW_CHUNKS * m_chunkSize;
+    // minRtt 为 0 (同机传输) 时按 1ms 计算
+    return static_cast<qint64>(gain * m_btlBw * qMax<qint64>(m_minRttMs, 1));
+}
+
+void TransferCongestionController::updateBandwidth(double rate, bool appLimited)
+{
+    // 发送方没有用满窗口时的样本偏低，只在高于当前估计时采用
+    if (appLimited && rate < m_btlBw)
+        return;
+    double &roundMax = m_bandwidthSamples[m_roundCount];
+    roundMax = qMax(roundMax, rate);
+
+    while (!m_bandwidthSamples.isEmpty() && m_bandwidthSamples.firstKey() <= m_roundCount - BANDWIDTH_WINDOW_ROUNDS)
+        m_bandwidthSamples.erase(m_bandwidthSamples.begin());
+    m_btlBw = 0.0;
+    for (double value : m_bandwidthSamples)
+        m_btlBw = qMax(m_btlBw, value);
+}
+
+void TransferCongestionController::updateMinRtt(qint64 nowMs, qint64 rttMs)
+{
+    if (rttMs < 0)
+        return;
+    if (m_minRttMs < 0 || rttMs <= m_minRttMs || nowMs - m_minRttStampMs > MIN_RTT_WINDOW_MS)
+    {
+        m_minRttMs = rttMs;
+        m_minRttStampMs = nowMs;
+    }
+}
+
+void TransferCongestionController::checkFullPipe()
+{
+    if (m_filledPipe || !m_roundStart)
+        return;
+    if (m_btlBw >= m_fullBw * FULL_BANDWIDTH_GROWTH)
+    {
+        m_fullBw = m_btlBw;
+        m_fullBwRounds = 0;
+        return;
+    }
+    if (++m_fullBwRounds >= FULL_BANDWIDTH_ROUNDS)
+        m_filledPipe = true;
+}
+
+void TransferCongestionController::advanceCycle(qint64 inflightBytes)
+{
+    if (!m_roundStart)
+        return;
+    // 0.75 增益阶段在在途数据回落到 BDP 前不结束
+    if (PROBE_CYCLE_GAINS[m_cycleIndex] < 1.0 && inflightBytes > bdpBytes(1.0))
+        return;
+    m_cycleIndex = (m_cycleIndex + 1) % PROBE_CYCLE_LENGTH;
+}
+
+void TransferCongestionController::setCongestionWindow(qint64 ackedBytes)
+{
+    // 按确认量增长 (Startup 阶段每轮约翻倍)，但不超过 gain * BDP。
+    // 没有 pacing，Startup 阶段也需要这个上限，否则瓶颈处排队会拉长每一轮，迟迟不能判断管道已满
+    double gain = STARTUP_GAIN;
+    if (m_phase == Drain)
+        gain = 1.0;
+    else if (m_phase == ProbeBandwidth)
+        gain = PROBE_CWND_GAIN * PROBE_CYCLE_GAINS[m_cycleIndex];
+    m_cwndBytes = qMin(m_cwndBytes + ackedBytes, qMax(bdpBytes(gain), m_filledPipe ? 0 : INITIAL_WINDOW_CHUNKS * m_chunkSize));
+    m_cwndBytes = qBound(MIN_WINDOW_CHUNKS * m_chunkSize, m_cwndBytes, MAX_WINDOW_BYTES);
+}
@@ -0,0 +1,101 @@
+#include "transferratelimiter.h"
+#include <cmath>
+
+TransferRateLimiter::TransferRateLimiter()
+{
+    m_clock.start();
+}
+
+void TransferRateLimiter::setLimits(const TransferRateLimits &limits)
+{
+    m_limits = limits;
+    m_limits.globalBytesPerSecond = qMax<qint64>(m_limits.globalBytesPerSecond, 0);
+    m_limits.perPeerBytesPerSecond = qMax<qint64>(m_limits.perPeerBytesPerSecond, 0);
+    // 下次使用时按新速率补充，超出新容量的额度在补充时截断
+}
+
+bool TransferRateLimiter::isActive() const
+{
+    if (m_limits.globalBytesPerSecond <= 0 && m_limits.perPeerBytesPerSecond <= 0)
+        return false;
+    if (!m_limits.scheduleEnabled || m_limits.scheduleStart == m_limits.scheduleEnd)
+        return true;
+    const QTime now = QTime::currentTime();
+    if (m_limits.scheduleStart < m_limits.scheduleEnd)
+        return now >= m_limits.scheduleStart && now < m_limits.scheduleEnd;
+    return now >= m_limits.scheduleStart || now < m_limits.scheduleEnd; // 跨过午夜
+}
+
+qint64 TransferRateLimiter::delayMs(const QString &peerUuid, bool *globalLimited)
+{
+    if (globalLimited)
+        *globalLimited = false;
+    if (!isActive())
+        return 0;
+
+    const qint64 nowMs = m_clock.elapsed();
+    qint64 delay = 0;
+    if (m_limits.globalBytesPerSecond > 0)
+    {
+        refill(m_global, m_limits.globalBytesPerSecond, nowMs);
+        delay = waitMs(m_global, m_limits.globalBytesPerSecond);
+        if (delay > 0)
+        {
+            if (globalLimited)
+                *globalLimited = true;
+            return delay;
+        }
+    }
+    if (m_limits.perPeerBytesPerSecond > 0)
+    {
+        Bucket &bucket = m_peers[peerUuid];
+        refill(bucket, m_limits.perPeerBytesPerSecond, nowMs);
+        delay = waitMs(bucket, m_limits.perPeerBytesPerSecond);
+    }
+    return delay;
+}
+
+void TransferRateLimiter::consume(const QString &peerUuid, qint64 bytes)
+{
+    if (!isActive())
+        return;
+    if (m_limits.globalBytesPerSecond > 0)
+        m_global.tokens -= bytes;
+    if (m_limits.perPeerBytesPerSecond > 0)
+        m_peers[peerUuid].tokens -= bytes;
+}
+
+void TransferRateLimiter::refund(const QString &peerUuid, qint64 bytes)
+{
+    if (bytes > 0)
+        consume(peerUuid, -bytes); // 多出的额度在下次补充时按桶容量截断
+}
+
+void TransferRateLimiter::forgetPeer(const QString &peerUuid)
+{
+    m_peers.remove(peerUuid);
+}
+
+void TransferRateLimiter::refill(Bucket &bucket, qint64 bytesPerSecond, qint64 nowMs) const
+{
+    const double capacity = double(bytesPerSecond) * FT_RATE_LIMIT_BURST_MS / 1000.0;
+    if (bucket.refilledAtMs < 0)
+    {
+        // 首次使用 (或限速刚开启): 从满桶开始
+        bucket.tokens = capacity;
+    }
+    else
+    {
+        bucket.tokens += double(bytesPerSecond) * (nowMs - bucket.refilledAtMs) / 1000.0;
+    }
+    bucket.tokens = qMin(bucket.tokens, capacity);
+    bucket.refilledAtMs = nowMs;
+}
+
+qint64 TransferRateLimiter::waitMs(const Bucket &bucket, qint64 bytesPerSecond)
+{
+    if (bucket.tokens > 0)
+        return 0;
+    // 补足欠额并得到至少 1 字节额度
+    return qMax<qint64>(1, qint64(std::ceil((1.0 - bucket.tokens) * 1000.0 / bytesPerSecond)));
+}
@@ -0,0 +1,161 @@
+#include "transferresumestore.h"
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QUuid>
+
+namespace
+{
+    const quint32 MANIFEST_MAGIC = 0x43525331; // "CRS1"
+    const quint16 MANIFEST_VERSION = 1;
+    const char RECEIVE_SUFFIX[] = ".recv";
+    const char SEND_SUFFIX[] = ".send";
+
+    bool writeFile(const QString &path, const QByteArray &data)
+    {
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+        {
+            qWarning() << "TransferResumeStore: Could not write" << path << ":" << file.errorString();
+            return false;
+        }
+        return true;
+    }
+
+    // 打开并检查文件头，成功时 in 位于第一个字段
+    bool openForRead(QFile &file, QDataStream &in)
+    {
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+        in.setDevice(&file);
+        in.setVersion(QDataStream::Qt_6_5);
+        quint32 magic = 0;
+        quint16 version = 0;
+        in >> magic >> version;
+        return in.status() == QDataStream::Ok && magic == MANIFEST_MAGIC && version == MANIFEST_VERSION;
+    }
+
+    QDataStream &operator<<(QDataStream &out, const ReceiveResumeManifest &m)
+    {
+        return out << m.transferID << m.peerUuid << m.fileName << m.fileID << m.savePath
+                   << m.fileSize << m.verifiedBytes << m.checksum;
+    }
+
+    QDataStream &operator>>(QDataStream &in, ReceiveResumeManifest &m)
+    {
+        return in >> m.transferID >> m.peerUuid >> m.fileName >> m.fileID >> m.savePath
+                  >> m.fileSize >> m.verifiedBytes >> m.checksum;
+    }
+
+    QDataStream &operator<<(QDataStream &out, const SendResumeRecord &r)
+    {
+        return out << r.transferID << r.peerUuid << r.filePath << r.fileID << r.fileSize;
+    }
+
+    QDataStream &operator>>(QDataStream &in, SendResumeRecord &r)
+    {
+        return in >> r.transferID >> r.peerUuid >> r.filePath >> r.fileID >> r.fileSize;
+    }
+
+    template <class T>
+    QByteArray serialize(const T &value)
+    {
+        QByteArray data;
+        QDataStream out(&data, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_6_5);
+        out << MANIFEST_MAGIC << MANIFEST_VERSION << value;
+        return data;
+    }
+
+    template <class T>
+    bool deserialize(const QString &path, T *value)
+    {
+        QFile file(path);
+        QDataStream in;
+        if (!openForRead(file, in))
+            return false;
+        T loaded;
+        in >> loaded;
+        if (in.status() != QDataStream::Ok)
+        {
+            qWarning() << "TransferResumeStore: Corrupted resume file" << path;
+            return false;
+        }
+        *value = loaded;
+        return true;
+    }
+}
+
+TransferResumeStore::TransferResumeStore(const QString &localUserUuid)
+{
+    QString baseAppPath = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+    if (baseAppPath.isEmpty())
+        baseAppPath = QCoreApplication::applicationDirPath() + "/UserData";
+    m_directory = baseAppPath + "/Transfers/" + (localUserUuid.isEmpty() ? QString("default_user") : localUserUuid);
+}
+
+QString TransferResumeStore::pathFor(const QString &transferID, const char *suffix) const
+{
+    if (QUuid::fromString(transferID).isNull())
+        return QString();
+    return m_directory + "/" + QUuid::fromString(transferID).toString(QUuid::WithoutBraces) + suffix;
+}
+
+bool TransferResumeStore::saveReceive(const ReceiveResumeManifest &manifest)
+{
+    QString path = pathFor(manifest.transferID, RECEIVE_SUFFIX);
+    if (path.isEmpty() || !QDir().mkpath(m_directory))
+        return false;
+    return writeFile(path, serialize(manifest));
+}
+
+bool TransferResumeStore::loadReceive(const QString &transferID, ReceiveResumeManifest *manifest) const
+{
+    QString path = pathFor(transferID, RECEIVE_SUFFIX);
+    return !path.isEmpty() && deserialize(path, manifest);
+}
+
+QList<ReceiveResumeManifest> TransferResumeStore::receivesFromPeer(const QString &peerUuid) const
+{
+    QList<ReceiveResumeManifest> manifests;
+    const QStringList files = QDir(m_directory).entryList({QString("*") + RECEIVE_SUFFIX}, QDir::Files);
+    for (const QString &fileName : files)
+    {
+        ReceiveResumeManifest manifest;
+        if (deserialize(m_directory + "/" + fileName, &manifest) && manifest.peerUuid == peerUuid)
+            manifests.append(manifest);
+    }
+    return manifests;
+}
+
+void TransferResumeStore::removeReceive(const QString &transferID)
+{
+    QString path = pathFor(transferID, RECEIVE_SUFFIX);
+    if (!path.isEmpty())
+        QFile::remove(path);
+}
+
+bool TransferResumeStore::saveSend(const SendResumeRecord &record)
+{
+    QString path = pathFor(record.transferID, SEND_SUFFIX);
+    if (path.isEmpty() || !QDir().mkpath(m_directory))
+        return false;
+    return writeFile(path, serialize(record));
+}
+
+bool TransferResumeStore::loadSend(const QString &transferID, SendResumeRecord *record) const
+{
+    QString path = pathFor(transferID, SEND_SUFFIX);
+    return !path.isEmpty() && deserialize(path, record);
+}
+
+void TransferResumeStore::removeSend(const QString &transferID)
+{
+    QString path = pathFor(transferID, SEND_SUFFIX);
+    if (!path.isEmpty())
+        QFile::remove(path);
+}
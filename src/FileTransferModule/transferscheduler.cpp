@@ -0,0 +1,73 @@
+#include "transferscheduler.h"
+
+TransferScheduler::TransferScheduler(qint64 quantumBytes)
+    : m_quantum(qMax<qint64>(quantumBytes, 1))
+{
+}
+
+void TransferScheduler::setWeight(const QString &transferID, int weight)
+{
+    m_weights.insert(transferID, qMax(weight, 1));
+}
+
+void TransferScheduler::activate(const QString &transferID, const QString &peerUuid)
+{
+    if (m_flows.contains(transferID))
+        return;
+    Flow flow;
+    flow.peerUuid = peerUuid;
+    m_flows.insert(transferID, flow);
+    m_peerFlows[peerUuid]++;
+    m_active.append(transferID);
+}
+
+void TransferScheduler::deactivate(const QString &transferID)
+{
+    auto it = m_flows.find(transferID);
+    if (it == m_flows.end())
+        return;
+    if (--m_peerFlows[it->peerUuid] <= 0)
+        m_peerFlows.remove(it->peerUuid);
+    m_flows.erase(it);
+    m_active.removeOne(transferID);
+}
+
+void TransferScheduler::remove(const QString &transferID)
+{
+    deactivate(transferID);
+    m_weights.remove(transferID);
+}
+
+bool TransferScheduler::consume(qint64 cost)
+{
+    if (m_active.isEmpty())
+        return false;
+    const QString transferID = m_active.first();
+    Flow &flow = m_flows[transferID];
+    // 每轮开始时补充一次额度
+    if (!flow.creditedThisTurn)
+    {
+        flow.deficit += quantumFor(flow, transferID);
+        flow.creditedThisTurn = true;
+    }
+    if (cost <= flow.deficit)
+    {
+        flow.deficit -= cost;
+        return true;
+    }
+    rotate();
+    return false;
+}
+
+qint64 TransferScheduler::quantumFor(const Flow &flow, const QString &transferID) const
+{
+    qint64 quantum = m_quantum * m_weights.value(transferID, 1) / qMax(m_peerFlows.value(flow.peerUuid, 1), 1);
+    return qMax<qint64>(quantum, 1);
+}
+
+void TransferScheduler::rotate()
+{
+    QString transferID = m_active.takeFirst();
+    m_flows[transferID].creditedThisTurn = false;
+    m_active.append(transferID);
+}
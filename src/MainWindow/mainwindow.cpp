@@ -37,11 +37,14 @@
 #include <QDateTime>
 #include <QFileDialog>
 #include <QStandardPaths>
+#include <QThread>
 
 MainWindow::MainWindow(const QString &currentUserId, QWidget *parent)
     : QMainWindow(parent),
       m_currentUserIdStr(currentUserId),
       networkManager(nullptr),
+      networkThread(nullptr),
+      transferThread(nullptr),
       settingsDialog(nullptr),
       localUserName(tr("Me")),
       localUserUuid(QString()),
@@ -62,16 +65,31 @@ MainWindow::MainWindow(const QString &currentUserId, QWidget *parent)
 
     chatHistoryManager = new ChatHistoryManager(QCoreApplication::applicationName() + "/" + m_currentUserIdStr, this);
 
-    networkManager = new NetworkManager(this);
+    // 套接字 I/O 与分帧在专用网络线程中进行，UI 重绘不会延迟 ACK，大帧解码也不会阻塞窗口
+    networkManager = new NetworkManager; // 无父对象: 由网络线程结束时删除
     networkManager->setLocalUserDetails(localUserUuid, localUserName);
     networkManager->setListenPreferences(localListenPort, autoNetworkListeningEnabled);
     networkManager->setOutgoingConnectionPreferences(localOutgoingPort, useSpecificOutgoingPort);
+    networkThread = new QThread(this);
+    networkThread->setObjectName("NetworkThread");
+    networkManager->moveToThread(networkThread);
+    connect(networkThread, &QThread::finished, networkManager, &QObject::deleteLater);
+    networkThread->start();
 
     // Initialize FileIOManager
-    FileIOManager *fileIOManager = new FileIOManager(this); // Or as a member if needed elsewhere
+    // 文件传输的数据面 (分块读写、ACK、重传) 运行在独立的传输线程中，FT_ 消息由网络线程直接投递到这里，
+    // UI 只接收节流后的进度与完成事件
+    FileIOManager *fileIOManager = new FileIOManager; // 无父对象: 由传输线程结束时删除
 
     // Initialize FileTransferManager
-    fileTransferManager = new FileTransferManager(networkManager, fileIOManager, localUserUuid, this); // Pass fileIOManager
+    fileTransferManager = new FileTransferManager(networkManager, fileIOManager, localUserUuid); // Pass fileIOManager
+    transferThread = new QThread(this);
+    transferThread->setObjectName("FileTransferThread");
+    fileIOManager->moveToThread(transferThread);
+    fileTransferManager->moveToThread(transferThread);
+    connect(transferThread, &QThread::finished, fileTransferManager, &QObject::deleteLater);
+    connect(transferThread, &QThread::finished, fileIOManager, &QObject::deleteLater);
+    transferThread->start();
 
     contactManager = new ContactManager(networkManager, this);
     connect(contactManager, &ContactManager::contactAdded, this, &MainWindow::handleContactAdded);
@@ -100,7 +118,7 @@ MainWindow::MainWindow(const QString &currentUserId, QWidget *parent)
 
     connect(networkManager, &NetworkManager::peerConnected, networkEventHandler, &NetworkEventHandler::handlePeerConnected);
     connect(networkManager, &NetworkManager::peerDisconnected, networkEventHandler, &NetworkEventHandler::handlePeerDisconnected);
-    connect(networkManager, &NetworkManager::newMessageReceived, networkEventHandler, &NetworkEventHandler::handleNewMessageReceived);
+    connect(networkManager, &NetworkManager::messagesReceived, networkEventHandler, &NetworkEventHandler::handleMessagesReceived);
     connect(networkManager, &NetworkManager::peerNetworkError, networkEventHandler, &NetworkEventHandler::handlePeerNetworkError);
     connect(networkManager, &NetworkManager::serverStatusMessage, this, &MainWindow::updateNetworkStatus);
     connect(networkManager, &NetworkManager::incomingSessionRequest, this, &MainWindow::handleIncomingConnectionRequest);
@@ -119,7 +137,28 @@ MainWindow::MainWindow(const QString &currentUserId, QWidget *parent)
     settings.beginGroup(userSettingsGroup);
     defaultDownloadDir = settings.value("DefaultDownloadDir", QStandardPaths::writableLocation(QStandardPaths::DownloadLocation)).toString();
     requireFileAccept = settings.value("RequireFileAccept", true).toBool();
+    // 接收端写合并阈值 (MB) 与 O_DIRECT 写入，只在配置文件中提供
+    qint64 writeBehindThresholdMB = settings.value("WriteBehindFlushThresholdMB", DEFAULT_WRITE_BEHIND_FLUSH_THRESHOLD / (1024 * 1024)).toLongLong();
+    bool directIOWrites = settings.value("DirectIOWrites", false).toBool();
+    // 文件块压缩 (与对端协商，已压缩的数据自动跳过)，只在配置文件中提供
+    bool compressFileTransfers = settings.value("CompressFileTransfers", true).toBool();
+    // 文件发送限速 (KB/s，0 为不限速) 及其生效时段
+    transferRateLimits.globalBytesPerSecond = settings.value("UploadLimitKBps", 0).toLongLong() * 1024;
+    transferRateLimits.perPeerBytesPerSecond = settings.value("UploadLimitPerPeerKBps", 0).toLongLong() * 1024;
+    transferRateLimits.scheduleEnabled = settings.value("UploadLimitScheduleEnabled", false).toBool();
+    transferRateLimits.scheduleStart = QTime::fromString(settings.value("UploadLimitScheduleStart", "09:00").toString(), "HH:mm");
+    transferRateLimits.scheduleEnd = QTime::fromString(settings.value("UploadLimitScheduleEnd", "18:00").toString(), "HH:mm");
+    if (!transferRateLimits.scheduleStart.isValid())
+        transferRateLimits.scheduleStart = QTime(9, 0);
+    if (!transferRateLimits.scheduleEnd.isValid())
+        transferRateLimits.scheduleEnd = QTime(18, 0);
     settings.endGroup();
+    if (fileTransferManager)
+    {
+        fileTransferManager->setWriteBehindOptions(writeBehindThresholdMB * 1024 * 1024, directIOWrites);
+        fileTransferManager->setRateLimits(transferRateLimits);
+        fileTransferManager->setCompressionEnabled(compressFileTransfers);
+    }
 
     loadCurrentUserContacts(); // 加载联系人
 
@@ -148,13 +187,33 @@ MainWindow::~MainWindow()
         qInfo() << "Cleared active session flag for user:" << m_currentUserIdStr;
     }
 
+    // 先停止传输线程 (其中的对象仍持有 NetworkManager 指针)，再停止网络线程
+    if (fileTransferManager)
+    {
+        disconnect(fileTransferManager, nullptr, this, nullptr);
+        fileTransferManager = nullptr;
+    }
+    if (transferThread)
+    {
+        transferThread->quit();
+        transferThread->wait();
+    }
     if (networkManager)
     {
-        networkManager->stopListening();
-        networkManager->stopUdpDiscovery();
         disconnect(networkManager, nullptr, nullptr, nullptr);
+        // 在网络线程中同步关闭监听与连接，然后结束线程 (finished 时删除 NetworkManager)
+        NetworkManager *nm = networkManager;
+        QMetaObject::invokeMethod(nm, [nm]() {
+            nm->stopListening();
+            nm->stopUdpDiscovery();
+        }, Qt::BlockingQueuedConnection);
+        networkManager = nullptr;
+    }
+    if (networkThread)
+    {
+        networkThread->quit();
+        networkThread->wait();
     }
-    // fileTransferManager will also be deleted by QObject parent system
 
     qDebug() << "MainWindow::~MainWindow() - Destruction finished.";
 }
@@ -248,7 +307,8 @@ void MainWindow::handleSettingsApplied(const QString &userName,
                                        quint16 outgoingPort, bool useSpecificOutgoingPortVal,
                                        bool enableUdpDiscovery, quint16 udpDiscoveryPort,
                                        bool enableContinuousUdpBroadcast, int udpBroadcastInterval,
-                                       const QString &newDefaultDownloadDir, bool newRequireFileAccept)
+                                       const QString &newDefaultDownloadDir, bool newRequireFileAccept,
+                                       const TransferRateLimits &newRateLimits)
 {
     if (m_currentUserIdStr.isEmpty())
         return;
@@ -332,6 +392,21 @@ void MainWindow::handleSettingsApplied(const QString &userName,
         settings.setValue("RequireFileAccept", requireFileAccept);
         settingsChanged = true;
     }
+    if (transferRateLimits != newRateLimits)
+    {
+        transferRateLimits = newRateLimits;
+        settings.setValue("UploadLimitKBps", transferRateLimits.globalBytesPerSecond / 1024);
+        settings.setValue("UploadLimitPerPeerKBps", transferRateLimits.perPeerBytesPerSecond / 1024);
+        settings.setValue("UploadLimitScheduleEnabled", transferRateLimits.scheduleEnabled);
+        settings.setValue("UploadLimitScheduleStart", transferRateLimits.scheduleStart.toString("HH:mm"));
+        settings.setValue("UploadLimitScheduleEnd", transferRateLimits.scheduleEnd.toString("HH:mm"));
+        settingsChanged = true;
+        // 立即作用于进行中的传输
+        if (fileTransferManager)
+        {
+            fileTransferManager->setRateLimits(transferRateLimits);
+        }
+    }
 
     settings.endGroup();
 
@@ -377,6 +452,7 @@ void MainWindow::onSettingsButtonClicked()
                                             udpDiscoveryEnabled, localUdpDiscoveryPort,
                                             udpContinuousBroadcastEnabled, udpBroadcastIntervalSeconds,
                                             defaultDownloadDir, requireFileAccept,
+                                            transferRateLimits,
                                             this);
         connect(settingsDialog, &SettingsDialog::settingsApplied, this, &MainWindow::handleSettingsApplied);
         connect(settingsDialog, &SettingsDialog::retryListenNowRequested, this, &MainWindow::handleRetryListenNowRequested);
@@ -389,7 +465,8 @@ void MainWindow::onSettingsButtonClicked()
                                      localOutgoingPort, useSpecificOutgoingPort,
                                      udpDiscoveryEnabled, localUdpDiscoveryPort,
                                      udpContinuousBroadcastEnabled, udpBroadcastIntervalSeconds,
-                                     defaultDownloadDir, requireFileAccept);
+                                     defaultDownloadDir, requireFileAccept,
+                                     transferRateLimits);
     }
     settingsDialog->exec();
 }
@@ -0,0 +1,281 @@
+#include "frameprotocol.h"
+#include "chunkbufferpool.h"
+#include <QIODevice>
+#include <QtEndian>
+
+QByteArray encodeFrameHeader(FrameType type, quint16 flags, quint32 payloadLength)
+{
+    QByteArray header(FRAME_HEADER_SIZE, Qt::Uninitialized);
+    char *out = header.data();
+    qToBigEndian<quint16>(FRAME_MAGIC, out);
+    out[2] = static_cast<char>(FRAME_HEADER_VERSION);
+    out[3] = static_cast<char>(type);
+    qToBigEndian<quint16>(flags, out + 4);
+    qToBigEndian<quint32>(payloadLength, out + 6);
+    return header;
+}
+
+QByteArray encodeFileChunkSubHeader(const QString &transferID, qint64 chunkID, quint8 capabilities, qint64 fileOffset, qint64 checksum)
+{
+    QByteArray id = transferID.toUtf8();
+    QByteArray header;
+    header.reserve(FILE_CHUNK_HEADER_FIXED_SIZE + FILE_CHUNK_OFFSET_SIZE + FILE_CHUNK_CHECKSUM_SIZE + id.size());
+
+    char fixed[sizeof(quint16)];
+    qToBigEndian<quint16>(static_cast<quint16>(id.size()), fixed);
+    header.append(fixed, sizeof(fixed));
+    header.append(id);
+    char chunk[sizeof(qint64)];
+    qToBigEndian<qint64>(chunkID, chunk);
+    header.append(chunk, sizeof(chunk));
+    if (capabilities & PeerCapabilityChunkOffsets)
+    {
+        char offset[sizeof(qint64)];
+        qToBigEndian<qint64>(fileOffset, offset);
+        header.append(offset, sizeof(offset));
+    }
+    if (capabilities & PeerCapabilityChunkChecksums)
+    {
+        char crc[sizeof(quint32)];
+        qToBigEndian<quint32>(static_cast<quint32>(checksum), crc);
+        header.append(crc, sizeof(crc));
+    }
+    return header;
+}
+
+bool decodeFileChunkHeader(const QByteArray &payload, quint8 capabilities, QString &transferID, qint64 &chunkID,
+                           qint64 &fileOffset, qint64 &checksum, qsizetype &dataOffset)
+{
+    const bool withFileOffset = capabilities & PeerCapabilityChunkOffsets;
+    const bool withChecksum = capabilities & PeerCapabilityChunkChecksums;
+    const int fixedSize = FILE_CHUNK_HEADER_FIXED_SIZE + (withFileOffset ? FILE_CHUNK_OFFSET_SIZE : 0) +
+                          (withChecksum ? FILE_CHUNK_CHECKSUM_SIZE : 0);
+    if (payload.size() < fixedSize)
+        return false;
+    const char *in = payload.constData();
+    quint16 idLength = qFromBigEndian<quint16>(in);
+    if (payload.size() < fixedSize + idLength)
+        return false;
+    transferID = QString::fromUtf8(in + 2, idLength);
+    const char *fields = in + FILE_CHUNK_HEADER_FIXED_SIZE + idLength;
+    chunkID = qFromBigEndian<qint64>(fields - sizeof(qint64));
+    fileOffset = -1;
+    checksum = -1;
+    if (withFileOffset)
+    {
+        fileOffset = qFromBigEndian<qint64>(fields);
+        if (fileOffset < 0)
+            return false;
+        fields += FILE_CHUNK_OFFSET_SIZE;
+    }
+    if (withChecksum)
+        checksum = qFromBigEndian<quint32>(fields);
+    dataOffset = fixedSize + idLength;
+    return true;
+}
+
+FrameDecoder::FrameDecoder(quint32 maxFrameSize)
+    : m_maxFrameSize(maxFrameSize),
+      m_headerBytesRead(0),
+      m_type(FrameType::TextMessage),
+      m_flags(FrameFlagNone),
+      m_payloadLength(0),
+      m_payloadReused(false),
+      m_payloadBytesRead(0),
+      m_frameReady(false),
+      m_fragmentBytes(0),
+      m_fragmentReused(false),
+      m_fragmentSizeHint(0),
+      m_fragmentType(FrameType::TextMessage),
+      m_inFragmentedFrame(false)
+{
+}
+
+void FrameDecoder::setMaxFrameSize(quint32 maxFrameSize)
+{
+    m_maxFrameSize = maxFrameSize;
+}
+
+quint32 FrameDecoder::maxFrameSize() const
+{
+    return m_maxFrameSize;
+}
+
+QString FrameDecoder::errorString() const
+{
+    return m_errorString;
+}
+
+void FrameDecoder::reset()
+{
+    m_headerBytesRead = 0;
+    m_type = FrameType::TextMessage;
+    m_flags = FrameFlagNone;
+    m_payloadLength = 0;
+    m_payload = QByteArray();
+    m_payloadReused = false;
+    m_payloadBytesRead = 0;
+    m_frameReady = false;
+    m_errorString.clear();
+    m_fragmentBuffer = QByteArray();
+    m_fragmentBytes = 0;
+    m_fragmentReused = false;
+    m_fragmentType = FrameType::TextMessage;
+    m_inFragmentedFrame = false;
+}
+
+FrameDecoder::Status FrameDecoder::fail(const QString &error)
+{
+    m_errorString = error;
+    m_payload = QByteArray();
+    m_fragmentBuffer = QByteArray();
+    m_fragmentBytes = 0;
+    return ProtocolError;
+}
+
+FrameDecoder::Status FrameDecoder::readFrom(QIODevice *device)
+{
+    if (m_frameReady)
+        return FrameReady;
+    if (!m_errorString.isEmpty())
+        return ProtocolError;
+    if (!device)
+        return fail(QStringLiteral("No device to read frames from"));
+
+    // 分片帧在此循环中直接并入重组缓冲区，直到得到一个完整的逻辑帧或数据不足
+    for (;;)
+    {
+        if (m_headerBytesRead < FRAME_HEADER_SIZE)
+        {
+            qint64 n = device->read(m_headerBuffer + m_headerBytesRead, FRAME_HEADER_SIZE - m_headerBytesRead);
+            if (n < 0)
+                return fail(QStringLiteral("Failed to read frame header: %1").arg(device->errorString()));
+            m_headerBytesRead += static_cast<int>(n);
+            if (m_headerBytesRead < FRAME_HEADER_SIZE)
+                return NeedMoreData;
+
+            quint16 magic = qFromBigEndian<quint16>(m_headerBuffer);
+            quint8 version = static_cast<quint8>(m_headerBuffer[2]);
+            m_type = static_cast<FrameType>(static_cast<quint8>(m_headerBuffer[3]));
+            m_flags = qFromBigEndian<quint16>(m_headerBuffer + 4);
+            m_payloadLength = qFromBigEndian<quint32>(m_headerBuffer + 6);
+
+            if (magic != FRAME_MAGIC)
+                return fail(QStringLiteral("Bad frame magic 0x%1").arg(magic, 4, 16, QLatin1Char('0')));
+            if (version != FRAME_HEADER_VERSION)
+                return fail(QStringLiteral("Unsupported frame version %1").arg(version));
+            // 在分配任何负载内存之前检查声明的长度
+            if (m_payloadLength > m_maxFrameSize)
+                return fail(QStringLiteral("Frame of %1 bytes exceeds limit of %2 bytes").arg(m_payloadLength).arg(m_maxFrameSize));
+
+            if (m_flags & FrameFlagFragment)
+            {
+                if (m_inFragmentedFrame && m_type != m_fragmentType)
+                    return fail(QStringLiteral("Fragment of type %1 interleaved with fragmented frame of type %2")
+                                    .arg(static_cast<int>(m_type))
+                                    .arg(static_cast<int>(m_fragmentType)));
+                if (static_cast<quint64>(m_fragmentBytes) + m_payloadLength > m_maxFrameSize)
+                    return fail(QStringLiteral("Fragmented frame exceeds limit of %1 bytes").arg(m_maxFrameSize));
+
+                // 分片负载直接读入重组缓冲区，不为每个分片单独分配
+                if (!m_inFragmentedFrame)
+                {
+                    m_inFragmentedFrame = true;
+                    m_fragmentType = m_type;
+                    m_fragmentBytes = 0;
+                    if (m_type == FrameType::FileChunk)
+                    {
+                        // 块大小在传输中很少改变: 按上一个重组的块取缓冲池中的缓冲区，其余分片不再分配
+                        bool allocated = true;
+                        m_fragmentBuffer = chunkBufferPool().acquire(static_cast<qsizetype>(qMax(m_fragmentSizeHint, m_payloadLength)), &allocated);
+                        m_fragmentReused = !allocated;
+                    }
+                    else
+                    {
+                        m_fragmentBuffer = QByteArray();
+                        m_fragmentReused = false;
+                    }
+                }
+                const qsizetype needed = static_cast<qsizetype>(m_fragmentBytes) + m_payloadLength;
+                if (m_fragmentBuffer.size() < needed)
+                {
+                    // 比预计的大 (或非 FileChunk 帧): 按倍数增长，不超过帧大小上限
+                    m_fragmentBuffer.resize(qMin<qsizetype>(qMax<qsizetype>(needed, m_fragmentBuffer.size() * 2), m_maxFrameSize));
+                    m_fragmentReused = false;
+                }
+            }
+            else if (m_type == FrameType::FileChunk)
+            {
+                bool allocated = true;
+                m_payload = chunkBufferPool().acquire(static_cast<qsizetype>(m_payloadLength), &allocated);
+                m_payloadReused = !allocated;
+            }
+            else
+            {
+                m_payload.resize(static_cast<qsizetype>(m_payloadLength));
+                m_payloadReused = false;
+            }
+            m_payloadBytesRead = 0;
+        }
+
+        if (m_payloadBytesRead < m_payloadLength)
+        {
+            char *target = (m_flags & FrameFlagFragment) ? m_fragmentBuffer.data() + m_fragmentBytes : m_payload.data();
+            qint64 n = device->read(target + m_payloadBytesRead, m_payloadLength - m_payloadBytesRead);
+            if (n < 0)
+                return fail(QStringLiteral("Failed to read frame payload: %1").arg(device->errorString()));
+            m_payloadBytesRead += static_cast<quint32>(n);
+            if (m_payloadBytesRead < m_payloadLength)
+                return NeedMoreData;
+        }
+
+        if (!(m_flags & FrameFlagFragment))
+        {
+            m_frameReady = true;
+            return FrameReady;
+        }
+
+        // 分片的负载已在重组缓冲区中
+        m_fragmentBytes += m_payloadLength;
+        m_headerBytesRead = 0;
+        m_payloadLength = 0;
+        m_payloadBytesRead = 0;
+
+        if (m_flags & FrameFlagFinalFragment)
+        {
+            m_type = m_fragmentType;
+            m_flags = static_cast<quint16>(m_flags & ~(FrameFlagFragment | FrameFlagFinalFragment));
+            m_fragmentBuffer.resize(static_cast<qsizetype>(m_fragmentBytes)); // 缩小不释放容量
+            if (m_fragmentType == FrameType::FileChunk)
+                m_fragmentSizeHint = m_fragmentBytes;
+            m_payload = std::move(m_fragmentBuffer);
+            m_payloadReused = m_fragmentReused;
+            m_payloadLength = m_fragmentBytes;
+            m_fragmentBuffer = QByteArray();
+            m_fragmentBytes = 0;
+            m_fragmentReused = false;
+            m_inFragmentedFrame = false;
+            m_frameReady = true;
+            return FrameReady;
+        }
+    }
+}
+
+Frame FrameDecoder::takeFrame()
+{
+    Frame frame;
+    if (!m_frameReady)
+        return frame;
+    frame.type = m_type;
+    frame.flags = m_flags;
+    frame.payload = std::move(m_payload);
+    frame.payloadReused = m_payloadReused;
+
+    m_headerBytesRead = 0;
+    m_payloadReused = false;
+    m_payloadLength = 0;
+    m_payloadBytesRead = 0;
+    m_payload = QByteArray();
+    m_frameReady = false;
+    return frame;
+}
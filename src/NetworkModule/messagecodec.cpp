@@ -0,0 +1,306 @@
+#include "messagecodec.h"
+#include <QDebug>
+
+namespace
+{
+    bool isTagTerminator(QChar c)
+    {
+        return c.isSpace() || c == QLatin1Char('/') || c == QLatin1Char('>');
+    }
+
+    // Base64 字符 -> 6 位值，非法字符为 -1
+    const std::array<qint8, 128> &base64DecodeTable()
+    {
+        static const std::array<qint8, 128> table = [] {
+            std::array<qint8, 128> t{};
+            t.fill(-1);
+            const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            for (int i = 0; i < 64; ++i)
+                t[static_cast<uchar>(alphabet[i])] = static_cast<qint8>(i);
+            return t;
+        }();
+        return table;
+    }
+}
+
+AttributeTokenizer::AttributeTokenizer(QStringView message)
+    : m_message(message),
+      m_tag(tagOf(message)),
+      m_pos(0),
+      m_state(InAttributes)
+{
+    if (m_tag.isEmpty())
+        m_state = Error;
+    else
+        m_pos = 1 + m_tag.size();
+}
+
+QStringView AttributeTokenizer::tagOf(QStringView message)
+{
+    if (message.isEmpty() || message.front() != QLatin1Char('<'))
+        return QStringView();
+    qsizetype end = 1;
+    while (end < message.size() && !isTagTerminator(message.at(end)))
+        ++end;
+    return message.sliced(1, end - 1);
+}
+
+bool AttributeTokenizer::next()
+{
+    if (m_state != InAttributes)
+        return false;
+
+    const qsizetype length = m_message.size();
+    while (m_pos < length && m_message.at(m_pos).isSpace())
+        ++m_pos;
+    if (m_pos >= length)
+    {
+        m_state = Error; // 缺少结尾的 "/>"
+        return false;
+    }
+    QChar c = m_message.at(m_pos);
+    if (c == QLatin1Char('/') || c == QLatin1Char('>'))
+    {
+        m_state = Finished;
+        return false;
+    }
+
+    qsizetype nameStart = m_pos;
+    while (m_pos < length && m_message.at(m_pos) != QLatin1Char('=') && !m_message.at(m_pos).isSpace())
+        ++m_pos;
+    if (m_pos + 1 >= length || m_message.at(m_pos) != QLatin1Char('=') || m_message.at(m_pos + 1) != QLatin1Char('"'))
+    {
+        m_state = Error;
+        return false;
+    }
+    m_name = m_message.sliced(nameStart, m_pos - nameStart);
+
+    qsizetype valueStart = m_pos + 2;
+    qsizetype valueEnd = m_message.indexOf(QLatin1Char('"'), valueStart);
+    if (valueEnd < 0)
+    {
+        m_state = Error;
+        return false;
+    }
+    m_value = m_message.sliced(valueStart, valueEnd - valueStart);
+    m_pos = valueEnd + 1;
+    return true;
+}
+
+namespace MessageCodec
+{
+    void appendTextValue(QString &out, const QByteArray &value)
+    {
+        out += QLatin1String(value.toBase64());
+    }
+
+    bool parseTextValue(QStringView text, QByteArray &value)
+    {
+        const std::array<qint8, 128> &table = base64DecodeTable();
+        value.resize((text.size() / 4) * 3 + 3);
+        char *out = value.data();
+        qsizetype written = 0;
+        quint32 accumulator = 0;
+        int bits = 0;
+        for (QChar c : text)
+        {
+            char16_t u = c.unicode();
+            if (u == u'=')
+                break; // 填充，其后不再有数据
+            if (u >= 128 || table[u] < 0)
+            {
+                value.clear();
+                return false;
+            }
+            accumulator = (accumulator << 6) | static_cast<quint32>(table[u]);
+            bits += 6;
+            if (bits >= 8)
+            {
+                bits -= 8;
+                out[written++] = static_cast<char>((accumulator >> bits) & 0xFF);
+            }
+        }
+        value.resize(written);
+        return true;
+    }
+
+    bool parseTextValue(QStringView text, QString &value)
+    {
+        value = text.toString();
+        return true;
+    }
+
+    bool parseTextValue(QStringView text, qint64 &value)
+    {
+        if (text.isEmpty())
+        {
+            value = 0;
+            return true;
+        }
+        bool ok = false;
+        value = text.toLongLong(&ok);
+        return ok;
+    }
+
+    bool parseTextValue(QStringView text, quint8 &value)
+    {
+        if (text.isEmpty())
+        {
+            value = 0;
+            return true;
+        }
+        bool ok = false;
+        uint parsed = text.toUInt(&ok);
+        value = static_cast<quint8>(qMin<uint>(parsed, 255));
+        return ok;
+    }
+
+    void appendBinaryValue(QByteArray &out, const QString &value)
+    {
+        QByteArray utf8 = value.toUtf8();
+        char length[sizeof(quint32)];
+        qToBigEndian<quint32>(static_cast<quint32>(utf8.size()), length);
+        out.append(length, sizeof(length));
+        out.append(utf8);
+    }
+
+    void appendBinaryValue(QByteArray &out, qint64 value)
+    {
+        char bytes[sizeof(qint64)];
+        qToBigEndian<qint64>(value, bytes);
+        out.append(bytes, sizeof(bytes));
+    }
+
+    void appendBinaryValue(QByteArray &out, quint8 value)
+    {
+        out.append(static_cast<char>(value));
+    }
+
+    bool readBinaryValue(const char *&in, const char *end, QString &value)
+    {
+        if (end - in < static_cast<qptrdiff>(sizeof(quint32)))
+            return false;
+        quint32 length = qFromBigEndian<quint32>(in);
+        in += sizeof(quint32);
+        if (static_cast<quint64>(end - in) < length)
+            return false;
+        value = QString::fromUtf8(in, static_cast<qsizetype>(length));
+        in += length;
+        return true;
+    }
+
+    bool readBinaryValue(const char *&in, const char *end, qint64 &value)
+    {
+        if (end - in < static_cast<qptrdiff>(sizeof(qint64)))
+            return false;
+        value = qFromBigEndian<qint64>(in);
+        in += sizeof(qint64);
+        return true;
+    }
+
+    bool readBinaryValue(const char *&in, const char *end, quint8 &value)
+    {
+        if (in >= end)
+            return false;
+        value = static_cast<quint8>(*in);
+        ++in;
+        return true;
+    }
+
+    void appendBinaryValue(QByteArray &out, const QByteArray &value)
+    {
+        char length[sizeof(quint32)];
+        qToBigEndian<quint32>(static_cast<quint32>(value.size()), length);
+        out.append(length, sizeof(length));
+        out.append(value);
+    }
+
+    bool readBinaryValue(const char *&in, const char *end, QByteArray &value)
+    {
+        if (end - in < static_cast<qptrdiff>(sizeof(quint32)))
+            return false;
+        quint32 length = qFromBigEndian<quint32>(in);
+        in += sizeof(quint32);
+        if (static_cast<quint64>(end - in) < length)
+            return false;
+        value = QByteArray(in, static_cast<qsizetype>(length));
+        in += length;
+        return true;
+    }
+
+    MessageType binaryType(const QByteArray &payload)
+    {
+        if (payload.size() < static_cast<qsizetype>(sizeof(quint16)))
+            return MessageType::Unknown;
+        quint16 type = qFromBigEndian<quint16>(payload.constData());
+        if (type == 0 || type >= static_cast<quint16>(MessageType::Count))
+            return MessageType::Unknown;
+        return static_cast<MessageType>(type);
+    }
+}
+
+void MessageDispatcher::registerTag(QLatin1String tag, MessageType type)
+{
+    size_t key = qHash(QStringView(QString(tag)));
+    MessageType existing = m_tagHashToType.value(key, MessageType::Unknown);
+    if (existing != MessageType::Unknown && existing != type)
+    {
+        qCritical() << "MessageDispatcher: Tag hash collision between" << tag << "and"
+                    << m_entries[static_cast<int>(existing)].tag;
+        return;
+    }
+    m_tagHashToType.insert(key, type);
+}
+
+void MessageDispatcher::unregisterHandler(MessageType type)
+{
+    if (type == MessageType::Unknown || type >= MessageType::Count)
+        return;
+    QWriteLocker locker(&m_lock);
+    m_entries[static_cast<int>(type)] = Entry();
+    for (auto it = m_tagHashToType.begin(); it != m_tagHashToType.end();)
+    {
+        if (it.value() == type)
+            it = m_tagHashToType.erase(it);
+        else
+            ++it;
+    }
+}
+
+bool MessageDispatcher::dispatchText(const QString &peerUuid, const QString &message) const
+{
+    AttributeTokenizer tokenizer(message);
+    QStringView tag = tokenizer.tag();
+    if (tag.isEmpty())
+        return false;
+    QReadLocker locker(&m_lock);
+    MessageType type = m_tagHashToType.value(qHash(tag), MessageType::Unknown);
+    if (type == MessageType::Unknown)
+        return false;
+    const Entry &entry = m_entries[static_cast<int>(type)];
+    if (!entry.fromText || tag != entry.tag)
+        return false;
+
+    if (!entry.fromText(peerUuid, tokenizer))
+    {
+        qWarning() << "MessageDispatcher: Malformed" << entry.tag << "from peer" << peerUuid << ":" << message.left(200);
+    }
+    return true;
+}
+
+bool MessageDispatcher::dispatchBinary(const QString &peerUuid, const QByteArray &payload) const
+{
+    MessageType type = MessageCodec::binaryType(payload);
+    if (type == MessageType::Unknown)
+        return false;
+    QReadLocker locker(&m_lock);
+    const Entry &entry = m_entries[static_cast<int>(type)];
+    if (!entry.fromBinary)
+        return false;
+    if (!entry.fromBinary(peerUuid, payload))
+    {
+        qWarning() << "MessageDispatcher: Malformed binary message of type" << static_cast<int>(type)
+                   << "(" << payload.size() << "bytes) from peer" << peerUuid;
+    }
+    return true;
+}
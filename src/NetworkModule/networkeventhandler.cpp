@@ -149,19 +149,19 @@ void NetworkEventHandler::handlePeerDisconnected(const QString &peerUuid)
     }
 }
 
+void NetworkEventHandler::handleMessagesReceived(const QList<ReceivedMessage> &messages)
+{
+    for (const ReceivedMessage &received : messages)
+    {
+        handleNewMessageReceived(received.peerUuid, received.message);
+    }
+}
+
 void NetworkEventHandler::handleNewMessageReceived(const QString &peerUuid, const QString &message)
 {
     if (!mainWindowPtr || !networkManager || !chatHistories || !contactListWidget || !messageDisplay) return;
 
-    // Check if it's a file transfer message
-    if (message.startsWith("<FT_")) {
-        if (fileTransferManager) {
-            fileTransferManager->handleIncomingFileMessage(peerUuid, message);
-        } else {
-            qWarning() << "NEH: Received file transfer message but FileTransferManager is null:" << message;
-        }
-        return; // Message handled (or attempted to be handled) by FileTransferManager
-    }
+    // FT_ 等控制消息已由 NetworkManager 的分发表交给各自的子系统，这里只会收到聊天消息
 
     QListWidgetItem *contactItem = nullptr;
     QString contactName = tr("Unknown");
@@ -1,19 +1,34 @@
 #include "networkmanager.h"
 #include <QNetworkInterface>
 #include <QDataStream>
-#include <QRegularExpression> // For parsing
+#include <QtEndian>
 #include <QDebug>             // Ensure QDebug is included
-
-// Helper function to extract attribute from simple XML-like string
-QString extractAttribute(const QString &message, const QString &attributeName)
+#include <QMutexLocker>
+#include <algorithm>
+#include "fileiomanager.h" // TransferFile (零拷贝发送)
+#include "chunkbufferpool.h"
+
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <cerrno>
+#endif
+
+namespace
 {
-    QRegularExpression regex(QStringLiteral("%1=\\\"([^\\\"]*)\\\"").arg(attributeName));
-    QRegularExpressionMatch match = regex.match(message);
-    if (match.hasMatch() && match.capturedTexts().size() > 1)
+    // 与 QDataStream(Qt_6_5) << QString 的输出相同 (quint32 字节数 + UTF-16BE)，
+    // 但不为每条消息构造 QDataStream
+    QByteArray encodeLegacyMessage(const QString &message)
     {
-        return match.captured(1);
+        if (message.isNull())
+            return QByteArray("\xFF\xFF\xFF\xFF", 4);
+        const qsizetype byteLength = message.size() * qsizetype(sizeof(char16_t));
+        QByteArray block(sizeof(quint32) + byteLength, Qt::Uninitialized);
+        char *out = block.data();
+        qToBigEndian<quint32>(static_cast<quint32>(byteLength), out);
+        qToBigEndian<quint16>(message.utf16(), message.size(), out + sizeof(quint32));
+        return block;
     }
-    return QString();
 }
 
 NetworkManager::NetworkManager(QObject *parent)
@@ -32,6 +47,9 @@ NetworkManager::NetworkManager(QObject *parent)
       udpBroadcastIntervalSeconds(DEFAULT_UDP_BROADCAST_INTERVAL_SECONDS), // Added: Use default
       retryListenTimer(nullptr),
       retryListenIntervalMs(15000),
+      maxFrameSize(DEFAULT_MAX_FRAME_SIZE),
+      flushScheduled(false),
+      deliveryScheduled(false),
       preferredOutgoingPortNumber(0),
       bindToSpecificOutgoingPort(false),
       localUserUuid(),
@@ -82,6 +100,9 @@ NetworkManager::~NetworkManager()
     qDeleteAll(outgoingSocketsAwaitingSessionAccepted.keys());
     outgoingSocketsAwaitingSessionAccepted.clear();
 
+    qDeleteAll(socketLinks);
+    socketLinks.clear();
+
     if (tcpServer)
     {
         qDebug() << "NetworkManager::~NetworkManager() - Disconnecting and deleting tcpServer";
@@ -123,13 +144,19 @@ void NetworkManager::setupServer()
     connect(tcpServer, &QTcpServer::newConnection, this, &NetworkManager::onNewConnection);
     connect(tcpServer, &QTcpServer::acceptError, this, [this](QAbstractSocket::SocketError socketError)
             {
-        lastError = tcpServer->errorString();
+        setLastError(tcpServer->errorString());
         emit peerNetworkError("", socketError, lastError);
         emit serverStatusMessage(QString("Server Error: %1").arg(lastError)); });
 }
 
 bool NetworkManager::startListening()
 {
+    if (!isInNetworkThread())
+    {
+        bool result = false;
+        QMetaObject::invokeMethod(this, &NetworkManager::startListening, Qt::BlockingQueuedConnection, &result);
+        return result;
+    }
     if (!autoStartListeningEnabled)
     {
         emit serverStatusMessage(tr("Network listening is disabled by user settings."));
@@ -165,7 +192,7 @@ bool NetworkManager::startListening()
 
     if (!tcpServer->listen(QHostAddress::Any, portToListen))
     {
-        lastError = tcpServer->errorString();
+        setLastError(tcpServer->errorString());
         emit serverStatusMessage(QString("Server could not start on port %1: %2. Will retry automatically if enabled.")
                                      .arg(portToListen)
                                      .arg(lastError));
@@ -207,6 +234,11 @@ void NetworkManager::attemptToListen()
 
 void NetworkManager::stopListening()
 {
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { stopListening(); }, Qt::QueuedConnection);
+        return;
+    }
     if (retryListenTimer && retryListenTimer->isActive())
     {
         retryListenTimer->stop();
@@ -227,6 +259,12 @@ void NetworkManager::stopListening()
     connectedSockets.clear();
     socketToUuidMap.clear();
     peerUuidToNameMap.clear();
+    {
+        QMutexLocker locker(&snapshotMutex);
+        peerSnapshots.clear();
+    }
+    qDeleteAll(socketLinks);
+    socketLinks.clear();
 
     for (QTcpSocket *socket : pendingIncomingSockets)
     {
@@ -234,6 +272,8 @@ void NetworkManager::stopListening()
         socket->deleteLater();
     }
     pendingIncomingSockets.clear();
+    pendingIncomingFrameVersions.clear();
+    pendingIncomingCapabilities.clear();
 
     for (QTcpSocket *socket : outgoingSocketsAwaitingSessionAccepted.keys())
     {
@@ -305,6 +345,11 @@ bool NetworkManager::isSelfConnection(const QString &targetHost, quint16 targetP
 
 void NetworkManager::connectToHost(const QString &peerNameToSet, const QString &targetPeerUuidHint, const QString &hostAddress, quint16 port)
 {
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { connectToHost(peerNameToSet, targetPeerUuidHint, hostAddress, port); }, Qt::QueuedConnection);
+        return;
+    }
     qDebug() << "NM::connectToHost: Attempting to connect to Name:" << peerNameToSet
              << "IP:" << hostAddress << "Port:" << port
              << "My UUID:" << localUserUuid << "My NameHint:" << localUserDisplayName
@@ -366,6 +411,11 @@ void NetworkManager::connectToHost(const QString &peerNameToSet, const QString &
 
 void NetworkManager::disconnectFromPeer(const QString &peerUuid)
 {
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { disconnectFromPeer(peerUuid); }, Qt::QueuedConnection);
+        return;
+    }
     QTcpSocket *socket = connectedSockets.value(peerUuid, nullptr);
     if (socket)
     {
@@ -378,68 +428,606 @@ void NetworkManager::disconnectFromPeer(const QString &peerUuid)
     }
 }
 
-void NetworkManager::sendMessage(const QString &targetPeerUuid, const QString &message)
+void NetworkManager::sendMessage(const QString &targetPeerUuid, const QString &message, OutboundChannel channel)
 {
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { sendMessage(targetPeerUuid, message, channel); }, Qt::QueuedConnection);
+        return;
+    }
     QTcpSocket *socket = connectedSockets.value(targetPeerUuid, nullptr);
     if (socket && socket->isOpen() && socket->state() == QAbstractSocket::ConnectedState)
     {
-        sendSystemMessage(socket, message);
+        sendSystemMessage(socket, message, channel);
     }
     else
     {
-        lastError = tr("Peer %1 not connected or socket invalid.").arg(targetPeerUuid);
+        setLastError(tr("Peer %1 not connected or socket invalid.").arg(targetPeerUuid));
         emit serverStatusMessage(tr("Cannot send message to %1: Not connected.").arg(peerUuidToNameMap.value(targetPeerUuid, targetPeerUuid)));
     }
 }
 
-QAbstractSocket::SocketState NetworkManager::getPeerSocketState(const QString &peerUuid) const
+bool NetworkManager::sendFileChunk(const QString &targetPeerUuid, const QString &transferID, qint64 chunkID, qint64 fileOffset, qint64 checksum, const QByteArray &data,
+                                   bool compressed)
 {
-    QTcpSocket *socket = connectedSockets.value(peerUuid, nullptr);
-    if (socket)
+    if (!isInNetworkThread())
     {
-        return socket->state();
+        // 是否支持二进制帧由快照决定，实际发送在网络线程中进行
+        if (getPeerFrameProtocolVersion(targetPeerUuid) == 0)
+            return false;
+        QMetaObject::invokeMethod(this, [=]() { sendFileChunk(targetPeerUuid, transferID, chunkID, fileOffset, checksum, data, compressed); }, Qt::QueuedConnection);
+        return true;
     }
-    return QAbstractSocket::UnconnectedState;
+    QTcpSocket *socket = connectedSockets.value(targetPeerUuid, nullptr);
+    PeerLink *link = socketLinks.value(socket, nullptr);
+    if (!socket || !link || link->frameProtocolVersion == 0)
+        return false;
+    if (!socket->isOpen() || socket->state() != QAbstractSocket::ConnectedState)
+    {
+        setLastError(tr("Peer %1 not connected or socket invalid.").arg(targetPeerUuid));
+        emit serverStatusMessage(tr("Cannot send message to %1: Not connected.").arg(peerUuidToNameMap.value(targetPeerUuid, targetPeerUuid)));
+        return false;
+    }
+
+    // 文件数据以隐式共享的方式进入批量通道，不再拼接或重新编码
+    OutboundMessage message;
+    message.type = FrameType::FileChunk;
+    message.head = encodeFileChunkSubHeader(transferID, chunkID, link->capabilities, fileOffset, checksum);
+    message.body = data;
+    message.flags = compressed ? FrameFlagCompressed : FrameFlagNone;
+    enqueueOutbound(socket, link, OutboundChannel::Bulk, std::move(message));
+    return true;
+}
+
+bool NetworkManager::sendFileChunkFromFile(const QString &targetPeerUuid, const QString &transferID, qint64 chunkID,
+                                           const QSharedPointer<TransferFile> &file, qint64 offset, qint64 length)
+{
+    if (!file || file->nativeDescriptor() < 0)
+        return false;
+    if (!isInNetworkThread())
+    {
+        if (!isPeerZeroCopyEnabled(targetPeerUuid))
+            return false;
+        QMetaObject::invokeMethod(this, [=]() { sendFileChunkFromFile(targetPeerUuid, transferID, chunkID, file, offset, length); }, Qt::QueuedConnection);
+        return true;
+    }
+    QTcpSocket *socket = connectedSockets.value(targetPeerUuid, nullptr);
+    PeerLink *link = socketLinks.value(socket, nullptr);
+    // 能力在排队后被关闭 (sendfile 不可用) 时，writeFileBackedFrame 会改为读取后发送，因此这里只要求二进制帧
+    if (!socket || !link || link->frameProtocolVersion == 0)
+        return false;
+    if (!socket->isOpen() || socket->state() != QAbstractSocket::ConnectedState)
+    {
+        setLastError(tr("Peer %1 not connected or socket invalid.").arg(targetPeerUuid));
+        emit serverStatusMessage(tr("Cannot send message to %1: Not connected.").arg(peerUuidToNameMap.value(targetPeerUuid, targetPeerUuid)));
+        return false;
+    }
+
+    // 队列中只保存文件范围，数据在轮到该消息写出时才由内核读取
+    OutboundMessage message;
+    message.type = FrameType::FileChunk;
+    message.head = encodeFileChunkSubHeader(transferID, chunkID, link->capabilities, offset, -1);
+    message.file = file;
+    message.fileOffset = offset;
+    message.fileLength = length;
+    enqueueOutbound(socket, link, OutboundChannel::Bulk, std::move(message));
+    return true;
+}
+
+bool NetworkManager::isPeerZeroCopyEnabled(const QString &peerUuid) const
+{
+    QMutexLocker locker(&snapshotMutex);
+    return peerSnapshots.value(peerUuid).capabilities & PeerCapabilityZeroCopyFileData;
+}
+
+bool NetworkManager::isPeerChunkChecksumEnabled(const QString &peerUuid) const
+{
+    QMutexLocker locker(&snapshotMutex);
+    return peerSnapshots.value(peerUuid).capabilities & PeerCapabilityChunkChecksums;
+}
+
+bool NetworkManager::isPeerUsingBinaryFrames(const QString &peerUuid) const
+{
+    return getPeerFrameProtocolVersion(peerUuid) > 0;
+}
+
+quint8 NetworkManager::getPeerFrameProtocolVersion(const QString &peerUuid) const
+{
+    QMutexLocker locker(&snapshotMutex);
+    return peerSnapshots.value(peerUuid).frameProtocolVersion;
+}
+
+bool NetworkManager::isPeerWritable(const QString &peerUuid) const
+{
+    QMutexLocker locker(&snapshotMutex);
+    auto it = peerSnapshots.constFind(peerUuid);
+    return it != peerSnapshots.constEnd() && it->writable;
+}
+
+qint64 NetworkManager::getPeerPendingBytes(const QString &peerUuid) const
+{
+    QMutexLocker locker(&snapshotMutex);
+    return peerSnapshots.value(peerUuid).pendingBytes;
+}
+
+qint64 NetworkManager::pendingOutboundBytes(QTcpSocket *socket, const PeerLink *link) const
+{
+    return link->queuedBytes + socket->bytesToWrite();
+}
+
+void NetworkManager::enqueueOutbound(QTcpSocket *socket, PeerLink *link, OutboundChannel channel, OutboundMessage message)
+{
+    link->queuedBytes += message.wireSize();
+    if (channel == OutboundChannel::Control)
+        link->controlQueue.enqueue(std::move(message));
+    else
+        link->bulkQueue.enqueue(std::move(message));
+
+    // 不立即写出: 同一轮事件循环中排队的消息在 flushPendingWrites 中一起交给套接字
+    socketsPendingFlush.insert(socket);
+    if (!flushScheduled)
+    {
+        flushScheduled = true;
+        QMetaObject::invokeMethod(this, &NetworkManager::flushPendingWrites, Qt::QueuedConnection);
+    }
+    if (link->writable && pendingOutboundBytes(socket, link) > PEER_SEND_HIGH_WATERMARK)
+    {
+        link->writable = false;
+        qDebug() << "NM: Peer" << socketToUuidMap.value(socket) << "reached send high watermark ("
+                 << pendingOutboundBytes(socket, link) << "bytes pending), pausing bulk senders.";
+        publishLinkState(socket, link);
+    }
+}
+
+bool NetworkManager::writeOutboundPayload(QTcpSocket *socket, const OutboundMessage &message, qsizetype offset, qsizetype length)
+{
+    if (offset < message.head.size())
+    {
+        qsizetype n = qMin(length, message.head.size() - offset);
+        if (socket->write(message.head.constData() + offset, n) != n)
+            return false;
+        offset += n;
+        length -= n;
+    }
+    if (length > 0)
+    {
+        qsizetype bodyOffset = offset - message.head.size();
+        if (socket->write(message.body.constData() + bodyOffset, length) != length)
+            return false;
+    }
+    return true;
+}
+
+void NetworkManager::pumpOutboundQueue(QTcpSocket *socket, PeerLink *link)
+{
+    // 只向套接字写缓冲区交付有限的数据量，其余留在队列中，由 bytesWritten 驱动继续发送。
+    // 每轮先清空控制通道，批量通道每次只写出一个分片，聊天消息最多等待一个分片的传输时间。
+    const bool canFragment = link->frameProtocolVersion >= FRAME_PROTOCOL_FRAGMENTS;
+    bool ok = true;
+    while (ok && socket->bytesToWrite() < PEER_SOCKET_BUFFER_TARGET)
+    {
+        // 写到一半的零拷贝分片必须先写完，其间不能插入控制消息
+        const bool fragmentPending = !link->bulkQueue.isEmpty() && link->bulkQueue.head().fragmentPending();
+        if (!fragmentPending && !link->controlQueue.isEmpty())
+        {
+            OutboundMessage message = link->controlQueue.dequeue();
+            link->queuedBytes -= message.wireSize();
+            if (message.framed)
+                ok = socket->write(encodeFrameHeader(message.type, message.flags, static_cast<quint32>(message.payloadSize()))) == FRAME_HEADER_SIZE;
+            ok = ok && writeOutboundPayload(socket, message, 0, message.payloadSize());
+            link->writeStats.messagesSinceLastWrite++;
+            continue;
+        }
+        if (link->bulkQueue.isEmpty())
+            break;
+
+        OutboundMessage &message = link->bulkQueue.head();
+        const qsizetype total = message.payloadSize();
+        if (message.file)
+        {
+            // 文件数据绕过 QTcpSocket 写缓冲区直接写入内核，必须等缓冲区中已有的数据发出后再写，
+            // 之后由 bytesWritten 继续驱动
+            if (socket->bytesToWrite() > 0)
+                break;
+            if (!message.fragmentPending())
+            {
+                // 开始新的分片: 帧头与其中的子头部分先放入 pendingPrefix
+                const qsizetype length = canFragment ? qMin<qsizetype>(BULK_FRAGMENT_SIZE, total - message.written) : total;
+                const bool last = message.written + length >= total;
+                quint16 flags = FrameFlagNone;
+                if (canFragment && !(message.written == 0 && last))
+                    flags = FrameFlagFragment | (last ? FrameFlagFinalFragment : FrameFlagNone);
+                message.pendingPrefix = encodeFrameHeader(message.type, flags, static_cast<quint32>(length));
+                message.fragmentEnd = message.written + length;
+                if (message.written < message.head.size())
+                {
+                    qsizetype n = qMin(length, message.head.size() - message.written);
+                    message.pendingPrefix.append(message.head.constData() + message.written, n);
+                    message.written += n;
+                }
+                link->queuedBytes -= length;
+            }
+            const FileFrameWriteStatus status = writeFileBackedFrame(socket, link, message);
+            if (status == FileFrameWouldBlock)
+            {
+                waitForFileWritable(socket, link);
+                break;
+            }
+            ok = status == FileFrameWritten;
+            if (message.written >= total)
+            {
+                link->queuedBytes -= FRAME_HEADER_SIZE;
+                link->bulkQueue.dequeue();
+            }
+            continue;
+        }
+        if (!message.framed || !canFragment || (message.written == 0 && total <= static_cast<qsizetype>(BULK_FRAGMENT_SIZE)))
+        {
+            // 旧版链路或小消息: 以完整消息为单位调度
+            if (message.framed)
+                ok = socket->write(encodeFrameHeader(message.type, message.flags, static_cast<quint32>(total))) == FRAME_HEADER_SIZE;
+            ok = ok && writeOutboundPayload(socket, message, 0, total);
+            link->queuedBytes -= message.wireSize();
+            link->bulkQueue.dequeue();
+            link->writeStats.messagesSinceLastWrite++;
+            continue;
+        }
+
+        const qsizetype length = qMin<qsizetype>(BULK_FRAGMENT_SIZE, total - message.written);
+        const bool last = message.written + length >= total;
+        quint16 flags = message.flags | FrameFlagFragment | (last ? FrameFlagFinalFragment : FrameFlagNone);
+        ok = socket->write(encodeFrameHeader(message.type, flags, static_cast<quint32>(length))) == FRAME_HEADER_SIZE;
+        ok = ok && writeOutboundPayload(socket, message, message.written, length);
+        message.written += length;
+        link->queuedBytes -= length;
+        link->writeStats.messagesSinceLastWrite++;
+        if (last)
+        {
+            link->queuedBytes -= FRAME_HEADER_SIZE;
+            link->bulkQueue.dequeue();
+        }
+    }
+    // 不调用 flush(): 数据留在 QTcpSocket 写缓冲区中合并，由事件循环在一次写操作中发出
+    if (!ok)
+        qWarning() << "NM: Short write to peer" << socketToUuidMap.value(socket) << ":" << socket->errorString();
+}
+
+NetworkManager::FileFrameWriteStatus NetworkManager::writeFileBackedFrame(QTcpSocket *socket, PeerLink *link, OutboundMessage &message)
+{
+    qint64 fileRemaining = message.fragmentEnd - message.written;
+    qint64 filePosition = message.fileOffset + (message.written - message.head.size());
+
+#ifdef Q_OS_LINUX
+    const int socketFd = static_cast<int>(socket->socketDescriptor());
+    bool direct = true; // QTcpSocket 写缓冲区仍为空，可以继续直接写入内核
+    while (!message.pendingPrefix.isEmpty())
+    {
+        ssize_t sent = ::send(socketFd, message.pendingPrefix.constData(), static_cast<size_t>(message.pendingPrefix.size()),
+                              MSG_DONTWAIT | MSG_NOSIGNAL | (fileRemaining > 0 ? MSG_MORE : 0));
+        if (sent > 0)
+        {
+            message.pendingPrefix.remove(0, sent);
+            continue;
+        }
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return FileFrameWouldBlock;
+        // 连接错误: 交给 QTcpSocket 写出并由其报告错误
+        if (socket->write(message.pendingPrefix) != message.pendingPrefix.size())
+            return FileFrameWriteFailed;
+        message.pendingPrefix.clear();
+        direct = false;
+    }
+
+    const qint64 zeroCopyStart = filePosition;
+    bool wouldBlock = false;
+    while (direct && fileRemaining > 0 && (link->capabilities & PeerCapabilityZeroCopyFileData))
+    {
+        off_t position = static_cast<off_t>(filePosition);
+        ssize_t n = ::sendfile(socketFd, message.file->nativeDescriptor(), &position, static_cast<size_t>(fileRemaining));
+        if (n > 0)
+        {
+            filePosition += n;
+            fileRemaining -= n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            wouldBlock = true; // 发送缓冲区已满: 文件范围留在队首，可写后继续 sendfile
+            break;
+        }
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+        {
+            // 文件系统不支持 sendfile，该链路之后改为普通发送
+            qWarning() << "NM: sendfile not supported for peer" << socketToUuidMap.value(socket) << ":" << qt_error_string(errno)
+                       << "- disabling zero-copy file data.";
+            link->capabilities &= ~PeerCapabilityZeroCopyFileData;
+        }
+        break; // 文件末尾 (文件变短) 或错误: 其余部分走拷贝路径，由其补零并报告
+    }
+    if (filePosition > zeroCopyStart)
+    {
+        link->writeStats.zeroCopyBytes += static_cast<quint64>(filePosition - zeroCopyStart);
+        message.file->readCompleted(zeroCopyStart, filePosition - zeroCopyStart);
+        message.written += filePosition - zeroCopyStart;
+    }
+    if (wouldBlock)
+        return FileFrameWouldBlock;
+#else
+    Q_UNUSED(link);
+    if (socket->write(message.pendingPrefix) != message.pendingPrefix.size())
+        return FileFrameWriteFailed;
+    message.pendingPrefix.clear();
+#endif
+
+    if (fileRemaining == 0)
+        return FileFrameWritten;
+
+    // 拷贝路径 (链路或文件系统不支持 sendfile、文件读取出错): 剩余部分读入内存交给 QTcpSocket，
+    // 帧必须完整写出，文件变短时以零填充
+    message.written += fileRemaining;
+    QByteArray data(static_cast<qsizetype>(fileRemaining), Qt::Uninitialized);
+    QString error;
+    qint64 n = message.file->readAt(filePosition, data.data(), fileRemaining, &error);
+    if (n < fileRemaining)
+    {
+        if (n < 0)
+            n = 0;
+        else if (error.isEmpty())
+            error = tr("File %1 is shorter than announced").arg(message.file->filePath());
+        std::fill(data.begin() + n, data.end(), '\0');
+
+        QString transferID;
+        qint64 chunkID = 0;
+        qint64 chunkOffset = -1;
+        qint64 checksum = -1;
+        qsizetype dataOffset = 0;
+        if (decodeFileChunkHeader(message.head, link->capabilities, transferID, chunkID, chunkOffset, checksum, dataOffset))
+        {
+            qWarning() << "NM: Zero-copy chunk" << chunkID << "of transfer" << transferID << "could not be read:" << error;
+            emit fileChunkSendFailed(socketToUuidMap.value(socket), transferID, chunkID, error);
+        }
+    }
+    if (socket->write(data) != data.size())
+        return FileFrameWriteFailed;
+    link->writeStats.messagesSinceLastWrite++;
+    return FileFrameWritten;
+}
+
+void NetworkManager::waitForFileWritable(QTcpSocket *socket, PeerLink *link)
+{
+    // QTcpSocket 写缓冲区为空时其自身的写通知器处于关闭状态，不会与这里的通知器冲突
+    if (!link->fileWriteNotifier)
+    {
+        link->fileWriteNotifier = new QSocketNotifier(socket->socketDescriptor(), QSocketNotifier::Write, socket);
+        connect(link->fileWriteNotifier, &QSocketNotifier::activated, this, [this, socket]() {
+            PeerLink *link = socketLinks.value(socket, nullptr);
+            if (!link)
+                return;
+            link->fileWriteNotifier->setEnabled(false);
+            if (socket->state() == QAbstractSocket::ConnectedState)
+            {
+                pumpOutboundQueue(socket, link);
+                updatePeerWritable(socket, link);
+            }
+        });
+    }
+    link->fileWriteNotifier->setEnabled(true);
+}
+
+void NetworkManager::flushPendingWrites()
+{
+    flushScheduled = false;
+    const QSet<QTcpSocket *> sockets = std::exchange(socketsPendingFlush, {});
+    for (QTcpSocket *socket : sockets)
+    {
+        PeerLink *link = socketLinks.value(socket, nullptr);
+        if (link && socket->state() == QAbstractSocket::ConnectedState)
+        {
+            pumpOutboundQueue(socket, link);
+            // 零拷贝写出不经过 QTcpSocket，不会触发 bytesWritten，在这里检查低水位
+            updatePeerWritable(socket, link);
+        }
+    }
+}
+
+PeerWriteStats NetworkManager::getPeerWriteStats(const QString &peerUuid) const
+{
+    QMutexLocker locker(&snapshotMutex);
+    return peerSnapshots.value(peerUuid).writeStats;
+}
+
+void NetworkManager::handleClientSocketBytesWritten(qint64 bytes)
+{
+    Q_UNUSED(bytes);
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    PeerLink *link = socketLinks.value(socket, nullptr);
+    if (!link)
+        return;
+
+    PeerWriteStats &stats = link->writeStats;
+    if (stats.messagesSinceLastWrite > 0)
+    {
+        stats.socketWrites++;
+        stats.messages += stats.messagesSinceLastWrite;
+        stats.maxMessagesPerWrite = qMax(stats.maxMessagesPerWrite, stats.messagesSinceLastWrite);
+        stats.messagesSinceLastWrite = 0;
+        if ((stats.socketWrites & 0x3FF) == 0)
+        {
+            qDebug() << "NM: Peer" << socketToUuidMap.value(socket) << "write coalescing:" << stats.messages << "messages in"
+                     << stats.socketWrites << "writes, avg" << stats.averageMessagesPerWrite() << "max" << stats.maxMessagesPerWrite;
+        }
+    }
+
+    pumpOutboundQueue(socket, link);
+    updatePeerWritable(socket, link);
+}
+
+void NetworkManager::updatePeerWritable(QTcpSocket *socket, PeerLink *link)
+{
+    bool becameWritable = !link->writable && pendingOutboundBytes(socket, link) <= PEER_SEND_LOW_WATERMARK;
+    if (becameWritable)
+        link->writable = true;
+    // 先更新快照，其他线程收到 peerWritable 时 isPeerWritable 已返回 true
+    publishLinkState(socket, link);
+    if (becameWritable)
+    {
+        QString peerUuid = socketToUuidMap.value(socket);
+        if (!peerUuid.isEmpty())
+            emit peerWritable(peerUuid);
+    }
+}
+
+MessageDispatcher *NetworkManager::getMessageDispatcher()
+{
+    return &messageDispatcher;
+}
+
+void NetworkManager::sendTypedMessageFrame(const QString &targetPeerUuid, const QByteArray &payload, OutboundChannel channel)
+{
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { sendTypedMessageFrame(targetPeerUuid, payload, channel); }, Qt::QueuedConnection);
+        return;
+    }
+    QTcpSocket *socket = connectedSockets.value(targetPeerUuid, nullptr);
+    if (!socket || !socket->isOpen() || socket->state() != QAbstractSocket::ConnectedState)
+    {
+        setLastError(tr("Peer %1 not connected or socket invalid.").arg(targetPeerUuid));
+        emit serverStatusMessage(tr("Cannot send message to %1: Not connected.").arg(peerUuidToNameMap.value(targetPeerUuid, targetPeerUuid)));
+        return;
+    }
+    PeerLink *link = socketLinks.value(socket, nullptr);
+    if (!link)
+        return;
+    OutboundMessage message;
+    message.type = FrameType::TypedMessage;
+    message.body = payload;
+    enqueueOutbound(socket, link, channel, std::move(message));
+}
+
+void NetworkManager::deliverTextMessage(const QString &peerUuid, const QString &message)
+{
+    if (messageDispatcher.dispatchText(peerUuid, message))
+        return;
+
+    // 普通聊天消息攒成一批，每轮事件循环只向 UI 线程投递一次
+    pendingReceivedMessages.append(ReceivedMessage{peerUuid, message});
+    if (!deliveryScheduled)
+    {
+        deliveryScheduled = true;
+        QMetaObject::invokeMethod(this, &NetworkManager::flushReceivedMessages, Qt::QueuedConnection);
+    }
+}
+
+void NetworkManager::flushReceivedMessages()
+{
+    deliveryScheduled = false;
+    if (pendingReceivedMessages.isEmpty())
+        return;
+    emit messagesReceived(std::exchange(pendingReceivedMessages, {}));
+}
+
+QAbstractSocket::SocketState NetworkManager::getPeerSocketState(const QString &peerUuid) const
+{
+    // 快照中只保存已建立的连接，断开时在 cleanupSocket 中移除
+    QMutexLocker locker(&snapshotMutex);
+    return peerSnapshots.contains(peerUuid) ? QAbstractSocket::ConnectedState : QAbstractSocket::UnconnectedState;
 }
 
 QPair<QString, quint16> NetworkManager::getPeerInfo(const QString &peerUuid) const
 {
-    QTcpSocket *socket = connectedSockets.value(peerUuid, nullptr);
-    if (socket)
+    QMutexLocker locker(&snapshotMutex);
+    auto it = peerSnapshots.constFind(peerUuid);
+    if (it != peerSnapshots.constEnd())
     {
-        return qMakePair(peerUuidToNameMap.value(peerUuid, socket->peerAddress().toString()), socket->peerPort());
+        return qMakePair(it->name.isEmpty() ? it->address : it->name, it->port);
     }
     return qMakePair(QString(), 0);
 }
 
 QString NetworkManager::getPeerIpAddress(const QString &peerUuid) const
 {
-    QTcpSocket *socket = connectedSockets.value(peerUuid, nullptr);
-    if (socket)
-    {
-        return socket->peerAddress().toString();
-    }
-    return QString();
+    QMutexLocker locker(&snapshotMutex);
+    return peerSnapshots.value(peerUuid).address;
 }
 
 QStringList NetworkManager::getConnectedPeerUuids() const
 {
-    return connectedSockets.keys();
+    QMutexLocker locker(&snapshotMutex);
+    return peerSnapshots.keys();
 }
 
 QString NetworkManager::getLastError() const
 {
+    QMutexLocker locker(&snapshotMutex);
     return lastError;
 }
 
+void NetworkManager::setLastError(const QString &error)
+{
+    QMutexLocker locker(&snapshotMutex);
+    lastError = error;
+}
+
+void NetworkManager::publishLinkState(QTcpSocket *socket, const PeerLink *link)
+{
+    QString peerUuid = socketToUuidMap.value(socket);
+    QMutexLocker locker(&snapshotMutex);
+    auto it = peerSnapshots.find(peerUuid);
+    if (it == peerSnapshots.end())
+        return;
+    it->writable = link->writable;
+    it->capabilities = link->capabilities;
+    it->pendingBytes = pendingOutboundBytes(socket, link);
+    it->writeStats = link->writeStats;
+}
+
 void NetworkManager::setLocalUserDetails(const QString &uuid, const QString &displayName)
 {
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { setLocalUserDetails(uuid, displayName); }, Qt::QueuedConnection);
+        return;
+    }
     this->localUserUuid = uuid;
     this->localUserDisplayName = displayName;
 }
 
+void NetworkManager::setMaxFrameSize(quint32 bytes)
+{
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { setMaxFrameSize(bytes); }, Qt::QueuedConnection);
+        return;
+    }
+    {
+        QMutexLocker locker(&snapshotMutex);
+        maxFrameSize = bytes > 0 ? bytes : DEFAULT_MAX_FRAME_SIZE;
+    }
+    for (PeerLink *link : std::as_const(socketLinks))
+    {
+        link->decoder.setMaxFrameSize(maxFrameSize);
+    }
+    qDebug() << "NM::setMaxFrameSize: Max frame size set to" << maxFrameSize << "bytes";
+}
+
+quint32 NetworkManager::getMaxFrameSize() const
+{
+    QMutexLocker locker(&snapshotMutex);
+    return maxFrameSize;
+}
+
 void NetworkManager::setListenPreferences(quint16 port, bool autoStartListen)
 {
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { setListenPreferences(port, autoStartListen); }, Qt::QueuedConnection);
+        return;
+    }
     bool portActuallyChanged = (preferredListenPort != port && port > 0);
     quint16 oldPreferredListenPort = preferredListenPort;
     preferredListenPort = (port > 0) ? port : defaultPort;
@@ -530,6 +1118,11 @@ void NetworkManager::setListenPreferences(quint16 port, bool autoStartListen)
 
 void NetworkManager::setOutgoingConnectionPreferences(quint16 port, bool useSpecific)
 {
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { setOutgoingConnectionPreferences(port, useSpecific); }, Qt::QueuedConnection);
+        return;
+    }
     preferredOutgoingPortNumber = port;
     bindToSpecificOutgoingPort = useSpecific;
     qDebug() << "NM::setOutgoingConnectionPreferences: Preferred Outgoing Port:" << preferredOutgoingPortNumber
@@ -583,6 +1176,11 @@ void NetworkManager::handleClientSocketReadyRead()
             << "IP:" << socket->peerAddress().toString() << "Port:" << socket->peerPort()
             << "Bytes available:" << socket->bytesAvailable();
 
+    processEstablishedSocketData(socket);
+}
+
+void NetworkManager::processEstablishedSocketData(QTcpSocket *socket)
+{
     QString peerUuid = socketToUuidMap.value(socket);
     if (peerUuid.isEmpty())
     {
@@ -591,21 +1189,25 @@ void NetworkManager::handleClientSocketReadyRead()
         return;
     }
 
-    QDataStream in(socket);
-    in.setVersion(QDataStream::Qt_6_5);
+    PeerLink *link = socketLinks.value(socket, nullptr);
+    if (link && link->frameProtocolVersion > 0)
+    {
+        processFramedSocketData(socket, peerUuid, link);
+        return;
+    }
 
     while (socket->bytesAvailable() > 0)
     {
-        if (socket->bytesAvailable() < (int)sizeof(quint32))
-            return;
-
-        in.startTransaction();
         QString message;
-        in >> message;
-
-        if (in.commitTransaction())
+        LegacyReadStatus status = readLegacyMessage(socket, message);
+        if (status == LegacyMessageReady)
         {
-            emit newMessageReceived(peerUuid, message);
+            deliverTextMessage(peerUuid, message);
+        }
+        else if (status == LegacyMessageTooLarge)
+        {
+            dropEstablishedConnection(socket, tr("Peer announced a message larger than %1 bytes").arg(maxFrameSize));
+            return;
         }
         else
         {
@@ -614,6 +1216,96 @@ void NetworkManager::handleClientSocketReadyRead()
     }
 }
 
+void NetworkManager::processFramedSocketData(QTcpSocket *socket, const QString &peerUuid, PeerLink *link)
+{
+    while (true)
+    {
+        FrameDecoder::Status status = link->decoder.readFrom(socket);
+        if (status == FrameDecoder::NeedMoreData)
+            return;
+        if (status == FrameDecoder::ProtocolError)
+        {
+            dropEstablishedConnection(socket, link->decoder.errorString());
+            return;
+        }
+
+        Frame frame = link->decoder.takeFrame();
+        switch (frame.type)
+        {
+        case FrameType::TextMessage:
+            deliverTextMessage(peerUuid, QString::fromUtf8(frame.payload));
+            break;
+        case FrameType::TypedMessage:
+            if (!messageDispatcher.dispatchBinary(peerUuid, frame.payload))
+            {
+                qWarning() << "NM::processFramedSocketData: No handler for typed message"
+                           << static_cast<int>(MessageCodec::binaryType(frame.payload)) << "from peer" << peerUuid;
+            }
+            break;
+        case FrameType::FileChunk:
+        {
+            QString transferID;
+            qint64 chunkID = 0;
+            qint64 fileOffset = -1;
+            qint64 checksum = -1;
+            qsizetype dataOffset = 0;
+            if (!decodeFileChunkHeader(frame.payload, link->capabilities, transferID, chunkID, fileOffset, checksum, dataOffset))
+            {
+                dropEstablishedConnection(socket, tr("Malformed file chunk frame"));
+                return;
+            }
+            chunkBufferPool().recordUse(transferID, !frame.payloadReused);
+            emit fileChunkReceived(peerUuid, transferID, chunkID, fileOffset, checksum, frame.payload, dataOffset,
+                                   frame.flags & FrameFlagCompressed);
+            break;
+        }
+        default:
+            qWarning() << "NM::processFramedSocketData: Ignoring frame of unknown type" << static_cast<int>(frame.type)
+                       << "(" << frame.payload.size() << "bytes) from peer" << peerUuid;
+            break;
+        }
+
+        // 接收方可能在处理消息时断开了该连接
+        if (socketLinks.value(socket, nullptr) != link)
+            return;
+    }
+}
+
+void NetworkManager::dropEstablishedConnection(QTcpSocket *socket, const QString &reason)
+{
+    QString peerUuid = socketToUuidMap.value(socket);
+    qWarning() << "NM::dropEstablishedConnection: Closing connection to peer" << peerUuid << "Reason:" << reason;
+    emit serverStatusMessage(tr("Protocol error with peer %1 (UUID: %2): %3. Closing connection.")
+                                 .arg(peerUuidToNameMap.value(peerUuid, "Unknown"))
+                                 .arg(peerUuid)
+                                 .arg(reason));
+    if (!peerUuid.isEmpty())
+    {
+        emit peerDisconnected(peerUuid);
+    }
+    cleanupSocket(socket);
+}
+
+NetworkManager::LegacyReadStatus NetworkManager::readLegacyMessage(QTcpSocket *socket, QString &message) const
+{
+    if (socket->bytesAvailable() < (qint64)sizeof(quint32))
+        return LegacyNeedMoreData;
+
+    // QDataStream 会按声明的长度一次性分配 QString，因此先窥视长度前缀
+    char lengthPrefix[sizeof(quint32)];
+    if (socket->peek(lengthPrefix, sizeof(lengthPrefix)) != (qint64)sizeof(lengthPrefix))
+        return LegacyNeedMoreData;
+    quint32 byteLength = qFromBigEndian<quint32>(lengthPrefix);
+    if (byteLength != 0xFFFFFFFF && byteLength > maxFrameSize)
+        return LegacyMessageTooLarge;
+
+    QDataStream in(socket);
+    in.setVersion(QDataStream::Qt_6_5);
+    in.startTransaction();
+    in >> message;
+    return in.commitTransaction() ? LegacyMessageReady : LegacyNeedMoreData;
+}
+
 void NetworkManager::handleClientSocketError(QAbstractSocket::SocketError socketError)
 {
     QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
@@ -622,7 +1314,7 @@ void NetworkManager::handleClientSocketError(QAbstractSocket::SocketError socket
 
     QString peerUuid = socketToUuidMap.value(socket);
     QString errorString = socket->errorString();
-    lastError = errorString;
+    setLastError(errorString);
 
     if (!peerUuid.isEmpty())
     {
@@ -644,24 +1336,29 @@ void NetworkManager::handlePendingIncomingSocketReadyRead()
     if (!socket || !socket->isValid() || socket->bytesAvailable() == 0)
         return;
 
-    QDataStream in(socket);
-    in.setVersion(QDataStream::Qt_6_5);
-
-    if (socket->bytesAvailable() < (int)sizeof(quint32))
-        return;
-
-    in.startTransaction();
     QString message;
-    in >> message;
+    LegacyReadStatus readStatus = readLegacyMessage(socket, message);
+    if (readStatus == LegacyMessageTooLarge)
+    {
+        qWarning() << "NM::PendingIncomingSocketReadyRead: Oversized handshake message from" << socket->peerAddress().toString();
+        emit serverStatusMessage(tr("Error: Oversized handshake message from %1. Closing.")
+                                     .arg(socket->peerAddress().toString()));
+        removePendingIncomingSocket(socket);
+        socket->abort();
+        return;
+    }
 
-    if (in.commitTransaction())
+    if (readStatus == LegacyMessageReady)
     {
         qDebug() << "NM::PendingIncomingSocketReadyRead: Received message:" << message << "from" << socket->peerAddress().toString();
-        if (message.startsWith("<SYS_HELLO"))
+        SysHelloMessage hello;
+        if (MessageCodec::decodeText(message, hello))
         {
-            QString peerUuid = extractAttribute(message, "UUID");
-            QString peerNameHint = extractAttribute(message, "NameHint");
-            qDebug() << "NM::PendingIncomingSocketReadyRead: Extracted peerUUID:" << peerUuid << "NameHint:" << peerNameHint;
+            QString peerUuid = hello.uuid;
+            QString peerNameHint = hello.nameHint;
+            // 旧版对端不携带 FrameProto，保持默认值 0 即旧版分帧
+            quint8 peerFrameVersion = hello.frameProto;
+            qDebug() << "NM::PendingIncomingSocketReadyRead: Extracted peerUUID:" << peerUuid << "NameHint:" << peerNameHint << "FrameProto:" << peerFrameVersion;
             qDebug() << "NM::PendingIncomingSocketReadyRead: Local user UUID for comparison:" << localUserUuid;
 
             if (peerUuid.isEmpty() || peerUuid == localUserUuid)
@@ -669,7 +1366,7 @@ void NetworkManager::handlePendingIncomingSocketReadyRead()
                 qWarning() << "NM::PendingIncomingSocketReadyRead: Invalid HELLO - peerUUID is empty or matches localUserUuid. PeerUUID:" << peerUuid << "LocalUUID:" << localUserUuid;
                 emit serverStatusMessage(tr("Error: Received HELLO from %1 without valid UUID or self-connect. Rejecting.")
                                              .arg(socket->peerAddress().toString()));
-                sendSystemMessage(socket, SYS_MSG_SESSION_REJECTED_FORMAT.arg("Invalid HELLO"));
+                sendSystemMessage(socket, MessageCodec::encodeText(SysSessionRejectedMessage{QStringLiteral("Invalid HELLO")}));
                 removePendingIncomingSocket(socket);
                 socket->abort();
                 return;
@@ -680,7 +1377,7 @@ void NetworkManager::handlePendingIncomingSocketReadyRead()
                 emit serverStatusMessage(tr("Peer %1 (UUID: %2) is already connected. Rejecting new session attempt.")
                                              .arg(peerNameHint)
                                              .arg(peerUuid));
-                sendSystemMessage(socket, SYS_MSG_SESSION_REJECTED_FORMAT.arg("Already connected"));
+                sendSystemMessage(socket, MessageCodec::encodeText(SysSessionRejectedMessage{QStringLiteral("Already connected")}));
                 removePendingIncomingSocket(socket);
                 socket->abort();
                 return;
@@ -692,6 +1389,8 @@ void NetworkManager::handlePendingIncomingSocketReadyRead()
                                          .arg(peerNameHint));
             qDebug() << "NM::PendingIncomingSocketReadyRead: Emitting incomingSessionRequest for UUID:" << peerUuid;
 
+            pendingIncomingFrameVersions.insert(socket, peerFrameVersion);
+            pendingIncomingCapabilities.insert(socket, hello.caps);
             disconnect(socket, &QTcpSocket::readyRead, this, &NetworkManager::handlePendingIncomingSocketReadyRead);
             emit incomingSessionRequest(socket, socket->peerAddress().toString(), socket->peerPort(), peerUuid, peerNameHint);
         }
@@ -744,8 +1443,12 @@ void NetworkManager::handleOutgoingSocketConnected()
                                  .arg(socket->peerAddress().toString())
                                  .arg(socket->peerPort()));
 
-    QString helloMessage = SYS_MSG_HELLO_FORMAT.arg(localUserUuid).arg(localUserDisplayName);
-    sendSystemMessage(socket, helloMessage);
+    SysHelloMessage hello;
+    hello.uuid = localUserUuid;
+    hello.nameHint = localUserDisplayName;
+    hello.frameProto = FRAME_PROTOCOL_VERSION;
+    hello.caps = LOCAL_PEER_CAPABILITIES;
+    sendSystemMessage(socket, MessageCodec::encodeText(hello));
 }
 
 void NetworkManager::handleOutgoingSocketReadyRead()
@@ -754,26 +1457,33 @@ void NetworkManager::handleOutgoingSocketReadyRead()
     if (!socket || !outgoingSocketsAwaitingSessionAccepted.contains(socket))
         return;
 
-    QDataStream in(socket);
-    in.setVersion(QDataStream::Qt_6_5);
-
-    if (socket->bytesAvailable() < (int)sizeof(quint32))
-        return;
-
-    in.startTransaction();
     QString message;
-    in >> message;
+    LegacyReadStatus readStatus = readLegacyMessage(socket, message);
+    if (readStatus == LegacyMessageTooLarge)
+    {
+        QString peerName = outgoingSocketsAwaitingSessionAccepted.value(socket).first;
+        qWarning() << "NM::OutgoingSocketReadyRead: Oversized handshake response from" << peerName;
+        emit serverStatusMessage(tr("Error: Oversized handshake response from %1. Closing.").arg(peerName));
+        outgoingSocketsAwaitingSessionAccepted.remove(socket);
+        socket->abort();
+        return;
+    }
 
-    if (in.commitTransaction())
+    if (readStatus == LegacyMessageReady)
     {
         QString localNameForPeerAttempt = outgoingSocketsAwaitingSessionAccepted.value(socket).first;
         QString targetPeerUuidHint = outgoingSocketsAwaitingSessionAccepted.value(socket).second; // Get the UUID hint
 
         qDebug() << "NM::OutgoingSocketReadyRead: Received message:" << message << "from attempted peer:" << localNameForPeerAttempt << "UUID Hint:" << targetPeerUuidHint;
-        if (message.startsWith("<SYS_SESSION_ACCEPTED"))
+        SysSessionAcceptedMessage accepted;
+        SysSessionRejectedMessage rejected;
+        if (MessageCodec::decodeText(message, accepted))
         {
-            QString peerUuid = extractAttribute(message, "UUID");
-            QString peerName = extractAttribute(message, "Name");
+            QString peerUuid = accepted.uuid;
+            QString peerName = accepted.name;
+            quint8 frameVersion = qMin(accepted.frameProto, FRAME_PROTOCOL_VERSION);
+            // 能力位只在二进制帧链路上生效
+            quint8 capabilities = frameVersion > 0 ? quint8(accepted.caps & LOCAL_PEER_CAPABILITIES) : quint8(PeerCapabilityNone);
 
             if (peerUuid.isEmpty())
             {
@@ -799,12 +1509,18 @@ void NetworkManager::handleOutgoingSocketReadyRead()
             // Corrected function call:
             addEstablishedConnection(socket, peerUuid,
                                      peerName.isEmpty() ? localNameForPeerAttempt : peerName,
-                                     socket->peerAddress().toString(), socket->peerPort());
+                                     socket->peerAddress().toString(), socket->peerPort(), frameVersion, capabilities);
             emit peerConnected(peerUuid, peerName.isEmpty() ? localNameForPeerAttempt : peerName, socket->peerAddress().toString(), socket->peerPort());
+
+            // 对端可能在 SESSION_ACCEPTED 之后立即发送了后续消息，它们已在缓冲区中，不会再触发 readyRead
+            if (socket->bytesAvailable() > 0)
+            {
+                processEstablishedSocketData(socket);
+            }
         }
-        else if (message.startsWith("<SYS_SESSION_REJECTED"))
+        else if (MessageCodec::decodeText(message, rejected))
         {
-            QString reason = extractAttribute(message, "Reason");
+            QString reason = rejected.reason;
             qWarning() << "NM::OutgoingSocketReadyRead: Session rejected by" << localNameForPeerAttempt << "Reason:" << reason;
             emit serverStatusMessage(tr("Session rejected by %1. Reason: %2")
                                          .arg(localNameForPeerAttempt)
@@ -859,6 +1575,11 @@ void NetworkManager::handleOutgoingSocketError(QAbstractSocket::SocketError sock
 
 void NetworkManager::acceptIncomingSession(QTcpSocket *tempSocket, const QString &peerUuid, const QString &localNameForPeer)
 {
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { acceptIncomingSession(tempSocket, peerUuid, localNameForPeer); }, Qt::QueuedConnection);
+        return;
+    }
     qDebug() << "NM::acceptIncomingSession: Attempting to accept session for PeerUUID:" << peerUuid << "LocalName:" << localNameForPeer << "My UUID:" << localUserUuid;
     if (!tempSocket || !pendingIncomingSockets.contains(tempSocket))
     {
@@ -872,7 +1593,7 @@ void NetworkManager::acceptIncomingSession(QTcpSocket *tempSocket, const QString
     {
         qWarning() << "NM::acceptIncomingSession: Invalid peer UUID for acceptance. PeerUUID:" << peerUuid;
         emit serverStatusMessage(tr("Error: Cannot accept session, invalid peer UUID."));
-        sendSystemMessage(tempSocket, SYS_MSG_SESSION_REJECTED_FORMAT.arg("Invalid UUID"));
+        sendSystemMessage(tempSocket, MessageCodec::encodeText(SysSessionRejectedMessage{QStringLiteral("Invalid UUID")}));
         removePendingIncomingSocket(tempSocket);
         tempSocket->abort();
         return;
@@ -881,19 +1602,26 @@ void NetworkManager::acceptIncomingSession(QTcpSocket *tempSocket, const QString
     {
         qWarning() << "NM::acceptIncomingSession: PeerUUID" << peerUuid << "already connected. Rejecting duplicate.";
         emit serverStatusMessage(tr("Error: Peer with UUID %1 is already connected. Rejecting duplicate session.").arg(peerUuid));
-        sendSystemMessage(tempSocket, SYS_MSG_SESSION_REJECTED_FORMAT.arg("Already connected"));
+        sendSystemMessage(tempSocket, MessageCodec::encodeText(SysSessionRejectedMessage{QStringLiteral("Already connected")}));
         removePendingIncomingSocket(tempSocket);
         tempSocket->abort();
         return;
     }
 
+    quint8 frameVersion = qMin(pendingIncomingFrameVersions.value(tempSocket, 0), FRAME_PROTOCOL_VERSION);
+    quint8 capabilities = frameVersion > 0 ? quint8(pendingIncomingCapabilities.value(tempSocket, 0) & LOCAL_PEER_CAPABILITIES) : quint8(PeerCapabilityNone);
     removePendingIncomingSocket(tempSocket);
-    qDebug() << "NM::acceptIncomingSession: Sending SESSION_ACCEPTED. My UUID:" << localUserUuid << "My Name:" << localUserDisplayName;
+    qDebug() << "NM::acceptIncomingSession: Sending SESSION_ACCEPTED. My UUID:" << localUserUuid << "My Name:" << localUserDisplayName << "FrameProto:" << frameVersion << "Caps:" << capabilities;
 
-    QString acceptedMessage = SYS_MSG_SESSION_ACCEPTED_FORMAT.arg(localUserUuid).arg(localUserDisplayName);
-    sendSystemMessage(tempSocket, acceptedMessage);
+    // SESSION_ACCEPTED 本身仍使用旧版分帧，之后的数据按协商结果分帧
+    SysSessionAcceptedMessage accepted;
+    accepted.uuid = localUserUuid;
+    accepted.name = localUserDisplayName;
+    accepted.frameProto = frameVersion;
+    accepted.caps = capabilities;
+    sendSystemMessage(tempSocket, MessageCodec::encodeText(accepted));
 
-    addEstablishedConnection(tempSocket, peerUuid, localNameForPeer, tempSocket->peerAddress().toString(), tempSocket->peerPort());
+    addEstablishedConnection(tempSocket, peerUuid, localNameForPeer, tempSocket->peerAddress().toString(), tempSocket->peerPort(), frameVersion, capabilities);
     emit serverStatusMessage(tr("Session with %1 (UUID: %2) accepted. Sent session acceptance.")
                                  .arg(localNameForPeer)
                                  .arg(peerUuid));
@@ -901,6 +1629,11 @@ void NetworkManager::acceptIncomingSession(QTcpSocket *tempSocket, const QString
 
 void NetworkManager::rejectIncomingSession(QTcpSocket *tempSocket)
 {
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { rejectIncomingSession(tempSocket); }, Qt::QueuedConnection);
+        return;
+    }
     if (!tempSocket || !pendingIncomingSockets.contains(tempSocket))
     {
         qWarning() << "NM::rejectIncomingSession: Socket not found or not pending.";
@@ -912,7 +1645,7 @@ void NetworkManager::rejectIncomingSession(QTcpSocket *tempSocket)
     qDebug() << "NM::rejectIncomingSession: Rejecting session from" << tempSocket->peerAddress().toString();
     emit serverStatusMessage(tr("Incoming session from %1 rejected by user.")
                                  .arg(tempSocket->peerAddress().toString()));
-    sendSystemMessage(tempSocket, SYS_MSG_SESSION_REJECTED_FORMAT.arg("Rejected by user"));
+    sendSystemMessage(tempSocket, MessageCodec::encodeText(SysSessionRejectedMessage{QStringLiteral("Rejected by user")}));
     removePendingIncomingSocket(tempSocket);
     tempSocket->abort();
 }
@@ -948,12 +1681,21 @@ void NetworkManager::cleanupSocket(QTcpSocket *socket, bool removeFromConnected)
             socketToUuidMap.remove(socket);
         }
         peerUuidToNameMap.remove(peerUuid);
+        if (removeFromConnected)
+        {
+            QMutexLocker locker(&snapshotMutex);
+            peerSnapshots.remove(peerUuid);
+        }
     }
 
     // Remove from other lists/maps if it could be there.
     // These lists should ideally be managed such that a socket isn't in multiple
     // "pending" type states simultaneously.
     pendingIncomingSockets.removeAll(socket);
+    pendingIncomingFrameVersions.remove(socket);
+    pendingIncomingCapabilities.remove(socket);
+    delete socketLinks.take(socket);
+    socketsPendingFlush.remove(socket);
     if (outgoingSocketsAwaitingSessionAccepted.contains(socket))
     {
         outgoingSocketsAwaitingSessionAccepted.remove(socket);
@@ -963,20 +1705,37 @@ void NetworkManager::cleanupSocket(QTcpSocket *socket, bool removeFromConnected)
     qDebug() << "NM::cleanupSocket: Socket scheduled for deletion.";
 }
 
-void NetworkManager::sendSystemMessage(QTcpSocket *socket, const QString &sysMessage)
+void NetworkManager::sendSystemMessage(QTcpSocket *socket, const QString &sysMessage, OutboundChannel channel)
 {
     if (socket && socket->isOpen() && socket->state() == QAbstractSocket::ConnectedState)
     {
-        QByteArray block;
-        QDataStream out(&block, QIODevice::WriteOnly);
-        out.setVersion(QDataStream::Qt_6_5);
-        out << sysMessage;
+        PeerLink *link = socketLinks.value(socket, nullptr);
+        if (link && link->frameProtocolVersion > 0)
+        {
+            OutboundMessage message;
+            message.type = FrameType::TextMessage;
+            message.body = sysMessage.toUtf8();
+            enqueueOutbound(socket, link, channel, std::move(message));
+            return;
+        }
+
+        QByteArray block = encodeLegacyMessage(sysMessage);
+        if (link)
+        {
+            // 旧版链路无法拆分消息，按完整消息在通道间调度
+            OutboundMessage message;
+            message.framed = false;
+            message.body = block;
+            enqueueOutbound(socket, link, channel, std::move(message));
+            return;
+        }
+        // 握手阶段尚无链路状态，直接写入
         socket->write(block);
         socket->flush();
     }
 }
 
-void NetworkManager::addEstablishedConnection(QTcpSocket *socket, const QString &peerUuid, const QString &peerName, const QString &peerAddress, quint16 peerPort)
+void NetworkManager::addEstablishedConnection(QTcpSocket *socket, const QString &peerUuid, const QString &peerName, const QString &peerAddress, quint16 peerPort, quint8 frameProtocolVersion, quint8 capabilities)
 {
     if (!socket || peerUuid.isEmpty())
     {
@@ -997,19 +1756,42 @@ void NetworkManager::addEstablishedConnection(QTcpSocket *socket, const QString
     connect(socket, &QTcpSocket::readyRead, this, &NetworkManager::handleClientSocketReadyRead);
     connect(socket, &QTcpSocket::disconnected, this, &NetworkManager::handleClientSocketDisconnected);
     connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::errorOccurred), this, &NetworkManager::handleClientSocketError);
-
-    // Set TCP buffer sizes to 8MB
-    const int bufferSize = 8 * 1024 * 1024; // 8MB
-    socket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, bufferSize);
-    socket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, bufferSize);
-    qDebug() << "NM::addEstablishedConnection: Requested TCP Receive Buffer Size:" << bufferSize << "for peer" << peerUuid;
-    qDebug() << "NM::addEstablishedConnection: Requested TCP Send Buffer Size:" << bufferSize << "for peer" << peerUuid;
+    connect(socket, &QTcpSocket::bytesWritten, this, &NetworkManager::handleClientSocketBytesWritten);
+
+    // 写出已按事件循环合并，关闭 Nagle 以免控制消息在内核中再等待
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    socket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, PEER_SOCKET_RECEIVE_BUFFER_SIZE);
+    socket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, PEER_SOCKET_SEND_BUFFER_SIZE);
+    qDebug() << "NM::addEstablishedConnection: Requested TCP Receive Buffer Size:" << PEER_SOCKET_RECEIVE_BUFFER_SIZE << "for peer" << peerUuid;
+    qDebug() << "NM::addEstablishedConnection: Requested TCP Send Buffer Size:" << PEER_SOCKET_SEND_BUFFER_SIZE << "for peer" << peerUuid;
     // You can check the actual size if needed, though it's not directly queryable via QAbstractSocket in a simple way after setting.
     // OS might cap it. For more detailed checks, platform-specific socket calls would be needed.
 
+    PeerLink *link = new PeerLink;
+    link->frameProtocolVersion = frameProtocolVersion;
+    link->capabilities = capabilities;
+    link->decoder.setMaxFrameSize(maxFrameSize);
+    delete socketLinks.take(socket);
+    socketLinks.insert(socket, link);
+    qDebug() << "NM::addEstablishedConnection: Frame protocol version for peer" << peerUuid << ":" << frameProtocolVersion
+             << (frameProtocolVersion > 0 ? "(binary frames)" : "(legacy QDataStream framing)")
+             << "Zero-copy file data:" << bool(capabilities & PeerCapabilityZeroCopyFileData)
+             << "Chunk offsets:" << bool(capabilities & PeerCapabilityChunkOffsets)
+             << "Chunk checksums:" << bool(capabilities & PeerCapabilityChunkChecksums);
+
     connectedSockets.insert(peerUuid, socket);
     socketToUuidMap.insert(socket, peerUuid);
     peerUuidToNameMap.insert(peerUuid, peerName);
+    {
+        PeerSnapshot snapshot;
+        snapshot.name = peerName;
+        snapshot.address = socket->peerAddress().toString();
+        snapshot.port = socket->peerPort();
+        snapshot.frameProtocolVersion = frameProtocolVersion;
+        snapshot.capabilities = capabilities;
+        QMutexLocker locker(&snapshotMutex);
+        peerSnapshots.insert(peerUuid, snapshot);
+    }
 
     emit peerConnected(peerUuid, peerName, peerAddress, peerPort);
 }
@@ -1019,6 +1801,8 @@ void NetworkManager::removePendingIncomingSocket(QTcpSocket *socket)
     if (!socket)
         return;
     pendingIncomingSockets.removeOne(socket);
+    pendingIncomingFrameVersions.remove(socket);
+    pendingIncomingCapabilities.remove(socket);
     disconnect(socket, &QTcpSocket::readyRead, this, &NetworkManager::handlePendingIncomingSocketReadyRead);
     disconnect(socket, &QTcpSocket::disconnected, this, &NetworkManager::handlePendingIncomingSocketDisconnected);
     disconnect(socket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::errorOccurred), this, &NetworkManager::handlePendingIncomingSocketError);
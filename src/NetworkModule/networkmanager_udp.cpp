@@ -6,6 +6,11 @@
 
 void NetworkManager::startUdpDiscovery()
 {
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { startUdpDiscovery(); }, Qt::QueuedConnection);
+        return;
+    }
     if (!udpDiscoveryEnabled)
     {
         qDebug() << "NM::startUdpDiscovery: Attempted to start but UDP discovery is disabled.";
@@ -82,6 +87,11 @@ void NetworkManager::startUdpDiscovery()
 
 void NetworkManager::stopUdpDiscovery()
 {
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { stopUdpDiscovery(); }, Qt::QueuedConnection);
+        return;
+    }
     if (udpBroadcastTimer && udpBroadcastTimer->isActive())
     { // Stop broadcast timer
         udpBroadcastTimer->stop();
@@ -122,6 +132,11 @@ void NetworkManager::stopUdpDiscovery()
 
 void NetworkManager::triggerManualUdpBroadcast()
 {
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { triggerManualUdpBroadcast(); }, Qt::QueuedConnection);
+        return;
+    }
     if (!udpDiscoveryEnabled)
     {
         emit serverStatusMessage(tr("Cannot send manual broadcast: UDP discovery is disabled."));
@@ -507,6 +522,11 @@ void NetworkManager::handleTemporaryUdpSocketError(QAbstractSocket::SocketError
 
 void NetworkManager::setUdpDiscoveryPreferences(bool enabled, quint16 port, bool continuousBroadcast, int broadcastIntervalSeconds)
 {
+    if (!isInNetworkThread())
+    {
+        QMetaObject::invokeMethod(this, [=]() { setUdpDiscoveryPreferences(enabled, port, continuousBroadcast, broadcastIntervalSeconds); }, Qt::QueuedConnection);
+        return;
+    }
     bool portChanged = (currentUdpDiscoveryPort != port);
     bool enabledChanged = (udpDiscoveryEnabled != enabled);
     bool continuousChanged = (udpContinuousBroadcastEnabled != continuousBroadcast);
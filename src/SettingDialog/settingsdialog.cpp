@@ -11,6 +11,7 @@
 #include <QTabWidget>
 #include <QGroupBox>
 #include <QFileDialog>
+#include <QTimeEdit>
 
 SettingsDialog::SettingsDialog(const QString &currentUserName,
                                const QString &currentUserUuid,
@@ -24,6 +25,7 @@ SettingsDialog::SettingsDialog(const QString &currentUserName,
                                int currentUdpBroadcastInterval,
                                const QString &currentDefaultDownloadDir,
                                bool currentRequireFileAccept,
+                               const TransferRateLimits &currentRateLimits,
                                QWidget *parent)
     : QDialog(parent),
       initialUserName(currentUserName),
@@ -37,7 +39,8 @@ SettingsDialog::SettingsDialog(const QString &currentUserName,
       initialContinuousUdpBroadcastEnabled(currentEnableContinuousUdpBroadcast),
       initialUdpBroadcastInterval(currentUdpBroadcastInterval),
       initialDefaultDownloadDir(currentDefaultDownloadDir),
-      initialRequireFileAccept(currentRequireFileAccept)
+      initialRequireFileAccept(currentRequireFileAccept),
+      initialRateLimits(currentRateLimits)
 {
     setupUI();
     setWindowTitle(tr("Application Settings"));
@@ -74,6 +77,7 @@ SettingsDialog::SettingsDialog(const QString &currentUserName,
 
     downloadDirEdit->setText(currentDefaultDownloadDir);
     requireFileAcceptCheckBox->setChecked(currentRequireFileAccept);
+    setRateLimitFields(currentRateLimits);
 
     connect(enableListeningCheckBox, &QCheckBox::toggled, this, &SettingsDialog::onEnableListeningChanged);
     connect(retryListenButton, &QPushButton::clicked, this, &SettingsDialog::onRetryListenNowClicked);
@@ -81,6 +85,7 @@ SettingsDialog::SettingsDialog(const QString &currentUserName,
     connect(udpDiscoveryCheckBox, &QCheckBox::toggled, this, &SettingsDialog::onUdpDiscoveryEnableChanged);
     connect(enableContinuousUdpBroadcastCheckBox, &QCheckBox::toggled, this, &SettingsDialog::onUdpContinuousBroadcastChanged); // Added
     connect(manualBroadcastButton, &QPushButton::clicked, this, &SettingsDialog::onManualBroadcastClicked);
+    connect(rateLimitScheduleCheckBox, &QCheckBox::toggled, this, &SettingsDialog::onRateLimitScheduleChanged);
 }
 
 SettingsDialog::~SettingsDialog()
@@ -98,7 +103,8 @@ void SettingsDialog::updateFields(const QString &userName, const QString &uuid,
                                   bool enableUdpDiscovery, quint16 udpDiscoveryPort,
                                   bool enableContinuousUdpBroadcast, int udpBroadcastInterval,
                                   const QString &defaultDownloadDir,
-                                  bool requireFileAccept)
+                                  bool requireFileAccept,
+                                  const TransferRateLimits &rateLimits)
 {
     userNameEdit->setText(userName);
     userUuidEdit->setText(uuid);
@@ -130,6 +136,7 @@ void SettingsDialog::updateFields(const QString &userName, const QString &uuid,
 
     downloadDirEdit->setText(defaultDownloadDir);
     requireFileAcceptCheckBox->setChecked(requireFileAccept);
+    setRateLimitFields(rateLimits);
 
     initialUserName = userName;
     initialUserUuid = uuid;
@@ -143,6 +150,7 @@ void SettingsDialog::updateFields(const QString &userName, const QString &uuid,
     initialUdpBroadcastInterval = udpBroadcastInterval;
     initialDefaultDownloadDir = defaultDownloadDir;
     initialRequireFileAccept = requireFileAccept;
+    initialRateLimits = rateLimits;
 }
 
 void SettingsDialog::setupUI()
@@ -246,6 +254,41 @@ void SettingsDialog::setupUI()
     fileFormLayout->addRow(tr("Default Download Directory:"), downloadDirLayout);
     fileFormLayout->addRow(requireFileAcceptCheckBox);
 
+    // 发送限速: 只限制文件数据，聊天消息不受影响
+    QGroupBox *rateLimitGroup = new QGroupBox(tr("Upload Bandwidth Limit"), this);
+    QFormLayout *rateLimitFormLayout = new QFormLayout(rateLimitGroup);
+
+    globalRateLimitSpinBox = new QSpinBox(this);
+    globalRateLimitSpinBox->setRange(0, 10000000);
+    globalRateLimitSpinBox->setSuffix(tr(" KB/s"));
+    globalRateLimitSpinBox->setSpecialValueText(tr("Unlimited"));
+    globalRateLimitSpinBox->setToolTip(tr("Total rate of all outgoing file transfers. Chat messages are never limited."));
+
+    perPeerRateLimitSpinBox = new QSpinBox(this);
+    perPeerRateLimitSpinBox->setRange(0, 10000000);
+    perPeerRateLimitSpinBox->setSuffix(tr(" KB/s"));
+    perPeerRateLimitSpinBox->setSpecialValueText(tr("Unlimited"));
+    perPeerRateLimitSpinBox->setToolTip(tr("Rate of outgoing file transfers to each contact."));
+
+    rateLimitScheduleCheckBox = new QCheckBox(tr("Only limit during these hours"), this);
+    rateLimitStartEdit = new QTimeEdit(this);
+    rateLimitStartEdit->setDisplayFormat("HH:mm");
+    rateLimitEndEdit = new QTimeEdit(this);
+    rateLimitEndEdit->setDisplayFormat("HH:mm");
+
+    QHBoxLayout *rateLimitScheduleLayout = new QHBoxLayout();
+    rateLimitScheduleLayout->addWidget(rateLimitStartEdit);
+    rateLimitScheduleLayout->addWidget(new QLabel(tr("to"), this));
+    rateLimitScheduleLayout->addWidget(rateLimitEndEdit);
+    rateLimitScheduleLayout->addStretch();
+
+    rateLimitFormLayout->addRow(tr("Total:"), globalRateLimitSpinBox);
+    rateLimitFormLayout->addRow(tr("Per Contact:"), perPeerRateLimitSpinBox);
+    rateLimitFormLayout->addRow(rateLimitScheduleCheckBox);
+    rateLimitFormLayout->addRow(tr("Hours:"), rateLimitScheduleLayout);
+
+    fileFormLayout->addRow(rateLimitGroup);
+
     tabWidget->addTab(fileTab, tr("File Transfer"));
 
     mainLayout->addWidget(tabWidget);
@@ -310,6 +353,22 @@ void SettingsDialog::onSelectDownloadDirClicked()
     }
 }
 
+void SettingsDialog::onRateLimitScheduleChanged(bool checked)
+{
+    rateLimitStartEdit->setEnabled(checked);
+    rateLimitEndEdit->setEnabled(checked);
+}
+
+void SettingsDialog::setRateLimitFields(const TransferRateLimits &rateLimits)
+{
+    globalRateLimitSpinBox->setValue(int(rateLimits.globalBytesPerSecond / 1024));
+    perPeerRateLimitSpinBox->setValue(int(rateLimits.perPeerBytesPerSecond / 1024));
+    rateLimitScheduleCheckBox->setChecked(rateLimits.scheduleEnabled);
+    rateLimitStartEdit->setTime(rateLimits.scheduleStart);
+    rateLimitEndEdit->setTime(rateLimits.scheduleEnd);
+    onRateLimitScheduleChanged(rateLimits.scheduleEnabled);
+}
+
 void SettingsDialog::onSaveButtonClicked()
 {
     QString newUserName = userNameEdit->text().trimmed();
@@ -323,6 +382,7 @@ void SettingsDialog::onSaveButtonClicked()
     int newUdpBroadcastInterval = udpBroadcastIntervalSpinBox->value();
     QString newDefaultDownloadDir = downloadDirEdit->text().trimmed();
     bool newRequireFileAccept = requireFileAcceptCheckBox->isChecked();
+    TransferRateLimits newRateLimits = getRateLimits();
 
     if (newUserName.isEmpty()) {
         QMessageBox::warning(this, tr("Input Error"), tr("User name cannot be empty."));
@@ -357,12 +417,13 @@ void SettingsDialog::onSaveButtonClicked()
     initialUdpBroadcastInterval = newUdpBroadcastInterval;
     initialDefaultDownloadDir = newDefaultDownloadDir;
     initialRequireFileAccept = newRequireFileAccept;
+    initialRateLimits = newRateLimits;
 
     emit settingsApplied(newUserName, newListenPort, newEnableListening,
                          newOutgoingPort, newUseSpecificOutgoing,
                          newEnableUdpDiscovery, newUdpDiscoveryPort,
                          newEnableContinuousUdpBroadcast, newUdpBroadcastInterval,
-                         newDefaultDownloadDir, newRequireFileAccept);
+                         newDefaultDownloadDir, newRequireFileAccept, newRateLimits);
     accept();
 }
 
@@ -426,3 +487,14 @@ bool SettingsDialog::isRequireFileAccept() const
 {
     return requireFileAcceptCheckBox->isChecked();
 }
+
+TransferRateLimits SettingsDialog::getRateLimits() const
+{
+    TransferRateLimits rateLimits;
+    rateLimits.globalBytesPerSecond = qint64(globalRateLimitSpinBox->value()) * 1024;
+    rateLimits.perPeerBytesPerSecond = qint64(perPeerRateLimitSpinBox->value()) * 1024;
+    rateLimits.scheduleEnabled = rateLimitScheduleCheckBox->isChecked();
+    rateLimits.scheduleStart = rateLimitStartEdit->time();
+    rateLimits.scheduleEnd = rateLimitEndEdit->time();
+    return rateLimits;
+}